@@ -0,0 +1,91 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file counters.h
+ *
+ * Hardware performance counters of the calling thread, read around the
+ * operations measured by the benchmarks.
+ *
+ * The counters are read with @c perf_event_open on Linux. Where they are not
+ * available (other systems, virtual machines without a PMU, or a restrictive
+ * @c perf_event_paranoid setting) every counter is reported as missing, and the
+ * benchmarks fall back to measuring time only. Counters are opened one by one,
+ * so a CPU lacking some event still reports the others.
+ *
+ * @author Antonio Macrì
+ */
+
+#ifndef _BENCH_COUNTERS_H_
+#define _BENCH_COUNTERS_H_
+
+#include <stdint.h>
+
+/**
+ * The events counted.
+ */
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTERS
+} counter_event;
+
+/**
+ * The value of a counter which is not available.
+ */
+#define COUNTER_MISSING UINT64_MAX
+
+/**
+ * The counters of a thread.
+ */
+typedef struct {
+    /** The descriptors of the events, or -1 for those not available. */
+    int fds[COUNTERS];
+} counters;
+
+/**
+ * Opens the counters of the calling thread. They only count while enabled
+ * by #counters_start, and only events of the calling thread.
+ *
+ * @return The number of counters available (possibly zero).
+ */
+int counters_open(counters *c);
+
+/**
+ * Resets and enables the counters.
+ */
+void counters_start(counters *c);
+
+/**
+ * Disables the counters and adds their values to an array (which must be
+ * initialized by the caller). The values of the counters not available are
+ * set to #COUNTER_MISSING. If the kernel multiplexed the counters, their
+ * values are scaled to the whole time they were enabled.
+ */
+void counters_stop(counters *c, uint64_t values[COUNTERS]);
+
+/**
+ * Divides the values of the counters by the number of bytes processed. The
+ * events which could not be counted are set to a negative value.
+ */
+void counters_per_byte(const uint64_t values[COUNTERS], double bytes, double events[COUNTERS]);
+
+/**
+ * Closes the counters.
+ */
+void counters_close(counters *c);
+
+/**
+ * Gets a short name of an event, suitable for a column header.
+ */
+const char * counters_name(counter_event event);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file counters.c
+ *
+ * Hardware performance counters of the calling thread.
+ *
+ * @author Antonio Macrì
+ */
+
+#define _GNU_SOURCE  // Required for syscall()
+
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <bench/counters.h>
+
+static const char *names[COUNTERS] = {
+    "cycles", "instr", "L1d miss", "LLC miss", "br miss"
+};
+
+#ifdef __linux__
+
+/*
+ * The type and the configuration of each event.
+ */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+            | PERF_COUNT_HW_CACHE_OP_READ << 8
+            | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+int counters_open(counters *c)
+{
+    int available = 0;
+    for (int i = 0; i < COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        // The library never enters the kernel for long, and excluding it lets
+        // the counters work with perf_event_paranoid up to 2.
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // The calling thread, on any CPU.
+        c->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (c->fds[i] >= 0) {
+            available++;
+        }
+    }
+    return available;
+}
+
+void counters_start(counters *c)
+{
+    for (int i = 0; i < COUNTERS; i++) {
+        if (c->fds[i] >= 0) {
+            ioctl(c->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void counters_stop(counters *c, uint64_t values[COUNTERS])
+{
+    for (int i = 0; i < COUNTERS; i++) {
+        if (c->fds[i] >= 0) {
+            ioctl(c->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int i = 0; i < COUNTERS; i++) {
+        // The value, the time enabled and the time running.
+        uint64_t data[3];
+        if (c->fds[i] < 0 || values[i] == COUNTER_MISSING
+                || read(c->fds[i], data, sizeof(data)) != sizeof(data)) {
+            values[i] = COUNTER_MISSING;
+            continue;
+        }
+        if (data[2] > 0 && data[2] < data[1]) {
+            data[0] = (uint64_t)((double)data[0] * data[1] / data[2]);
+        }
+        values[i] += data[0];
+    }
+}
+
+void counters_close(counters *c)
+{
+    for (int i = 0; i < COUNTERS; i++) {
+        if (c->fds[i] >= 0) {
+            close(c->fds[i]);
+            c->fds[i] = -1;
+        }
+    }
+}
+
+#else
+
+int counters_open(counters *c)
+{
+    for (int i = 0; i < COUNTERS; i++) {
+        c->fds[i] = -1;
+    }
+    return 0;
+}
+
+void counters_start(counters *c)
+{
+    (void)c;
+}
+
+void counters_stop(counters *c, uint64_t values[COUNTERS])
+{
+    (void)c;
+    for (int i = 0; i < COUNTERS; i++) {
+        values[i] = COUNTER_MISSING;
+    }
+}
+
+void counters_close(counters *c)
+{
+    (void)c;
+}
+
+#endif
+
+void counters_per_byte(const uint64_t values[COUNTERS], double bytes, double events[COUNTERS])
+{
+    for (int i = 0; i < COUNTERS; i++) {
+        events[i] = (values[i] == COUNTER_MISSING || bytes == 0) ? -1 : values[i] / bytes;
+    }
+}
+
+const char * counters_name(counter_event event)
+{
+    return names[event];
+}
@@ -1,21 +1,34 @@
+#define _XOPEN_SOURCE 500  // Required for ftruncate()
+
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <lz77ppm/lz77.h>
 
+#include <price.h>
+#include <ustream_internal.h>
+
+#include <bench/counters.h>
+
 #include "assertions.h"
 
 //#define VERBOSE
 
 int WINDOW_SIZE = 1 << 9;
 int BUFFER_SIZE = 1 << 5;
+int ACCELERATION = 0;
 
 /*
  * Testing with an input size up to the size of window plus that of the
@@ -36,20 +49,35 @@ unsigned long total_size_decompressed = 0;
 unsigned long test_size_compressed = 0;
 unsigned long test_size_decompressed = 0;
 
+/*
+ * The hardware counters of the main thread (those of the threads started by
+ * the library are not counted), and the events counted during the current
+ * test, together with the bytes consumed by its compressions.
+ */
+counters test_counters;
+uint64_t test_events_compression[COUNTERS];
+uint64_t test_events_decompression[COUNTERS];
+unsigned long test_size_original = 0;
+
 int do_compress(lz77_ustream *original, lz77_cstream *compressed)
 {
+    counters_start(&test_counters);
     start = clock();
     int compressed_size = lz77_compress(original, compressed);
     test_time_compression += clock() - start;
+    counters_stop(&test_counters, test_events_compression);
     test_size_compressed += compressed_size;
+    test_size_original += lz77_ustream_get_processed_bytes(original);
     return compressed_size;
 }
 
 int do_decompress(lz77_cstream *compressed, lz77_ustream *decompressed)
 {
+    counters_start(&test_counters);
     start = clock();
     int decompressed_size = lz77_decompress(compressed, decompressed);
     test_time_decompression += clock() - start;
+    counters_stop(&test_counters, test_events_decompression);
     test_size_decompressed += decompressed_size;
     return decompressed_size;
 }
@@ -69,6 +97,20 @@ uint8_t get_random(int i) {
     return rand();
 }
 
+uint8_t get_words(int i) {
+    (void)(i);
+    static const char *words[] = {
+        "nel ", "mezzo ", "del ", "cammin ", "di ", "nostra ", "vita ", "mi ",
+        "ritrovai ", "per ", "una ", "selva ", "oscura ", "che ", "la ", "diritta ",
+        "via ", "era ", "smarrita\n"
+    };
+    static const char *word = "";
+    if (*word == '\0') {
+        word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+    }
+    return *word++;
+}
+
 static int triangle = 0;
 
 uint8_t get_triangle(int i) {
@@ -77,6 +119,54 @@ uint8_t get_triangle(int i) {
     return (cc <= triangle) ? cc++, 'A' + triangle : (cc = 1, 'A' + triangle++);
 }
 
+/*
+ * Runs of equal bytes, a bit shorter than the look-ahead buffer, with
+ * increasing values: each position is larger than the previous ones.
+ */
+uint8_t get_stairs(int i) {
+    return i / (BUFFER_SIZE - 1);
+}
+
+/*
+ * A big-endian counter of 32 bits.
+ */
+uint8_t get_counter(int i) {
+    return (i / 4) >> (8 * (3 - i % 4));
+}
+
+/*
+ * A binary de Bruijn sequence (in which each string of 16 bits appears
+ * once), built by preferring ones. It must be read sequentially.
+ */
+uint8_t get_debruijn(int i) {
+    static uint8_t seen[(1 << 16) / 8];
+    static uint16_t word;
+    if (i == 0) {
+        memset(seen, 0, sizeof(seen));
+        word = 0;
+        seen[0] = 1;
+    }
+    uint16_t one = (word << 1) | 1;
+    if (!(seen[one / 8] & (1 << (one % 8)))) {
+        word = one;
+    } else {
+        word = word << 1;
+    }
+    seen[word / 8] |= 1 << (word % 8);
+    return '0' + (word & 1);
+}
+
+/*
+ * Stretches of random bytes alternating with stretches of words, each one as
+ * long as half the window. It must be read sequentially.
+ */
+uint8_t get_patchy(int i) {
+    if ((i / (WINDOW_SIZE / 2)) % 2 == 0) {
+        return get_random(i);
+    }
+    return get_words(i);
+}
+
 static const char *get_char_input = NULL;
 
 uint8_t get_char(int i) {
@@ -113,6 +203,10 @@ void test_variable_length_i(const int original_size, uint8_t (*initializer)(int)
             0,
             1); // can_realloc = true
 
+    if (ACCELERATION > 0) {
+        assert_int_equal(0, lz77_ustream_set_acceleration(original_stream, ACCELERATION), extrainfo);
+    }
+
     int compressed_size = do_compress(original_stream, compressed_stream);
     uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream);
 
@@ -278,6 +372,104 @@ void test_static_alloc()
     }
 }
 
+void test_static_alloc_compression_i(const int original_size)
+{
+    uint8_t *original = malloc(original_size);
+    if (original == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", original_size);
+        printf("Aborting.");
+        exit(-2);
+    }
+
+    for (int i = 0; i < original_size; i++) {
+        original[i] = get_random(i);
+    }
+
+    char extrainfo[100];
+    sprintf(extrainfo, "Original size is %d bytes", original_size);
+
+    // Compress into a reallocated buffer to get the expected output.
+
+    lz77_ustream * original_stream = lz77_ustream_from_memory(
+            original,
+            original_size,
+            WINDOW_SIZE,
+            BUFFER_SIZE);
+
+    lz77_cstream * compressed_stream = lz77_cstream_to_memory(
+            original_stream,
+            NULL,
+            0,
+            1); // can_realloc = true
+
+    int expected_size = do_compress(original_stream, compressed_stream);
+    uint8_t *expected = lz77_cstream_get_buffer(compressed_stream);
+
+    assert_true(expected_size > 0, extrainfo);
+
+    lz77_ustream_free(&original_stream);
+    lz77_cstream_free(&compressed_stream);
+
+    // Compress again into fixed-size buffers, slightly smaller and larger than
+    // needed: the output must be either complete or rejected with ENOMEM.
+
+    for (int compressed_maxsize = expected_size - 9;
+            compressed_maxsize <= expected_size + 9;
+            compressed_maxsize++) {
+        if (compressed_maxsize <= 0) {
+            continue;
+        }
+        uint8_t compressed[compressed_maxsize];
+
+        original_stream = lz77_ustream_from_memory(
+                original,
+                original_size,
+                WINDOW_SIZE,
+                BUFFER_SIZE);
+
+        compressed_stream = lz77_cstream_to_memory(
+                original_stream,
+                compressed,
+                compressed_maxsize,
+                0); // can_realloc = false
+
+        int compressed_size = do_compress(original_stream, compressed_stream);
+
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+
+        if (compressed_maxsize < expected_size) {
+            assert_true(compressed_size < 0 && errno == ENOMEM, extrainfo);
+        } else {
+            assert_int_equal(expected_size, compressed_size, extrainfo);
+            assert_n_array_equal(expected, compressed, expected_size, extrainfo);
+        }
+    }
+
+    // Cleanup.
+    free(original);
+    free(expected);
+}
+
+void test_static_alloc_compression()
+{
+    const int max_original_size = TEST_MAX_INPUT_SIZE;
+
+    printf("\nTesting compression with static allocation (up to %d bytes)...\n",
+            max_original_size);
+
+    int percent = -1;
+    for (int i = 0; i <= max_original_size; i++) {
+        test_static_alloc_compression_i(i);
+
+        int p = i * 100 / max_original_size;
+        if (p % 10 == 0 && p > percent) {
+            percent = p;
+            printf(" %d%%...\n", percent);
+        }
+    }
+}
+
 void test_compress_from_file_i(const int original_size)
 {
     uint8_t *original = malloc(original_size);
@@ -680,38 +872,135 @@ void test_decompress_from_file()
     }
 }
 
-void test_ustream_fill_buffer()
+static int compress_file_to_file(int fd_input, int fd_compressed,
+                                 int fd_checkpoint, int interval, int resume)
 {
-    const int half_count = BUFFER_SIZE + 1;
-    // This 10 is the factor used by ustream to allocate the internal buffer.
-    const int min_original_size = WINDOW_SIZE * 10 - half_count;
-
-    printf("\nTest filling ustream's buffer (from %d to %d bytes of data)...\n",
-            min_original_size, min_original_size + 2 * half_count);
+    lz77_ustream * original_stream = lz77_ustream_from_descriptor(
+            fd_input,
+            WINDOW_SIZE,
+            BUFFER_SIZE);
 
-    int percent = -1;
-    for (int i = 0; i <= 2 * half_count; i++) {
-        test_decompress_to_file_i(min_original_size + i);
+    lz77_cstream * compressed_stream = lz77_cstream_to_descriptor(
+            original_stream,
+            fd_compressed);
 
-        int p = i * 100 / (2 * half_count);
-        if (p % 10 == 0 && p > percent) {
-            percent = p;
-            printf(" %d%%...\n", percent);
+    int compressed_size = -1;
+    if (resume) {
+        if (lz77_checkpoint_resume(original_stream, compressed_stream, fd_checkpoint) < 0) {
+            goto cleanup;
+        }
+    }
+    if (fd_checkpoint >= 0) {
+        if (lz77_checkpoint_enable(original_stream, fd_checkpoint, interval) < 0) {
+            goto cleanup;
         }
     }
+    compressed_size = do_compress(original_stream, compressed_stream);
+
+cleanup:
+    lz77_ustream_free(&original_stream);
+    lz77_cstream_free(&compressed_stream);
+    return compressed_size;
 }
 
-void test_variable_lookahead()
+void test_checkpoint_resume_i(const int original_size)
 {
-    const int max_original_size = TEST_MAX_INPUT_SIZE;
+    uint8_t *original = malloc(original_size);
+    if (original == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", original_size);
+        printf("Aborting.");
+        exit(-2);
+    }
 
-    printf("\nTesting with look-ahead of size %d bytes (up to %d bytes of data)...\n",
-            BUFFER_SIZE, max_original_size);
+    for (int i = 0; i < original_size; i++) {
+        original[i] = get_words(i);
+    }
+
+    char extrainfo[100];
+    sprintf(extrainfo, "Original size is %d bytes", original_size);
+
+    int fd_input = open("/tmp/temp-input.txt", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    int fd_expected = open("/tmp/temp-compressed.txt",
+            O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    int fd_resumed = open("/tmp/temp-resumed.txt", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    int fd_checkpoint = open("/tmp/temp-checkpoint.txt",
+            O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+
+    if (fd_input < 0 || fd_expected < 0 || fd_resumed < 0 || fd_checkpoint < 0) {
+        perror("Cannot create temporary files");
+        exit(-2);
+    }
+    if (write(fd_input, original, original_size) != original_size) {
+        perror("Cannot write data to input file");
+        exit(-2);
+    }
+
+    // Compress without checkpoints to get the expected output.
+    lseek(fd_input, 0, SEEK_SET);
+    int expected_size = compress_file_to_file(fd_input, fd_expected, -1, 0, 0);
+    assert_true(expected_size > 0, extrainfo);
+
+    // Compress taking checkpoints, then simulate a crash by resuming from the
+    // last checkpoint: the data written after it is thrown away and produced
+    // again. The interval is chosen so that about half of the input is
+    // compressed again.
+    int interval = original_size / 2 + 1;
+    lseek(fd_input, 0, SEEK_SET);
+    int compressed_size = compress_file_to_file(fd_input, fd_resumed, fd_checkpoint, interval, 0);
+    assert_int_equal(expected_size, compressed_size, extrainfo);
+
+    struct stat checkpoint_stat;
+    fstat(fd_checkpoint, &checkpoint_stat);
+    if (checkpoint_stat.st_size > 0) {
+        compressed_size = compress_file_to_file(fd_input, fd_resumed, fd_checkpoint, interval, 1);
+        assert_int_equal(expected_size, compressed_size, extrainfo);
+    }
+
+    // A checkpoint is refused once the input has been modified. The output is
+    // left untouched.
+    if (checkpoint_stat.st_size > 0) {
+        struct timeval times[2] = { { 1, 0 }, { 1, 0 } };
+        assert_int_equal(0, utimes("/tmp/temp-input.txt", times), extrainfo);
+        assert_int_equal(-1, compress_file_to_file(fd_input, fd_resumed, fd_checkpoint,
+                interval, 1), extrainfo);
+        assert_true(lseek(fd_input, 0, SEEK_END) >= 0 && write(fd_input, "x", 1) == 1, extrainfo);
+        assert_int_equal(-1, compress_file_to_file(fd_input, fd_resumed, fd_checkpoint,
+                interval, 1), extrainfo);
+    }
+
+    // Check that the outputs are identical.
+    uint8_t *expected = malloc(expected_size);
+    uint8_t *resumed = malloc(expected_size);
+    struct stat resumed_stat;
+    fstat(fd_resumed, &resumed_stat);
+    assert_int_equal(expected_size, resumed_stat.st_size, extrainfo);
+    lseek(fd_expected, 0, SEEK_SET);
+    lseek(fd_resumed, 0, SEEK_SET);
+    assert_true(read(fd_expected, expected, expected_size) == expected_size, extrainfo);
+    assert_true(read(fd_resumed, resumed, expected_size) == expected_size, extrainfo);
+    assert_n_array_equal(expected, resumed, expected_size, extrainfo);
+
+    // Cleanup.
+    free(original);
+    free(expected);
+    free(resumed);
+    close(fd_input);
+    close(fd_expected);
+    close(fd_resumed);
+    close(fd_checkpoint);
+}
+
+void test_checkpoint_resume()
+{
+    // Go beyond the size of the buffer of the input stream, so that the window
+    // is moved (and the tree rotated) between checkpoints.
+    const int max_original_size = WINDOW_SIZE * 24;
+
+    printf("\nTesting resume from checkpoints (up to %d bytes)...\n", max_original_size);
 
     int percent = -1;
-    for (int i = 0; i <= max_original_size; i++) {
-        triangle = 0;
-        test_variable_length_i(i, get_triangle);
+    for (int i = 0; i <= max_original_size; i += 61) {
+        test_checkpoint_resume_i(i);
 
         int p = i * 100 / max_original_size;
         if (p % 10 == 0 && p > percent) {
@@ -721,69 +1010,2392 @@ void test_variable_lookahead()
     }
 }
 
-void run_test(void (*test)(void))
+void test_multiple_members_i(const int original_size)
 {
-    test_size_compressed = test_size_decompressed = 0;
-    test_time_compression = test_time_decompression = 0;
+    uint8_t *original = malloc(original_size);
+    // Members shorter than the window, so that it is never full when one starts.
+    const int member_size = WINDOW_SIZE / 2 + 7;
+    const int max_members = original_size / member_size + 1;
+    // Each member has a header and a terminating token, and its output is
+    // never larger than (9/8) times its input.
+    uint8_t *compressed = malloc(original_size * 2 + max_members * 32);
+    if (original == NULL || compressed == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", original_size * 3);
+        printf("Aborting.");
+        exit(-2);
+    }
 
-    test();
+    for (int i = 0; i < original_size; i++) {
+        original[i] = get_words(i);
+    }
 
-    printf("Compression ratio (greater is better):  %.3lf\n",
-            test_size_decompressed / (double)test_size_compressed);
-    printf("Seconds taken by compression:           %.3lf\n",
-            test_time_compression / (double)CLOCKS_PER_SEC);
-    printf("Seconds taken by decompression:         %.3lf\n",
-            test_time_decompression / (double)CLOCKS_PER_SEC);
+    char extrainfo[100];
+    sprintf(extrainfo, "Original size is %d bytes", original_size);
 
-    total_time_compression += test_time_compression;
-    total_time_decompression += test_time_decompression;
-    total_size_compressed += test_size_compressed;
-    total_size_decompressed += test_size_decompressed;
-}
+    // Compress each member independently, concatenating their outputs.
+    int compressed_size = 0;
+    int member_start = 0;
+    do {
+        int size = original_size - member_start;
+        if (size > member_size) {
+            size = member_size;
+        }
 
-void test_explicit_i(const char *input, int window_size, int buffer_size)
-{
-    int WINDOW_SIZE_saved = WINDOW_SIZE;
-    int BUFFER_SIZE_saved = BUFFER_SIZE;
-    WINDOW_SIZE = window_size;
-    BUFFER_SIZE = buffer_size;
+        lz77_ustream * original_stream = lz77_ustream_from_memory(
+                original + member_start,
+                size,
+                WINDOW_SIZE,
+                BUFFER_SIZE);
+
+        lz77_cstream * compressed_stream = lz77_cstream_to_memory(
+                original_stream,
+                NULL,
+                0,
+                1); // can_realloc = true
+
+        int size_compressed = do_compress(original_stream, compressed_stream);
+        uint8_t *member = lz77_cstream_get_buffer(compressed_stream);
+        assert_true(size_compressed > 0, extrainfo);
+
+        memcpy(compressed + compressed_size, member, size_compressed);
+        compressed_size += size_compressed;
+        member_start += size;
+
+        free(member);
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+    } while (member_start < original_size);
+
+    // Decompress to a file, so that the buffer of the output stream is flushed
+    // while the window is not full.
+    int fd_output = open("/tmp/temp-output.txt", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd_output < 0) {
+        perror("Cannot create temporary file");
+        exit(-2);
+    }
 
-    printf(" %s (window: %d, lookahead: %d)\n", input, window_size, buffer_size);
-    test_variable_length_i(strlen(get_char_input = input), get_char);
+    lz77_cstream * compressed_stream = lz77_cstream_from_memory(compressed, compressed_size);
 
-    WINDOW_SIZE = WINDOW_SIZE_saved;
-    BUFFER_SIZE = BUFFER_SIZE_saved;
+    lz77_ustream * decompressed_stream = lz77_ustream_to_descriptor(
+            compressed_stream,
+            fd_output);
+
+    int decompressed_size = do_decompress(compressed_stream, decompressed_stream);
+
+    lz77_cstream_free(&compressed_stream);
+    lz77_ustream_free(&decompressed_stream);
+
+    // Check results.
+    assert_int_equal(original_size, decompressed_size, extrainfo);
+
+    uint8_t *decompressed = malloc(original_size);
+    lseek(fd_output, 0, SEEK_SET);
+    assert_true(read(fd_output, decompressed, original_size) == original_size, extrainfo);
+    assert_n_array_equal(original, decompressed, original_size, extrainfo);
+
+    // Cleanup.
+    free(original);
+    free(compressed);
+    free(decompressed);
+    close(fd_output);
 }
 
-void test_explicit()
+void test_multiple_members()
 {
-    printf("\nTesting with with explicit inputs...\n");
+    // Go beyond the size of the buffer of the output stream, so that it is
+    // flushed a few times.
+    const int max_original_size = WINDOW_SIZE * 24;
 
-    test_explicit_i("BBAAABBC", 4, 2);
-    test_explicit_i("BAAABBCA", 4, 2);
-    test_explicit_i("AAABBCAB", 4, 2);
-    test_explicit_i("YAZABCDEFGHI", 8, 4);
+    printf("\nTesting streams with multiple members (up to %d bytes)...\n", max_original_size);
+
+    int percent = -1;
+    for (int i = 0; i <= max_original_size; i += 61) {
+        test_multiple_members_i(i);
+
+        int p = i * 100 / max_original_size;
+        if (p % 10 == 0 && p > percent) {
+            percent = p;
+            printf(" %d%%...\n", percent);
+        }
+    }
 }
 
-int main()
+void test_hints_i(const int original_size)
 {
-    run_test(test_variable_length_zero);
+    uint8_t *original = malloc(original_size);
+    uint8_t *decompressed = malloc(original_size);
+    if (original == NULL || decompressed == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", original_size * 2);
+        printf("Aborting.");
+        exit(-2);
+    }
 
-    run_test(test_variable_length_value);
+    for (int i = 0; i < original_size; i++) {
+        original[i] = get_words(i);
+    }
 
-    run_test(test_variable_length_random);
+    char extrainfo[100];
+    sprintf(extrainfo, "Original size is %d bytes", original_size);
 
-    run_test(test_static_alloc);
+    // Compress with a smaller window and look-ahead buffer, to get the hints.
+    lz77_ustream * fast_original = lz77_ustream_from_memory(
+            original,
+            original_size,
+            WINDOW_SIZE / 4,
+            LZ77_MIN_LOOKAHEAD_SIZE + 6);
 
-    run_test(test_compress_from_file);
+    lz77_cstream * fast_compressed = lz77_cstream_to_memory(
+            fast_original,
+            NULL,
+            0,
+            1); // can_realloc = true
 
-    run_test(test_decompress_to_file);
+    int hints_size = lz77_compress(fast_original, fast_compressed);
+    uint8_t *hints = lz77_cstream_get_buffer(fast_compressed);
+    assert_true(hints_size > 0, extrainfo);
 
-    run_test(test_compress_to_file);
+    lz77_ustream_free(&fast_original);
+    lz77_cstream_free(&fast_compressed);
 
-    run_test(test_decompress_from_file);
+    // Wrong hints must not make the compression wrong.
+    if (original_size % 3 == 0 && hints_size > 16) {
+        hints[hints_size / 2] ^= 0x5A;
+    }
 
-    run_test(test_ustream_fill_buffer);
+    // Compress again using the hints.
+    lz77_ustream * original_stream = lz77_ustream_from_memory(
+            original,
+            original_size,
+            WINDOW_SIZE,
+            BUFFER_SIZE);
+
+    lz77_cstream * hints_stream = lz77_cstream_from_memory(hints, hints_size);
+    assert_int_equal(0, lz77_hints_enable(original_stream, hints_stream, original_size % 4), extrainfo);
+
+    lz77_cstream * compressed_stream = lz77_cstream_to_memory(
+            original_stream,
+            NULL,
+            0,
+            1); // can_realloc = true
+
+    int compressed_size = do_compress(original_stream, compressed_stream);
+    uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream);
+    assert_true(compressed_size > 0, extrainfo);
+
+    lz77_ustream_free(&original_stream);
+    lz77_cstream_free(&hints_stream);
+    lz77_cstream_free(&compressed_stream);
+
+    // Decompress and check results.
+    compressed_stream = lz77_cstream_from_memory(compressed, compressed_size);
+
+    lz77_ustream * decompressed_stream = lz77_ustream_to_memory(
+            compressed_stream,
+            decompressed,
+            original_size,
+            0); // can_realloc = false
+
+    int decompressed_size = do_decompress(compressed_stream, decompressed_stream);
+
+    assert_int_equal(original_size, decompressed_size, extrainfo);
+    assert_n_array_equal(original, decompressed, original_size, extrainfo);
+
+    // Cleanup.
+    lz77_cstream_free(&compressed_stream);
+    lz77_ustream_free(&decompressed_stream);
+    free(original);
+    free(decompressed);
+    free(compressed);
+    free(hints);
+}
+
+void test_hints()
+{
+    const int max_original_size = WINDOW_SIZE * 24;
+
+    printf("\nTesting compression with hints (up to %d bytes)...\n", max_original_size);
+
+    int percent = -1;
+    for (int i = 0; i <= max_original_size; i += 61) {
+        test_hints_i(i);
+
+        int p = i * 100 / max_original_size;
+        if (p % 10 == 0 && p > percent) {
+            percent = p;
+            printf(" %d%%...\n", percent);
+        }
+    }
+}
+
+void test_large_memory_input()
+{
+    // The size of the data in memory must not be truncated to the size of the
+    // look-ahead buffer's counter (i.e., to 16 bits).
+    printf("\nTesting with large inputs in memory...\n");
+
+    for (int i = 65536 - 1; i <= 65536 + BUFFER_SIZE; i++) {
+        test_variable_length_i(i, get_words);
+    }
+    test_variable_length_i(2 * 65536, get_words);
+}
+
+/*
+ * Inputs which make the binary search tree degenerate into long paths, with
+ * the maximum slowdown of their compression with respect to ordinary text.
+ */
+static const struct {
+    const char *name;
+    uint8_t (*initializer)(int);
+    double max_slowdown;
+} adversarial_inputs[] = {
+    { "get_stairs", get_stairs, 8 },
+    { "get_counter", get_counter, 8 },
+    { "get_debruijn", get_debruijn, 8 },
+    { "get_triangle", get_triangle, 8 },
+    { "get_value", get_value, 8 },
+};
+
+void test_adversarial()
+{
+    const int original_size = 1 << 18;
+
+    int WINDOW_SIZE_saved = WINDOW_SIZE;
+    int BUFFER_SIZE_saved = BUFFER_SIZE;
+    WINDOW_SIZE = 1 << 15;
+    BUFFER_SIZE = 32;
+
+    printf("\nTesting with adversarial inputs (%d bytes, window: %d, lookahead: %d)...\n",
+            original_size, WINDOW_SIZE, BUFFER_SIZE);
+
+    unsigned long before = test_time_compression;
+    test_variable_length_i(original_size, get_words);
+    double baseline = (test_time_compression - before) / (double)CLOCKS_PER_SEC;
+    printf(" %-14s %.3lfs\n", "get_words", baseline);
+    // Avoid failures due to the resolution of the clock.
+    if (baseline < 0.05) {
+        baseline = 0.05;
+    }
+
+    for (unsigned i = 0; i < sizeof(adversarial_inputs) / sizeof(adversarial_inputs[0]); i++) {
+        triangle = 0;
+        before = test_time_compression;
+        test_variable_length_i(original_size, adversarial_inputs[i].initializer);
+        double seconds = (test_time_compression - before) / (double)CLOCKS_PER_SEC;
+        printf(" %-14s %.3lfs\n", adversarial_inputs[i].name, seconds);
+
+        char extrainfo[100];
+        sprintf(extrainfo, "Input %s took %.3lfs (budget %.3lfs)", adversarial_inputs[i].name,
+                seconds, baseline * adversarial_inputs[i].max_slowdown);
+        assert_true(seconds <= baseline * adversarial_inputs[i].max_slowdown, extrainfo);
+    }
+
+    WINDOW_SIZE = WINDOW_SIZE_saved;
+    BUFFER_SIZE = BUFFER_SIZE_saved;
+}
+
+/*
+ * An executor which queues the tasks, to be run later by run_deferred_tasks(),
+ * or rejects them once the queue is full.
+ */
+#define DEFERRED_MAX_TASKS 8
+
+struct {
+    void (*task)(void *argument);
+    void *argument;
+} deferred_tasks[DEFERRED_MAX_TASKS];
+int deferred_count;
+
+int deferred_submit(lz77_executor *executor, void (*task)(void *argument), void *argument)
+{
+    (void)(executor);
+    if (deferred_count == DEFERRED_MAX_TASKS) {
+        errno = EAGAIN;
+        return -1;
+    }
+    deferred_tasks[deferred_count].task = task;
+    deferred_tasks[deferred_count].argument = argument;
+    deferred_count++;
+    return 0;
+}
+
+void run_deferred_tasks()
+{
+    // Run them in reverse order, since they must not depend on each other.
+    while (deferred_count > 0) {
+        deferred_count--;
+        deferred_tasks[deferred_count].task(deferred_tasks[deferred_count].argument);
+    }
+}
+
+typedef struct {
+    int64_t result;
+    int error;
+    int calls;
+} async_outcome;
+
+void async_done(int64_t result, int error, void *argument)
+{
+    async_outcome *outcome = argument;
+    outcome->result = result;
+    outcome->error = error;
+    outcome->calls++;
+}
+
+void test_async_i(const int original_size)
+{
+    lz77_executor executor = { deferred_submit, 1, NULL };
+    uint8_t *original[DEFERRED_MAX_TASKS];
+    uint8_t *decompressed[DEFERRED_MAX_TASKS];
+    lz77_ustream *original_stream[DEFERRED_MAX_TASKS];
+    lz77_cstream *compressed_stream[DEFERRED_MAX_TASKS];
+    async_outcome outcome[DEFERRED_MAX_TASKS];
+
+    char extrainfo[100];
+    sprintf(extrainfo, "Original size is %d bytes", original_size);
+
+    // Fill the queue of the executor with compressions of different inputs.
+    for (int t = 0; t < DEFERRED_MAX_TASKS; t++) {
+        original[t] = malloc(original_size + t + 1);
+        decompressed[t] = malloc(original_size + t + 1);
+        if (original[t] == NULL || decompressed[t] == NULL) {
+            printf("Cannot allocate %d bytes of memory.\n", (original_size + t + 1) * 2);
+            printf("Aborting.");
+            exit(-2);
+        }
+        for (int i = 0; i < original_size + t; i++) {
+            original[t][i] = get_words(i);
+        }
+        original_stream[t] = lz77_ustream_from_memory(original[t], original_size + t,
+                WINDOW_SIZE, BUFFER_SIZE);
+        compressed_stream[t] = lz77_cstream_to_memory(original_stream[t], NULL, 0, 1);
+        memset(&outcome[t], 0, sizeof(outcome[t]));
+        assert_int_equal(0, lz77_compress_async(&executor, original_stream[t],
+                compressed_stream[t], async_done, &outcome[t]), extrainfo);
+    }
+
+    // A rejected job must not be completed.
+    async_outcome rejected = { 0, 0, 0 };
+    assert_int_equal(-1, lz77_compress_async(&executor, original_stream[0],
+            compressed_stream[0], async_done, &rejected), extrainfo);
+    assert_int_equal(EAGAIN, errno, extrainfo);
+
+    for (int t = 0; t < DEFERRED_MAX_TASKS; t++) {
+        assert_int_equal(0, outcome[t].calls, extrainfo);
+    }
+    start = clock();
+    run_deferred_tasks();
+    test_time_compression += clock() - start;
+    assert_int_equal(0, rejected.calls, extrainfo);
+
+    // Decompress with no executor, i.e. in this thread.
+    for (int t = 0; t < DEFERRED_MAX_TASKS; t++) {
+        assert_int_equal(1, outcome[t].calls, extrainfo);
+        assert_true(outcome[t].result > 0, extrainfo);
+        test_size_compressed += outcome[t].result;
+
+        uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream[t]);
+        lz77_ustream_free(&original_stream[t]);
+        lz77_cstream_free(&compressed_stream[t]);
+
+        compressed_stream[t] = lz77_cstream_from_memory(compressed, outcome[t].result);
+        original_stream[t] = lz77_ustream_to_memory(compressed_stream[t],
+                decompressed[t], original_size + t, 0);
+        memset(&outcome[t], 0, sizeof(outcome[t]));
+        start = clock();
+        assert_int_equal(0, lz77_decompress_async(NULL, compressed_stream[t],
+                original_stream[t], async_done, &outcome[t]), extrainfo);
+        test_time_decompression += clock() - start;
+        assert_int_equal(1, outcome[t].calls, extrainfo);
+        assert_int_equal(original_size + t, outcome[t].result, extrainfo);
+        assert_int_equal(0, memcmp(original[t], decompressed[t], original_size + t), extrainfo);
+        test_size_decompressed += outcome[t].result;
+
+        lz77_ustream_free(&original_stream[t]);
+        lz77_cstream_free(&compressed_stream[t]);
+        free(compressed);
+        free(original[t]);
+        free(decompressed[t]);
+    }
+}
+
+void test_async()
+{
+    const int max_original_size = WINDOW_SIZE * 8;
+
+    printf("\nTesting asynchronous operations (up to %d bytes)...\n", max_original_size);
+
+    int percent = -1;
+    for (int i = 0; i <= max_original_size; i += 37) {
+        test_async_i(i);
+
+        int p = i * 100 / max_original_size;
+        if (p % 10 == 0 && p > percent) {
+            percent = p;
+            printf(" %d%%...\n", percent);
+        }
+    }
+}
+
+void test_acceleration()
+{
+    const int max_original_size = WINDOW_SIZE * 8;
+    const int accelerations[] = { 1, 16, 1000 };
+    const int count = sizeof(accelerations) / sizeof(accelerations[0]);
+
+    printf("\nTesting accelerated compression (up to %d bytes)...\n", max_original_size);
+
+    int percent = -1;
+    for (int a = 0; a < count; a++) {
+        ACCELERATION = accelerations[a];
+        for (int i = 0; i <= max_original_size; i += 53) {
+            test_variable_length_i(i, get_patchy);
+
+            int p = (a * max_original_size + i) * 100 / (count * max_original_size);
+            if (p % 10 == 0 && p > percent) {
+                percent = p;
+                printf(" %d%%...\n", percent);
+            }
+        }
+    }
+    ACCELERATION = 0;
+}
+
+/*
+ * Creates a sparse file alternating pieces of data and holes: the lengths of
+ * the pieces are given by `layout' (a hole first, if layout[0] is zero), and
+ * the content of the file is also stored in `original'.
+ */
+int create_sparse_file(const char *path, const int *layout, int count, uint8_t *original)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror("Cannot create sparse file");
+        exit(-2);
+    }
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        if (i % 2 == 0) {
+            for (int j = 0; j < layout[i]; j++) {
+                original[size + j] = get_words(size + j);
+            }
+            if (write(fd, original + size, layout[i]) != layout[i]) {
+                perror("Cannot write sparse file");
+                exit(-2);
+            }
+        } else {
+            memset(original + size, 0, layout[i]);
+            if (lseek(fd, layout[i], SEEK_CUR) < 0) {
+                perror("Cannot seek sparse file");
+                exit(-2);
+            }
+        }
+        size += layout[i];
+    }
+    if (ftruncate(fd, size) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        perror("Cannot truncate sparse file");
+        exit(-2);
+    }
+    return fd;
+}
+
+void test_sparse()
+{
+    const int hole = 256 * 1024;
+    const int layouts[][5] = {
+        { 1000, hole, 3000, 0, 0 },
+        { 0, hole, 5000, hole, 0 },
+        { 7000, hole, 0, hole, 2000 },
+        { 4000, 1000, 4000, hole, 1 },
+    };
+    const int count = sizeof(layouts) / sizeof(layouts[0]);
+
+    printf("\nTesting sparse files...\n");
+
+    uint8_t *original = malloc(hole * 3);
+    uint8_t *decompressed = malloc(hole * 3 + 1);
+    if (original == NULL || decompressed == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", hole * 3);
+        printf("Aborting.");
+        exit(-2);
+    }
+
+    for (int l = 0; l < count; l++) {
+        int original_size = 0, data_size = 0;
+        for (int i = 0; i < 5; i++) {
+            original_size += layouts[l][i];
+            data_size += i % 2 == 0 ? layouts[l][i] : 0;
+        }
+        int fd_original = create_sparse_file("/tmp/temp-original.txt", layouts[l], 5, original);
+
+        char extrainfo[100];
+        sprintf(extrainfo, "Layout %d, original size is %d bytes", l, original_size);
+
+        // The holes are recorded only if the file system supports them.
+        struct stat st;
+        assert_int_equal(0, fstat(fd_original, &st), extrainfo);
+        int has_holes = st.st_blocks * 512 < original_size - hole;
+
+        lz77_ustream * original_stream = lz77_ustream_from_descriptor(
+                fd_original, WINDOW_SIZE, BUFFER_SIZE);
+        assert_int_equal(0, lz77_ustream_set_sparse(original_stream, 1), extrainfo);
+        lz77_cstream * compressed_stream = lz77_cstream_to_memory(original_stream, NULL, 0, 1);
+
+        int compressed_size = do_compress(original_stream, compressed_stream);
+        uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream);
+        assert_true(compressed_size > 0, extrainfo);
+        if (has_holes) {
+            assert_true(compressed_size < data_size + 1000, extrainfo);
+        }
+
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+        close(fd_original);
+
+        // Decompress to a sparse file, and then to memory (writing zeros).
+        for (int to_memory = 0; to_memory <= 1; to_memory++) {
+            compressed_stream = lz77_cstream_from_memory(compressed, compressed_size);
+            int fd_decompressed = -1;
+            lz77_ustream * decompressed_stream;
+            uint8_t *output = decompressed;
+            if (to_memory) {
+                decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+            } else {
+                fd_decompressed = open("/tmp/temp-decompressed.txt",
+                        O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+                if (fd_decompressed < 0) {
+                    perror("Cannot create decompressed file");
+                    exit(-2);
+                }
+                decompressed_stream = lz77_ustream_to_descriptor(compressed_stream, fd_decompressed);
+                assert_int_equal(0, lz77_ustream_set_sparse(decompressed_stream, 1), extrainfo);
+            }
+
+            int decompressed_size = do_decompress(compressed_stream, decompressed_stream);
+            assert_int_equal(original_size, decompressed_size, extrainfo);
+
+            if (to_memory) {
+                output = lz77_ustream_get_buffer(decompressed_stream);
+            } else {
+                assert_int_equal(0, fstat(fd_decompressed, &st), extrainfo);
+                assert_int_equal(original_size, st.st_size, extrainfo);
+                if (has_holes) {
+                    assert_true(st.st_blocks * 512 < original_size - hole, extrainfo);
+                }
+                if (lseek(fd_decompressed, 0, SEEK_SET) != 0) {
+                    perror("Cannot read decompressed file");
+                    exit(-2);
+                }
+                assert_int_equal(original_size,
+                        read(fd_decompressed, decompressed, original_size + 1), extrainfo);
+                close(fd_decompressed);
+            }
+            assert_int_equal(0, memcmp(original, output, original_size), extrainfo);
+
+            if (to_memory) {
+                free(output);
+            }
+            lz77_cstream_free(&compressed_stream);
+            lz77_ustream_free(&decompressed_stream);
+        }
+        free(compressed);
+
+        printf(" %d%%...\n", (l + 1) * 100 / count);
+    }
+
+    free(original);
+    free(decompressed);
+}
+
+/*
+ * Builds the content of the record number `i' of a journal.
+ */
+int make_record(int i, char *record)
+{
+    int size = sprintf(record, "%d: the message number %d, with %d dots", i, i * 7, i % 61);
+    for (int j = 0; j < i % 61; j++) {
+        record[size++] = '.';
+    }
+    return size;
+}
+
+/*
+ * Makes a flush fail in the middle of its member (the log cannot grow beyond
+ * its current size), and leaves an incomplete entry at the end of the index:
+ * neither must prevent appending more records and reading all of them.
+ */
+void test_journal_failures()
+{
+    const int total = 400;
+
+    int fd = open("/tmp/temp-journal.lz", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    int index_fd = open("/tmp/temp-journal.idx", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0 || index_fd < 0) {
+        perror("Cannot create journal");
+        exit(-2);
+    }
+
+    char record[200];
+    lz77_journal_writer *writer = lz77_journal_writer_open(fd, index_fd,
+            WINDOW_SIZE, BUFFER_SIZE);
+    assert_true(writer != NULL, "Failed flush");
+    for (int i = 0; i < total / 2; i++) {
+        int size = make_record(i, record);
+        assert_int_equal(i, lz77_journal_append(writer, record, size, i), "Failed flush");
+        if (i == total / 4) {
+            assert_int_equal(0, lz77_journal_flush(writer), "Failed flush");
+        }
+    }
+
+    struct stat st;
+    assert_int_equal(0, fstat(fd, &st), "Failed flush");
+    off_t log_size = st.st_size;
+    struct rlimit saved, limited;
+    assert_int_equal(0, getrlimit(RLIMIT_FSIZE, &saved), "Failed flush");
+    limited = saved;
+    limited.rlim_cur = log_size + 100;
+    signal(SIGXFSZ, SIG_IGN);
+    assert_int_equal(0, setrlimit(RLIMIT_FSIZE, &limited), "Failed flush");
+    errno = 0;
+    assert_true(lz77_journal_flush(writer) < 0, "Failed flush");
+    assert_int_equal(EFBIG, errno, "Failed flush");
+    assert_int_equal(0, setrlimit(RLIMIT_FSIZE, &saved), "Failed flush");
+    signal(SIGXFSZ, SIG_DFL);
+    assert_int_equal(0, fstat(fd, &st), "Failed flush");
+    assert_int_equal(log_size, st.st_size, "Failed flush");
+
+    for (int i = total / 2; i < total * 3 / 4; i++) {
+        int size = make_record(i, record);
+        assert_int_equal(i, lz77_journal_append(writer, record, size, i), "Failed flush");
+    }
+    assert_int_equal(0, lz77_journal_writer_close(&writer), "Failed flush");
+
+    // A crash while writing an entry leaves a part of it, and its member.
+    assert_true(write(index_fd, "torn", 4) == 4, "Incomplete entry");
+    assert_true(write(fd, "garbage", 7) == 7, "Incomplete entry");
+    writer = lz77_journal_writer_open(fd, index_fd, WINDOW_SIZE, BUFFER_SIZE);
+    assert_true(writer != NULL, "Incomplete entry");
+    for (int i = total * 3 / 4; i < total; i++) {
+        int size = make_record(i, record);
+        assert_int_equal(i, lz77_journal_append(writer, record, size, i), "Incomplete entry");
+        test_size_decompressed += size;
+    }
+    assert_int_equal(0, lz77_journal_writer_close(&writer), "Incomplete entry");
+    test_size_compressed += lseek(fd, 0, SEEK_END);
+
+    lz77_journal_reader *reader = lz77_journal_reader_open(fd, index_fd);
+    assert_true(reader != NULL, "Reading after failures");
+    assert_int_equal(total, lz77_journal_count(reader), "Reading after failures");
+    const uint8_t *data;
+    uint32_t size;
+    for (int i = 0; i < total; i++) {
+        assert_int_equal(1, lz77_journal_next(reader, &data, &size), "Reading after failures");
+        int expected = make_record(i, record);
+        assert_int_equal(expected, size, "Reading after failures");
+        assert_int_equal(0, memcmp(record, data, size), "Reading after failures");
+    }
+    assert_int_equal(0, lz77_journal_next(reader, &data, &size), "Reading after failures");
+    lz77_journal_reader_free(&reader);
+    close(fd);
+    close(index_fd);
+}
+
+void test_journal()
+{
+    const int total = 3000;
+    const uint32_t flush_sizes[] = { 1000, 64 * 1024, LZ77_JOURNAL_DEFAULT_FLUSH_SIZE };
+    const uint64_t intervals[] = { 0, 0, 50 };
+    const int count = sizeof(flush_sizes) / sizeof(flush_sizes[0]);
+
+    printf("\nTesting journals (%d records)...\n", total);
+
+    for (int c = 0; c < count; c++) {
+        char extrainfo[100];
+        sprintf(extrainfo, "Flush size %lu, interval %lu",
+                (unsigned long)flush_sizes[c], (unsigned long)intervals[c]);
+
+        int fd = open("/tmp/temp-journal.lz", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        int index_fd = open("/tmp/temp-journal.idx", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd < 0 || index_fd < 0) {
+            perror("Cannot create journal");
+            exit(-2);
+        }
+
+        // Append the records in two sessions, with some garbage (as left by
+        // a crash) between them. The timestamp of record i is i / 3.
+        char record[200];
+        for (int session = 0; session < 2; session++) {
+            lz77_journal_writer *writer = lz77_journal_writer_open(fd, index_fd,
+                    WINDOW_SIZE, BUFFER_SIZE);
+            assert_true(writer != NULL, extrainfo);
+            assert_int_equal(0, lz77_journal_set_flush(writer, flush_sizes[c], intervals[c]),
+                    extrainfo);
+            int first = session * total * 2 / 3;
+            int last = session == 0 ? total * 2 / 3 : total;
+            for (int i = first; i < last; i++) {
+                int size = make_record(i, record);
+                assert_int_equal(i, lz77_journal_append(writer, record, size, i / 3), extrainfo);
+                test_size_decompressed += size;
+            }
+            assert_int_equal(0, lz77_journal_writer_close(&writer), extrainfo);
+            assert_true(write(fd, "garbage", 7) == 7, extrainfo);
+        }
+        test_size_compressed += lseek(fd, 0, SEEK_CUR);
+
+        lz77_journal_reader *reader = lz77_journal_reader_open(fd, index_fd);
+        assert_true(reader != NULL, extrainfo);
+        assert_int_equal(total, lz77_journal_count(reader), extrainfo);
+
+        // Read the records sequentially, and then from a few positions.
+        const int starts[] = { 0, 1, 999, 2000, total - 1, total };
+        for (int s = -1; s < (int)(sizeof(starts) / sizeof(starts[0])); s++) {
+            int start = s < 0 ? 0 : starts[s];
+            if (s >= 0) {
+                assert_int_equal(0, lz77_journal_seek(reader, start), extrainfo);
+            }
+            const uint8_t *data;
+            uint32_t size;
+            for (int i = start; i < total; i++) {
+                assert_int_equal(1, lz77_journal_next(reader, &data, &size), extrainfo);
+                int expected = make_record(i, record);
+                assert_int_equal(expected, size, extrainfo);
+                assert_int_equal(0, memcmp(record, data, size), extrainfo);
+            }
+            assert_int_equal(0, lz77_journal_next(reader, &data, &size), extrainfo);
+        }
+        assert_true(lz77_journal_seek(reader, total + 1) < 0, extrainfo);
+
+        // Seeking by time stops at the beginning of a member which contains
+        // the first record of that time.
+        for (int t = 0; t <= total / 3; t += 37) {
+            int64_t r = lz77_journal_seek_time(reader, t);
+            assert_true(r >= 0 && r <= t * 3, extrainfo);
+            assert_true(r == 0 || (r - 1) / 3 < t, extrainfo);
+        }
+        assert_int_equal(total, lz77_journal_seek_time(reader, total), extrainfo);
+
+        lz77_journal_reader_free(&reader);
+        close(fd);
+        close(index_fd);
+
+        printf(" %d%%...\n", (c + 1) * 100 / count);
+    }
+
+    test_journal_failures();
+}
+
+void test_cache()
+{
+    const int payloads = 40;
+    const int payload_size = 3000;
+
+    printf("\nTesting the cache of compressed data (%d payloads)...\n", payloads);
+
+    uint8_t *data = malloc(payloads * payload_size);
+    if (data == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", payloads * payload_size);
+        printf("Aborting.");
+        exit(-2);
+    }
+    for (int i = 0; i < payloads * payload_size; i++) {
+        data[i] = get_words(i);
+    }
+
+    // A budget for about ten results.
+    lz77_cache *cache = lz77_cache_create(10 * (payload_size / 2 + 100));
+    assert_true(cache != NULL, "Cannot create the cache");
+
+    int percent = -1;
+    uint64_t hits, misses, expected_hits = 0;
+    for (int round = 0; round < 200; round++) {
+        // Mostly a few recent payloads, sometimes any of them.
+        int p = round % 5 == 0 ? (round * 7) % payloads : (round / 10) % 4;
+        uint16_t window_size = round % 7 == 0 ? WINDOW_SIZE / 2 : WINDOW_SIZE;
+        const uint8_t *payload = data + p * payload_size;
+
+        char extrainfo[100];
+        sprintf(extrainfo, "Round %d, payload %d", round, p);
+
+        const uint8_t *cached;
+        int64_t cached_size = lz77_cache_compress(cache, payload, payload_size,
+                window_size, BUFFER_SIZE, &cached);
+        assert_true(cached_size > 0, extrainfo);
+
+        // The result must be the same as that of an actual compression.
+        lz77_ustream *original_stream = lz77_ustream_from_memory(payload, payload_size,
+                window_size, BUFFER_SIZE);
+        lz77_cstream *compressed_stream = lz77_cstream_to_memory(original_stream, NULL, 0, 1);
+        int compressed_size = do_compress(original_stream, compressed_stream);
+        uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream);
+        assert_int_equal(compressed_size, cached_size, extrainfo);
+        assert_int_equal(0, memcmp(compressed, cached, compressed_size), extrainfo);
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+        free(compressed);
+        test_size_decompressed += payload_size;
+
+        // Compressing again the same payload is always a hit.
+        lz77_cache_get_stats(cache, &hits, NULL, NULL);
+        expected_hits = hits + 1;
+        assert_true(lz77_cache_compress(cache, payload, payload_size,
+                window_size, BUFFER_SIZE, &cached) == cached_size, extrainfo);
+        lz77_cache_get_stats(cache, &hits, NULL, NULL);
+        assert_int_equal(expected_hits, hits, extrainfo);
+
+        int q = round * 100 / 200;
+        if (q % 10 == 0 && q > percent) {
+            percent = q;
+            printf(" %d%%...\n", percent);
+        }
+    }
+
+    size_t used;
+    lz77_cache_get_stats(cache, &hits, &misses, &used);
+    assert_true(used <= (size_t)(10 * (payload_size / 2 + 100)), "The budget has been exceeded");
+    assert_true(misses > 4 && misses < 200, "Unexpected number of misses");
+
+    lz77_cache_free(&cache);
+    assert_true(cache == NULL, "The cache has not been freed");
+    free(data);
+}
+
+void test_target_throughput()
+{
+    const int original_size = 1 << 20;
+    const uint64_t targets[] = { 0, 1, 1000000000000ULL };
+    const int count = sizeof(targets) / sizeof(targets[0]);
+
+    printf("\nTesting compression with a target throughput (%d bytes)...\n", original_size);
+
+    uint8_t *original = malloc(original_size);
+    if (original == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", original_size);
+        printf("Aborting.");
+        exit(-2);
+    }
+    for (int i = 0; i < original_size; i++) {
+        original[i] = get_words(i);
+    }
+
+    int sizes[3];
+    for (int t = 0; t < count; t++) {
+        char extrainfo[100];
+        sprintf(extrainfo, "Target throughput %llu B/s", (unsigned long long)targets[t]);
+
+        lz77_ustream *original_stream = lz77_ustream_from_memory(original, original_size,
+                WINDOW_SIZE, BUFFER_SIZE);
+        if (targets[t] > 0) {
+            assert_int_equal(0, lz77_ustream_set_target_throughput(original_stream, targets[t]),
+                    extrainfo);
+        }
+        lz77_cstream *compressed_stream = lz77_cstream_to_memory(original_stream, NULL, 0, 1);
+        sizes[t] = do_compress(original_stream, compressed_stream);
+        uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream);
+        assert_true(sizes[t] > 0, extrainfo);
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+
+        compressed_stream = lz77_cstream_from_memory(compressed, sizes[t]);
+        lz77_ustream *decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+        assert_int_equal(original_size, do_decompress(compressed_stream, decompressed_stream),
+                extrainfo);
+        uint8_t *decompressed = lz77_ustream_get_buffer(decompressed_stream);
+        assert_int_equal(0, memcmp(original, decompressed, original_size), extrainfo);
+        lz77_cstream_free(&compressed_stream);
+        lz77_ustream_free(&decompressed_stream);
+        free(compressed);
+        free(decompressed);
+
+        printf(" %d%%...\n", (t + 1) * 100 / count);
+    }
+
+    // A target which is always reached keeps the highest effort, while an
+    // unreachable one lowers it.
+    assert_int_equal(sizes[0], sizes[1], "A reachable target changed the output");
+    assert_true(sizes[2] > sizes[0], "An unreachable target did not lower the effort");
+
+    free(original);
+}
+
+void test_seek_index()
+{
+    const int original_size = 1 << 20;
+    const uint64_t intervals[] = { 4096, LZ77_SEEK_DEFAULT_INTERVAL };
+    const int count = sizeof(intervals) / sizeof(intervals[0]);
+
+    printf("\nTesting random access with a seek index (%d bytes)...\n", original_size);
+
+    uint8_t *original = malloc(original_size);
+    uint8_t *range = malloc(original_size);
+    if (original == NULL || range == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", original_size);
+        printf("Aborting.");
+        exit(-2);
+    }
+    for (int i = 0; i < original_size; i++) {
+        original[i] = get_words(i);
+    }
+
+    // Two members, as a phrase cannot refer to the data of a previous member.
+    int fd = open("/tmp/temp-seek.lz", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror("Cannot create compressed file");
+        exit(-2);
+    }
+    const int half = original_size / 2 + 123;
+    for (int m = 0; m < 2; m++) {
+        lz77_ustream *original_stream = lz77_ustream_from_memory(original + (m ? half : 0),
+                m ? original_size - half : half, WINDOW_SIZE, BUFFER_SIZE);
+        lz77_cstream *compressed_stream = lz77_cstream_to_descriptor(original_stream, fd);
+        assert_true(do_compress(original_stream, compressed_stream) > 0, "Compression failed");
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+    }
+    test_size_compressed += lseek(fd, 0, SEEK_CUR);
+
+    for (int c = 0; c < count; c++) {
+        char extrainfo[100];
+        sprintf(extrainfo, "Interval %lu", (unsigned long)intervals[c]);
+
+        int index_fd = open("/tmp/temp-seek.idx", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (index_fd < 0) {
+            perror("Cannot create seek index");
+            exit(-2);
+        }
+        assert_true(lseek(fd, 0, SEEK_SET) == 0, extrainfo);
+        lz77_cstream *compressed_stream = lz77_cstream_from_descriptor(fd);
+        lz77_ustream *decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+        assert_int_equal(0, lz77_seek_index_enable(decompressed_stream, index_fd, intervals[c]),
+                extrainfo);
+        assert_int_equal(original_size, do_decompress(compressed_stream, decompressed_stream),
+                extrainfo);
+        free(lz77_ustream_get_buffer(decompressed_stream));
+        lz77_cstream_free(&compressed_stream);
+        lz77_ustream_free(&decompressed_stream);
+        test_size_decompressed += original_size;
+
+        // Ranges at the edges of entries and members, and at the end.
+        const int offsets[] = { 0, 1, 4095, 4096, 300001, half - 500, half, original_size - 10,
+                                original_size, original_size + 5 };
+        const int noffsets = sizeof(offsets) / sizeof(offsets[0]);
+        for (int i = 0; i < noffsets + 50; i++) {
+            int offset = i < noffsets ? offsets[i] : rand() % original_size;
+            int size = i < noffsets ? 1000 : rand() % 20000;
+            int expected = offset >= original_size ? 0
+                    : (offset + size > original_size ? original_size - offset : size);
+            memset(range, 0, size);
+            assert_int_equal(expected, lz77_seek_read(fd, index_fd, offset, range, size),
+                    extrainfo);
+            if (expected > 0) {
+                assert_int_equal(0, memcmp(original + offset, range, expected), extrainfo);
+            }
+        }
+
+        close(index_fd);
+        printf(" %d%%...\n", (c + 1) * 100 / count);
+    }
+
+    close(fd);
+    free(range);
+    free(original);
+}
+
+void test_solid_failures()
+{
+    const int total = 400;
+
+    int fd = open("/tmp/temp-solid.lz", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    int table_fd = open("/tmp/temp-solid.tab", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0 || table_fd < 0) {
+        perror("Cannot create solid archive");
+        exit(-2);
+    }
+
+    char entry[200];
+    lz77_solid_writer *writer = lz77_solid_writer_open(fd, table_fd, WINDOW_SIZE, BUFFER_SIZE);
+    assert_true(writer != NULL, "Failed flush");
+    for (int i = 0; i < total / 2; i++) {
+        int size = make_record(i, entry);
+        assert_int_equal(i, lz77_solid_add(writer, entry, size), "Failed flush");
+        if (i == total / 4) {
+            assert_int_equal(0, lz77_solid_flush(writer), "Failed flush");
+        }
+    }
+
+    struct stat st;
+    assert_int_equal(0, fstat(fd, &st), "Failed flush");
+    off_t archive_size = st.st_size;
+    assert_int_equal(0, fstat(table_fd, &st), "Failed flush");
+    off_t table_size = st.st_size;
+    struct rlimit saved, limited;
+    assert_int_equal(0, getrlimit(RLIMIT_FSIZE, &saved), "Failed flush");
+    limited = saved;
+    limited.rlim_cur = archive_size + 100;
+    signal(SIGXFSZ, SIG_IGN);
+    assert_int_equal(0, setrlimit(RLIMIT_FSIZE, &limited), "Failed flush");
+    errno = 0;
+    assert_true(lz77_solid_flush(writer) < 0, "Failed flush");
+    assert_int_equal(EFBIG, errno, "Failed flush");
+    assert_int_equal(0, setrlimit(RLIMIT_FSIZE, &saved), "Failed flush");
+    signal(SIGXFSZ, SIG_DFL);
+    assert_int_equal(0, fstat(fd, &st), "Failed flush");
+    assert_int_equal(archive_size, st.st_size, "Failed flush");
+    assert_int_equal(0, fstat(table_fd, &st), "Failed flush");
+    assert_int_equal(table_size, st.st_size, "Failed flush");
+
+    for (int i = total / 2; i < total * 3 / 4; i++) {
+        int size = make_record(i, entry);
+        assert_int_equal(i, lz77_solid_add(writer, entry, size), "Failed flush");
+    }
+    assert_int_equal(0, lz77_solid_writer_close(&writer), "Failed flush");
+
+    // A crash while writing the table leaves a part of an entry, and a group.
+    assert_true(write(table_fd, "torn", 4) == 4, "Incomplete entry");
+    assert_true(write(fd, "garbage", 7) == 7, "Incomplete entry");
+    writer = lz77_solid_writer_open(fd, table_fd, WINDOW_SIZE, BUFFER_SIZE);
+    assert_true(writer != NULL, "Incomplete entry");
+    for (int i = total * 3 / 4; i < total; i++) {
+        int size = make_record(i, entry);
+        assert_int_equal(i, lz77_solid_add(writer, entry, size), "Incomplete entry");
+        test_size_decompressed += size;
+    }
+    assert_int_equal(0, lz77_solid_writer_close(&writer), "Incomplete entry");
+    test_size_compressed += lseek(fd, 0, SEEK_END);
+
+    lz77_solid_reader *reader = lz77_solid_reader_open(fd, table_fd);
+    assert_true(reader != NULL, "Reading after failures");
+    assert_int_equal(total, lz77_solid_count(reader), "Reading after failures");
+    for (int i = 0; i < total; i++) {
+        const uint8_t *data;
+        int expected = make_record(i, entry);
+        assert_int_equal(expected, lz77_solid_get(reader, i, &data), "Reading after failures");
+        assert_int_equal(0, memcmp(entry, data, expected), "Reading after failures");
+    }
+    lz77_solid_reader_free(&reader);
+    close(fd);
+    close(table_fd);
+}
+
+void test_solid()
+{
+    const int total = 500;
+    const uint32_t group_sizes[] = { 1, 16 * 1024, LZ77_SOLID_DEFAULT_GROUP_SIZE };
+    const int count = sizeof(group_sizes) / sizeof(group_sizes[0]);
+
+    printf("\nTesting solid archives (%d entries)...\n", total);
+
+    // Small entries, similar to each other, of up to 4 KB (some empty).
+    uint32_t *offsets = malloc((total + 1) * sizeof(*offsets));
+    if (offsets == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", (int)((total + 1) * sizeof(*offsets)));
+        printf("Aborting.");
+        exit(-2);
+    }
+    offsets[0] = 0;
+    for (int i = 0; i < total; i++) {
+        offsets[i + 1] = offsets[i] + (i % 50 == 7 ? 0 : rand() % 4096);
+    }
+    uint8_t *original = malloc(offsets[total]);
+    if (original == NULL) {
+        printf("Cannot allocate %lu bytes of memory.\n", (unsigned long)offsets[total]);
+        printf("Aborting.");
+        exit(-2);
+    }
+    for (uint32_t i = 0; i < offsets[total]; i++) {
+        original[i] = get_words(i);
+    }
+
+    // The size of the entries compressed one by one.
+    int64_t separate_size = 0;
+    for (int i = 0; i < total; i++) {
+        lz77_ustream *ustream = lz77_ustream_from_memory(original + offsets[i],
+                offsets[i + 1] - offsets[i], WINDOW_SIZE, BUFFER_SIZE);
+        lz77_cstream *cstream = lz77_cstream_to_memory(ustream, NULL, 0, 1);
+        int64_t size = lz77_compress(ustream, cstream);
+        assert_true(size >= 0, "Compression of a single entry");
+        separate_size += size;
+        free(lz77_cstream_get_buffer(cstream));
+        lz77_cstream_free(&cstream);
+        lz77_ustream_free(&ustream);
+    }
+
+    for (int c = 0; c < count; c++) {
+        char extrainfo[100];
+        sprintf(extrainfo, "Group size %lu", (unsigned long)group_sizes[c]);
+
+        int fd = open("/tmp/temp-solid.lz", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        int table_fd = open("/tmp/temp-solid.tab", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd < 0 || table_fd < 0) {
+            perror("Cannot create solid archive");
+            exit(-2);
+        }
+
+        // Add the entries in two sessions, with some garbage (as left by a
+        // crash) between them.
+        for (int session = 0; session < 2; session++) {
+            lz77_solid_writer *writer = lz77_solid_writer_open(fd, table_fd,
+                    WINDOW_SIZE, BUFFER_SIZE);
+            assert_true(writer != NULL, extrainfo);
+            assert_int_equal(0, lz77_solid_set_group_size(writer, group_sizes[c]), extrainfo);
+            int first = session * total / 2;
+            int last = session == 0 ? total / 2 : total;
+            for (int i = first; i < last; i++) {
+                assert_int_equal(i, lz77_solid_add(writer, original + offsets[i],
+                        offsets[i + 1] - offsets[i]), extrainfo);
+            }
+            assert_int_equal(0, lz77_solid_writer_close(&writer), extrainfo);
+            assert_true(write(fd, "garbage", 7) == 7, extrainfo);
+        }
+        int64_t solid_size = lseek(fd, 0, SEEK_CUR) - 7;
+        test_size_compressed += solid_size;
+        if (group_sizes[c] > 1) {
+            assert_true(solid_size < separate_size, extrainfo);
+        }
+
+        // The whole archive is an ordinary compressed stream.
+        assert_true(ftruncate(fd, solid_size) == 0, extrainfo);
+        assert_true(lseek(fd, 0, SEEK_SET) == 0, extrainfo);
+        lz77_cstream *compressed_stream = lz77_cstream_from_descriptor(fd);
+        lz77_ustream *decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+        assert_int_equal(offsets[total], do_decompress(compressed_stream, decompressed_stream),
+                extrainfo);
+        uint8_t *decompressed = lz77_ustream_get_buffer(decompressed_stream);
+        assert_int_equal(0, memcmp(original, decompressed, offsets[total]), extrainfo);
+        free(decompressed);
+        lz77_cstream_free(&compressed_stream);
+        lz77_ustream_free(&decompressed_stream);
+
+        // Read the entries sequentially, and then in random order.
+        lz77_solid_reader *reader = lz77_solid_reader_open(fd, table_fd);
+        assert_true(reader != NULL, extrainfo);
+        assert_int_equal(total, lz77_solid_count(reader), extrainfo);
+        for (int i = 0; i < 2 * total; i++) {
+            int entry = i < total ? i : rand() % total;
+            const uint8_t *data;
+            int64_t expected = offsets[entry + 1] - offsets[entry];
+            assert_int_equal(expected, lz77_solid_get(reader, entry, &data), extrainfo);
+            assert_int_equal(0, memcmp(original + offsets[entry], data, expected), extrainfo);
+        }
+        const uint8_t *data;
+        assert_true(lz77_solid_get(reader, total, &data) < 0, extrainfo);
+
+        lz77_solid_reader_free(&reader);
+        close(fd);
+        close(table_fd);
+
+        printf(" %d%%...\n", (c + 1) * 100 / count);
+    }
+
+    free(original);
+    free(offsets);
+
+    test_solid_failures();
+}
+
+void test_reset_allocations()
+{
+    const int messages = 300;
+    const int max_size = 8192;
+
+    printf("\nTesting allocations of reset streams (%d messages)...\n", messages);
+
+    uint8_t *original = malloc(messages * max_size);
+    uint8_t *compressed = malloc(2 * max_size + 1024);
+    uint8_t *decompressed = malloc(max_size);
+    if (original == NULL || compressed == NULL || decompressed == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", (messages + 3) * max_size + 1024);
+        printf("Aborting.");
+        exit(-2);
+    }
+    for (int i = 0; i < messages * max_size; i++) {
+        original[i] = get_words(i);
+    }
+
+    // Into a preallocated buffer, and into a buffer grown by the algorithm:
+    // the latter is large enough after the first (largest) message.
+    for (int c = 0; c < 2; c++) {
+        const char *extrainfo = c == 0 ? "Preallocated buffer" : "Reallocated buffer";
+
+        lz77_ustream *original_stream = lz77_ustream_from_memory(original, max_size,
+                WINDOW_SIZE, BUFFER_SIZE);
+        lz77_cstream *compressed_stream = c == 0
+                ? lz77_cstream_to_memory(original_stream, compressed, 2 * max_size + 1024, 0)
+                : lz77_cstream_to_memory(original_stream, NULL, 0, 1);
+        lz77_alloc_counters ucounters, ccounters, after;
+        assert_int_equal(0, lz77_ustream_get_alloc_counters(original_stream, &ucounters),
+                extrainfo);
+        assert_int_equal(0, lz77_cstream_get_alloc_counters(compressed_stream, &ccounters),
+                extrainfo);
+        assert_true(ucounters.allocations >= 3 && ucounters.bytes > 0, extrainfo);
+        assert_int_equal(1, ccounters.allocations, extrainfo);
+
+        for (int m = 0; m < messages; m++) {
+            int size = m == 0 ? max_size : rand() % max_size;
+            const uint8_t *message = original + m * max_size;
+            if (m > 0) {
+                assert_int_equal(0, lz77_ustream_reset(original_stream, message, size),
+                        extrainfo);
+                assert_int_equal(0, lz77_cstream_reset(compressed_stream, NULL, 0), extrainfo);
+            }
+            int compressed_size = do_compress(original_stream, compressed_stream);
+            assert_true(compressed_size > 0, extrainfo);
+
+            if (m == 0) {
+                // The first compression allocates the table of the lengths
+                // (and the output buffer, unless it is preallocated).
+                assert_int_equal(0, lz77_ustream_get_alloc_counters(original_stream,
+                        &ucounters), extrainfo);
+                assert_int_equal(0, lz77_cstream_get_alloc_counters(compressed_stream,
+                        &ccounters), extrainfo);
+            } else {
+                assert_int_equal(0, lz77_ustream_get_alloc_counters(original_stream, &after),
+                        extrainfo);
+                assert_int_equal(0, memcmp(&ucounters, &after, sizeof(after)), extrainfo);
+                assert_int_equal(0, lz77_cstream_get_alloc_counters(compressed_stream, &after),
+                        extrainfo);
+                assert_int_equal(0, memcmp(&ccounters, &after, sizeof(after)), extrainfo);
+            }
+
+            lz77_cstream *input = lz77_cstream_from_memory(
+                    lz77_cstream_get_buffer(compressed_stream), compressed_size);
+            lz77_ustream *output = lz77_ustream_to_memory(input, decompressed, max_size, 0);
+            assert_int_equal(size, do_decompress(input, output), extrainfo);
+            assert_int_equal(0, memcmp(message, decompressed, size), extrainfo);
+            lz77_cstream_free(&input);
+            lz77_ustream_free(&output);
+        }
+
+        // Streams which own their buffer cannot be reset.
+        lz77_ustream *output = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+        assert_true(lz77_ustream_reset(output, original, max_size) < 0, extrainfo);
+        lz77_ustream_free(&output);
+
+        if (c == 1) {
+            free(lz77_cstream_get_buffer(compressed_stream));
+        }
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+
+        printf(" %d%%...\n", (c + 1) * 100 / 2);
+    }
+
+    free(decompressed);
+    free(compressed);
+    free(original);
+}
+
+void test_reset_descriptors()
+{
+    const int messages = 50;
+    const int max_size = 8192;
+
+    printf("\nTesting streams reset to other descriptors (%d files)...\n", messages);
+
+    uint8_t *original = malloc(max_size);
+    uint8_t *decompressed = malloc(max_size);
+    if (original == NULL || decompressed == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", 2 * max_size);
+        printf("Aborting.");
+        exit(-2);
+    }
+
+    lz77_ustream *original_stream = NULL;
+    lz77_cstream *compressed_stream = NULL;
+    lz77_cstream *input = NULL;
+    lz77_ustream *output = NULL;
+    lz77_alloc_counters counters[4];
+    for (int m = 0; m < messages; m++) {
+        char extrainfo[100];
+        sprintf(extrainfo, "File %d", m);
+
+        // Each file is compressed and decompressed through new descriptors.
+        int size = m == 0 ? max_size : rand() % max_size;
+        for (int i = 0; i < size; i++) {
+            original[i] = get_words(i + m * max_size);
+        }
+        int fd_input = open("/tmp/temp-input.txt", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        int fd_compressed = open("/tmp/temp-compressed.txt",
+                O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        int fd_decompressed = open("/tmp/temp-decompressed.txt",
+                O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd_input < 0 || fd_compressed < 0 || fd_decompressed < 0) {
+            perror("Cannot create temporary files");
+            exit(-2);
+        }
+        assert_int_equal(size, write(fd_input, original, size), extrainfo);
+        assert_true(lseek(fd_input, 0, SEEK_SET) == 0, extrainfo);
+
+        if (m == 0) {
+            original_stream = lz77_ustream_from_descriptor(fd_input, WINDOW_SIZE, BUFFER_SIZE);
+            compressed_stream = lz77_cstream_to_descriptor(original_stream, fd_compressed);
+        } else {
+            assert_int_equal(0, lz77_ustream_reset_descriptor(original_stream, fd_input),
+                    extrainfo);
+            assert_int_equal(0, lz77_cstream_reset_descriptor(compressed_stream, fd_compressed),
+                    extrainfo);
+        }
+        int compressed_size = do_compress(original_stream, compressed_stream);
+        assert_true(compressed_size > 0, extrainfo);
+        assert_true(lseek(fd_compressed, 0, SEEK_SET) == 0, extrainfo);
+
+        if (m == 0) {
+            input = lz77_cstream_from_descriptor(fd_compressed);
+            output = lz77_ustream_to_descriptor(input, fd_decompressed);
+        } else {
+            assert_int_equal(0, lz77_cstream_reset_descriptor(input, fd_compressed), extrainfo);
+            assert_int_equal(0, lz77_ustream_reset_descriptor(output, fd_decompressed),
+                    extrainfo);
+        }
+        assert_int_equal(size, do_decompress(input, output), extrainfo);
+        assert_true(lseek(fd_decompressed, 0, SEEK_SET) == 0, extrainfo);
+        assert_int_equal(size, read(fd_decompressed, decompressed, max_size), extrainfo);
+        assert_int_equal(0, memcmp(original, decompressed, size), extrainfo);
+
+        // After the first file, the streams allocate nothing.
+        lz77_alloc_counters current[4];
+        lz77_ustream_get_alloc_counters(original_stream, &current[0]);
+        lz77_cstream_get_alloc_counters(compressed_stream, &current[1]);
+        lz77_cstream_get_alloc_counters(input, &current[2]);
+        lz77_ustream_get_alloc_counters(output, &current[3]);
+        if (m == 0) {
+            memcpy(counters, current, sizeof(counters));
+        } else {
+            assert_int_equal(0, memcmp(counters, current, sizeof(counters)), extrainfo);
+        }
+
+        close(fd_input);
+        close(fd_compressed);
+        close(fd_decompressed);
+    }
+
+    // Streams in memory cannot be reset to a descriptor.
+    lz77_ustream *memory_stream = lz77_ustream_from_memory(original, max_size,
+            WINDOW_SIZE, BUFFER_SIZE);
+    assert_true(lz77_ustream_reset_descriptor(memory_stream, 0) < 0, "Memory stream");
+    lz77_ustream_free(&memory_stream);
+
+    lz77_ustream_free(&original_stream);
+    lz77_cstream_free(&compressed_stream);
+    lz77_cstream_free(&input);
+    lz77_ustream_free(&output);
+    free(decompressed);
+    free(original);
+}
+
+void test_raw_blocks()
+{
+    const uint16_t window_sizes[] = { 64, 4096, 32768, 32768 };
+    const uint16_t lookahead_sizes[] = { 16, 255, 16, 4096 };
+    const int count = sizeof(window_sizes) / sizeof(window_sizes[0]);
+    const uint32_t sizes[] = { 0, 1, 2, 3, 100, 4096, 10000 };
+    const int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+    uint8_t (*const sources[])(int) = { get_words, get_zero, get_random };
+    const int nsources = sizeof(sources) / sizeof(sources[0]);
+    const uint32_t max_size = 10000;
+
+    printf("\nTesting raw blocks...\n");
+
+    uint8_t *original = malloc(max_size);
+    uint8_t *block = malloc(LZ77_RAW_BOUND(max_size));
+    uint8_t *decompressed = malloc(max_size + 1);
+    if (original == NULL || block == NULL || decompressed == NULL) {
+        printf("Cannot allocate %lu bytes of memory.\n",
+                (unsigned long)(2 * max_size + 1 + LZ77_RAW_BOUND(max_size)));
+        printf("Aborting.");
+        exit(-2);
+    }
+
+    for (int c = 0; c < count; c++) {
+        char extrainfo[100];
+        for (int s = 0; s < nsizes; s++) {
+            for (int g = 0; g < nsources; g++) {
+                uint32_t size = sizes[s];
+                sprintf(extrainfo, "Window %d, look-ahead %d, %lu bytes, source %d",
+                        window_sizes[c], lookahead_sizes[c], (unsigned long)size, g);
+                for (uint32_t i = 0; i < size; i++) {
+                    original[i] = sources[g](i);
+                }
+
+                int64_t block_size = lz77_raw_compress(original, size, block,
+                        LZ77_RAW_BOUND(size), window_sizes[c], lookahead_sizes[c]);
+                assert_true(block_size >= 0 && block_size <= LZ77_RAW_BOUND(size), extrainfo);
+                test_size_compressed += block_size;
+                test_size_decompressed += size;
+                // Matches are shorter when the codes of the longest lengths
+                // do not fit into 16 bits.
+                if (sources[g] == get_zero && size >= 100 && lookahead_sizes[c] <= 255) {
+                    assert_true(block_size < size / 4, extrainfo);
+                }
+
+                assert_int_equal(size, lz77_raw_decompress(block, block_size, decompressed,
+                        size, window_sizes[c], lookahead_sizes[c]), extrainfo);
+                assert_int_equal(0, memcmp(original, decompressed, size), extrainfo);
+
+                // A truncated block, or a wrong size of the original data, is
+                // rejected.
+                if (block_size > 0) {
+                    assert_true(lz77_raw_decompress(block, block_size - 1, decompressed,
+                            size, window_sizes[c], lookahead_sizes[c]) < 0, extrainfo);
+                }
+                assert_true(lz77_raw_decompress(block, block_size, decompressed,
+                        size + 1, window_sizes[c], lookahead_sizes[c]) < 0, extrainfo);
+            }
+
+            // Random data does not fit into a buffer smaller than the input.
+            if (sizes[s] > 0) {
+                for (uint32_t i = 0; i < sizes[s]; i++) {
+                    original[i] = get_random(i);
+                }
+                errno = 0;
+                assert_true(lz77_raw_compress(original, sizes[s], block, sizes[s] - 1,
+                        window_sizes[c], lookahead_sizes[c]) < 0, extrainfo);
+                assert_int_equal(ENOMEM, errno, extrainfo);
+            }
+        }
+
+        printf(" %d%%...\n", (c + 1) * 100 / count);
+    }
+
+    // The look-ahead buffer cannot be larger than the window.
+    assert_true(lz77_raw_compress(original, 10, block, 100, 64, 65) < 0, "Invalid sizes");
+
+    free(decompressed);
+    free(block);
+    free(original);
+}
+
+/*
+ * The compressed data sent to a socket in small segments.
+ */
+typedef struct {
+    int fd;
+    const uint8_t *data;
+    uint32_t size;
+    /** If non-zero, the connection is left open (as by a peer awaiting a reply). */
+    int keep_open;
+} socket_sender;
+
+void * send_segments(void *argument)
+{
+    socket_sender *sender = argument;
+    uint32_t sent = 0;
+    while (sent < sender->size) {
+        uint32_t count = 1 + rand() % 1500;
+        if (count > sender->size - sent) {
+            count = sender->size - sent;
+        }
+        ssize_t n = send(sender->fd, sender->data + sent, count, MSG_NOSIGNAL);
+        if (n <= 0) {
+            break;
+        }
+        sent += n;
+    }
+    if (!sender->keep_open) {
+        shutdown(sender->fd, SHUT_WR);
+    }
+    return NULL;
+}
+
+void test_socket_receive()
+{
+    const uint32_t original_size = 300 * 1024;
+    const uint32_t buffer_sizes[] = { 0, 4096, 64 * 1024, 64 * 1024, 100 };
+    const uint32_t low_waters[] = { 1, 1, 16 * 1024, 1, 100 };
+    const uint8_t wait_alls[] = { 0, 0, 0, 1, 1 };
+    const uint8_t multi_members[] = { 0, 1, 0, 1, 0 };
+    const int count = sizeof(buffer_sizes) / sizeof(buffer_sizes[0]);
+
+    printf("\nTesting decompression from a socket...\n");
+
+    uint8_t *original = malloc(original_size);
+    if (original == NULL) {
+        printf("Cannot allocate %lu bytes of memory.\n", (unsigned long)original_size);
+        printf("Aborting.");
+        exit(-2);
+    }
+    for (uint32_t i = 0; i < original_size; i++) {
+        original[i] = get_words(i);
+    }
+    lz77_ustream *original_stream = lz77_ustream_from_memory(original, original_size,
+            WINDOW_SIZE, BUFFER_SIZE);
+    lz77_cstream *compressed_stream = lz77_cstream_to_memory(original_stream, NULL, 0, 1);
+    int64_t compressed_size = lz77_compress(original_stream, compressed_stream);
+    assert_true(compressed_size > 0, "Compression");
+    uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream);
+    lz77_ustream_free(&original_stream);
+    lz77_cstream_free(&compressed_stream);
+
+    for (int c = 0; c < count; c++) {
+        char extrainfo[100];
+        sprintf(extrainfo, "Buffer of %lu bytes, low-water mark %lu, wait all %d, "
+                "multi-member %d", (unsigned long)buffer_sizes[c],
+                (unsigned long)low_waters[c], wait_alls[c], multi_members[c]);
+
+        test_size_compressed += compressed_size;
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+            perror("Cannot create sockets");
+            exit(-2);
+        }
+        socket_sender sender = { sv[1], compressed, compressed_size, 0 };
+        pthread_t thread;
+        assert_int_equal(0, pthread_create(&thread, NULL, send_segments, &sender), extrainfo);
+
+        compressed_stream = lz77_cstream_from_descriptor(sv[0]);
+        assert_int_equal(0, lz77_cstream_set_receive(compressed_stream, buffer_sizes[c],
+                low_waters[c], wait_alls[c], multi_members[c]), extrainfo);
+        lz77_ustream *decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+        assert_int_equal(original_size, do_decompress(compressed_stream, decompressed_stream),
+                extrainfo);
+        uint8_t *decompressed = lz77_ustream_get_buffer(decompressed_stream);
+        assert_int_equal(0, memcmp(original, decompressed, original_size), extrainfo);
+
+        // The stream can be tuned only before being used.
+        assert_true(lz77_cstream_set_receive(compressed_stream, 0, 1, 0, 0) < 0, extrainfo);
+
+        pthread_join(thread, NULL);
+        free(decompressed);
+        lz77_ustream_free(&decompressed_stream);
+        lz77_cstream_free(&compressed_stream);
+        close(sv[0]);
+        close(sv[1]);
+
+        printf(" %d%%...\n", (c + 1) * 100 / count);
+    }
+
+    // A peer awaiting a reply keeps the connection open after one or two
+    // members: only the first one is read by default, without waiting for
+    // more data, and both are read when asked to, until the peer shuts the
+    // connection down (the alarm ends a stalled test).
+    const int sent_members[] = { 1, 2, 2 };
+    const int keep_opens[] = { 1, 1, 0 };
+    uint8_t *members = malloc(compressed_size * 2);
+    if (members == NULL) {
+        printf("Cannot allocate %lu bytes of memory.\n", (unsigned long)compressed_size * 2);
+        printf("Aborting.");
+        exit(-2);
+    }
+    memcpy(members, compressed, compressed_size);
+    memcpy(members + compressed_size, compressed, compressed_size);
+    for (int c = 0; c < 3; c++) {
+        int multi_member = !keep_opens[c];
+        char extrainfo[100];
+        sprintf(extrainfo, "%d members, connection left open %d, multi-member %d",
+                sent_members[c], keep_opens[c], multi_member);
+
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+            perror("Cannot create sockets");
+            exit(-2);
+        }
+        socket_sender sender = { sv[1], members, compressed_size * sent_members[c], keep_opens[c] };
+        pthread_t thread;
+        assert_int_equal(0, pthread_create(&thread, NULL, send_segments, &sender), extrainfo);
+
+        compressed_stream = lz77_cstream_from_descriptor(sv[0]);
+        assert_int_equal(0, lz77_cstream_set_receive(compressed_stream, 0, 1, 0, multi_member),
+                extrainfo);
+        lz77_ustream *decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+        alarm(10);
+        assert_int_equal(original_size * (multi_member + 1),
+                do_decompress(compressed_stream, decompressed_stream), extrainfo);
+        alarm(0);
+        uint8_t *decompressed = lz77_ustream_get_buffer(decompressed_stream);
+        assert_int_equal(0, memcmp(original, decompressed, original_size), extrainfo);
+
+        // The sender may be blocked on the member left unread.
+        free(decompressed);
+        lz77_ustream_free(&decompressed_stream);
+        lz77_cstream_free(&compressed_stream);
+        close(sv[0]);
+        pthread_join(thread, NULL);
+        close(sv[1]);
+    }
+    free(members);
+
+    // Only sockets can be tuned, with a low-water mark within the buffer.
+    int fd = open("/tmp/temp-socket.lz", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    int sv[2];
+    if (fd < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        perror("Cannot create descriptors");
+        exit(-2);
+    }
+    compressed_stream = lz77_cstream_from_descriptor(fd);
+    errno = 0;
+    assert_true(lz77_cstream_set_receive(compressed_stream, 0, 1, 0, 0) < 0, "Not a socket");
+    assert_int_equal(EINVAL, errno, "Not a socket");
+    lz77_cstream_free(&compressed_stream);
+    compressed_stream = lz77_cstream_from_descriptor(sv[0]);
+    assert_true(lz77_cstream_set_receive(compressed_stream, 4096, 0, 0, 0) < 0, "Low-water mark");
+    assert_true(lz77_cstream_set_receive(compressed_stream, 4096, 4097, 0, 0) < 0, "Low-water mark");
+    lz77_cstream_free(&compressed_stream);
+    close(fd);
+    close(sv[0]);
+    close(sv[1]);
+    unlink("/tmp/temp-socket.lz");
+
+    free(compressed);
+    free(original);
+}
+
+/*
+ * An executor which runs each task in a new thread.
+ */
+typedef struct {
+    void (*task)(void *argument);
+    void *argument;
+} thread_task;
+
+void * run_thread_task(void *argument)
+{
+    thread_task task = *(thread_task *)argument;
+    free(argument);
+    task.task(task.argument);
+    return NULL;
+}
+
+int thread_submit(lz77_executor *executor, void (*task)(void *argument), void *argument)
+{
+    (void)(executor);
+    thread_task *t = malloc(sizeof(*t));
+    if (t == NULL) {
+        return -1;
+    }
+    t->task = task;
+    t->argument = argument;
+    pthread_t thread;
+    int error = pthread_create(&thread, NULL, run_thread_task, t);
+    if (error != 0) {
+        free(t);
+        errno = error;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void test_parallel_decompression()
+{
+    const int layout[] = { 300 * 1024, 256 * 1024, 468 * 1024 };
+    const int original_size = layout[0] + layout[1] + layout[2];
+    const uint16_t window_size = 4096, lookahead_size = 255;
+    const int count = 3;
+
+    printf("\nTesting parallel decompression (%d bytes)...\n", original_size);
+
+    lz77_executor executors[] = { { thread_submit, 3, NULL }, { deferred_submit, 2, NULL } };
+    uint8_t *original = malloc(original_size);
+    uint8_t *decompressed = malloc(original_size + 1);
+    if (original == NULL || decompressed == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", original_size * 2);
+        printf("Aborting.");
+        exit(-2);
+    }
+    lz77_dictionary *dictionary = NULL;
+
+    // A sparse file (compressed into several members), runs of equal bytes
+    // alternating with words (whose phrases depend on each other across the
+    // chunks), and words compressed with a dictionary.
+    for (int input = 0; input < count; input++) {
+        char extrainfo[100];
+        lz77_ustream *original_stream;
+        int fd_original = -1;
+        if (input == 0) {
+            fd_original = create_sparse_file("/tmp/temp-original.txt", layout, 3, original);
+            original_stream = lz77_ustream_from_descriptor(fd_original,
+                    window_size, lookahead_size);
+            assert_int_equal(0, lz77_ustream_set_sparse(original_stream, 1), "Sparse file");
+        } else {
+            for (int i = 0; i < original_size; i++) {
+                original[i] = input == 1 && (i / 3000) % 2 == 0 ? 'a' : get_words(i);
+            }
+            original_stream = lz77_ustream_from_memory(original, original_size,
+                    window_size, lookahead_size);
+        }
+        if (input == 2) {
+            dictionary = lz77_dictionary_create(original + original_size - window_size,
+                    window_size, window_size, lookahead_size);
+            assert_true(dictionary != NULL, "Cannot prepare the dictionary");
+            assert_int_equal(0, lz77_dictionary_use(original_stream, dictionary), "Dictionary");
+        }
+        lz77_cstream *compressed_stream = lz77_cstream_to_memory(original_stream, NULL, 0, 1);
+        int compressed_size = do_compress(original_stream, compressed_stream);
+        uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream);
+        assert_true(compressed_size > 0, "Compression");
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+        if (fd_original >= 0) {
+            close(fd_original);
+        }
+
+        // With threads, with tasks run only after the decompression, and in
+        // this thread; to memory and to a file.
+        for (int e = 0; e <= 2; e++) {
+            for (int to_memory = 0; to_memory <= 1; to_memory++) {
+                sprintf(extrainfo, "Input %d, executor %d, %s", input, e,
+                        to_memory ? "to memory" : "to a file");
+
+                compressed_stream = lz77_cstream_from_memory(compressed, compressed_size);
+                lz77_ustream *decompressed_stream;
+                int fd_decompressed = -1;
+                if (to_memory) {
+                    decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+                } else {
+                    fd_decompressed = open("/tmp/temp-decompressed.txt",
+                            O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+                    if (fd_decompressed < 0) {
+                        perror("Cannot create decompressed file");
+                        exit(-2);
+                    }
+                    decompressed_stream = lz77_ustream_to_descriptor(compressed_stream,
+                            fd_decompressed);
+                }
+                if (dictionary != NULL) {
+                    assert_int_equal(0, lz77_dictionary_use(decompressed_stream, dictionary),
+                            extrainfo);
+                }
+
+                lz77_alloc_counters before, after;
+                lz77_ustream_get_alloc_counters(decompressed_stream, &before);
+                test_size_compressed += compressed_size;
+                start = clock();
+                int64_t decompressed_size = lz77_decompress_parallel(
+                        e < 2 ? &executors[e] : NULL, compressed_stream, decompressed_stream);
+                test_time_decompression += clock() - start;
+                run_deferred_tasks();
+                lz77_ustream_get_alloc_counters(decompressed_stream, &after);
+                assert_int_equal(original_size, decompressed_size, extrainfo);
+                test_size_decompressed += decompressed_size;
+
+                // The job and the bitmap, after the buffer of the stream and
+                // the output (to a file); the arrays are only reallocated.
+                assert_int_equal(to_memory ? 2 : 4, after.allocations - before.allocations,
+                        extrainfo);
+
+                uint8_t *output = decompressed;
+                if (to_memory) {
+                    output = lz77_ustream_get_buffer(decompressed_stream);
+                } else {
+                    if (lseek(fd_decompressed, 0, SEEK_SET) != 0) {
+                        perror("Cannot read decompressed file");
+                        exit(-2);
+                    }
+                    assert_int_equal(original_size,
+                            read(fd_decompressed, decompressed, original_size + 1), extrainfo);
+                    close(fd_decompressed);
+                }
+                assert_int_equal(0, memcmp(original, output, original_size), extrainfo);
+
+                if (to_memory) {
+                    free(output);
+                }
+                lz77_ustream_free(&decompressed_stream);
+                lz77_cstream_free(&compressed_stream);
+            }
+        }
+
+        // Without its dictionary, the stream refers to data before the window.
+        if (dictionary != NULL) {
+            compressed_stream = lz77_cstream_from_memory(compressed, compressed_size);
+            lz77_ustream *decompressed_stream = lz77_ustream_to_memory(compressed_stream,
+                    NULL, 0, 1);
+            errno = 0;
+            assert_true(lz77_decompress_parallel(&executors[0], compressed_stream,
+                    decompressed_stream) < 0, "Missing dictionary");
+            assert_int_equal(EINVAL, errno, "Missing dictionary");
+            free(lz77_ustream_get_buffer(decompressed_stream));
+            lz77_ustream_free(&decompressed_stream);
+            lz77_cstream_free(&compressed_stream);
+            lz77_dictionary_free(&dictionary);
+        }
+
+        // A seek index cannot be written.
+        compressed_stream = lz77_cstream_from_memory(compressed, compressed_size);
+        lz77_ustream *decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+        assert_int_equal(0, lz77_seek_index_enable(decompressed_stream, 1, 1024), "Seek index");
+        errno = 0;
+        assert_true(lz77_decompress_parallel(NULL, compressed_stream, decompressed_stream) < 0,
+                "Seek index");
+        assert_int_equal(EINVAL, errno, "Seek index");
+        lz77_ustream_free(&decompressed_stream);
+        lz77_cstream_free(&compressed_stream);
+
+        free(compressed);
+        printf(" %d%%...\n", (input + 1) * 100 / count);
+    }
+
+    unlink("/tmp/temp-original.txt");
+    unlink("/tmp/temp-decompressed.txt");
+    free(original);
+    free(decompressed);
+}
+
+/*
+ * The state of a thread reading the values of a store.
+ */
+typedef struct {
+    lz77_store *store;
+    const uint8_t *original;
+    const uint32_t *offsets;
+    int total;
+    int failures;
+} store_reader;
+
+void * read_store(void *argument)
+{
+    store_reader *reader = argument;
+    uint8_t buffer[4096];
+    for (int i = 0; i < 4 * reader->total; i++) {
+        int key = (i * 7) % reader->total;
+        int64_t expected = reader->offsets[key + 1] - reader->offsets[key];
+        if (lz77_store_get(reader->store, key, buffer, sizeof(buffer)) != expected
+                || memcmp(reader->original + reader->offsets[key], buffer, expected) != 0) {
+            reader->failures++;
+        }
+    }
+    return NULL;
+}
+
+void test_store()
+{
+    const int total = 300;
+    const int nthreads = 4;
+    const uint16_t window_size = 4096, lookahead_size = 255;
+
+    printf("\nTesting compressed stores (%d values)...\n", total);
+
+    // Small values, similar to each other, of up to 4 KB (some empty), and
+    // a dictionary made of the same kind of content.
+    uint32_t *offsets = malloc((total + 1) * sizeof(*offsets));
+    if (offsets == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", (int)((total + 1) * sizeof(*offsets)));
+        printf("Aborting.");
+        exit(-2);
+    }
+    offsets[0] = 0;
+    for (int i = 0; i < total; i++) {
+        offsets[i + 1] = offsets[i] + (i % 50 == 7 ? 0 : rand() % 4096);
+    }
+    uint32_t size = offsets[total] + window_size;
+    uint8_t *original = malloc(size);
+    if (original == NULL) {
+        printf("Cannot allocate %lu bytes of memory.\n", (unsigned long)size);
+        printf("Aborting.");
+        exit(-2);
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        original[i] = get_words(i);
+    }
+    lz77_dictionary *dictionary = lz77_dictionary_create(original + offsets[total],
+            window_size, window_size, lookahead_size);
+    assert_true(dictionary != NULL, "Cannot prepare the dictionary");
+
+    uint64_t stored_sizes[2];
+    for (int d = 0; d < 2; d++) {
+        char extrainfo[100];
+        sprintf(extrainfo, "%s dictionary", d == 0 ? "Without" : "With");
+
+        lz77_store *store = lz77_store_create(window_size, lookahead_size,
+                d == 0 ? NULL : dictionary, 2 * 1024 * 1024);
+        assert_true(store != NULL, extrainfo);
+        for (int i = 0; i < total; i++) {
+            assert_int_equal(i, lz77_store_put(store, original + offsets[i],
+                    offsets[i + 1] - offsets[i]), extrainfo);
+        }
+        // Random data is stored as it is.
+        uint8_t noise[1000];
+        for (uint32_t i = 0; i < sizeof(noise); i++) {
+            noise[i] = get_random(i);
+        }
+        assert_int_equal(total, lz77_store_put(store, noise, sizeof(noise)), extrainfo);
+
+        uint64_t original_size, stored_size, hits, misses;
+        lz77_store_get_stats(store, &original_size, &stored_size, &hits, &misses);
+        assert_int_equal(offsets[total] + sizeof(noise), original_size, extrainfo);
+        assert_true(stored_size < original_size / 2, extrainfo);
+        assert_int_equal(0, hits + misses, extrainfo);
+        stored_sizes[d] = stored_size;
+        test_size_compressed += stored_size;
+        test_size_decompressed += original_size;
+
+        // Read every value, and then the same ones from several threads at
+        // the same time (mostly from the cache).
+        uint8_t buffer[4096];
+        for (int i = 0; i < total; i++) {
+            int64_t expected = offsets[i + 1] - offsets[i];
+            assert_int_equal(expected, lz77_store_size(store, i), extrainfo);
+            assert_int_equal(expected, lz77_store_get(store, i, buffer, sizeof(buffer)), extrainfo);
+            assert_int_equal(0, memcmp(original + offsets[i], buffer, expected), extrainfo);
+        }
+        assert_int_equal(sizeof(noise), lz77_store_get(store, total, buffer, sizeof(buffer)),
+                extrainfo);
+        assert_int_equal(0, memcmp(noise, buffer, sizeof(noise)), extrainfo);
+
+        store_reader readers[nthreads];
+        pthread_t threads[nthreads];
+        for (int t = 0; t < nthreads; t++) {
+            readers[t].store = store;
+            readers[t].original = original;
+            readers[t].offsets = offsets;
+            readers[t].total = total;
+            readers[t].failures = 0;
+            assert_int_equal(0, pthread_create(&threads[t], NULL, read_store, &readers[t]),
+                    extrainfo);
+        }
+        for (int t = 0; t < nthreads; t++) {
+            pthread_join(threads[t], NULL);
+            assert_int_equal(0, readers[t].failures, extrainfo);
+        }
+        lz77_store_get_stats(store, NULL, NULL, &hits, &misses);
+        assert_int_equal(total + 1 + nthreads * 4 * total, hits + misses, extrainfo);
+        assert_true(hits > misses, extrainfo);
+
+        // Missing values and small buffers are rejected.
+        errno = 0;
+        assert_true(lz77_store_get(store, total + 1, buffer, sizeof(buffer)) < 0, extrainfo);
+        assert_int_equal(EINVAL, errno, extrainfo);
+        assert_true(lz77_store_size(store, total + 1) < 0, extrainfo);
+        errno = 0;
+        assert_true(lz77_store_get(store, total, buffer, sizeof(noise) - 1) < 0, extrainfo);
+        assert_int_equal(ENOMEM, errno, extrainfo);
+
+        lz77_store_free(&store);
+        assert_true(store == NULL, extrainfo);
+
+        printf(" %d%%...\n", (d + 1) * 100 / 2);
+    }
+    // Small values are compressed better with the dictionary.
+    assert_true(stored_sizes[1] < stored_sizes[0], "Dictionary");
+
+    // A small cache keeps evicting values, which are still read correctly.
+    lz77_store *store = lz77_store_create(window_size, lookahead_size, NULL, 16 * 4096);
+    assert_true(store != NULL, "Small cache");
+    for (int i = 0; i < total; i++) {
+        assert_int_equal(i, lz77_store_put(store, original + offsets[i],
+                offsets[i + 1] - offsets[i]), "Small cache");
+    }
+    for (int i = 0; i < 3 * total; i++) {
+        int key = rand() % total;
+        int64_t expected = offsets[key + 1] - offsets[key];
+        uint8_t buffer[4096];
+        assert_int_equal(expected, lz77_store_get(store, key, buffer, sizeof(buffer)),
+                "Small cache");
+        assert_int_equal(0, memcmp(original + offsets[key], buffer, expected), "Small cache");
+    }
+    lz77_store_free(&store);
+
+    // The look-ahead buffer cannot be larger than the window without a
+    // dictionary.
+    assert_true(lz77_store_create(64, 65, NULL, 0) == NULL, "Invalid sizes");
+
+    lz77_dictionary_free(&dictionary);
+    free(original);
+    free(offsets);
+}
+
+void test_prices()
+{
+    const uint16_t window_sizes[] = { 256, 4096, LZ77_MAX_WINDOW_SIZE };
+    const uint16_t lookahead_sizes[] = { 8, 255, 1024 };
+    const int count = sizeof(window_sizes) / sizeof(window_sizes[0]);
+
+    printf("\nTesting the prices of the tokens...\n");
+
+    // A phrase pays only if it is encodable and strictly cheaper than its
+    // symbols (of 9 bits each).
+    uint8_t lengths[] = { 0, 4, 5, 14, 20 };
+    lz77_prices prices = { 9, 14, 4, lengths };
+    assert_int_equal(0, prices_phrase_pays(&prices, 0), "Terminating token");
+    assert_int_equal(0, prices_phrase_pays(&prices, 1), "Phrase of 18 bits for 9");
+    assert_int_equal(0, prices_phrase_pays(&prices, 2), "Phrase of 19 bits for 18");
+    assert_int_equal(0, prices_phrase_pays(&prices, 3), "Phrase of 28 bits for 27");
+    assert_true(prices_phrase_pays(&prices, 4), "Phrase of 34 bits for 36");
+    lengths[2] = 4;
+    lengths[3] = 13;
+    assert_int_equal(0, prices_phrase_pays(&prices, 2), "Phrase of 18 bits for 18");
+    assert_int_equal(0, prices_phrase_pays(&prices, 3), "Phrase of 27 bits for 27");
+    lengths[3] = 12;
+    assert_true(prices_phrase_pays(&prices, 3), "Phrase of 26 bits for 27");
+
+    // The tables of the streams, against the codes of the encoder.
+    for (int c = 0; c < count; c++) {
+        char extrainfo[100];
+        uint16_t window_size = window_sizes[c], lookahead_size = lookahead_sizes[c];
+        lz77_tinyhuff encoder;
+        uint8_t winoff_bits = ustream_init_length_encoder(&encoder, window_size, lookahead_size);
+        lz77_tinyhuff_code *codes = malloc((lookahead_size + 1) * sizeof(*codes));
+        if (codes == NULL) {
+            printf("Cannot allocate the codes.\n");
+            printf("Aborting.");
+            exit(-2);
+        }
+        tinyhuff_build_table(&encoder, codes);
+        lz77_alloc_counters counters = { 0, 0, 0 };
+        assert_int_equal(0, prices_init(&prices, codes, lookahead_size, winoff_bits, &counters),
+                "Prices");
+
+        int accepted = 0;
+        for (uint32_t length = 0; length <= lookahead_size; length++) {
+            sprintf(extrainfo, "Window of %d bytes, look-ahead of %d, length %lu",
+                    window_size, lookahead_size, (unsigned long)length);
+            int pays = 0;
+            if (length >= encoder.min_value) {
+                uint16_t code;
+                uint32_t bits = LZ77_TYPE_BITS + winoff_bits
+                        + tinyhuff_encode(&encoder, length, &code);
+                pays = bits < length * LZ77_SYMBOL_BITS;
+            }
+            assert_int_equal(pays, prices_phrase_pays(&prices, length) != 0, extrainfo);
+            accepted += pays;
+        }
+        sprintf(extrainfo, "Window of %d bytes, look-ahead of %d", window_size, lookahead_size);
+        assert_true(accepted > 0, extrainfo);
+        assert_int_equal(0, prices_phrase_pays(&prices, encoder.min_value - 1), extrainfo);
+
+        prices_free(&prices);
+        free(codes);
+        printf(" %d%%...\n", (c + 1) * 100 / count);
+    }
+}
+
+const lz77_dictionary *test_dictionary_object;
+
+void test_dictionary_i(const int original_size)
+{
+    uint8_t *original = malloc(original_size);
+    if (original == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", original_size);
+        printf("Aborting.");
+        exit(-2);
+    }
+
+    for (int i = 0; i < original_size; i++) {
+        original[i] = get_words(i);
+    }
+
+    char extrainfo[100];
+    sprintf(extrainfo, "Original size is %d bytes", original_size);
+
+    // Compress, from memory or from a file.
+    int fd_original = -1;
+    lz77_ustream * original_stream;
+    if (original_size % 2 == 0) {
+        original_stream = lz77_ustream_from_memory(original, original_size,
+                WINDOW_SIZE, BUFFER_SIZE);
+    } else {
+        fd_original = open("/tmp/temp-original.txt",
+                0 | O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd_original < 0
+                || write(fd_original, original, original_size) != original_size
+                || lseek(fd_original, 0, SEEK_SET) != 0) {
+            perror("Cannot create original file");
+            exit(-2);
+        }
+        original_stream = lz77_ustream_from_descriptor(fd_original, WINDOW_SIZE, BUFFER_SIZE);
+    }
+    assert_int_equal(0, lz77_dictionary_use(original_stream, test_dictionary_object), extrainfo);
+
+    lz77_cstream * compressed_stream = lz77_cstream_to_memory(
+            original_stream,
+            NULL,
+            0,
+            1); // can_realloc = true
+
+    int compressed_size = do_compress(original_stream, compressed_stream);
+    uint8_t *compressed = lz77_cstream_get_buffer(compressed_stream);
+    assert_true(compressed_size > 0, extrainfo);
+
+    lz77_ustream_free(&original_stream);
+    lz77_cstream_free(&compressed_stream);
+    if (fd_original >= 0) {
+        close(fd_original);
+    }
+
+    // Decompress, to memory or to a file.
+    compressed_stream = lz77_cstream_from_memory(compressed, compressed_size);
+
+    int fd_decompressed = -1;
+    lz77_ustream * decompressed_stream;
+    if (original_size % 3 == 0) {
+        decompressed_stream = lz77_ustream_to_memory(compressed_stream, NULL, 0, 1);
+    } else {
+        fd_decompressed = open("/tmp/temp-decompressed.txt",
+                0 | O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd_decompressed < 0) {
+            perror("Cannot create decompressed file");
+            exit(-2);
+        }
+        decompressed_stream = lz77_ustream_to_descriptor(compressed_stream, fd_decompressed);
+    }
+    assert_int_equal(0, lz77_dictionary_use(decompressed_stream, test_dictionary_object), extrainfo);
+
+    int decompressed_size = do_decompress(compressed_stream, decompressed_stream);
+    assert_int_equal(original_size, decompressed_size, extrainfo);
+
+    uint8_t *decompressed;
+    if (fd_decompressed < 0) {
+        decompressed = lz77_ustream_get_buffer(decompressed_stream);
+    } else {
+        decompressed = malloc(original_size + 1);
+        if (decompressed == NULL || lseek(fd_decompressed, 0, SEEK_SET) != 0) {
+            perror("Cannot read decompressed file");
+            exit(-2);
+        }
+        assert_int_equal(original_size, read(fd_decompressed, decompressed, original_size + 1),
+                extrainfo);
+        close(fd_decompressed);
+    }
+    assert_int_equal(0, memcmp(original, decompressed, original_size), extrainfo);
+
+    lz77_cstream_free(&compressed_stream);
+    lz77_ustream_free(&decompressed_stream);
+
+    free(original);
+    free(compressed);
+    free(decompressed);
+}
+
+void test_dictionary()
+{
+    const int max_original_size = WINDOW_SIZE * 4;
+
+    printf("\nTesting compression with a dictionary (up to %d bytes)...\n", max_original_size);
+
+    // Prepare a dictionary, save it and use its image.
+    uint8_t *content = malloc(WINDOW_SIZE * 2);
+    if (content == NULL) {
+        printf("Cannot allocate %d bytes of memory.\n", WINDOW_SIZE * 2);
+        printf("Aborting.");
+        exit(-2);
+    }
+    for (int i = 0; i < WINDOW_SIZE * 2; i++) {
+        content[i] = get_words(i);
+    }
+    lz77_dictionary *prepared = lz77_dictionary_create(content, WINDOW_SIZE * 2,
+            WINDOW_SIZE, BUFFER_SIZE);
+    assert_true(prepared != NULL, "Cannot prepare the dictionary");
+    free(content);
+
+    int fd = open("/tmp/temp-dictionary.bin", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror("Cannot create dictionary file");
+        exit(-2);
+    }
+    assert_int_equal(0, lz77_dictionary_save(prepared, fd), "Cannot save the dictionary");
+    lz77_dictionary_free(&prepared);
+    struct stat st;
+    fstat(fd, &st);
+    uint8_t *image = malloc(st.st_size);
+    if (image == NULL || lseek(fd, 0, SEEK_SET) != 0 || read(fd, image, st.st_size) != st.st_size) {
+        perror("Cannot read dictionary file");
+        exit(-2);
+    }
+    close(fd);
+    unlink("/tmp/temp-dictionary.bin");
+
+    // A corrupted image is refused.
+    image[st.st_size / 2] ^= 1;
+    assert_true(lz77_dictionary_from_memory(image, st.st_size) == NULL, "Corrupted dictionary");
+    assert_int_equal(EINVAL, errno, "Corrupted dictionary");
+    image[st.st_size / 2] ^= 1;
+
+    lz77_dictionary *loaded = lz77_dictionary_from_memory(image, st.st_size);
+    assert_true(loaded != NULL, "Cannot load the dictionary");
+    test_dictionary_object = loaded;
+
+    int percent = -1;
+    for (int i = 0; i <= max_original_size; i += 7) {
+        test_dictionary_i(i);
+
+        int p = i * 100 / max_original_size;
+        if (p % 10 == 0 && p > percent) {
+            percent = p;
+            printf(" %d%%...\n", percent);
+        }
+    }
+
+    lz77_dictionary_free(&loaded);
+    free(image);
+}
+
+void test_ustream_fill_buffer()
+{
+    const int half_count = BUFFER_SIZE + 1;
+    // This 10 is the factor used by ustream to allocate the internal buffer.
+    const int min_original_size = WINDOW_SIZE * 10 - half_count;
+
+    printf("\nTest filling ustream's buffer (from %d to %d bytes of data)...\n",
+            min_original_size, min_original_size + 2 * half_count);
+
+    int percent = -1;
+    for (int i = 0; i <= 2 * half_count; i++) {
+        test_decompress_to_file_i(min_original_size + i);
+
+        int p = i * 100 / (2 * half_count);
+        if (p % 10 == 0 && p > percent) {
+            percent = p;
+            printf(" %d%%...\n", percent);
+        }
+    }
+}
+
+void test_variable_lookahead()
+{
+    const int max_original_size = TEST_MAX_INPUT_SIZE;
+
+    printf("\nTesting with look-ahead of size %d bytes (up to %d bytes of data)...\n",
+            BUFFER_SIZE, max_original_size);
+
+    int percent = -1;
+    for (int i = 0; i <= max_original_size; i++) {
+        triangle = 0;
+        test_variable_length_i(i, get_triangle);
+
+        int p = i * 100 / max_original_size;
+        if (p % 10 == 0 && p > percent) {
+            percent = p;
+            printf(" %d%%...\n", percent);
+        }
+    }
+}
+
+/*
+ * Prints the speed of the operations of a test, followed by the hardware
+ * events per byte, if any were counted.
+ */
+void print_speed(const char *label, unsigned long size, unsigned long time,
+                 const uint64_t values[COUNTERS])
+{
+    if (time == 0) {
+        return;
+    }
+    printf("%-40s%.2lf", label, size / (time / (double)CLOCKS_PER_SEC) / 1e6);
+    double events[COUNTERS];
+    counters_per_byte(values, size, events);
+    const char *separator = "  (per byte:";
+    for (int i = 0; i < COUNTERS; i++) {
+        if (events[i] >= 0) {
+            printf("%s %.2lf %s", separator, events[i], counters_name(i));
+            separator = ",";
+        }
+    }
+    printf("%s\n", separator[0] == ',' ? ")" : "");
+}
+
+void run_test(void (*test)(void))
+{
+    test_size_compressed = test_size_decompressed = test_size_original = 0;
+    test_time_compression = test_time_decompression = 0;
+    memset(test_events_compression, 0, sizeof(test_events_compression));
+    memset(test_events_decompression, 0, sizeof(test_events_decompression));
+
+    test();
+
+    printf("Compression ratio (greater is better):  %.3lf\n",
+            test_size_decompressed / (double)test_size_compressed);
+    printf("Seconds taken by compression:           %.3lf\n",
+            test_time_compression / (double)CLOCKS_PER_SEC);
+    printf("Seconds taken by decompression:         %.3lf\n",
+            test_time_decompression / (double)CLOCKS_PER_SEC);
+    print_speed("MB/s of compression:", test_size_original, test_time_compression,
+            test_events_compression);
+    print_speed("MB/s of decompression:", test_size_decompressed, test_time_decompression,
+            test_events_decompression);
+
+    total_time_compression += test_time_compression;
+    total_time_decompression += test_time_decompression;
+    total_size_compressed += test_size_compressed;
+    total_size_decompressed += test_size_decompressed;
+}
+
+void test_explicit_i(const char *input, int window_size, int buffer_size)
+{
+    int WINDOW_SIZE_saved = WINDOW_SIZE;
+    int BUFFER_SIZE_saved = BUFFER_SIZE;
+    WINDOW_SIZE = window_size;
+    BUFFER_SIZE = buffer_size;
+
+    printf(" %s (window: %d, lookahead: %d)\n", input, window_size, buffer_size);
+    test_variable_length_i(strlen(get_char_input = input), get_char);
+
+    WINDOW_SIZE = WINDOW_SIZE_saved;
+    BUFFER_SIZE = BUFFER_SIZE_saved;
+}
+
+void test_explicit()
+{
+    printf("\nTesting with with explicit inputs...\n");
+
+    test_explicit_i("BBAAABBC", 4, 2);
+    test_explicit_i("BAAABBCA", 4, 2);
+    test_explicit_i("AAABBCAB", 4, 2);
+    test_explicit_i("YAZABCDEFGHI", 8, 4);
+}
+
+int main()
+{
+    counters_open(&test_counters);
+
+    run_test(test_variable_length_zero);
+
+    run_test(test_variable_length_value);
+
+    run_test(test_variable_length_random);
+
+    run_test(test_static_alloc);
+
+    run_test(test_static_alloc_compression);
+
+    run_test(test_compress_from_file);
+
+    run_test(test_decompress_to_file);
+
+    run_test(test_compress_to_file);
+
+    run_test(test_decompress_from_file);
+
+    run_test(test_ustream_fill_buffer);
+
+    run_test(test_checkpoint_resume);
+
+    run_test(test_multiple_members);
+
+    run_test(test_large_memory_input);
+
+    run_test(test_hints);
+
+    run_test(test_adversarial);
+
+    run_test(test_async);
+
+    run_test(test_acceleration);
+
+    run_test(test_dictionary);
+
+    run_test(test_sparse);
+
+    run_test(test_journal);
+
+    run_test(test_cache);
+
+    run_test(test_target_throughput);
+
+    run_test(test_seek_index);
+
+    run_test(test_solid);
+
+    run_test(test_reset_allocations);
+
+    run_test(test_reset_descriptors);
+
+    run_test(test_raw_blocks);
+
+    run_test(test_store);
+
+    run_test(test_socket_receive);
+
+    run_test(test_parallel_decompression);
+
+    run_test(test_prices);
 
     int BUFFER_SIZE_saved = BUFFER_SIZE;
     int WINDOW_SIZE_saved = WINDOW_SIZE;
@@ -813,6 +3425,7 @@ int main()
     printf("Total seconds taken by decompression: %.3lf\n",
             total_time_decompression / (double)CLOCKS_PER_SEC);
 
+    counters_close(&test_counters);
     return 0;
 }
 
@@ -0,0 +1,65 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file alloc.h
+ *
+ * Counters of the memory allocations made on behalf of a stream.
+ *
+ * Every stream counts the allocations of its own structures and buffers,
+ * including those made while it is used by #lz77_compress or
+ * #lz77_decompress (e.g., when an output buffer grows). Reading the counters
+ * before and after an operation tells what the operation allocated: a stream
+ * reused with #lz77_ustream_reset and #lz77_cstream_reset makes no
+ * allocations at all once its buffers are large enough, which is what a
+ * server compressing many small messages needs.
+ */
+
+#ifndef _LZ77_ALLOC_H_
+#define _LZ77_ALLOC_H_
+
+#include <stdint.h>
+
+#include <lz77ppm/cstream.h>
+#include <lz77ppm/ustream.h>
+
+/**
+ * The memory allocations made on behalf of a stream.
+ */
+typedef struct {
+    /** The number of blocks allocated (by @c malloc or @c calloc). */
+    uint64_t allocations;
+    /** The number of blocks resized (by @c realloc). */
+    uint64_t reallocations;
+    /** The total number of bytes requested by both. */
+    uint64_t bytes;
+} lz77_alloc_counters;
+
+/**
+ * Gets the allocations made on behalf of an @c lz77_ustream since it was
+ * created.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_ustream_get_alloc_counters(const lz77_ustream *ustream, lz77_alloc_counters *counters);
+
+/**
+ * Gets the allocations made on behalf of an @c lz77_cstream since it was
+ * created.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_cstream_get_alloc_counters(const lz77_cstream *cstream, lz77_alloc_counters *counters);
+
+#endif
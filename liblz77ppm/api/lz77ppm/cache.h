@@ -0,0 +1,99 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file cache.h
+ *
+ * A cache of compressed data, for applications which compress the same
+ * inputs over and over (e.g., configuration blobs or cached responses sent by
+ * a server).
+ *
+ * The results of the compressions are kept in memory, identified by a 128-bit
+ * hash of the input and of the compression parameters, so compressing an
+ * input already in the cache costs just the computation of its hash (several
+ * GB/s). When the results exceed the memory budget of the cache, the least
+ * recently used ones are evicted.
+ *
+ * The inputs themselves are not kept, so two inputs with the same hash would
+ * get the same result. The hash is seeded randomly for each cache, and the
+ * probability of such a collision is negligible (about 2^-64 after 2^32
+ * distinct inputs), but the hash is not cryptographic: do not use the cache
+ * if inputs are chosen by an attacker who can observe its behaviour.
+ *
+ * A cache is not thread-safe: an application sharing it among threads must
+ * serialize the calls (and the use of the returned data) with a lock.
+ */
+
+#ifndef _LZ77_CACHE_H_
+#define _LZ77_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A cache of compressed data.
+ */
+typedef struct _lz77_cache lz77_cache;
+
+/**
+ * Creates an empty cache.
+ *
+ * @param budget The maximum amount of memory (in bytes) used by the cached
+ *        results, including the bookkeeping of each of them.
+ *
+ * @return A pointer to the newly created cache, or @c NULL in case of error.
+ *         See @c errno for further information.
+ */
+lz77_cache * lz77_cache_create(size_t budget);
+
+/**
+ * Compresses a memory buffer, like #lz77_compress, unless the same data has
+ * already been compressed with the same parameters.
+ *
+ * @param cache The cache.
+ * @param data The data to be compressed.
+ * @param size The size of @c data.
+ * @param window_size The size of the window.
+ * @param lookahead_size The size of the look-ahead buffer.
+ * @param compressed Must point to a pointer that will be set to the
+ *        compressed data. It is owned by the cache, and it is valid until the
+ *        next call on the cache.
+ *
+ * @return The size of the compressed data, or a negative value if an error
+ *         occurred. See @c errno for further information. If an invalid
+ *         argument is provided, @c errno is set to @c EINVAL and an
+ *         explanatory string is written to the @link lz77_log logger@endlink.
+ */
+int64_t lz77_cache_compress(lz77_cache *cache,
+                            const uint8_t *data,
+                            uint32_t size,
+                            uint16_t window_size,
+                            uint16_t lookahead_size,
+                            const uint8_t **compressed);
+
+/**
+ * Gets the statistics of a cache.
+ *
+ * @param cache The cache.
+ * @param hits If not @c NULL, it will be set to the number of compressions
+ *        whose result was found in the cache.
+ * @param misses If not @c NULL, it will be set to the number of compressions
+ *        actually performed.
+ * @param used If not @c NULL, it will be set to the amount of memory used by
+ *        the cached results.
+ */
+void lz77_cache_get_stats(const lz77_cache *cache, uint64_t *hits, uint64_t *misses, size_t *used);
+
+/**
+ * Frees a cache with all its results, and sets its pointer to @c NULL.
+ *
+ * @param pcache A pointer to the cache to be freed.
+ */
+void lz77_cache_free(lz77_cache **pcache);
+
+#endif
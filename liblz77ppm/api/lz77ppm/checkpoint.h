@@ -0,0 +1,88 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file checkpoint.h
+ *
+ * Periodic checkpoints of a long compression, which allow resuming it after
+ * an interruption.
+ *
+ * A checkpoint is taken between two tokens and records the position reached
+ * in the input and in the output, the bits of the last (incomplete) output
+ * byte, the content of the sliding window and the binary search tree built
+ * on it. Since the whole state of the compressor is saved, a resumed
+ * compression produces exactly the same output as an uninterrupted one.
+ *
+ * The checkpoint file contains two slots, which are overwritten alternately,
+ * each one protected by a checksum: if the process dies while writing a
+ * checkpoint, the previous one is still available.
+ */
+
+#ifndef _LZ77_CHECKPOINT_H_
+#define _LZ77_CHECKPOINT_H_
+
+#include <stdint.h>
+
+#include <lz77ppm/cstream.h>
+#include <lz77ppm/ustream.h>
+
+/**
+ * Enables periodic checkpoints for a compression.
+ *
+ * Call this function before #lz77_compress. Both streams must be backed by
+ * descriptors: the input stream must be readable again from the offset of a
+ * checkpoint (i.e., it must be seekable) and the output stream must refer to
+ * a regular file.
+ *
+ * @param original The input stream of the compression.
+ * @param checkpoint_fd The descriptor of the file to which checkpoints are
+ *        written. It must be opened for reading and writing.
+ * @param interval The number of input bytes to be processed between two
+ *        checkpoints.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ *
+ * Before a checkpoint is written, the output produced so far is flushed and
+ * synchronized to the disk, so that the checkpoint never refers to data
+ * which could be lost.
+ */
+int lz77_checkpoint_enable(lz77_ustream *original, int checkpoint_fd, uint64_t interval);
+
+/**
+ * Prepares a pair of streams to resume an interrupted compression from the
+ * most recent valid checkpoint.
+ *
+ * Call this function before #lz77_compress, which will then continue from
+ * the checkpoint instead of starting from the beginning of the input. The
+ * streams must be created as for the interrupted compression (with the same
+ * window and look-ahead sizes), except that the output file must be opened
+ * without truncating it. The input is positioned at the offset of the
+ * checkpoint, while the output file is truncated to the size it had when
+ * the checkpoint was taken.
+ *
+ * @param original The input stream of the compression.
+ * @param compressed The output stream of the compression.
+ * @param checkpoint_fd The descriptor of the checkpoint file.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If no valid checkpoint is found,
+ *         @c errno is set to @c ENOENT. If an invalid argument is provided,
+ *         or if the size or the modification time of the input file differ
+ *         from those recorded in the checkpoint, @c errno is set to
+ *         @c EINVAL. In all cases, an explanatory string is written to the
+ *         @link lz77_log logger@endlink.
+ *
+ * To keep taking checkpoints while resuming, call #lz77_checkpoint_enable
+ * with the same checkpoint file as well.
+ */
+int lz77_checkpoint_resume(lz77_ustream *original, lz77_cstream *compressed, int checkpoint_fd);
+
+#endif
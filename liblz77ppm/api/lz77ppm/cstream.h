@@ -53,6 +53,50 @@ lz77_cstream * lz77_cstream_from_memory(const uint8_t *data, uint32_t size);
  */
 lz77_cstream * lz77_cstream_from_descriptor(int fd);
 
+/**
+ * Tunes how an input @c lz77_cstream backed by a socket receives its data.
+ *
+ * A stream reading from a socket uses a buffer of 256 KiB by default, and
+ * refills it only when it is almost empty: each refill waits for the
+ * low-water mark (counting the bytes still buffered), and then takes, without
+ * waiting, everything else already received by the system, so that the
+ * decompression gets large batches even if the data arrives in small
+ * segments. By default the low-water mark is 1 byte, and nothing is read past
+ * the end of the first member: the decompression returns as soon as the
+ * terminating token has been received, even if the peer keeps the connection
+ * open (e.g., to wait for a reply).
+ *
+ * A higher low-water mark (or @c wait_all) saves system calls and wake-ups on
+ * bulk transfers, but a refill then waits until the peer sends more data or
+ * shuts the connection down: do not use it when the peer waits for a reply
+ * after the end of the compressed stream. The same holds for @c multi_member,
+ * since the stream waits for the beginning of another member (or the end of
+ * the connection) after each one.
+ *
+ * Call this function before the stream is used.
+ *
+ * @param cstream A stream created with #lz77_cstream_from_descriptor on a
+ *        socket.
+ * @param buffer_size The size of the buffer, or zero to keep the current one.
+ * @param low_water The number of bytes that must be buffered before a refill
+ *        returns (from 1 to the size of the buffer).
+ * @param wait_all If non-zero, each refill waits until the whole buffer is
+ *        filled (as with @c MSG_WAITALL), regardless of @c low_water.
+ * @param multi_member If non-zero, the members following the first one (see
+ *        #lz77_decompress) are read too, until the peer shuts the
+ *        connection down.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_cstream_set_receive(lz77_cstream *cstream,
+                             uint32_t buffer_size,
+                             uint32_t low_water,
+                             uint8_t wait_all,
+                             uint8_t multi_member);
+
 /**
  * Creates an output @c lz77_cstream which is backed by a memory buffer.
  * This stream is used as output by the compression algorithm.
@@ -101,6 +145,45 @@ lz77_cstream * lz77_cstream_to_memory(lz77_ustream *from,
  */
 lz77_cstream * lz77_cstream_to_descriptor(lz77_ustream *from, int fd);
 
+/**
+ * Resets an output @c lz77_cstream backed by a memory buffer, so that it can
+ * be used by another compression (of an input stream with the same window and
+ * look-ahead sizes).
+ *
+ * @param cstream A stream created with #lz77_cstream_to_memory.
+ * @param buffer The memory buffer to which data will be written, or @c NULL to
+ *        write again to the current buffer (whose content is overwritten).
+ *        The previous buffer is not freed, even if it was allocated by the
+ *        algorithm.
+ * @param size The size of the buffer. It is ignored if @c buffer is @c NULL.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_cstream_reset(lz77_cstream *cstream, uint8_t *buffer, uint32_t size);
+
+/**
+ * Resets an @c lz77_cstream backed by a descriptor, so that it can be used by
+ * another compression (if it is an output stream, of an input stream with the
+ * same window and look-ahead sizes) or decompression (if it is an input
+ * stream) on a different descriptor.
+ *
+ * The buffer of the stream is kept. The previous descriptor is not closed.
+ *
+ * @param cstream A stream created with #lz77_cstream_from_descriptor or
+ *        #lz77_cstream_to_descriptor.
+ * @param fd The descriptor from which data is read, or to which it is
+ *        written.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_cstream_reset_descriptor(lz77_cstream *cstream, int fd);
+
 /**
  * Gets the output buffer associated to an @c lz77_cstream bound to a memory
  * buffer.
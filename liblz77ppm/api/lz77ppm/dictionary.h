@@ -0,0 +1,121 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file dictionary.h
+ *
+ * Prepared dictionaries, which prime the window of a compression (and of the
+ * corresponding decompression) with data similar to the one being compressed.
+ *
+ * Small inputs are poorly compressed, since the window is initially empty: a
+ * dictionary made of typical content lets their first bytes be encoded as
+ * phrases too. A prepared dictionary contains the window @em and the binary
+ * search tree built on it, so that starting a compression costs a copy
+ * instead of a search for every byte of the dictionary.
+ *
+ * A dictionary is never modified once created, so it can be shared by any
+ * number of streams and threads. It is stored as a single image, which can be
+ * saved to a file and then used directly from memory (e.g., mapped with
+ * @c mmap), without being parsed or copied.
+ *
+ * The compressed data does not record the dictionary: it must be decompressed
+ * with the same dictionary used to compress it. Only the first member of a
+ * compressed stream is primed with the dictionary.
+ */
+
+#ifndef _LZ77_DICTIONARY_H_
+#define _LZ77_DICTIONARY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lz77ppm/ustream.h>
+
+/**
+ * A prepared dictionary.
+ */
+typedef struct _lz77_dictionary lz77_dictionary;
+
+/**
+ * Prepares a dictionary for the given window and look-ahead sizes.
+ *
+ * @param data The content of the dictionary. Only its last @c window_size
+ *        bytes are used, so the most common strings should be put at the end.
+ * @param size The size of @c data.
+ * @param window_size The size of the window of the compressions.
+ * @param lookahead_size The size of the look-ahead buffer of the compressions.
+ *
+ * @return A pointer to the newly created dictionary, or @c NULL in case of
+ *         error. See @c errno for further information. If an invalid argument
+ *         is provided, @c errno is set to @c EINVAL and an explanatory string
+ *         is written to the @link lz77_log logger@endlink.
+ */
+lz77_dictionary * lz77_dictionary_create(const uint8_t *data,
+                                         uint32_t size,
+                                         uint16_t window_size,
+                                         uint16_t lookahead_size);
+
+/**
+ * Uses the image of a dictionary saved by #lz77_dictionary_save.
+ *
+ * The image is validated, but not copied: it must not be modified or released
+ * until the dictionary is freed.
+ *
+ * @param image The image of the dictionary, aligned to at least two bytes
+ *        (which is always the case for a mapped file).
+ * @param size The size of @c image.
+ *
+ * @return A pointer to the dictionary, or @c NULL in case of error. If the
+ *         image is not valid, @c errno is set to @c EINVAL and an explanatory
+ *         string is written to the @link lz77_log logger@endlink.
+ */
+lz77_dictionary * lz77_dictionary_from_memory(const void *image, size_t size);
+
+/**
+ * Writes the image of a dictionary to a file or socket descriptor.
+ *
+ * @param dictionary The dictionary.
+ * @param fd The descriptor to which the image is written.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int lz77_dictionary_save(const lz77_dictionary *dictionary, int fd);
+
+/**
+ * Primes a stream with a dictionary.
+ *
+ * Call this function before #lz77_compress or #lz77_decompress. An input
+ * stream must have the window and look-ahead sizes of the dictionary; if it
+ * is backed by memory, its data is copied after the dictionary. An output
+ * stream must be backed by a descriptor or by a reallocatable buffer, and its
+ * compressed stream must have the window size of the dictionary (which is
+ * checked when the decompression starts).
+ *
+ * @param ustream The stream to be primed.
+ * @param dictionary The dictionary. It must not be freed before the
+ *        operation is completed.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_dictionary_use(lz77_ustream *ustream, const lz77_dictionary *dictionary);
+
+/**
+ * Frees the memory allocated for a dictionary, and sets its pointer to
+ * @c NULL.
+ *
+ * The image given to #lz77_dictionary_from_memory is not released.
+ *
+ * @param pdictionary A pointer to the dictionary to be freed.
+ */
+void lz77_dictionary_free(lz77_dictionary **pdictionary);
+
+#endif
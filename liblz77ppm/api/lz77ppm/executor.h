@@ -0,0 +1,153 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file executor.h
+ *
+ * Asynchronous compression and decompression, run by an executor supplied by
+ * the application.
+ *
+ * The library never creates threads by itself: every operation which runs in
+ * the background, or in parallel with others, is submitted as a task to an
+ * executor, which is usually a thread pool of the application. This way, the
+ * pool can be sized to the number of cores once for the whole process, and
+ * the library does not add threads competing with it.
+ *
+ * A stream must not be used by more than one operation at a time, and it
+ * must not be freed until the operation using it has completed. The
+ * #report_progress function is called by the threads of the executor.
+ */
+
+#ifndef _LZ77_EXECUTOR_H_
+#define _LZ77_EXECUTOR_H_
+
+#include <stdint.h>
+
+#include <lz77ppm/cstream.h>
+#include <lz77ppm/ustream.h>
+
+/**
+ * An executor, running tasks on behalf of the library.
+ */
+typedef struct _lz77_executor {
+    /**
+     * Submits a task, which is to be run once, at some later point, by any
+     * thread (possibly before this function returns).
+     *
+     * @param executor This executor.
+     * @param task The function to be run.
+     * @param argument The argument passed to @c task.
+     *
+     * @return 0 in case of success, or -1 if the task cannot be accepted (with
+     *         @c errno set accordingly, e.g. to @c EAGAIN).
+     */
+    int (*submit)(struct _lz77_executor *executor, void (*task)(void *argument), void *argument);
+    /** The number of tasks which the executor can run at the same time. */
+    int workers;
+    /** Any data needed by the application, not used by the library. */
+    void *context;
+} lz77_executor;
+
+/**
+ * The executor used when none is passed to an asynchronous operation.
+ *
+ * It is @c NULL by default, in which case asynchronous operations are run in
+ * the calling thread, and completed before they return.
+ */
+extern lz77_executor *lz77_default_executor;
+
+/**
+ * A function called when an asynchronous operation is completed.
+ *
+ * @param result The value which #lz77_compress or #lz77_decompress would have
+ *        returned.
+ * @param error The value of @c errno, if @c result is @c -1, or zero.
+ * @param argument The argument given when starting the operation.
+ */
+typedef void (*lz77_completion)(int64_t result, int error, void *argument);
+
+/**
+ * Starts compressing a stream, like #lz77_compress, on an executor.
+ *
+ * @param executor The executor running the compression, or @c NULL to use
+ *        #lz77_default_executor.
+ * @param original The stream containing the data to be compressed.
+ * @param compressed The stream that will contain the compressed data.
+ * @param done The function called (by the thread running the compression)
+ *        when the compression is completed.
+ * @param argument The argument passed to @c done.
+ *
+ * @return 0 if the compression has been submitted, in which case @c done
+ *         will be called exactly once, or -1 in case of error (@c done is not
+ *         called). See @c errno for further information. If an invalid
+ *         argument is provided, @c errno is set to @c EINVAL and an
+ *         explanatory string is written to the @link lz77_log logger@endlink.
+ */
+int lz77_compress_async(lz77_executor *executor,
+                        lz77_ustream *original,
+                        lz77_cstream *compressed,
+                        lz77_completion done,
+                        void *argument);
+
+/**
+ * Starts decompressing a stream, like #lz77_decompress, on an executor.
+ *
+ * @param executor The executor running the decompression, or @c NULL to use
+ *        #lz77_default_executor.
+ * @param compressed The stream containing the data to be decompressed.
+ * @param original The stream that will contain the decompressed data.
+ * @param done The function called (by the thread running the decompression)
+ *        when the decompression is completed.
+ * @param argument The argument passed to @c done.
+ *
+ * @return 0 if the decompression has been submitted, in which case @c done
+ *         will be called exactly once, or -1 in case of error (@c done is not
+ *         called). See @c errno for further information. If an invalid
+ *         argument is provided, @c errno is set to @c EINVAL and an
+ *         explanatory string is written to the @link lz77_log logger@endlink.
+ */
+int lz77_decompress_async(lz77_executor *executor,
+                          lz77_cstream *compressed,
+                          lz77_ustream *original,
+                          lz77_completion done,
+                          void *argument);
+
+/**
+ * Decompresses a stream with several threads of an executor, like
+ * #lz77_decompress, and waits for the decompression to be completed.
+ *
+ * The compressed stream is parsed serially into an array of tokens, without
+ * copying any data; then the output is split into chunks, which are filled by
+ * the threads of the executor and by the calling thread at the same time. The
+ * phrases which refer to the data of a previous chunk are deferred, and
+ * completed by the calling thread in the order of the stream. This works with
+ * any compressed stream (which needs no restart points), but since the parse
+ * takes most of the time of #lz77_decompress, it is faster only when several
+ * cores are available.
+ *
+ * The tokens take about 4 bytes per token in memory, and the whole output is
+ * kept in memory before being written to a descriptor. A stream writing a
+ * seek index cannot be decompressed in parallel, and holes are written as
+ * zeros.
+ *
+ * @param executor The executor running the tasks, or @c NULL to use
+ *        #lz77_default_executor (if it is @c NULL too, the decompression is
+ *        run entirely in the calling thread). Tasks which are not run before
+ *        the decompression ends do nothing.
+ * @param compressed The stream containing the data to be decompressed.
+ * @param original The stream that will contain the decompressed data.
+ *
+ * @return The value returned by #lz77_decompress. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int64_t lz77_decompress_parallel(lz77_executor *executor,
+                                 lz77_cstream *compressed,
+                                 lz77_ustream *original);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file hints.h
+ *
+ * Match hints taken from a previous compression of the same data.
+ *
+ * When data that has already been compressed is compressed again with a
+ * larger window or look-ahead buffer (e.g., when it is moved to a colder
+ * storage tier), the phrases of the old compressed stream tell where matches
+ * are to be found. They are used as hints: at each position covered by an old
+ * phrase, its source is checked in the new window and the match is extended
+ * as far as the new look-ahead buffer allows; if it cannot be extended any
+ * further, the binary search tree is not searched at all. Furthermore, the
+ * positions inside an old phrase are not added to the tree, since their
+ * content is already found in the window at the source of the phrase. This
+ * avoids most of the walks of the tree, which dominate the cost of the
+ * compression.
+ *
+ * Skipping positions makes some long matches impossible to find, though:
+ * those starting near the end of an old phrase are the most likely to extend
+ * beyond it, so the last few bytes of each phrase can still be added to the
+ * tree, trading speed for compression ratio. For instance, recompressing the
+ * Divine Comedy from a window of 4096 bytes and a look-ahead of 32 bytes to
+ * 32768 and 255 bytes is about three times as fast as a full compression if
+ * no bytes are added (but the output is 12% larger), and a third faster if
+ * the last two bytes are added (with an output 3.5% larger).
+ *
+ * Hints are always verified against the data being compressed, so a wrong or
+ * corrupted hint stream can make the compression worse, but never wrong.
+ */
+
+#ifndef _LZ77_HINTS_H_
+#define _LZ77_HINTS_H_
+
+#include <stdint.h>
+
+#include <lz77ppm/cstream.h>
+#include <lz77ppm/ustream.h>
+
+/**
+ * Uses the tokens of a compressed stream as match hints for a compression.
+ *
+ * Call this function before #lz77_compress. The hint stream is read while the
+ * compression proceeds; it must not be freed before the compression is
+ * completed, and it cannot be used for anything else.
+ *
+ * @param original The input stream of the compression.
+ * @param hints A stream (created with #lz77_cstream_from_memory or
+ *        #lz77_cstream_from_descriptor) containing a compressed version of the
+ *        same data, possibly made of several members and compressed with
+ *        different window and look-ahead sizes.
+ * @param tail The number of bytes at the end of each phrase of @c hints which
+ *        are added to the tree anyway.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_hints_enable(lz77_ustream *original, lz77_cstream *hints, uint16_t tail);
+
+#endif
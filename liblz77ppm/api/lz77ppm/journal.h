@@ -0,0 +1,212 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file journal.h
+ *
+ * Compressed journals, i.e. logs appended record by record and read back from
+ * any record without decompressing the whole file.
+ *
+ * A journal consists of two files. The log contains the records, framed by
+ * their size (a 4-byte big-endian integer), and compressed in a sequence of
+ * members: each member is an ordinary compressed stream, so the whole log can
+ * still be decompressed with #lz77_decompress. The records are buffered in
+ * memory by the writer and compressed when they are flushed, which happens
+ * when they reach a given size or span a given interval of time (and when the
+ * writer is closed).
+ *
+ * The index contains an entry for every member (i.e., for every flush),
+ * recording its offset in the log, the number of its first record and the
+ * timestamps of its first and last records. A reader loads the index, finds
+ * the member containing a record (or a time) with a binary search, and
+ * decompresses only that member and the following ones.
+ */
+
+#ifndef _LZ77_JOURNAL_H_
+#define _LZ77_JOURNAL_H_
+
+#include <stdint.h>
+
+/**
+ * The default size of the records buffered before they are compressed.
+ */
+#define LZ77_JOURNAL_DEFAULT_FLUSH_SIZE (256 * 1024)
+
+/**
+ * Appends records to a journal.
+ */
+typedef struct _lz77_journal_writer lz77_journal_writer;
+
+/**
+ * Reads the records of a journal.
+ */
+typedef struct _lz77_journal_reader lz77_journal_reader;
+
+/**
+ * Opens a journal for appending records.
+ *
+ * If the index is not empty, the records are numbered after those already in
+ * the journal. The records which were not flushed (e.g., because the
+ * application crashed) are not recovered: a member without an entry, and an
+ * incomplete entry at the end of the index, are discarded.
+ *
+ * @param fd A descriptor to the log, opened for writing. Records are appended
+ *        at its end.
+ * @param index_fd A descriptor to the index, opened for reading and writing.
+ * @param window_size The size of the window of the compression.
+ * @param lookahead_size The size of the look-ahead buffer of the compression.
+ *
+ * @return A pointer to the newly created writer, or @c NULL in case of error.
+ *         See @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+lz77_journal_writer * lz77_journal_writer_open(int fd,
+                                               int index_fd,
+                                               uint16_t window_size,
+                                               uint16_t lookahead_size);
+
+/**
+ * Sets when the buffered records are flushed.
+ *
+ * Smaller members are compressed worse, but fewer records are lost in a crash
+ * and fewer records are decompressed to reach a given one.
+ *
+ * @param writer The writer.
+ * @param size The size of the buffered records (including their framing)
+ *        which triggers a flush. The default is
+ *        #LZ77_JOURNAL_DEFAULT_FLUSH_SIZE.
+ * @param interval The maximum difference between the timestamps of the first
+ *        and the last record of a member, or zero (the default) to disable
+ *        flushing by time. It is checked only when a record is appended:
+ *        call #lz77_journal_flush periodically if records may stay buffered
+ *        for too long.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_journal_set_flush(lz77_journal_writer *writer, uint32_t size, uint64_t interval);
+
+/**
+ * Appends a record to a journal.
+ *
+ * @param writer The writer.
+ * @param record The content of the record.
+ * @param size The size of the record.
+ * @param timestamp The time of the record, in any unit chosen by the
+ *        application. Timestamps must not decrease from one record to the
+ *        next, so that records can be found by time.
+ *
+ * @return The number of the record (starting from zero), or a negative value
+ *         if an error occurred. See @c errno for further information.
+ */
+int64_t lz77_journal_append(lz77_journal_writer *writer,
+                            const void *record,
+                            uint32_t size,
+                            uint64_t timestamp);
+
+/**
+ * Compresses the buffered records, and adds their member to the index.
+ *
+ * If the flush fails, whatever it wrote to the log and to the index is
+ * removed, and the records stay buffered for the next flush.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int lz77_journal_flush(lz77_journal_writer *writer);
+
+/**
+ * Flushes the buffered records, frees a writer and sets its pointer to
+ * @c NULL. The descriptors are not closed.
+ *
+ * @param pwriter A pointer to the writer to be closed.
+ *
+ * @return 0 in case of success, or a negative value if the records could not
+ *         be flushed (the writer is freed anyway). See @c errno for further
+ *         information.
+ */
+int lz77_journal_writer_close(lz77_journal_writer **pwriter);
+
+/**
+ * Opens a journal for reading, loading its index.
+ *
+ * The reader is positioned at the first record.
+ *
+ * @param fd A descriptor to the log, opened for reading.
+ * @param index_fd A descriptor to the index, opened for reading.
+ *
+ * @return A pointer to the newly created reader, or @c NULL in case of error.
+ *         See @c errno for further information. If the index is not valid,
+ *         @c errno is set to @c EINVAL and an explanatory string is written to
+ *         the @link lz77_log logger@endlink.
+ */
+lz77_journal_reader * lz77_journal_reader_open(int fd, int index_fd);
+
+/**
+ * Gets the number of records of a journal.
+ */
+uint64_t lz77_journal_count(const lz77_journal_reader *reader);
+
+/**
+ * Positions a reader at a record, decompressing the member containing it.
+ *
+ * @param reader The reader.
+ * @param record The number of the record. If it is equal to the number of
+ *        records, the reader is positioned at the end of the journal.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If the record does not exist,
+ *         @c errno is set to @c EINVAL and an explanatory string is written to
+ *         the @link lz77_log logger@endlink.
+ */
+int lz77_journal_seek(lz77_journal_reader *reader, uint64_t record);
+
+/**
+ * Positions a reader at the first record of the first member which contains
+ * records not older than a given time.
+ *
+ * The records preceding the requested time within that member are not
+ * skipped, since their timestamps are not stored in the log.
+ *
+ * @param reader The reader.
+ * @param timestamp The time to be found.
+ *
+ * @return The number of the record at which the reader is positioned (equal
+ *         to the number of records if all of them are older), or a negative
+ *         value if an error occurred. See @c errno for further information.
+ */
+int64_t lz77_journal_seek_time(lz77_journal_reader *reader, uint64_t timestamp);
+
+/**
+ * Reads the record at which a reader is positioned, and advances it to the
+ * next one.
+ *
+ * @param reader The reader.
+ * @param record Must point to a pointer that will be set to the content of
+ *        the record. The content is valid until the next call on the reader.
+ * @param size Must point to an integer that will be set to the size of the
+ *        record.
+ *
+ * @return 1 if a record has been read, 0 at the end of the journal, or a
+ *         negative value if an error occurred. See @c errno for further
+ *         information.
+ */
+int lz77_journal_next(lz77_journal_reader *reader, const uint8_t **record, uint32_t *size);
+
+/**
+ * Frees a reader and sets its pointer to @c NULL. The descriptors are not
+ * closed.
+ *
+ * @param preader A pointer to the reader to be freed.
+ */
+void lz77_journal_reader_free(lz77_journal_reader **preader);
+
+#endif
@@ -17,7 +17,18 @@
 
 #include <stdint.h>
 
+#include <lz77ppm/alloc.h>
+#include <lz77ppm/cache.h>
+#include <lz77ppm/checkpoint.h>
 #include <lz77ppm/cstream.h>
+#include <lz77ppm/dictionary.h>
+#include <lz77ppm/executor.h>
+#include <lz77ppm/hints.h>
+#include <lz77ppm/journal.h>
+#include <lz77ppm/raw.h>
+#include <lz77ppm/seek.h>
+#include <lz77ppm/solid.h>
+#include <lz77ppm/store.h>
 #include <lz77ppm/ustream.h>
 
 #define LZ77PPM_VERSION 0x10
@@ -42,6 +53,28 @@
  */
 #define LZ77_MIN_WINDOW_SIZE 4
 
+/**
+ * The maximum accepted window size for a compression. The index of the root of
+ * the binary search tree (equal to the window size) must differ from the one
+ * used to mark an unused node.
+ */
+#define LZ77_MAX_WINDOW_SIZE 65534
+
+/**
+ * The default maximum depth of a search in the binary search tree.
+ *
+ * @see #lz77_ustream_set_search_depth
+ */
+#define LZ77_DEFAULT_SEARCH_DEPTH 256
+
+/**
+ * The maximum number of positions skipped after a search which found no match,
+ * when the compression is accelerated.
+ *
+ * @see #lz77_ustream_set_acceleration
+ */
+#define LZ77_MAX_ACCELERATION_SKIP 255
+
 /**
  * The minimum accepted look-ahead buffer size.
  */
@@ -65,6 +98,15 @@ int64_t lz77_compress(lz77_ustream *original, lz77_cstream *compressed);
  * Reconstruct the original data from a stream compressed using the LZ77
  * algorithm.
  *
+ * The compressed stream may be the concatenation of several @em members, i.e.
+ * of the outputs of independent compressions with the same window and
+ * look-ahead sizes: their decompressed data is concatenated as well. This
+ * allows, for instance, copying unchanged members from a previous version of
+ * a file instead of compressing their data again. Bytes following the last
+ * member which do not start a new one are ignored. A stream read from a
+ * socket stops after its first member, unless told otherwise with
+ * #lz77_cstream_set_receive.
+ *
  * @param compressed The stream containing the data to be decompressed.
  * @param original The stream that will contain the decompressed data.
  *
@@ -0,0 +1,93 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file raw.h
+ *
+ * Raw blocks: small buffers (e.g., memory or database pages) compressed
+ * without any framing.
+ *
+ * A raw block contains only the tokens of the data, encoded as in a member of
+ * a compressed stream, without its header and its terminating token: the
+ * window and look-ahead sizes and the size of the original data are agreed out
+ * of band (e.g., every page of a cache has the same size). Both functions work
+ * on buffers provided by the caller and allocate no memory.
+ *
+ * The compression uses a dedicated matcher, much faster than the binary
+ * search tree of #lz77_compress on small inputs: it does not initialize a tree
+ * as large as the window, and it looks for matches with a hash table of the
+ * last position of each sequence of bytes (keeping the table and the whole
+ * input in the first-level cache of a page-sized block). Its matches are
+ * found greedily and are not always the longest ones, so the output is
+ * somewhat larger than the one of a stream.
+ */
+
+#ifndef _LZ77_RAW_H_
+#define _LZ77_RAW_H_
+
+#include <stdint.h>
+
+/**
+ * The maximum size of a raw block compressed from @c size bytes, reached when
+ * every byte is encoded as a symbol.
+ */
+#define LZ77_RAW_BOUND(size) ((uint32_t)(((uint64_t)(size) * 9 + 7) / 8))
+
+/**
+ * Compresses a buffer into a raw block.
+ *
+ * @param data The data to be compressed.
+ * @param size The size of the data.
+ * @param buffer The buffer to which the block is written.
+ * @param capacity The size of @c buffer. A capacity of #LZ77_RAW_BOUND(size)
+ *        bytes is always enough; with a smaller one, the compression may fail
+ *        as soon as the buffer is full (e.g., a capacity of <tt>size - 1</tt>
+ *        bytes rejects the blocks which are not worth compressing).
+ * @param window_size The size of the window.
+ * @param lookahead_size The size of the look-ahead buffer, i.e. the maximum
+ *        length of a match.
+ *
+ * @return The size of the raw block, or a negative value if an error occurred.
+ *         See @c errno for further information. If the buffer is too small,
+ *         @c errno is set to @c ENOMEM. If an invalid argument is provided,
+ *         @c errno is set to @c EINVAL and an explanatory string is written to
+ *         the @link lz77_log logger@endlink.
+ */
+int64_t lz77_raw_compress(const uint8_t *data,
+                          uint32_t size,
+                          uint8_t *buffer,
+                          uint32_t capacity,
+                          uint16_t window_size,
+                          uint16_t lookahead_size);
+
+/**
+ * Decompresses a raw block.
+ *
+ * @param block The raw block.
+ * @param size The size of the raw block.
+ * @param buffer The buffer to which the original data is written.
+ * @param original_size The size of the original data (exactly as many bytes
+ *        are written to @c buffer).
+ * @param window_size The size of the window used by the compression.
+ * @param lookahead_size The size of the look-ahead buffer used by the
+ *        compression.
+ *
+ * @return The size of the original data, or a negative value if an error
+ *         occurred. See @c errno for further information. If an invalid
+ *         argument is provided or the block is corrupted, @c errno is set to
+ *         @c EINVAL and an explanatory string is written to the
+ *         @link lz77_log logger@endlink.
+ */
+int64_t lz77_raw_decompress(const uint8_t *block,
+                            uint32_t size,
+                            uint8_t *buffer,
+                            uint32_t original_size,
+                            uint16_t window_size,
+                            uint16_t lookahead_size);
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file seek.h
+ *
+ * Random access to compressed files through a separate seek index, without
+ * changing their format.
+ *
+ * The index is written while the file is decompressed once. Every given
+ * number of output bytes (and after every hole of a sparse file), it records
+ * the position in bits of the next token in the compressed file, the offset
+ * reached in the output, and the content of the window, which is all the
+ * state the decompression needs to resume from there. A range of the original
+ * data is then read by decompressing from the nearest preceding entry, i.e. at
+ * most one interval more than the requested bytes.
+ *
+ * The index is made of a header followed by entries of a fixed size (the size
+ * of the window, plus 18 bytes), so that an entry is found with a binary
+ * search without loading the index. Since the window is saved, the index
+ * takes about <tt>window_size / interval</tt> of the size of the original data
+ * (e.g., 6% with the maximum window and the default interval), and a file
+ * compressed with a dictionary can be read from its index without it.
+ */
+
+#ifndef _LZ77_SEEK_H_
+#define _LZ77_SEEK_H_
+
+#include <stdint.h>
+
+#include <lz77ppm/ustream.h>
+
+/**
+ * The default number of output bytes between two entries of a seek index.
+ */
+#define LZ77_SEEK_DEFAULT_INTERVAL (1 << 20)
+
+/**
+ * Makes a decompression write a seek index.
+ *
+ * Call this function before #lz77_decompress. The compressed stream must be
+ * read from its beginning, since the positions recorded are counted from
+ * there.
+ *
+ * @param original The output stream of the decompression.
+ * @param index_fd The descriptor of the index, opened for writing. The index
+ *        is written from the current offset: it should refer to an empty file.
+ * @param interval The number of output bytes between two entries.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_seek_index_enable(lz77_ustream *original, int index_fd, uint64_t interval);
+
+/**
+ * Reads a range of the original data of a compressed file, using its seek
+ * index.
+ *
+ * @param fd A descriptor to the compressed file, opened for reading. Its file
+ *        offset is changed.
+ * @param index_fd A descriptor to the seek index, opened for reading. Its file
+ *        offset is not changed.
+ * @param offset The offset of the first byte to be read in the original data.
+ * @param buffer The buffer to which the data is copied.
+ * @param size The number of bytes to be read.
+ *
+ * @return The number of bytes read, which is less than @c size only if the
+ *         end of the original data is reached, or a negative value if an
+ *         error occurred. See @c errno for further information. If the index
+ *         is not valid, @c errno is set to @c EINVAL and an explanatory
+ *         string is written to the @link lz77_log logger@endlink.
+ */
+int64_t lz77_seek_read(int fd, int index_fd, uint64_t offset, void *buffer, uint32_t size);
+
+#endif
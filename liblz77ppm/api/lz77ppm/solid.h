@@ -0,0 +1,171 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file solid.h
+ *
+ * Solid archives, i.e. many small entries (e.g., the files of a source tree)
+ * compressed together, so that each one can refer to the data of the
+ * previous ones instead of starting with an empty window.
+ *
+ * The entries are concatenated into groups, and each group is compressed as a
+ * member of the archive: each member is an ordinary compressed stream, so the
+ * whole archive can still be decompressed with #lz77_decompress (yielding the
+ * concatenation of the entries). A separate table records, for every entry,
+ * the offset and the size of its member in the archive and its position
+ * within the decompressed member, so that reading an entry decompresses only
+ * its group.
+ *
+ * Larger groups compress better, while smaller ones make an entry cheaper to
+ * read. Groups are independent, so they can be read in parallel (with a
+ * reader for each thread).
+ */
+
+#ifndef _LZ77_SOLID_H_
+#define _LZ77_SOLID_H_
+
+#include <stdint.h>
+
+/**
+ * The default size of the entries compressed together.
+ */
+#define LZ77_SOLID_DEFAULT_GROUP_SIZE (1024 * 1024)
+
+/**
+ * Adds entries to a solid archive.
+ */
+typedef struct _lz77_solid_writer lz77_solid_writer;
+
+/**
+ * Reads the entries of a solid archive.
+ */
+typedef struct _lz77_solid_reader lz77_solid_reader;
+
+/**
+ * Opens a solid archive for adding entries.
+ *
+ * If the table is not empty, the entries are numbered after those already in
+ * the archive. The entries which were not flushed (e.g., because the
+ * application crashed) are not recovered: a group without entries in the
+ * table, and an incomplete entry at the end of the table, are discarded.
+ *
+ * @param fd A descriptor to the archive, opened for writing. Groups are
+ *        appended at its end.
+ * @param table_fd A descriptor to the table of the entries, opened for
+ *        reading and writing.
+ * @param window_size The size of the window of the compression.
+ * @param lookahead_size The size of the look-ahead buffer of the compression.
+ *
+ * @return A pointer to the newly created writer, or @c NULL in case of error.
+ *         See @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+lz77_solid_writer * lz77_solid_writer_open(int fd,
+                                           int table_fd,
+                                           uint16_t window_size,
+                                           uint16_t lookahead_size);
+
+/**
+ * Sets the size of the groups.
+ *
+ * An entry is never split: a group is flushed before an entry which would
+ * make it larger than the given size, and larger entries form a group on
+ * their own.
+ *
+ * @param writer The writer.
+ * @param size The maximum size of a group. The default is
+ *        #LZ77_SOLID_DEFAULT_GROUP_SIZE.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_solid_set_group_size(lz77_solid_writer *writer, uint32_t size);
+
+/**
+ * Adds an entry to a solid archive.
+ *
+ * @param writer The writer.
+ * @param data The content of the entry.
+ * @param size The size of the entry.
+ *
+ * @return The number of the entry (starting from zero), or a negative value
+ *         if an error occurred. See @c errno for further information.
+ */
+int64_t lz77_solid_add(lz77_solid_writer *writer, const void *data, uint32_t size);
+
+/**
+ * Compresses the current group, and adds its entries to the table. The next
+ * entry starts a new group.
+ *
+ * If the flush fails, whatever it wrote to the archive and to the table is
+ * removed, and the entries stay in the group for the next flush.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int lz77_solid_flush(lz77_solid_writer *writer);
+
+/**
+ * Flushes the current group, frees a writer and sets its pointer to @c NULL.
+ * The descriptors are not closed.
+ *
+ * @param pwriter A pointer to the writer to be closed.
+ *
+ * @return 0 in case of success, or a negative value if the group could not
+ *         be flushed (the writer is freed anyway). See @c errno for further
+ *         information.
+ */
+int lz77_solid_writer_close(lz77_solid_writer **pwriter);
+
+/**
+ * Opens a solid archive for reading, loading its table.
+ *
+ * @param fd A descriptor to the archive, opened for reading.
+ * @param table_fd A descriptor to the table of the entries, opened for
+ *        reading.
+ *
+ * @return A pointer to the newly created reader, or @c NULL in case of error.
+ *         See @c errno for further information. If the table is not valid,
+ *         @c errno is set to @c EINVAL and an explanatory string is written to
+ *         the @link lz77_log logger@endlink.
+ */
+lz77_solid_reader * lz77_solid_reader_open(int fd, int table_fd);
+
+/**
+ * Gets the number of entries of a solid archive.
+ */
+uint64_t lz77_solid_count(const lz77_solid_reader *reader);
+
+/**
+ * Reads an entry of a solid archive, decompressing its group unless it is the
+ * group of the previous entry read.
+ *
+ * @param reader The reader.
+ * @param entry The number of the entry.
+ * @param data Must point to a pointer that will be set to the content of the
+ *        entry. The content is valid until the next call on the reader.
+ *
+ * @return The size of the entry, or a negative value if an error occurred.
+ *         See @c errno for further information. If the entry does not exist,
+ *         @c errno is set to @c EINVAL and an explanatory string is written to
+ *         the @link lz77_log logger@endlink.
+ */
+int64_t lz77_solid_get(lz77_solid_reader *reader, uint64_t entry, const uint8_t **data);
+
+/**
+ * Frees a reader and sets its pointer to @c NULL. The descriptors are not
+ * closed.
+ *
+ * @param preader A pointer to the reader to be freed.
+ */
+void lz77_solid_reader_free(lz77_solid_reader **preader);
+
+#endif
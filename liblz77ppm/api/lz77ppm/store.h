@@ -0,0 +1,138 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file store.h
+ *
+ * A compressed in-memory store of values (e.g., the objects of an application
+ * cache), which keeps many values in less memory than their original size.
+ *
+ * Each value is compressed when it is inserted, and appended to an arena of
+ * large chunks, so that it costs only its compressed size and a small record.
+ * Values are identified by the number assigned on insertion, and they cannot
+ * be modified or removed (the memory is released when the store is freed).
+ * Without a dictionary, a value is compressed as a @link raw.h raw
+ * block@endlink; with a dictionary, it is compressed as a stream primed with
+ * it, which compresses small values much better but is slower.
+ *
+ * The values read recently are also kept decompressed, within a memory budget,
+ * so that reading a hot value costs just a copy. When the decompressed values
+ * exceed the budget, the least recently read ones are evicted.
+ *
+ * A store is thread-safe: any number of threads can read values at the same
+ * time (values are decompressed in parallel, and the cache is split into
+ * independent shards), while insertions are serialized with the reads.
+ */
+
+#ifndef _LZ77_STORE_H_
+#define _LZ77_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <lz77ppm/dictionary.h>
+
+/**
+ * A compressed in-memory store.
+ */
+typedef struct _lz77_store lz77_store;
+
+/**
+ * Creates an empty store.
+ *
+ * @param window_size The size of the window of the compressions.
+ * @param lookahead_size The size of the look-ahead buffer of the compressions.
+ *        Without a dictionary, it must not be greater than the window size.
+ * @param dictionary The dictionary used by the compressions, or @c NULL. It
+ *        must have the given window and look-ahead sizes, and it must not be
+ *        freed before the store.
+ * @param budget The maximum amount of memory (in bytes) used by the cache of
+ *        decompressed values, including their bookkeeping. The budget is
+ *        split evenly among the shards of the cache, so a value larger than a
+ *        sixteenth of it is never cached. With a budget of zero, every read
+ *        decompresses its value.
+ *
+ * @return A pointer to the newly created store, or @c NULL in case of error.
+ *         See @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+lz77_store * lz77_store_create(uint16_t window_size,
+                               uint16_t lookahead_size,
+                               const lz77_dictionary *dictionary,
+                               size_t budget);
+
+/**
+ * Compresses a value and adds it to a store.
+ *
+ * A value which cannot be compressed is stored as it is.
+ *
+ * @param store The store.
+ * @param data The value.
+ * @param size The size of the value.
+ *
+ * @return The number of the value (starting from zero), or a negative value
+ *         if an error occurred. See @c errno for further information.
+ */
+int64_t lz77_store_put(lz77_store *store, const void *data, uint32_t size);
+
+/**
+ * Gets the size of a value of a store.
+ *
+ * @param store The store.
+ * @param key The number of the value.
+ *
+ * @return The size of the value, or a negative value if an error occurred.
+ *         If the value does not exist, @c errno is set to @c EINVAL and an
+ *         explanatory string is written to the @link lz77_log logger@endlink.
+ */
+int64_t lz77_store_size(lz77_store *store, uint64_t key);
+
+/**
+ * Reads a value of a store, copying it from the cache or decompressing it.
+ *
+ * @param store The store.
+ * @param key The number of the value.
+ * @param buffer The buffer to which the value is copied.
+ * @param capacity The size of @c buffer.
+ *
+ * @return The size of the value, or a negative value if an error occurred.
+ *         See @c errno for further information. If the buffer is too small,
+ *         @c errno is set to @c ENOMEM. If the value does not exist,
+ *         @c errno is set to @c EINVAL and an explanatory string is written
+ *         to the @link lz77_log logger@endlink.
+ */
+int64_t lz77_store_get(lz77_store *store, uint64_t key, void *buffer, uint32_t capacity);
+
+/**
+ * Gets the statistics of a store.
+ *
+ * @param store The store.
+ * @param original If not @c NULL, it will be set to the total size of the
+ *        values.
+ * @param stored If not @c NULL, it will be set to the memory used by the
+ *        compressed values, including their records.
+ * @param hits If not @c NULL, it will be set to the number of reads served
+ *        by the cache.
+ * @param misses If not @c NULL, it will be set to the number of reads which
+ *        decompressed their value.
+ */
+void lz77_store_get_stats(lz77_store *store,
+                          uint64_t *original,
+                          uint64_t *stored,
+                          uint64_t *hits,
+                          uint64_t *misses);
+
+/**
+ * Frees a store with all its values, and sets its pointer to @c NULL.
+ *
+ * @param pstore A pointer to the store to be freed.
+ */
+void lz77_store_free(lz77_store **pstore);
+
+#endif
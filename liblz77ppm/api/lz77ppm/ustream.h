@@ -111,6 +111,141 @@ lz77_ustream * lz77_ustream_to_memory(lz77_cstream *from,
  */
 lz77_ustream * lz77_ustream_to_descriptor(lz77_cstream *from, int fd);
 
+/**
+ * Limits the number of nodes of the binary search tree visited when looking
+ * for a match.
+ *
+ * The tree is not balanced, so some inputs (e.g., runs of increasing values
+ * slightly shorter than the look-ahead buffer) make it degenerate into long
+ * paths, slowing down the compression by orders of magnitude. When a search
+ * goes deeper than the limit, the longest match found so far is used and the
+ * current position is not added to the tree. The limit is never reached on
+ * ordinary data.
+ *
+ * @param ustream An input stream, before the compression is started.
+ * @param depth The maximum number of nodes visited by a search, or zero to
+ *        disable the limit. The default is #LZ77_DEFAULT_SEARCH_DEPTH.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_ustream_set_search_depth(lz77_ustream *ustream, uint16_t depth);
+
+/**
+ * Speeds up the compression of poorly compressible data, skipping the search
+ * of matches where previous searches failed.
+ *
+ * After @em n consecutive searches which found no match, the next
+ * <tt>n * acceleration / 16</tt> positions (but no more than
+ * #LZ77_MAX_ACCELERATION_SKIP) are encoded as literals without being searched,
+ * and they are not added to the binary search tree. The stride grows while
+ * nothing matches, and it returns to a single byte as soon as a match is found.
+ * Matches starting at the skipped positions, or at later positions referring
+ * to them, are lost, so the output is somewhat larger, but the compression
+ * of incompressible regions becomes many times faster.
+ *
+ * @param ustream An input stream, before the compression is started.
+ * @param acceleration The acceleration, or zero (the default) to search every
+ *        position.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_ustream_set_acceleration(lz77_ustream *ustream, uint16_t acceleration);
+
+/**
+ * Adapts the effort of the compression to a target throughput.
+ *
+ * Every 128 KiB of input, the compression measures its throughput and, if it
+ * is below the target, it lowers the search depth and raises the acceleration
+ * (see #lz77_ustream_set_search_depth and #lz77_ustream_set_acceleration);
+ * when it is well above the target, it gradually returns to the values set on
+ * the stream. The throughput is measured on the CPU time of the compressing
+ * thread, so the time spent waiting for the input or for the output (e.g.,
+ * while a socket is full because its reader is slow) does not lower the
+ * effort. To compress blocks of @em n bytes within @em t seconds each, use a
+ * target of <tt>n / t</tt>.
+ *
+ * @param ustream An input stream, before the compression is started.
+ * @param bytes_per_second The target throughput, or zero (the default) to
+ *        always use the search depth and acceleration set on the stream.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_ustream_set_target_throughput(lz77_ustream *ustream, uint64_t bytes_per_second);
+
+/**
+ * Handles the holes of sparse files.
+ *
+ * When compressing, the holes of the input file (found with @c SEEK_HOLE and
+ * @c SEEK_DATA) are not read: each of them is recorded by its length, and the
+ * data following it is compressed in a new member. Only holes of at least
+ * 64 KiB are recorded. When decompressing, the recorded holes are recreated by
+ * seeking the output file (and deallocating any content it already had),
+ * instead of writing zeros; if the output does not support holes, or if this
+ * function is not called, zeros are written.
+ *
+ * @param ustream A stream backed by a descriptor, before the compression or
+ *        decompression is started.
+ * @param sparse A boolean value indicating whether holes are handled.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_ustream_set_sparse(lz77_ustream *ustream, uint8_t sparse);
+
+/**
+ * Resets an input @c lz77_ustream backed by a memory buffer, so that another
+ * buffer can be compressed with the same stream.
+ *
+ * The parameters of the stream (e.g., the search depth) are kept, and so are
+ * its internal structures: compressing many small buffers with a single
+ * stream allocates no memory after the first compression (see
+ * @link alloc.h@endlink).
+ *
+ * @param ustream A stream created with #lz77_ustream_from_memory, which does
+ *        not use a dictionary, hints or checkpoints.
+ * @param data The memory buffer from which data is read.
+ * @param size The size of the buffer.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_ustream_reset(lz77_ustream *ustream, const uint8_t *data, uint32_t size);
+
+/**
+ * Resets an @c lz77_ustream backed by a descriptor, so that it can be used by
+ * another compression (if it is an input stream) or decompression (if it is
+ * an output stream) on a different descriptor.
+ *
+ * The parameters of the stream and its buffers are kept, so that a process
+ * running many jobs on descriptors (e.g., a server) does not set up a new
+ * stream for each of them. The previous descriptor is not closed.
+ *
+ * @param ustream A stream created with #lz77_ustream_from_descriptor or
+ *        #lz77_ustream_to_descriptor, which does not use hints, checkpoints,
+ *        a seek index or a dictionary.
+ * @param fd The descriptor from which data is read, or to which it is
+ *        written.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information. If an invalid argument is
+ *         provided, @c errno is set to @c EINVAL and an explanatory string is
+ *         written to the @link lz77_log logger@endlink.
+ */
+int lz77_ustream_reset_descriptor(lz77_ustream *ustream, int fd);
+
 /**
  * Gets the output buffer associated to an @c lz77_ustream bound to a memory
  * buffer.
@@ -121,6 +256,13 @@ lz77_ustream * lz77_ustream_to_descriptor(lz77_cstream *from, int fd);
  */
 uint8_t * lz77_ustream_get_buffer(lz77_ustream *ustream);
 
+/**
+ * Gets the total number of bytes processed, i.e. the number of bytes consumed
+ * from the stream, if opened for reading, or the number of bytes written to
+ * it, if opened for writing.
+ */
+uint64_t lz77_ustream_get_processed_bytes(lz77_ustream *ustream);
+
 /**
  * Frees all resources associated with an @c lz77_ustream.
  */
@@ -0,0 +1,89 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+#include <alloc_internal.h>
+#include <cstream_internal.h>
+#include <ustream_internal.h>
+
+int lz77_ustream_get_alloc_counters(const lz77_ustream *ustream, lz77_alloc_counters *counters)
+{
+    if (ustream == NULL || counters == NULL) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    *counters = ustream->allocations;
+    return 0;
+}
+
+int lz77_cstream_get_alloc_counters(const lz77_cstream *cstream, lz77_alloc_counters *counters)
+{
+    if (cstream == NULL || counters == NULL) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    *counters = cstream->allocations;
+    return 0;
+}
+
+void alloc_record(lz77_alloc_counters *counters, size_t size)
+{
+    assert(counters != NULL);
+
+    counters->allocations++;
+    counters->bytes += size;
+}
+
+void * alloc_malloc(lz77_alloc_counters *counters, size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr != NULL) {
+        alloc_record(counters, size);
+    }
+    return ptr;
+}
+
+void * alloc_calloc(lz77_alloc_counters *counters, size_t count, size_t size)
+{
+    void *ptr = calloc(count, size);
+    if (ptr != NULL) {
+        alloc_record(counters, count * size);
+    }
+    return ptr;
+}
+
+void * alloc_realloc(lz77_alloc_counters *counters, void *ptr, size_t size)
+{
+    assert(counters != NULL);
+
+    void *temp = realloc(ptr, size);
+    if (temp != NULL) {
+        counters->reallocations++;
+        counters->bytes += size;
+    }
+    return temp;
+}
+
+void alloc_add(lz77_alloc_counters *counters, const lz77_alloc_counters *other)
+{
+    assert(counters != NULL && other != NULL);
+
+    counters->allocations += other->allocations;
+    counters->reallocations += other->reallocations;
+    counters->bytes += other->bytes;
+}
@@ -0,0 +1,49 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file alloc_internal.h
+ *
+ * Allocation functions which update the counters of a stream.
+ */
+
+#ifndef _LZ77_ALLOC_INTERNAL_H_
+#define _LZ77_ALLOC_INTERNAL_H_
+
+#include <stddef.h>
+
+#include <lz77ppm/alloc.h>
+
+/**
+ * Records an allocation of @c size bytes made without the functions below
+ * (i.e., the allocation of the stream itself).
+ */
+void alloc_record(lz77_alloc_counters *counters, size_t size);
+
+/**
+ * Like @c malloc, counting the allocation if it succeeds.
+ */
+void * alloc_malloc(lz77_alloc_counters *counters, size_t size);
+
+/**
+ * Like @c calloc, counting the allocation if it succeeds.
+ */
+void * alloc_calloc(lz77_alloc_counters *counters, size_t count, size_t size);
+
+/**
+ * Like @c realloc, counting the reallocation if it succeeds.
+ */
+void * alloc_realloc(lz77_alloc_counters *counters, void *ptr, size_t size);
+
+/**
+ * Adds the allocations counted separately (e.g., by another thread) to the
+ * counters of a stream.
+ */
+void alloc_add(lz77_alloc_counters *counters, const lz77_alloc_counters *other);
+
+#endif
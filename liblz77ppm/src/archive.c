@@ -0,0 +1,185 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _DEFAULT_SOURCE  // Required on Linux for ftruncate()
+#define _BSD_SOURCE      // The same, before glibc 2.19
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+#include <archive.h>
+#include <io.h>
+
+static void discard(archive_writer *writer);
+
+int archive_open(archive_writer *writer, int fd, int index_fd, size_t entry_size, void *last)
+{
+    memset(last, 0, entry_size);
+    off_t index_size = lseek(index_fd, 0, SEEK_END);
+    if (index_size < 0) {
+        return -1;
+    }
+    if (index_size % entry_size != 0) {
+        // Discard an entry being written when the application crashed (its
+        // member is discarded by archive_recover()).
+        off_t whole = index_size - index_size % entry_size;
+        lz77_log(LOG_WARN, "Discarding %llu bytes of an incomplete entry of the index",
+                 (unsigned long long)(index_size - whole));
+        if (ftruncate(index_fd, whole) != 0) {
+            return -1;
+        }
+        index_size = whole;
+    }
+    if (index_size > 0) {
+        if (lseek(index_fd, index_size - entry_size, SEEK_SET) < 0
+                || io_read(index_fd, last, entry_size, 1) != (ssize_t)entry_size) {
+            return -1;
+        }
+    }
+    if (lseek(index_fd, index_size, SEEK_SET) < 0) {
+        return -1;
+    }
+
+    writer->fd = fd;
+    writer->index_fd = index_fd;
+    writer->end = 0;
+    writer->index_size = index_size;
+    return 0;
+}
+
+int archive_recover(archive_writer *writer, uint64_t end)
+{
+    struct stat st;
+    if (fstat(writer->fd, &st) != 0) {
+        return -1;
+    }
+    if ((uint64_t)st.st_size < end) {
+        lz77_log(LOG_ERROR, "The members are shorter than their index");
+        errno = EINVAL;
+        return -1;
+    }
+    if ((uint64_t)st.st_size > end) {
+        lz77_log(LOG_WARN, "Discarding %llu bytes not recorded in the index",
+                 (unsigned long long)(st.st_size - end));
+        if (ftruncate(writer->fd, end) != 0) {
+            return -1;
+        }
+    }
+    if (lseek(writer->fd, end, SEEK_SET) < 0) {
+        return -1;
+    }
+
+    writer->end = end;
+    return 0;
+}
+
+int64_t archive_append(archive_writer *writer,
+                       const uint8_t *data,
+                       uint32_t size,
+                       uint16_t window_size,
+                       uint16_t lookahead_size)
+{
+    lz77_ustream *ustream = lz77_ustream_from_memory(data, size, window_size, lookahead_size);
+    if (ustream == NULL) {
+        return -1;
+    }
+    lz77_cstream *cstream = lz77_cstream_to_descriptor(ustream, writer->fd);
+    if (cstream == NULL) {
+        lz77_ustream_free(&ustream);
+        return -1;
+    }
+    int64_t result = lz77_compress(ustream, cstream);
+    lz77_ustream_free(&ustream);
+    lz77_cstream_free(&cstream);
+    if (result < 0) {
+        discard(writer);
+        return -1;
+    }
+    return result;
+}
+
+int archive_commit(archive_writer *writer,
+                   uint64_t member_size,
+                   const void *entries,
+                   size_t size)
+{
+    if (io_write(writer->index_fd, entries, size) < 0) {
+        discard(writer);
+        return -1;
+    }
+
+    writer->end += member_size;
+    writer->index_size += size;
+    return 0;
+}
+
+int64_t archive_load(int fd, uint64_t offset, uint64_t size, uint8_t **data)
+{
+    if (size > UINT32_MAX) {
+        lz77_log(LOG_ERROR, "A compressed member is too large");
+        errno = EFBIG;
+        return -1;
+    }
+
+    uint8_t *compressed = malloc(size > 0 ? size : 1);
+    if (compressed == NULL) {
+        return -1;
+    }
+    if (lseek(fd, offset, SEEK_SET) < 0
+            || io_read(fd, compressed, size, 1) != (ssize_t)size) {
+        lz77_log(LOG_ERROR, "Cannot read a compressed member");
+        int error = errno;
+        free(compressed);
+        errno = error;
+        return -1;
+    }
+
+    int64_t result = -1;
+    lz77_cstream *cstream = lz77_cstream_from_memory(compressed, size);
+    lz77_ustream *ustream = cstream ? lz77_ustream_to_memory(cstream, NULL, 0, 1) : NULL;
+    if (ustream != NULL) {
+        result = lz77_decompress(cstream, ustream);
+    }
+    int error = errno;
+    uint8_t *buffer = ustream ? lz77_ustream_get_buffer(ustream) : NULL;
+    lz77_ustream_free(&ustream);
+    lz77_cstream_free(&cstream);
+    free(compressed);
+    if (result < 0) {
+        free(buffer);
+        errno = error;
+        return -1;
+    }
+
+    *data = buffer;
+    return result;
+}
+
+/*
+ * Removes the part of a member (and of its entries) written by a failed
+ * flush, so that the data are written again by the next one, at the same
+ * offset. The value of @c errno is preserved.
+ */
+static void discard(archive_writer *writer)
+{
+    int error = errno;
+    off_t end = writer->end;
+    off_t index_size = writer->index_size;
+    if (ftruncate(writer->fd, end) != 0 || lseek(writer->fd, end, SEEK_SET) < 0
+            || ftruncate(writer->index_fd, index_size) != 0
+            || lseek(writer->index_fd, index_size, SEEK_SET) < 0) {
+        lz77_log(LOG_ERROR, "Cannot discard the member of a failed flush");
+    }
+    errno = error;
+}
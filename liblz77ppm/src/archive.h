@@ -0,0 +1,122 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file archive.h
+ *
+ * Routines shared by the containers (journals and solid archives) made of a
+ * file of independently compressed members and of an index of fixed-size
+ * entries describing them.
+ *
+ * A member is always written before its entries, so that the index never
+ * refers to incomplete data, and a writer recovers from a crash by discarding
+ * whatever follows the last whole entry of the index and the member it
+ * describes.
+ */
+
+#ifndef _LZ77_ARCHIVE_H_
+#define _LZ77_ARCHIVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The files of a container being appended to.
+ */
+typedef struct {
+    /** The descriptor of the file of members. */
+    int fd;
+    /** The descriptor of the index. */
+    int index_fd;
+    /** The size of the file of members (i.e., the offset of the next one). */
+    uint64_t end;
+    /** The size of the index (i.e., the offset of the next entry). */
+    uint64_t index_size;
+} archive_writer;
+
+/**
+ * Opens the index of a container for appending.
+ *
+ * An incomplete entry at the end of the index (e.g., because the application
+ * crashed while writing it) is discarded, and the index is positioned at its
+ * end. The caller then finds the end of the last member from @c last and
+ * calls #archive_recover.
+ *
+ * @param writer The writer to be initialized.
+ * @param entry_size The size of an entry of the index.
+ * @param last Must point to a buffer of @c entry_size bytes that will be set
+ *        to the last entry of the index, or zeroed if the index is empty.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int archive_open(archive_writer *writer, int fd, int index_fd, size_t entry_size, void *last);
+
+/**
+ * Discards the data following the last member recorded in the index (e.g.,
+ * because the application crashed while flushing it), and positions the file
+ * of members at its end.
+ *
+ * @param end The end of the last member recorded in the index.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred
+ *         (@c EINVAL if the file is shorter than @c end). See @c errno for
+ *         further information.
+ */
+int archive_recover(archive_writer *writer, uint64_t end);
+
+/**
+ * Compresses a buffer into a new member, appended to the file of members.
+ *
+ * The member is not part of the container until #archive_commit is called.
+ * In case of error, whatever was written is removed.
+ *
+ * @return The size of the member, or a negative value if an error occurred.
+ *         See @c errno for further information.
+ */
+int64_t archive_append(archive_writer *writer,
+                       const uint8_t *data,
+                       uint32_t size,
+                       uint16_t window_size,
+                       uint16_t lookahead_size);
+
+/**
+ * Writes the entries describing the member appended by #archive_append to
+ * the index.
+ *
+ * In case of error, whatever was written is removed, together with the member
+ * itself, so that the same data can be appended again.
+ *
+ * @param member_size The value returned by #archive_append.
+ * @param entries The encoded entries.
+ * @param size The size of @c entries, in bytes.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int archive_commit(archive_writer *writer,
+                   uint64_t member_size,
+                   const void *entries,
+                   size_t size);
+
+/**
+ * Reads and decompresses a member of a container.
+ *
+ * @param fd The descriptor of the file of members.
+ * @param offset The offset of the member in the file.
+ * @param size The size of the member.
+ * @param data Must point to a pointer that will be set to the decompressed
+ *        member, which must be freed by the caller.
+ *
+ * @return The size of the decompressed member, or a negative value if an
+ *         error occurred (@c EFBIG if the member is too large to be loaded).
+ *         See @c errno for further information.
+ */
+int64_t archive_load(int fd, uint64_t offset, uint64_t size, uint8_t **data);
+
+#endif
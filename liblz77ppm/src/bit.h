@@ -49,4 +49,45 @@ uint8_t bit_get(const uint8_t *bits, int pos);
  */
 void bit_set(uint8_t *bits, int pos, uint8_t state);
 
+/**
+ * Stores a 64-bit word in big-endian byte order at a possibly unaligned
+ * address.
+ *
+ * @param bits The address of the first byte to be written.
+ * @param value The word to be stored. Its most significant byte is written
+ *        at @c bits[0].
+ *
+ * Optimizing compilers translate this function into a byte swap (on
+ * little-endian machines) followed by a single unaligned store.
+ */
+static inline void bit_store_be64(uint8_t *bits, uint64_t value)
+{
+    bits[0] = value >> 56;
+    bits[1] = value >> 48;
+    bits[2] = value >> 40;
+    bits[3] = value >> 32;
+    bits[4] = value >> 24;
+    bits[5] = value >> 16;
+    bits[6] = value >> 8;
+    bits[7] = value;
+}
+
+/**
+ * Loads a 64-bit word stored in big-endian byte order at a possibly unaligned
+ * address.
+ *
+ * @param bits The address of the first byte to be read.
+ *
+ * @return The word, whose most significant byte is read from @c bits[0].
+ *
+ * @see bit_store_be64
+ */
+static inline uint64_t bit_load_be64(const uint8_t *bits)
+{
+    return ((uint64_t)bits[0] << 56) | ((uint64_t)bits[1] << 48)
+         | ((uint64_t)bits[2] << 40) | ((uint64_t)bits[3] << 32)
+         | ((uint64_t)bits[4] << 24) | ((uint64_t)bits[5] << 16)
+         | ((uint64_t)bits[6] << 8)  | (uint64_t)bits[7];
+}
+
 #endif
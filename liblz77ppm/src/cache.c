@@ -0,0 +1,167 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/cache.h>
+#include <lz77ppm/logger.h>
+
+#include <hash.h>
+#include <lru.h>
+
+/**
+ * A cached result. The key of its entry is the hash of the input and of the
+ * parameters.
+ */
+typedef struct {
+    /** The entry in the table (the first member). */
+    lru_entry entry;
+    /** The compressed data. */
+    uint8_t *data;
+    uint32_t size;
+} cache_entry;
+
+struct _lz77_cache {
+    uint64_t seed;
+    lru_table table;
+    /** The last result, if it did not fit into the budget. */
+    uint8_t *uncached;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+static void release_entry(lru_entry *entry);
+
+lz77_cache * lz77_cache_create(size_t budget)
+{
+    lz77_cache *object = calloc(1, sizeof(*object));
+    if (object != NULL) {
+        if (lru_init(&object->table, budget, 64, release_entry) < 0) {
+            free(object);
+            return NULL;
+        }
+        // A different seed for each cache makes the hashes unpredictable from
+        // outside the process.
+        uint64_t values[2] = { (uint64_t)time(NULL), (uint64_t)clock() };
+        uint64_t seed[2];
+        hash_128(values, sizeof(values), (uint64_t)(uintptr_t)object, seed);
+        object->seed = seed[0];
+    }
+    return object;
+}
+
+int64_t lz77_cache_compress(lz77_cache *cache,
+                            const uint8_t *data,
+                            uint32_t size,
+                            uint16_t window_size,
+                            uint16_t lookahead_size,
+                            const uint8_t **compressed)
+{
+    if (cache == NULL || data == NULL || compressed == NULL) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    free(cache->uncached);
+    cache->uncached = NULL;
+
+    uint64_t key[2];
+    uint64_t parameters = (uint64_t)window_size << 16 | lookahead_size;
+    hash_128(data, size, cache->seed ^ parameters, key);
+
+    cache_entry *entry = (cache_entry *)lru_use(&cache->table, key);
+    if (entry != NULL) {
+        cache->hits++;
+        *compressed = entry->data;
+        return entry->size;
+    }
+
+    cache->misses++;
+    lz77_ustream *ustream = lz77_ustream_from_memory(data, size, window_size, lookahead_size);
+    if (ustream == NULL) {
+        return -1;
+    }
+    lz77_cstream *cstream = lz77_cstream_to_memory(ustream, NULL, 0, 1);
+    if (cstream == NULL) {
+        lz77_ustream_free(&ustream);
+        return -1;
+    }
+    int64_t result = lz77_compress(ustream, cstream);
+    uint8_t *output = lz77_cstream_get_buffer(cstream);
+    int error = errno;
+    lz77_ustream_free(&ustream);
+    lz77_cstream_free(&cstream);
+    if (result < 0) {
+        free(output);
+        errno = error;
+        return -1;
+    }
+
+    size_t cost = sizeof(cache_entry) + result;
+    entry = cost <= cache->table.budget ? malloc(sizeof(*entry)) : NULL;
+    if (entry == NULL) {
+        // The result cannot be cached, but it is still returned.
+        cache->uncached = output;
+        *compressed = output;
+        return result;
+    }
+    memcpy(entry->entry.key, key, sizeof(key));
+    entry->entry.cost = cost;
+    entry->data = output;
+    entry->size = result;
+    lru_insert(&cache->table, &entry->entry);
+
+    *compressed = output;
+    return result;
+}
+
+void lz77_cache_get_stats(const lz77_cache *cache, uint64_t *hits, uint64_t *misses, size_t *used)
+{
+    assert(cache != NULL);
+
+    if (hits != NULL) {
+        *hits = cache->hits;
+    }
+    if (misses != NULL) {
+        *misses = cache->misses;
+    }
+    if (used != NULL) {
+        *used = cache->table.used;
+    }
+}
+
+void lz77_cache_free(lz77_cache **pcache)
+{
+    assert(pcache != NULL);
+
+    lz77_cache *cache = *pcache;
+    if (cache == NULL) {
+        return;
+    }
+
+    lru_destroy(&cache->table);
+    free(cache->uncached);
+    free(cache);
+    *pcache = NULL;
+}
+
+/*
+ * Frees an entry evicted from the table, with its compressed data.
+ */
+static void release_entry(lru_entry *entry)
+{
+    cache_entry *cached = (cache_entry *)entry;
+    free(cached->data);
+    free(cached);
+}
@@ -0,0 +1,379 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _DEFAULT_SOURCE  // Required on Linux for htobe64() and be64toh()
+#define _BSD_SOURCE      // The same, before glibc 2.19
+#ifdef __FreeBSD__
+#  include <sys/endian.h>
+#else
+#  include <endian.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+#include <checkpoint_internal.h>
+#include <cstream_internal.h>
+#include <ustream_internal.h>
+#include <alloc_internal.h>
+#include <hash.h>
+#include <io.h>
+
+/** The version of the layout of the checkpoint file. */
+#define CHECKPOINT_VERSION 0x11
+
+/**
+ * Contains the header of a slot of the checkpoint file. All multi-byte fields
+ * are stored in big-endian byte order.
+ *
+ * The header is followed by the nodes of the tree (<tt>window_size + 1</tt>
+ * triplets of 16-bit indices, normalized so that the node at index 0 is
+ * associated to the first byte of the window), by the window (always
+ * @c window_size bytes, of which only the first @c window_currsize are
+ * meaningful) and by the FNV-1a hash of all the preceding bytes of the slot.
+ */
+typedef struct {
+    /** A "magic" identifier, always set to the sequence 'L', 'Z', 'C', 'K'. */
+    uint8_t magic[4];
+    /** The version of the layout of the slot. */
+    uint8_t version;
+    /** The number of valid bits in @c cached. */
+    uint8_t cached_nbits;
+    /** The size of the window. */
+    uint16_t window_size;
+    /** The size of the look-ahead buffer. */
+    uint16_t lookahead_size;
+    /** The current size of the window. */
+    uint16_t window_currsize;
+    /** The number of consecutive searches which found no match. */
+    uint16_t misses;
+    /** The number of positions still to be skipped without searching. */
+    uint16_t skip;
+    /** The sequence number of the checkpoint (the highest is the newest). */
+    uint64_t sequence;
+    /** The number of input bytes consumed. */
+    uint64_t input_offset;
+    /** The number of complete bytes written to the output file. */
+    uint64_t output_offset;
+    /** The bits of the incomplete output byte, left-aligned. */
+    uint64_t cached;
+    /** The size of the input file when the checkpoint was taken. */
+    uint64_t input_size;
+    /** The modification time of the input file, in nanoseconds. */
+    uint64_t input_mtime;
+} checkpoint_header;
+
+static size_t slot_size(uint16_t window_size);
+static int read_slot(int fd, int index, uint8_t *slot, uint16_t window_size,
+                     uint16_t lookahead_size);
+static int stat_input(int fd, uint64_t *size, uint64_t *mtime);
+
+int lz77_checkpoint_enable(lz77_ustream *original, int checkpoint_fd, uint64_t interval)
+{
+    if (original == NULL) {
+        lz77_log(LOG_ERROR, "Argument `original' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (!original->is_input || original->fd < 0) {
+        lz77_log(LOG_ERROR, "Checkpoints require an input stream backed by a descriptor");
+        errno = EINVAL;
+        return -1;
+    }
+    if (checkpoint_fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return -1;
+    }
+    if (interval == 0) {
+        lz77_log(LOG_ERROR, "The checkpoint interval must be greater than zero");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (original->checkpoint_slot == NULL) {
+        original->checkpoint_slot = alloc_malloc(&original->allocations,
+                slot_size(original->window_maxsize));
+        if (original->checkpoint_slot == NULL) {
+            return -1;
+        }
+    }
+    original->checkpoint_fd = checkpoint_fd;
+    original->checkpoint_interval = interval;
+    original->checkpoint_next = original->processed_bytes + interval;
+
+    return 0;
+}
+
+int checkpoint_save(lz77_ustream *original, lz77_cstream *compressed)
+{
+    assert(original != NULL);
+    assert(compressed != NULL);
+    assert(original->checkpoint_interval > 0);
+    assert(original->checkpoint_slot != NULL);
+
+    if (compressed->fd < 0) {
+        lz77_log(LOG_ERROR, "Checkpoints require an output stream backed by a descriptor");
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Make the output durable before writing a checkpoint referring to it.
+    // Only the complete bytes are written: the others are saved in the
+    // checkpoint itself.
+    assert(compressed->end % 8 == 0);
+    if (io_write(compressed->fd, compressed->data, compressed->end / 8) < 0) {
+        return -1;
+    }
+    compressed->end = 0;
+    if (fdatasync(compressed->fd) < 0 && errno != EINVAL) {
+        return -1;
+    }
+
+    uint64_t input_size, input_mtime;
+    if (stat_input(original->fd, &input_size, &input_mtime) < 0) {
+        return -1;
+    }
+
+    uint16_t window_size = original->window_maxsize;
+    uint8_t *slot = original->checkpoint_slot;
+    memset(slot, 0, slot_size(window_size));
+
+    checkpoint_header *header = (checkpoint_header *)slot;
+    memcpy(header->magic, "LZCK", 4);
+    header->version = CHECKPOINT_VERSION;
+    header->cached_nbits = compressed->cached_nbits;
+    header->window_size = htons(window_size);
+    header->lookahead_size = htons(original->lookahead_maxsize);
+    header->window_currsize = htons(original->window_currsize);
+    header->misses = htons(original->misses);
+    header->skip = htons(original->skip);
+    header->sequence = htobe64(original->checkpoint_sequence + 1);
+    header->input_offset = htobe64(original->processed_bytes);
+    header->output_offset = htobe64(compressed->processed_bits / 8);
+    header->cached = htobe64(compressed->cached);
+    header->input_size = htobe64(input_size);
+    header->input_mtime = htobe64(input_mtime);
+
+    // Normalize the tree, so that the first byte of the window is associated
+    // to the node at index 0 (this is where the window will be put when the
+    // checkpoint is restored).
+    lz77_tree *tree = (lz77_tree *)(slot + sizeof(*header));
+    memcpy(tree, original->tree, (window_size + 1) * sizeof(*tree));
+    int x = (original->window - original->cdata) % window_size;
+    lz77_tree_rotate(tree, window_size, x);
+    for (int i = 0; i <= window_size; i++) {
+        tree[i].parent = htons(tree[i].parent);
+        tree[i].smaller = htons(tree[i].smaller);
+        tree[i].larger = htons(tree[i].larger);
+    }
+
+    uint8_t *window = (uint8_t *)(tree + window_size + 1);
+    memcpy(window, original->window, original->window_currsize);
+
+    size_t checked_size = slot_size(window_size) - sizeof(uint64_t);
+    uint64_t checksum = htobe64(hash_fnv1a64(slot, checked_size, HASH_FNV1A64_INIT));
+    memcpy(slot + checked_size, &checksum, sizeof(checksum));
+
+    // Alternate between the two slots, so that the previous checkpoint is
+    // still valid if this one is not completely written.
+    int index = (original->checkpoint_sequence + 1) % 2;
+    off_t position = index * slot_size(window_size);
+    if (lseek(original->checkpoint_fd, position, SEEK_SET) != position
+            || io_write(original->checkpoint_fd, slot, slot_size(window_size)) < 0
+            || fdatasync(original->checkpoint_fd) < 0) {
+        return -1;
+    }
+
+    original->checkpoint_sequence += 1;
+    original->checkpoint_next = original->processed_bytes + original->checkpoint_interval;
+
+    return 0;
+}
+
+int lz77_checkpoint_resume(lz77_ustream *original, lz77_cstream *compressed, int checkpoint_fd)
+{
+    if (original == NULL) {
+        lz77_log(LOG_ERROR, "Argument `original' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (compressed == NULL) {
+        lz77_log(LOG_ERROR, "Argument `compressed' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (!original->is_input || original->fd < 0 || compressed->is_input || compressed->fd < 0) {
+        lz77_log(LOG_ERROR, "Resuming requires streams backed by descriptors");
+        errno = EINVAL;
+        return -1;
+    }
+    if (checkpoint_fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return -1;
+    }
+    // Check that the streams have not been used yet.
+    assert(original->processed_bytes == 0 && original->window_currsize == 0);
+    assert(compressed->processed_bits == 0 && compressed->end == 0);
+
+    uint16_t window_size = original->window_maxsize;
+    uint16_t lookahead_size = original->lookahead_maxsize;
+    size_t size = slot_size(window_size);
+    uint8_t *slot = malloc(2 * size);
+    if (slot == NULL) {
+        return -1;
+    }
+
+    // Pick the newest valid slot.
+    int valid0 = read_slot(checkpoint_fd, 0, slot, window_size, lookahead_size) == 0;
+    int valid1 = read_slot(checkpoint_fd, 1, slot + size, window_size, lookahead_size) == 0;
+    if (!valid0 && !valid1) {
+        lz77_log(LOG_ERROR, "No valid checkpoint found");
+        free(slot);
+        errno = ENOENT;
+        return -1;
+    }
+    if (valid1 && (!valid0 || be64toh(((checkpoint_header *)(slot + size))->sequence)
+            > be64toh(((checkpoint_header *)slot)->sequence))) {
+        memcpy(slot, slot + size, size);
+    }
+
+    checkpoint_header *header = (checkpoint_header *)slot;
+    uint16_t window_currsize = ntohs(header->window_currsize);
+    uint64_t input_offset = be64toh(header->input_offset);
+    uint64_t output_offset = be64toh(header->output_offset);
+
+    // The checkpoint describes a prefix of the input, which must not have
+    // changed since (otherwise, the output would mix the two versions).
+    uint64_t input_size, input_mtime;
+    if (stat_input(original->fd, &input_size, &input_mtime) < 0) {
+        free(slot);
+        return -1;
+    }
+    if (input_size != be64toh(header->input_size)
+            || input_mtime != be64toh(header->input_mtime)) {
+        lz77_log(LOG_ERROR, "The input has changed since the checkpoint was taken");
+        free(slot);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Position the input and truncate the output. Anything written after the
+    // checkpoint is discarded.
+    if (lseek(original->fd, input_offset, SEEK_SET) != (off_t)input_offset
+            || lseek(compressed->fd, output_offset, SEEK_SET) != (off_t)output_offset
+            || ftruncate(compressed->fd, output_offset) < 0) {
+        lz77_log(LOG_ERROR, "Cannot position the streams at the checkpoint");
+        free(slot);
+        return -1;
+    }
+
+    // Restore the state of the compressor. The window is put at the beginning
+    // of the data buffer, where ustream_open() will find it.
+    lz77_tree *tree = (lz77_tree *)(slot + sizeof(*header));
+    for (int i = 0; i <= window_size; i++) {
+        original->tree[i].parent = ntohs(tree[i].parent);
+        original->tree[i].smaller = ntohs(tree[i].smaller);
+        original->tree[i].larger = ntohs(tree[i].larger);
+    }
+    uint8_t *window = (uint8_t *)(tree + window_size + 1);
+    memcpy(original->data, window, window_currsize);
+    original->window = original->data;
+    original->window_currsize = window_currsize;
+    original->processed_bytes = input_offset;
+    original->misses = ntohs(header->misses);
+    original->skip = ntohs(header->skip);
+    original->checkpoint_sequence = be64toh(header->sequence);
+    if (original->checkpoint_interval > 0) {
+        original->checkpoint_next = input_offset + original->checkpoint_interval;
+    }
+
+    compressed->skip_header = 1;
+    compressed->processed_bits = output_offset * 8;
+    compressed->cached = be64toh(header->cached);
+    compressed->cached_nbits = header->cached_nbits;
+
+    free(slot);
+    return 0;
+}
+
+/**
+ * Gets the size of a slot of the checkpoint file.
+ */
+static size_t slot_size(uint16_t window_size)
+{
+    return sizeof(checkpoint_header)
+            + (window_size + 1) * sizeof(lz77_tree)
+            + window_size
+            + sizeof(uint64_t);
+}
+
+/**
+ * Reads and validates a slot of the checkpoint file.
+ *
+ * @return 0 if the slot contains a valid checkpoint for the given parameters,
+ *         or a negative value otherwise.
+ */
+static int read_slot(int fd, int index, uint8_t *slot, uint16_t window_size,
+                     uint16_t lookahead_size)
+{
+    size_t size = slot_size(window_size);
+    off_t position = index * size;
+    if (lseek(fd, position, SEEK_SET) != position) {
+        return -1;
+    }
+    // Keep reading until the whole slot is read, as done for pipes.
+    if (io_read(fd, slot, size, 1) != (ssize_t)size) {
+        return -1;
+    }
+
+    size_t checked_size = size - sizeof(uint64_t);
+    uint64_t checksum;
+    memcpy(&checksum, slot + checked_size, sizeof(checksum));
+    if (be64toh(checksum) != hash_fnv1a64(slot, checked_size, HASH_FNV1A64_INIT)) {
+        return -1;
+    }
+
+    checkpoint_header *header = (checkpoint_header *)slot;
+    if (memcmp(header->magic, "LZCK", 4) != 0 || header->version != CHECKPOINT_VERSION) {
+        return -1;
+    }
+    if (ntohs(header->window_size) != window_size
+            || ntohs(header->lookahead_size) != lookahead_size) {
+        lz77_log(LOG_WARN, "Ignoring a checkpoint taken with different parameters");
+        return -1;
+    }
+    if (ntohs(header->window_currsize) > window_size || header->cached_nbits >= 8) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Gets the size and the modification time (in nanoseconds) of the input file,
+ * which identify the version of the input a checkpoint was taken from.
+ */
+static int stat_input(int fd, uint64_t *size, uint64_t *mtime)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    *size = st.st_size;
+    *mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file checkpoint_internal.h
+ *
+ * Functions used by the compression algorithm to take checkpoints.
+ */
+
+#ifndef _LZ77_CHECKPOINT_INTERNAL_H_
+#define _LZ77_CHECKPOINT_INTERNAL_H_
+
+#include <lz77ppm/checkpoint.h>
+
+/**
+ * Writes a checkpoint describing the current state of a compression.
+ *
+ * It must be called between two tokens, i.e. after the last token consumed
+ * from @c original has been written to @c compressed.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int checkpoint_save(lz77_ustream *original, lz77_cstream *compressed);
+
+#endif
@@ -23,9 +23,11 @@
 #include <lz77ppm/lz77.h>
 #include <lz77ppm/logger.h>
 
+#include <alloc_internal.h>
 #include <cstream_internal.h>
 #include <ustream_internal.h>
 #include <bit.h>
+#include <io.h>
 
 uint8_t * lz77_cstream_get_buffer(lz77_cstream *cstream)
 {
@@ -63,6 +65,7 @@ lz77_cstream * lz77_cstream_from_memory(const uint8_t *data, uint32_t size)
 
     lz77_cstream *object = calloc(1, sizeof(*object));
     if (object != NULL) {
+        alloc_record(&object->allocations, sizeof(*object));
         object->fd = -1;
         object->cdata = data;
         object->size = size;
@@ -82,8 +85,17 @@ lz77_cstream * lz77_cstream_from_descriptor(int fd)
 
     lz77_cstream *object = calloc(1, sizeof(*object));
     if (object != NULL) {
-        int data_size = 1024; // 1 KB
-        uint8_t * data = malloc(data_size);
+        alloc_record(&object->allocations, sizeof(*object));
+        int data_size = io_setup(fd, &object->is_pipe);
+        if (data_size == 0 && io_is_socket(fd)) {
+            object->is_socket = 1;
+            object->low_water = 1;
+            data_size = IO_SOCKET_SIZE;
+        }
+        if (data_size == 0) {
+            data_size = 1024; // 1 KB
+        }
+        uint8_t * data = alloc_malloc(&object->allocations, data_size);
         if (data == NULL) {
             free(object);
             return NULL;
@@ -112,8 +124,12 @@ lz77_cstream * lz77_cstream_to_descriptor(lz77_ustream *from, int fd)
 
     lz77_cstream *object = calloc(1, sizeof(*object));
     if (object != NULL) {
-        int data_size = 1024; // 1 KB
-        uint8_t * data = malloc(data_size);
+        alloc_record(&object->allocations, sizeof(*object));
+        int data_size = io_setup(fd, &object->is_pipe);
+        if (data_size == 0) {
+            data_size = 1024; // 1 KB
+        }
+        uint8_t * data = alloc_malloc(&object->allocations, data_size);
         if (data == NULL) {
             free(object);
             return NULL;
@@ -141,6 +157,7 @@ lz77_cstream * lz77_cstream_to_memory(lz77_ustream *from,
 
     lz77_cstream *object = calloc(1, sizeof(*object));
     if (object != NULL) {
+        alloc_record(&object->allocations, sizeof(*object));
         object->fd = -1;
         object->data = data;
         object->size = data == NULL ? 0 : size;
@@ -151,87 +168,353 @@ lz77_cstream * lz77_cstream_to_memory(lz77_ustream *from,
     return object;
 }
 
+int lz77_cstream_reset(lz77_cstream *cstream, uint8_t *buffer, uint32_t size)
+{
+    if (cstream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `cstream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (cstream->is_input || cstream->fd >= 0) {
+        lz77_log(LOG_ERROR, "Only an output stream backed by a memory buffer can be reset");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (buffer != NULL) {
+        cstream->data = buffer;
+        cstream->size = size;
+    }
+    cstream->pos = 0;
+    cstream->end = 0;
+    cstream->cached = 0;
+    cstream->cached_nbits = 0;
+    cstream->skip_header = 0;
+    cstream->processed_bits = 0;
+    return 0;
+}
+
+int lz77_cstream_reset_descriptor(lz77_cstream *cstream, int fd)
+{
+    if (cstream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `cstream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return -1;
+    }
+    if (cstream->fd < 0) {
+        lz77_log(LOG_ERROR, "Only a stream backed by a descriptor can be reset to another one");
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The buffer, sized for the first descriptor, is kept.
+    cstream->fd = fd;
+    io_setup(fd, &cstream->is_pipe);
+    if (cstream->is_input) {
+        cstream->is_socket = !cstream->is_pipe && io_is_socket(fd);
+        if (cstream->is_socket && cstream->low_water == 0) {
+            cstream->low_water = 1;
+        }
+        cstream->cdata = cstream->data;
+        // The sizes are read again from the header.
+        cstream->window_maxsize = 0;
+        cstream->lookahead_maxsize = 0;
+    }
+    cstream->pos = 0;
+    cstream->end = 0;
+    cstream->cached = 0;
+    cstream->cached_nbits = 0;
+    cstream->skip_header = 0;
+    cstream->processed_bits = 0;
+    return 0;
+}
+
+int lz77_cstream_set_receive(lz77_cstream *cstream,
+                             uint32_t buffer_size,
+                             uint32_t low_water,
+                             uint8_t wait_all,
+                             uint8_t multi_member)
+{
+    if (cstream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `cstream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (!cstream->is_input || !cstream->is_socket) {
+        lz77_log(LOG_ERROR, "Only an input stream backed by a socket can be tuned for receiving");
+        errno = EINVAL;
+        return -1;
+    }
+    if (cstream->end > 0 || cstream->processed_bits > 0) {
+        lz77_log(LOG_ERROR, "The stream has already been used");
+        errno = EINVAL;
+        return -1;
+    }
+    if (buffer_size == 0) {
+        buffer_size = cstream->size;
+    }
+    if (buffer_size < CSTREAM_SLACK_BYTES || low_water == 0 || low_water > buffer_size) {
+        lz77_log(LOG_ERROR, "Invalid buffer size or low-water mark");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (buffer_size != cstream->size) {
+        uint8_t *data = alloc_realloc(&cstream->allocations, cstream->data, buffer_size);
+        if (data == NULL) {
+            return -1;
+        }
+        cstream->cdata = cstream->data = data;
+        cstream->size = buffer_size;
+    }
+    cstream->low_water = low_water;
+    cstream->wait_all = wait_all != 0;
+    cstream->multi_member = multi_member != 0;
+    return 0;
+}
+
+/*
+ * Writes the header of a member, with the window and look-ahead sizes of the
+ * stream.
+ */
+static int write_header(lz77_cstream *cstream)
+{
+    cstream_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "LZ77", 4);
+    header.version = LZ77PPM_VERSION;
+    header.window_size = htons(cstream->window_maxsize);
+    header.lookahead_size = htons(cstream->lookahead_maxsize);
+    if (cstream_write(cstream, &header, sizeof(header)) < 0) {
+        lz77_log(LOG_ERROR, "Cannot write to stream");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Writes the bits of the write cache, padding the last byte with zeros.
+ */
+static int flush_cache(lz77_cstream *cstream)
+{
+    if (cstream->cached_nbits > 0) {
+        uint64_t cached_ordered = htobe64(cstream->cached);
+        int nbytes = (cstream->cached_nbits + 7) / 8;
+        if (cstream_write(cstream, &cached_ordered, nbytes) < 0) {
+            return -1;
+        }
+        cstream->cached = 0;
+        cstream->cached_nbits = 0;
+    }
+    return 0;
+}
+
+/*
+ * Reads the header at the current position of an input stream and sets the
+ * window and look-ahead sizes accordingly.
+ */
+static int read_header(lz77_cstream *cstream)
+{
+    cstream_header header;
+    // memset to zero, since cstream_read requires the buffer to be zeroed.
+    memset(&header, 0, sizeof(header));
+    if (cstream_read(cstream, &header, 0, sizeof(header) * 8) != sizeof(header) * 8) {
+        lz77_log(LOG_ERROR, "Cannot read from stream");
+        return -1;
+    }
+    if (memcmp(header.magic, "LZ77", 4) != 0) {
+        lz77_log(LOG_ERROR, "Invalid file type");
+        errno = 0;
+        return -1;
+    }
+    if (header.version != LZ77PPM_VERSION) {
+        lz77_log(LOG_ERROR, "File compressed with an unsupported program version");
+        errno = 0;
+        return -1;
+    }
+    cstream->window_maxsize = ntohs(header.window_size);
+    if (cstream->window_maxsize < LZ77_MIN_WINDOW_SIZE) {
+        lz77_log(LOG_ERROR, "The compressed file specifies an invalid window size");
+        errno = 0;
+        return -1;
+    }
+    cstream->lookahead_maxsize = ntohs(header.lookahead_size);
+    if (cstream->lookahead_maxsize < LZ77_MIN_LOOKAHEAD_SIZE) {
+        lz77_log(LOG_ERROR, "The compressed file specifies an invalid look-ahead size");
+        errno = 0;
+        return -1;
+    }
+    if (cstream->lookahead_maxsize > cstream->window_maxsize) {
+        lz77_log(LOG_ERROR,
+                "The compressed file specifies a look-ahead bigger than the window");
+        errno = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
 int cstream_open(lz77_cstream *cstream)
 {
     assert(cstream != NULL);
     assert(cstream->pos == 0);
     assert(!cstream->is_input || (cstream->window_maxsize == 0 && cstream->lookahead_maxsize == 0));
 
-    cstream_header header;
-    // memset to zero, since cstream_read requires the buffer to be zeroed.
-    memset(&header, 0, sizeof(header));
     if (cstream->is_input) {
-        if (cstream_read(cstream, &header, 0, sizeof(header) * 8) != sizeof(header) * 8) {
-            lz77_log(LOG_ERROR, "Cannot read from stream");
+        return read_header(cstream);
+    }
+    else if (!cstream->skip_header) {
+        return write_header(cstream);
+    }
+
+    return 0;
+}
+
+int cstream_open_at(lz77_cstream *cstream,
+                    uint16_t window_size,
+                    uint16_t lookahead_size,
+                    uint64_t bit_position)
+{
+    assert(cstream != NULL);
+    assert(cstream->is_input);
+    assert(cstream->pos == 0 && cstream->processed_bits == 0);
+
+    if (cstream->fd >= 0) {
+        off_t offset = bit_position / 8;
+        if (lseek(cstream->fd, offset, SEEK_SET) != offset) {
             return -1;
         }
-        if (memcmp(header.magic, "LZ77", 4) != 0) {
-            lz77_log(LOG_ERROR, "Invalid file type");
+        // Skip the bits of the first byte which belong to the previous token.
+        uint8_t ignored = 0;
+        uint16_t nbits = bit_position % 8;
+        if (nbits > 0 && cstream_read(cstream, &ignored, 0, nbits) != nbits) {
+            lz77_log(LOG_ERROR, "Cannot read from stream");
             errno = 0;
             return -1;
         }
-        if (header.version != LZ77PPM_VERSION) {
-            lz77_log(LOG_ERROR, "File compressed with an unsupported program version");
-            errno = 0;
+    }
+    else {
+        if (bit_position > cstream->end) {
+            lz77_log(LOG_ERROR, "The position is beyond the end of the stream");
+            errno = EINVAL;
             return -1;
         }
-        cstream->window_maxsize = ntohs(header.window_size);
-        if (cstream->window_maxsize < LZ77_MIN_WINDOW_SIZE) {
-            lz77_log(LOG_ERROR, "The compressed file specifies an invalid window size");
+        cstream->pos = bit_position;
+    }
+    cstream->processed_bits = bit_position;
+    cstream->window_maxsize = window_size;
+    cstream->lookahead_maxsize = lookahead_size;
+    return 0;
+}
+
+int cstream_put_hole(lz77_cstream *cstream, uint64_t length)
+{
+    assert(cstream != NULL);
+    assert(!cstream->is_input);
+
+    if (flush_cache(cstream) < 0) {
+        return -1;
+    }
+    cstream_hole hole;
+    memcpy(hole.magic, "LZ0H", 4);
+    length = htobe64(length);
+    memcpy(hole.length, &length, sizeof(length));
+    if (cstream_write(cstream, &hole, sizeof(hole)) < 0) {
+        lz77_log(LOG_ERROR, "Cannot write to stream");
+        return -1;
+    }
+    return write_header(cstream);
+}
+
+int cstream_next_member(lz77_cstream *cstream, uint64_t *hole)
+{
+    assert(cstream != NULL);
+    assert(cstream->is_input);
+
+    // Each member ends with the padding bits of its last byte.
+    uint8_t ignored = 0;
+    uint16_t padding = (8 - cstream->pos % 8) % 8;
+    if (padding > 0 && cstream_read(cstream, &ignored, 0, padding) != padding) {
+        return 0;
+    }
+    // Peeking at the next member would wait for the peer of a socket, which
+    // may have nothing more to send.
+    if (cstream->is_socket && !cstream->multi_member) {
+        return 0;
+    }
+
+    // A hole record may precede the header.
+    *hole = 0;
+    uint8_t magic[4] = { 0 };
+    int p = cstream_peek(cstream, magic, 0, sizeof(magic) * 8);
+    if (p < 0) {
+        return -1;
+    }
+    if (p == sizeof(magic) * 8 && memcmp(magic, "LZ0H", 4) == 0) {
+        cstream_hole record;
+        memset(&record, 0, sizeof(record));
+        if (cstream_read(cstream, &record, 0, sizeof(record) * 8) != sizeof(record) * 8) {
+            lz77_log(LOG_ERROR, "Truncated hole record");
             errno = 0;
             return -1;
         }
-        cstream->lookahead_maxsize = ntohs(header.lookahead_size);
-        if (cstream->lookahead_maxsize < LZ77_MIN_LOOKAHEAD_SIZE) {
-            lz77_log(LOG_ERROR, "The compressed file specifies an invalid look-ahead size");
-            errno = 0;
+        memcpy(hole, record.length, sizeof(*hole));
+        *hole = be64toh(*hole);
+        memset(magic, 0, sizeof(magic));
+        p = cstream_peek(cstream, magic, 0, sizeof(magic) * 8);
+        if (p < 0) {
             return -1;
         }
-        if (cstream->lookahead_maxsize > cstream->window_maxsize) {
-            lz77_log(LOG_ERROR,
-                    "The compressed file specifies a look-ahead bigger than the window");
+    }
+
+    // Anything not starting with the magic of a header is not a member: it is
+    // ignored, as were trailing bytes before multi-member streams existed.
+    if (p < (int)sizeof(magic) * 8 || memcmp(magic, "LZ77", 4) != 0) {
+        if (*hole > 0) {
+            lz77_log(LOG_ERROR, "A hole record is not followed by a member");
             errno = 0;
             return -1;
         }
-    }
-    else {
-        memcpy(header.magic, "LZ77", 4);
-        header.version = LZ77PPM_VERSION;
-        header.window_size = htons(cstream->window_maxsize);
-        header.lookahead_size = htons(cstream->lookahead_maxsize);
-        if (cstream_write(cstream, &header, sizeof(header)) < 0) {
-            lz77_log(LOG_ERROR, "Cannot write to stream");
-            return -1;
+        if (p > 0) {
+            lz77_log(LOG_WARN, "Ignoring trailing garbage after the compressed data");
         }
+        return 0;
     }
 
-    return 0;
+    uint16_t window_maxsize = cstream->window_maxsize;
+    uint16_t lookahead_maxsize = cstream->lookahead_maxsize;
+    if (read_header(cstream) < 0) {
+        return -1;
+    }
+    if (cstream->window_maxsize != window_maxsize
+            || cstream->lookahead_maxsize != lookahead_maxsize) {
+        lz77_log(LOG_ERROR,
+                "The members of the compressed file use different window or look-ahead sizes");
+        errno = 0;
+        return -1;
+    }
+
+    return 1;
 }
 
 int cstream_close(lz77_cstream *cstream)
 {
     assert(cstream != NULL);
 
-    if (cstream->cached_nbits > 0) {
-        uint64_t cached_ordered = htobe64(cstream->cached);
-        int nbytes = (cstream->cached_nbits + 7) / 8;
-        cstream_write(cstream, &cached_ordered, nbytes);
-        cstream->cached_nbits = 0;
+    if (flush_cache(cstream) < 0) {
+        return -1;
     }
 
     if (cstream->fd >= 0) {
         // Flush the data buffer when in output mode.
         if (cstream->is_input == 0) {
-            uint8_t *data = cstream->data;
-            uint32_t count = (cstream->end + 7) / 8;
-            int64_t writecount = 0;
-            while (writecount != count) {
-                writecount = write(cstream->fd, data, count);
-                if (writecount < 0) {
-                    return -1;
-                }
-                data += writecount;
-                count -= writecount;
+            if (io_write(cstream->fd, cstream->data, (cstream->end + 7) / 8) < 0) {
+                return -1;
             }
             cstream->end = 0;
         }
@@ -299,7 +582,24 @@ int cstream_peek(lz77_cstream *cstream, void *buffer, uint16_t startbit, uint16_
             // Try to refill the data buffer.
             end_byte = (cstream->end + 7) / 8;
             int max_count = cstream->size - end_byte;
-            int count = read(cstream->fd, cstream->data + end_byte, max_count);
+            int count;
+            if (cstream->is_socket) {
+                // Wait for the low-water mark (counting the bytes left), and
+                // take everything else already received.
+                uint32_t min_count = 1;
+                if (cstream->wait_all) {
+                    min_count = max_count;
+                } else if (cstream->low_water > (uint32_t)end_byte) {
+                    min_count = cstream->low_water - end_byte;
+                }
+                if (min_count > (uint32_t)max_count) {
+                    min_count = max_count;
+                }
+                count = io_recv(cstream->fd, cstream->data + end_byte, max_count, min_count);
+            } else {
+                count = io_read(cstream->fd, cstream->data + end_byte, max_count,
+                        cstream->is_pipe);
+            }
             if (count < 0) {
                 return count;
             }
@@ -335,6 +635,72 @@ int cstream_consume(lz77_cstream *cstream, uint16_t nbits)
     return nbits;
 }
 
+int cstream_read_token(lz77_cstream *cstream,
+                       lz77_tinyhuff *length_encoder,
+                       uint8_t winoff_bits,
+                       uint16_t *offset,
+                       uint16_t *length,
+                       uint8_t *next)
+{
+    assert(cstream != NULL);
+    assert(length_encoder != NULL);
+    assert(cstream->is_input);
+
+    // Get the next bit from the compressed data to determine if there is
+    // a phrase or a symbol token.
+    uint64_t bits;
+    if (cstream_peek_bits(cstream, &bits, LZ77_TYPE_BITS) != LZ77_TYPE_BITS) {
+        return -1;
+    }
+    cstream_consume(cstream, LZ77_TYPE_BITS);
+
+    *length = 0;
+    if (bits) {
+        if (cstream_peek_bits(cstream, &bits, winoff_bits) != winoff_bits) {
+            return -1;
+        }
+        cstream_consume(cstream, winoff_bits);
+        *offset = bits;
+
+        // The code of the terminating token may be followed by its padding
+        // only: on a socket, try the bits already received first, so that
+        // the stream does not wait for bits that the peer will never send.
+        uint64_t code;
+        uint16_t peek;
+        int c = 0;
+        uint64_t available = cstream->end - cstream->pos;
+        if (cstream->is_socket && available > 0 && available < sizeof(peek) * 8) {
+            cstream_peek_bits(cstream, &code, available);
+            peek = code << (sizeof(peek) * 8 - available);
+            c = tinyhuff_decode(length_encoder, &peek, available, length);
+        }
+        if (c == 0) {
+            int p = cstream_peek_bits(cstream, &code, sizeof(peek) * 8);
+            if (p < 0) {
+                return -1;
+            }
+            peek = code;
+            c = tinyhuff_decode(length_encoder, &peek, p, length);
+        }
+        if (c <= 0) {
+            // EOF in the middle of the length code, or invalid code.
+            return -1;
+        }
+        cstream_consume(cstream, c);
+
+        // A phrase of length zero is the terminating token.
+        return *length != 0;
+    }
+    else {
+        if (cstream_peek_bits(cstream, &bits, LZ77_NEXT_BITS) != LZ77_NEXT_BITS) {
+            return -1;
+        }
+        cstream_consume(cstream, LZ77_NEXT_BITS);
+        *next = bits;
+        return 1;
+    }
+}
+
 int cstream_write_bits(lz77_cstream *cstream,
                        const uint64_t *reg,
                        uint16_t startbit,
@@ -363,7 +729,7 @@ int cstream_write_bits(lz77_cstream *cstream,
 
     uint64_t value = *reg;
     value = value >> (sizeof(value) * 8 - startbit - nbits);
-    value = value & ((1 << nbits) - 1);
+    value = value & (((uint64_t)1 << nbits) - 1);
     value = value << (sizeof(value) * 8 - nbits - cstream->cached_nbits);
     cstream->cached |= value;
     cstream->cached_nbits += nbits;
@@ -380,42 +746,8 @@ int cstream_write(lz77_cstream *cstream, const void *buffer, uint32_t nbytes)
     // We should have written multiple of bytes to the output stream.
     assert(cstream->end % 8 == 0);
 
-    if (cstream->end / 8 + nbytes > cstream->size) {
-        if (cstream->fd >= 0) {
-            uint8_t *data = cstream->data;
-            uint32_t count = cstream->end / 8;
-            int64_t writecount = 0;
-            while (writecount != count) {
-                writecount = write(cstream->fd, data, count);
-                if (writecount < 0) {
-                    return -1;
-                }
-                data += writecount;
-                count -= writecount;
-            }
-            cstream->end = 0;
-        }
-        else {
-            if (cstream->can_realloc == 0) {
-                errno = ENOMEM;
-                return -1;
-            }
-            uint32_t new_size = cstream->end / 8 + nbytes;
-            if (new_size < 1024) {
-                new_size = 1024;
-            }
-            if (new_size < cstream->size * 1.1) {
-                new_size = cstream->size * 1.1;
-            }
-            uint8_t *temp = realloc(cstream->data, new_size);
-            if (temp == NULL) {
-                free(cstream->data);
-                cstream->data = NULL;
-                return -1;
-            }
-            cstream->size = new_size;
-            cstream->data = temp;
-        }
+    if (cstream_reserve(cstream, nbytes) < 0) {
+        return -1;
     }
     assert(cstream->end / 8 + nbytes <= cstream->size);
 
@@ -426,3 +758,92 @@ int cstream_write(lz77_cstream *cstream, const void *buffer, uint32_t nbytes)
 
     return 0;
 }
+
+int cstream_reserve(lz77_cstream *cstream, uint32_t nbytes)
+{
+    assert(cstream != NULL);
+    assert(!cstream->is_input);
+    assert(cstream->end % 8 == 0);
+
+    if (cstream->end / 8 + nbytes <= cstream->size) {
+        return 0;
+    }
+
+    if (cstream->fd >= 0) {
+        if (io_write(cstream->fd, cstream->data, cstream->end / 8) < 0) {
+            return -1;
+        }
+        cstream->end = 0;
+        assert(nbytes <= cstream->size);
+    }
+    else {
+        if (cstream->can_realloc == 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        uint32_t new_size = cstream->end / 8 + nbytes;
+        if (new_size < 1024) {
+            new_size = 1024;
+        }
+        if (new_size < cstream->size * 1.1) {
+            new_size = cstream->size * 1.1;
+        }
+        uint8_t *temp = alloc_realloc(&cstream->allocations, cstream->data, new_size);
+        if (temp == NULL) {
+            free(cstream->data);
+            cstream->data = NULL;
+            return -1;
+        }
+        cstream->size = new_size;
+        cstream->data = temp;
+    }
+
+    return 0;
+}
+
+int cstream_peek_bits_slow(lz77_cstream *cstream, uint64_t *bits, uint8_t nbits)
+{
+    assert(cstream != NULL);
+    assert(cstream->is_input);
+
+    // Near the end of the buffer: let cstream_peek() refill it (when the
+    // stream is backed by a descriptor) and extract the bits one by one.
+    uint8_t buffer[sizeof(*bits)];
+    memset(buffer, 0, sizeof(buffer));
+    int i = 0;
+    while (i < nbits) {
+        int ii = cstream_peek(cstream, buffer, 0, nbits);
+        if (ii < 0) {
+            return ii;
+        }
+        if (ii == i) {
+            break;  // EOF.
+        }
+        i = ii;
+    }
+    *bits = bit_load_be64(buffer) >> (sizeof(*bits) * 8 - nbits);
+    return i;
+}
+
+int cstream_put_bits_slow(lz77_cstream *cstream, uint64_t bits, uint8_t nbits)
+{
+    assert(cstream != NULL);
+    assert(!cstream->is_input);
+
+    if (cstream->cached_nbits < 8) {
+        int result = cstream_reserve(cstream, CSTREAM_SLACK_BYTES);
+        if (result == 0) {
+            return cstream_put_bits(cstream, bits, nbits);
+        }
+        if (errno != ENOMEM || cstream->can_realloc) {
+            return result;
+        }
+    }
+
+    // A fixed-size buffer is almost full: the unaligned stores performed by
+    // cstream_put_bits() would overflow it, so fall back to the byte-exact
+    // (slower) writer. Since the free space in the buffer cannot grow, every
+    // subsequent call will end up here as well.
+    uint16_t startbit = sizeof(bits) * 8 - nbits;
+    return cstream_write_bits(cstream, &bits, startbit, nbits);
+}
@@ -15,8 +15,14 @@
 #ifndef _LZ77_CSTREAM_INTERNAL_H_
 #define _LZ77_CSTREAM_INTERNAL_H_
 
+#include <assert.h>
+
+#include <lz77ppm/alloc.h>
 #include <lz77ppm/cstream.h>
 
+#include <bit.h>
+#include <tinyhuff.h>
+
 /**
  * Represents a stream containing compressed data.
  *
@@ -99,6 +105,41 @@ struct _lz77_cstream {
      * (and thus used for input by the decompression algorithm).
      */
     uint8_t is_input;
+    /**
+     * A boolean value indicating whether @c fd refers to a pipe. Pipes are
+     * read until the internal buffer is full, instead of accepting the
+     * (possibly very small) chunks returned by a single @c read.
+     */
+    uint8_t is_pipe;
+    /**
+     * A boolean value indicating whether @c fd refers to a socket, which is
+     * read with @c recv in batches bounded by @c low_water.
+     *
+     * @see #lz77_cstream_set_receive
+     */
+    uint8_t is_socket;
+    /**
+     * A boolean value indicating that each refill from a socket waits until
+     * the whole buffer is filled.
+     */
+    uint8_t wait_all;
+    /**
+     * The number of bytes that must be buffered before a refill from a socket
+     * returns (unless the peer shuts the connection down).
+     */
+    uint32_t low_water;
+    /**
+     * A boolean value indicating that the members following the first one are
+     * read from a socket (otherwise nothing is read past the end of the first
+     * member, so that the stream never waits for data not sent by the peer).
+     */
+    uint8_t multi_member;
+    /**
+     * A boolean value indicating that the header has already been written to
+     * the output (e.g., when resuming a compression from a checkpoint), so
+     * that #cstream_open must not write it again.
+     */
+    uint8_t skip_header;
     /**
      * The maximum size of the sliding window.
      */
@@ -117,8 +158,34 @@ struct _lz77_cstream {
      * processed_bits).
      */
     uint64_t processed_bits;
+    /**
+     * The allocations made on behalf of the stream.
+     *
+     * @see #lz77_cstream_get_alloc_counters
+     */
+    lz77_alloc_counters allocations;
 };
 
+/**
+ * The number of bytes that must be available in the output buffer, starting
+ * from the position of the next byte to be written, for #cstream_put_bits to
+ * store a whole 64-bit word.
+ */
+#define CSTREAM_SLACK_BYTES 8
+
+/**
+ * The maximum number of bits that can be written with a single call to
+ * #cstream_put_bits.
+ */
+#define CSTREAM_PUT_MAX_BITS 56
+
+/**
+ * The maximum number of bits that can be peeked with a single call to
+ * #cstream_peek_bits (a 64-bit word shifted by up to 7 bits still holds
+ * them).
+ */
+#define CSTREAM_PEEK_MAX_BITS 56
+
 /**
  * Contains the header written to the compressed output file.
  */
@@ -138,6 +205,17 @@ typedef struct {
     uint16_t lookahead_size;
 } cstream_header;
 
+/**
+ * Contains a record written between two members, standing for a run of zero
+ * bytes (a hole of a sparse file) which precedes the data of the second one.
+ */
+typedef struct {
+    /** A "magic" identifier, always set to the sequence 'L', 'Z', '0', 'H'. */
+    uint8_t magic[4];
+    /** The number of zero bytes, as a big-endian 64-bit integer. */
+    uint8_t length[8];
+} cstream_hole;
+
 /**
  * Opens an @c lz77_cstream, initializing its internal data structures.
  *
@@ -151,6 +229,49 @@ typedef struct {
  */
 int cstream_open(lz77_cstream *cstream);
 
+/**
+ * Opens an input @c lz77_cstream in the middle of the compressed data, instead
+ * of at its header, e.g. to resume a decompression from a seek index.
+ *
+ * @param cstream The stream, which must not have been used yet.
+ * @param window_size The size of the window, as given by the header.
+ * @param lookahead_size The size of the look-ahead buffer, as given by the
+ *        header.
+ * @param bit_position The position of the next token, in bits from the
+ *        beginning of the compressed data. A stream backed by a descriptor
+ *        must refer to a seekable file.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int cstream_open_at(lz77_cstream *cstream,
+                    uint16_t window_size,
+                    uint16_t lookahead_size,
+                    uint64_t bit_position);
+
+/**
+ * Skips the padding at the end of the member just decoded and reads the header
+ * of the next one, if any.
+ *
+ * @param hole Set to the number of zero bytes preceding the data of the next
+ *        member, if it is preceded by a hole record (zero otherwise).
+ *
+ * @return 1 if a new member starts, 0 at the end of the stream, or a negative
+ *         value in case of error.
+ */
+int cstream_next_member(lz77_cstream *cstream, uint64_t *hole);
+
+/**
+ * Ends the member being written (whose terminating token has already been
+ * written), writes a hole record and starts a new member.
+ *
+ * @param length The number of zero bytes of the hole.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int cstream_put_hole(lz77_cstream *cstream, uint64_t length);
+
 /**
  * Closes an @c lz77_cstream, releasing internal resources.
  *
@@ -227,6 +348,29 @@ int cstream_write_bits(lz77_cstream *cstream,
                        uint16_t startbit,
                        uint16_t nbits);
 
+/**
+ * Reads an LZ77 token.
+ *
+ * @param length_encoder The encoder of the lengths of the phrases.
+ * @param winoff_bits The number of bits of an offset in the window.
+ * @param offset Must point to an integer that will be set to the offset of a
+ *        phrase token. It is left untouched for a symbol token.
+ * @param length Must point to an integer that will be set to the length of a
+ *        phrase token, or to zero for a symbol token.
+ * @param next Must point to a byte that will be set to the symbol of a symbol
+ *        token. It is left untouched for a phrase token.
+ *
+ * @return 1 if a phrase or a symbol token was read, 0 if the terminating token
+ *         was read, or a negative value in case of error (including a stream
+ *         truncated in the middle of a token).
+ */
+int cstream_read_token(lz77_cstream *cstream,
+                       lz77_tinyhuff *length_encoder,
+                       uint8_t winoff_bits,
+                       uint16_t *offset,
+                       uint16_t *length,
+                       uint8_t *next);
+
 /**
  * Writes bytes to an @c lz77_cstream from a buffer.
  *
@@ -240,4 +384,106 @@ int cstream_write_bits(lz77_cstream *cstream,
  */
 int cstream_write(lz77_cstream *cstream, const void *buffer, uint32_t nbytes);
 
+/**
+ * Ensures that the output buffer of an @c lz77_cstream can accommodate at
+ * least @c nbytes more bytes, flushing it to the descriptor or reallocating
+ * it if needed.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred.
+ *         If the buffer is full and cannot be reallocated, @c errno is set to
+ *         @c ENOMEM.
+ */
+int cstream_reserve(lz77_cstream *cstream, uint32_t nbytes);
+
+/**
+ * Handles the cases which #cstream_put_bits cannot deal with by itself, i.e.
+ * when the output buffer must be flushed or reallocated, or when it is a
+ * fixed-size buffer which is almost full. Do not call it directly.
+ */
+int cstream_put_bits_slow(lz77_cstream *cstream, uint64_t bits, uint8_t nbits);
+
+/**
+ * Handles the cases which #cstream_peek_bits cannot deal with by itself, i.e.
+ * when less than 8 bytes are buffered and the buffer must be refilled, or the
+ * end of the stream is near. Do not call it directly.
+ */
+int cstream_peek_bits_slow(lz77_cstream *cstream, uint64_t *bits, uint8_t nbits);
+
+/**
+ * Appends bits to an @c lz77_cstream.
+ *
+ * @param bits An integer containing the bits to be written, right-aligned.
+ *        All the bits above the lowest @c nbits ones must be zero.
+ * @param nbits The number of bits to write (from 1 to #CSTREAM_PUT_MAX_BITS).
+ *
+ * @return 0 in case of success, or a negative value if an error occurred.
+ *         See @c errno for further information.
+ *
+ * This is the writer used in the inner loop of the compression algorithm.
+ * The bits are appended to the write cache, which always holds less than a
+ * byte between two calls; then the whole cache is stored as a single 64-bit
+ * word at the current end of the output buffer, and the end is advanced by
+ * the number of complete bytes. Bytes past the new end are garbage which will
+ * be overwritten by the next store. As long as the buffer has
+ * #CSTREAM_SLACK_BYTES free bytes, no function is called and no branch is
+ * taken.
+ *
+ * Do not mix with #cstream_write_bits on the same stream (except for the
+ * fallback performed internally by #cstream_put_bits_slow).
+ */
+static inline int cstream_put_bits(lz77_cstream *cstream, uint64_t bits, uint8_t nbits)
+{
+    assert(cstream != NULL);
+    assert(!cstream->is_input);
+    assert(0 < nbits && nbits <= CSTREAM_PUT_MAX_BITS);
+    assert((bits >> nbits) == 0);
+
+    if (cstream->end / 8 + CSTREAM_SLACK_BYTES > cstream->size) {
+        return cstream_put_bits_slow(cstream, bits, nbits);
+    }
+    assert(cstream->cached_nbits < 8);
+
+    uint8_t total = cstream->cached_nbits + nbits;
+    uint64_t cached = cstream->cached | (bits << (sizeof(cached) * 8 - total));
+    bit_store_be64(cstream->data + cstream->end / 8, cached);
+
+    uint8_t nbytes = total / 8;
+    cstream->end += nbytes * 8;
+    cstream->processed_bits += nbytes * 8;
+    cstream->cached = cached << (nbytes * 8);
+    cstream->cached_nbits = total % 8;
+
+    return 0;
+}
+
+/**
+ * Peeks the next bits of an input stream, without consuming them.
+ *
+ * @param bits Must point to an integer that will be set to the bits peeked,
+ *        right-aligned (the first bit of the stream is the most significant
+ *        one). Bits past the end of the stream are set to zero.
+ * @param nbits The number of bits to be peeked (at most
+ *        #CSTREAM_PEEK_MAX_BITS).
+ *
+ * @return The number of bits actually available (less than @c nbits only at
+ *         the end of the stream), or a negative value in case of error.
+ *
+ * As long as at least 8 bytes are buffered, the bits are extracted with a
+ * single load and two shifts; otherwise the buffer is refilled first.
+ */
+static inline int cstream_peek_bits(lz77_cstream *cstream, uint64_t *bits, uint8_t nbits)
+{
+    assert(cstream != NULL);
+    assert(cstream->is_input);
+    assert(0 < nbits && nbits <= CSTREAM_PEEK_MAX_BITS);
+
+    if (cstream->pos / 8 + sizeof(*bits) > cstream->end / 8) {
+        return cstream_peek_bits_slow(cstream, bits, nbits);
+    }
+
+    uint64_t word = bit_load_be64(cstream->cdata + cstream->pos / 8);
+    *bits = (word << (cstream->pos % 8)) >> (sizeof(word) * 8 - nbits);
+    return nbits;
+}
+
 #endif
@@ -0,0 +1,371 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _DEFAULT_SOURCE  // Required on Linux for htobe64() and be64toh()
+#define _BSD_SOURCE      // The same, before glibc 2.19
+#ifdef __FreeBSD__
+#  include <sys/endian.h>
+#else
+#  include <endian.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+#include <dictionary_internal.h>
+#include <ustream_internal.h>
+#include <alloc_internal.h>
+#include <hash.h>
+#include <io.h>
+
+/** The version of the layout of the image of a dictionary. */
+#define DICTIONARY_VERSION 0x10
+
+/**
+ * Contains the header of the image of a dictionary. All multi-byte fields are
+ * stored in big-endian byte order.
+ *
+ * The header is followed by the nodes of the tree (<tt>window_size + 1</tt>
+ * triplets of 16-bit indices, where the node at index 0 is associated to the
+ * first byte of the window), by the window (@c size bytes) and by the FNV-1a
+ * hash of all the preceding bytes of the image.
+ */
+typedef struct {
+    /** A "magic" identifier, always set to the sequence 'L', 'Z', 'D', 'I'. */
+    uint8_t magic[4];
+    /** The version of the layout of the image. */
+    uint8_t version;
+    /** Reserved for future uses. */
+    uint8_t reserved;
+    /** The size of the window of the compressions. */
+    uint16_t window_size;
+    /** The size of the look-ahead buffer of the compressions. */
+    uint16_t lookahead_size;
+    /** The number of bytes of the dictionary (at most @c window_size). */
+    uint16_t size;
+    /** Reserved for future uses. */
+    uint8_t reserved2[4];
+} dictionary_header;
+
+struct _lz77_dictionary {
+    /** The image of the dictionary. */
+    const uint8_t *image;
+    /** The size of @c image. */
+    size_t image_size;
+    /** The image, if it has been allocated by the library. */
+    uint8_t *allocated;
+    uint16_t window_size;
+    uint16_t lookahead_size;
+    /** The number of bytes of the dictionary. */
+    uint16_t size;
+    /** The tree stored in the image. */
+    const lz77_tree *tree;
+    /** The window stored in the image. */
+    const uint8_t *window;
+};
+
+static size_t image_size(uint16_t window_size, uint16_t size);
+static lz77_dictionary * dictionary_parse(const uint8_t *image, size_t size);
+static void copy_tree(lz77_tree *dest, const lz77_tree *src, int window_size);
+
+lz77_dictionary * lz77_dictionary_create(const uint8_t *data,
+                                         uint32_t size,
+                                         uint16_t window_size,
+                                         uint16_t lookahead_size)
+{
+    if (data == NULL && size > 0) {
+        lz77_log(LOG_ERROR, "Argument `data' must not be NULL");
+        errno = EINVAL;
+        return NULL;
+    }
+    if (size > window_size) {
+        data += size - window_size;
+        size = window_size;
+    }
+
+    // Let the compressor build the tree on the dictionary, as if it were
+    // compressing it (without writing anything).
+    lz77_ustream *ustream = lz77_ustream_from_memory(data ? data : (const uint8_t *)"",
+            size, window_size, lookahead_size);
+    if (ustream == NULL) {
+        return NULL;
+    }
+    if (ustream_open(ustream) < 0) {
+        lz77_ustream_free(&ustream);
+        return NULL;
+    }
+    int count;
+    do {
+        uint16_t offset, length;
+        uint8_t next;
+        count = ustream_find_and_advance(ustream, &offset, &length, &next);
+    } while (count > 0);
+    // The window never slides, since the dictionary fits into it: the node at
+    // index 0 is already associated to its first byte.
+    assert(ustream->window == ustream->cdata);
+    assert(ustream->window_currsize == size);
+
+    size_t total = image_size(window_size, size);
+    uint8_t *image = malloc(total);
+    if (image == NULL) {
+        lz77_ustream_free(&ustream);
+        return NULL;
+    }
+    memset(image, 0, total);
+    dictionary_header *header = (dictionary_header *)image;
+    memcpy(header->magic, "LZDI", 4);
+    header->version = DICTIONARY_VERSION;
+    header->window_size = htons(window_size);
+    header->lookahead_size = htons(lookahead_size);
+    header->size = htons(size);
+
+    lz77_tree *tree = (lz77_tree *)(image + sizeof(*header));
+    for (int i = 0; i <= window_size; i++) {
+        // Nodes beyond the dictionary are not initialized until used.
+        int used = i == window_size || i < (int)size;
+        tree[i].parent = htons(used ? ustream->tree[i].parent : UNUSED);
+        tree[i].smaller = htons(used ? ustream->tree[i].smaller : UNUSED);
+        tree[i].larger = htons(used ? ustream->tree[i].larger : UNUSED);
+    }
+    memcpy(tree + window_size + 1, ustream->window, size);
+    lz77_ustream_free(&ustream);
+
+    size_t checked_size = total - sizeof(uint64_t);
+    uint64_t checksum = htobe64(hash_fnv1a64(image, checked_size, HASH_FNV1A64_INIT));
+    memcpy(image + checked_size, &checksum, sizeof(checksum));
+
+    lz77_dictionary *dictionary = dictionary_parse(image, total);
+    if (dictionary == NULL) {
+        free(image);
+        return NULL;
+    }
+    dictionary->allocated = image;
+    return dictionary;
+}
+
+lz77_dictionary * lz77_dictionary_from_memory(const void *image, size_t size)
+{
+    if (image == NULL) {
+        lz77_log(LOG_ERROR, "Argument `image' must not be NULL");
+        errno = EINVAL;
+        return NULL;
+    }
+    if ((uintptr_t)image % sizeof(uint16_t) != 0) {
+        lz77_log(LOG_ERROR, "The image of the dictionary is not aligned");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    const uint8_t *bytes = image;
+    const dictionary_header *header = image;
+    if (size < sizeof(*header) + sizeof(uint64_t)
+            || memcmp(header->magic, "LZDI", 4) != 0
+            || header->version != DICTIONARY_VERSION) {
+        lz77_log(LOG_ERROR, "The image is not a dictionary");
+        errno = EINVAL;
+        return NULL;
+    }
+    uint16_t window_size = ntohs(header->window_size);
+    if (window_size < LZ77_MIN_WINDOW_SIZE || window_size > LZ77_MAX_WINDOW_SIZE
+            || ntohs(header->lookahead_size) < LZ77_MIN_LOOKAHEAD_SIZE
+            || ntohs(header->size) > window_size
+            || size != image_size(window_size, ntohs(header->size))) {
+        lz77_log(LOG_ERROR, "The header of the dictionary is not valid");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t checked_size = size - sizeof(uint64_t);
+    uint64_t checksum;
+    memcpy(&checksum, bytes + checked_size, sizeof(checksum));
+    if (be64toh(checksum) != hash_fnv1a64(bytes, checked_size, HASH_FNV1A64_INIT)) {
+        lz77_log(LOG_ERROR, "The dictionary is corrupted");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // The indices are used without further checks when a stream is primed.
+    const lz77_tree *tree = (const lz77_tree *)(bytes + sizeof(*header));
+    for (int i = 0; i <= window_size; i++) {
+        uint16_t parent = ntohs(tree[i].parent);
+        uint16_t smaller = ntohs(tree[i].smaller);
+        uint16_t larger = ntohs(tree[i].larger);
+        if ((parent > window_size && parent != UNUSED)
+                || (smaller >= window_size && smaller != UNUSED)
+                || (larger >= window_size && larger != UNUSED)) {
+            lz77_log(LOG_ERROR, "The tree of the dictionary is not valid");
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    return dictionary_parse(bytes, size);
+}
+
+int lz77_dictionary_save(const lz77_dictionary *dictionary, int fd)
+{
+    if (dictionary == NULL) {
+        lz77_log(LOG_ERROR, "Argument `dictionary' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return -1;
+    }
+    return io_write(fd, dictionary->image, dictionary->image_size);
+}
+
+int lz77_dictionary_use(lz77_ustream *ustream, const lz77_dictionary *dictionary)
+{
+    if (ustream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `ustream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (dictionary == NULL) {
+        lz77_log(LOG_ERROR, "Argument `dictionary' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (ustream->processed_bytes != 0 || ustream->window_currsize != 0
+            || ustream->lookahead_currsize != 0) {
+        lz77_log(LOG_ERROR, "The dictionary must be used before the stream is opened");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!ustream->is_input) {
+        if (ustream->fd < 0 && ustream->can_realloc == 0) {
+            lz77_log(LOG_ERROR, "A dictionary requires a reallocatable output buffer");
+            errno = EINVAL;
+            return -1;
+        }
+        // The window size is known only when the stream is opened.
+        ustream->dictionary = dictionary;
+        return 0;
+    }
+
+    if (ustream->window_maxsize != dictionary->window_size
+            || ustream->lookahead_maxsize != dictionary->lookahead_size) {
+        lz77_log(LOG_ERROR,
+                "The dictionary was prepared for a window of %d bytes and a look-ahead "
+                "buffer of %d bytes", dictionary->window_size, dictionary->lookahead_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint16_t size = dictionary->size;
+    if (ustream->fd < 0) {
+        // The window must precede the data: copy both into a new buffer.
+        if (ustream->size > UINT32_MAX - size) {
+            lz77_log(LOG_ERROR, "The input is too large to be primed with a dictionary");
+            errno = EINVAL;
+            return -1;
+        }
+        uint32_t total = ustream->size + size;
+        uint8_t *data = alloc_malloc(&ustream->allocations, total > 0 ? total : 1);
+        if (data == NULL) {
+            return -1;
+        }
+        memcpy(data + size, ustream->cdata, ustream->size);
+        ustream->cdata = ustream->data = data;
+        // The buffer is now owned by the stream.
+        ustream->can_realloc = 1;
+        ustream->size = ustream->end = total;
+        ustream->window = data;
+        ustream->lookahead = data + size;
+    }
+    // Otherwise, ustream_open() will read the input after the window, as
+    // when resuming from a checkpoint.
+    memcpy(ustream->data, dictionary->window, size);
+    ustream->window_currsize = size;
+    copy_tree(ustream->tree, dictionary->tree, dictionary->window_size);
+    return 0;
+}
+
+void lz77_dictionary_free(lz77_dictionary **pdictionary)
+{
+    assert(pdictionary != NULL);
+
+    lz77_dictionary *dictionary = *pdictionary;
+    if (dictionary == NULL) {
+        return;
+    }
+    free(dictionary->allocated);
+    free(dictionary);
+    *pdictionary = NULL;
+}
+
+int dictionary_prime_output(lz77_ustream *ustream)
+{
+    assert(ustream != NULL);
+    assert(!ustream->is_input);
+
+    const lz77_dictionary *dictionary = ustream->dictionary;
+    assert(dictionary != NULL);
+    if (ustream->window_maxsize != dictionary->window_size) {
+        lz77_log(LOG_ERROR,
+                "The dictionary was prepared for a window of %d bytes (the stream uses %d)",
+                dictionary->window_size, ustream->window_maxsize);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ustream_prime(ustream, dictionary->window, dictionary->size);
+}
+
+/**
+ * Gets the size of the image of a dictionary.
+ */
+static size_t image_size(uint16_t window_size, uint16_t size)
+{
+    return sizeof(dictionary_header)
+            + (window_size + 1) * sizeof(lz77_tree)
+            + size
+            + sizeof(uint64_t);
+}
+
+/**
+ * Creates a dictionary referring to a valid image.
+ */
+static lz77_dictionary * dictionary_parse(const uint8_t *image, size_t size)
+{
+    lz77_dictionary *dictionary = calloc(1, sizeof(*dictionary));
+    if (dictionary == NULL) {
+        return NULL;
+    }
+    const dictionary_header *header = (const dictionary_header *)image;
+    dictionary->image = image;
+    dictionary->image_size = size;
+    dictionary->window_size = ntohs(header->window_size);
+    dictionary->lookahead_size = ntohs(header->lookahead_size);
+    dictionary->size = ntohs(header->size);
+    dictionary->tree = (const lz77_tree *)(image + sizeof(*header));
+    dictionary->window = (const uint8_t *)(dictionary->tree + dictionary->window_size + 1);
+    return dictionary;
+}
+
+/**
+ * Copies the tree of a dictionary into the tree of a stream.
+ */
+static void copy_tree(lz77_tree *dest, const lz77_tree *src, int window_size)
+{
+    for (int i = 0; i <= window_size; i++) {
+        dest[i].parent = ntohs(src[i].parent);
+        dest[i].smaller = ntohs(src[i].smaller);
+        dest[i].larger = ntohs(src[i].larger);
+    }
+}
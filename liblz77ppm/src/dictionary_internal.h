@@ -0,0 +1,35 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file dictionary_internal.h
+ *
+ * Internal functions to prime the output of a decompression with a
+ * dictionary.
+ */
+
+#ifndef _LZ77_DICTIONARY_INTERNAL_H_
+#define _LZ77_DICTIONARY_INTERNAL_H_
+
+#include <lz77ppm/dictionary.h>
+
+/**
+ * Copies the dictionary of an output stream to the beginning of its buffer,
+ * as the initial window.
+ *
+ * It must be called when the stream is opened, after the window size has
+ * been taken from the compressed stream and the buffer has been allocated.
+ * The copied bytes are recorded in the @c hidden field of the stream, so that
+ * they are not written to the output.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int dictionary_prime_output(lz77_ustream *ustream);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file effort_internal.h
+ *
+ * Functions used by the compression algorithm to adapt its effort to a
+ * target throughput.
+ */
+
+#ifndef _LZ77_EFFORT_INTERNAL_H_
+#define _LZ77_EFFORT_INTERNAL_H_
+
+#include <lz77ppm/ustream.h>
+
+/**
+ * The number of input bytes between two measurements of the throughput.
+ */
+#define EFFORT_INTERVAL (128 * 1024)
+
+/**
+ * The number of effort levels. The highest level uses the search depth and
+ * the acceleration set on the stream; the lower ones search fewer nodes of the
+ * tree and skip more positions after failed searches, down to level 0, which
+ * barely compresses at all.
+ */
+#define EFFORT_LEVELS 8
+
+/**
+ * Starts measuring the throughput of a compression, at the highest effort
+ * level. Call it before the first token is read from @c original.
+ */
+void effort_start(lz77_ustream *original);
+
+/**
+ * Measures the throughput since the last call (or since #effort_start), and
+ * raises or lowers the effort level accordingly.
+ */
+void effort_adjust(lz77_ustream *original);
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+/**
+ * An asynchronous operation, waiting to be run by an executor.
+ */
+typedef struct {
+    /** A boolean value indicating whether the operation is a compression. */
+    int compress;
+    lz77_ustream *ustream;
+    lz77_cstream *cstream;
+    lz77_completion done;
+    void *argument;
+} async_job;
+
+static int submit(lz77_executor *executor,
+                  int compress,
+                  lz77_ustream *ustream,
+                  lz77_cstream *cstream,
+                  lz77_completion done,
+                  void *argument);
+static void run_job(void *argument);
+
+lz77_executor *lz77_default_executor;
+
+int lz77_compress_async(lz77_executor *executor,
+                        lz77_ustream *original,
+                        lz77_cstream *compressed,
+                        lz77_completion done,
+                        void *argument)
+{
+    return submit(executor, 1, original, compressed, done, argument);
+}
+
+int lz77_decompress_async(lz77_executor *executor,
+                          lz77_cstream *compressed,
+                          lz77_ustream *original,
+                          lz77_completion done,
+                          void *argument)
+{
+    return submit(executor, 0, original, compressed, done, argument);
+}
+
+static int submit(lz77_executor *executor,
+                  int compress,
+                  lz77_ustream *ustream,
+                  lz77_cstream *cstream,
+                  lz77_completion done,
+                  void *argument)
+{
+    if (ustream == NULL || cstream == NULL) {
+        lz77_log(LOG_ERROR, "Streams must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (done == NULL) {
+        lz77_log(LOG_ERROR, "Argument `done' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (executor == NULL) {
+        executor = lz77_default_executor;
+    }
+    if (executor != NULL && executor->submit == NULL) {
+        lz77_log(LOG_ERROR, "The executor has no submit function");
+        errno = EINVAL;
+        return -1;
+    }
+
+    async_job *job = malloc(sizeof(*job));
+    if (job == NULL) {
+        return -1;
+    }
+    job->compress = compress;
+    job->ustream = ustream;
+    job->cstream = cstream;
+    job->done = done;
+    job->argument = argument;
+
+    if (executor == NULL) {
+        run_job(job);
+        return 0;
+    }
+    if (executor->submit(executor, run_job, job) < 0) {
+        int error = errno;
+        free(job);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Runs an operation and reports its result. The job is freed before calling
+ * the completion function, which may free the streams or submit another job.
+ */
+static void run_job(void *argument)
+{
+    async_job job = *(async_job *)argument;
+    free(argument);
+
+    errno = 0;
+    int64_t result = job.compress
+            ? lz77_compress(job.ustream, job.cstream)
+            : lz77_decompress(job.cstream, job.ustream);
+    job.done(result, result < 0 ? errno : 0, job.argument);
+}
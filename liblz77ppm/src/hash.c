@@ -0,0 +1,79 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#include <string.h>
+
+#include <hash.h>
+
+uint64_t hash_fnv1a64(const void *data, size_t size, uint64_t hash)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*
+ * The constants and the rounds of hash_128() are those of XXH64, whose four
+ * lanes are finalized in two different ways to get 128 bits.
+ */
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+
+static uint64_t rotate_left(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t mix_round(uint64_t accumulator, const uint8_t *input)
+{
+    uint64_t value;
+    memcpy(&value, input, sizeof(value));
+    accumulator += value * PRIME2;
+    return rotate_left(accumulator, 31) * PRIME1;
+}
+
+static uint64_t avalanche(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+void hash_128(const void *data, size_t size, uint64_t seed, uint64_t hash[2])
+{
+    const uint8_t *bytes = data;
+    uint64_t lanes[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int j = 0; j < 4; j++) {
+            lanes[j] = mix_round(lanes[j], bytes + i + j * 8);
+        }
+    }
+    // The last block is padded with zeros (the size tells it apart).
+    uint8_t last[32] = { 0 };
+    memcpy(last, bytes + i, size - i);
+    for (int j = 0; j < 4; j++) {
+        lanes[j] = mix_round(lanes[j], last + j * 8);
+    }
+
+    uint64_t h0 = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7)
+            + rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+    uint64_t h1 = (lanes[0] ^ rotate_left(lanes[2], 29)) * PRIME4
+            + (lanes[1] ^ rotate_left(lanes[3], 43)) * PRIME3;
+    hash[0] = avalanche(h0 + size);
+    hash[1] = avalanche(h1 ^ (size * PRIME1));
+}
@@ -0,0 +1,54 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file hash.h
+ *
+ * Non-cryptographic hash functions used to check the integrity of auxiliary
+ * data (such as checkpoints) and to identify data in memory.
+ */
+
+#ifndef _LZ77_HASH_H_
+#define _LZ77_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The initial value for #hash_fnv1a64.
+ */
+#define HASH_FNV1A64_INIT 0xcbf29ce484222325ULL
+
+/**
+ * Computes the 64-bit FNV-1a hash of a buffer.
+ *
+ * @param data The bytes to be hashed.
+ * @param size The number of bytes to be hashed.
+ * @param hash The hash of the preceding data, or #HASH_FNV1A64_INIT when
+ *        starting a new computation. This allows hashing non-contiguous data
+ *        in several steps.
+ *
+ * @return The updated hash.
+ */
+uint64_t hash_fnv1a64(const void *data, size_t size, uint64_t hash);
+
+/**
+ * Computes a 128-bit hash of a buffer, processing 32 bytes at a time.
+ *
+ * It is much faster than #hash_fnv1a64 on large buffers, and long enough to
+ * identify a buffer by its hash. The result depends on the byte order of the
+ * machine, so it must not be stored or exchanged.
+ *
+ * @param data The bytes to be hashed.
+ * @param size The number of bytes to be hashed.
+ * @param seed A value which selects a different hash function.
+ * @param hash Must point to two integers that will be set to the hash.
+ */
+void hash_128(const void *data, size_t size, uint64_t seed, uint64_t hash[2]);
+
+#endif
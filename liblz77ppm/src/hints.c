@@ -0,0 +1,148 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+#include <hints_internal.h>
+#include <cstream_internal.h>
+#include <ustream_internal.h>
+#include <alloc_internal.h>
+
+static int read_phrase(lz77_hints *hints);
+
+int lz77_hints_enable(lz77_ustream *original, lz77_cstream *hints, uint16_t tail)
+{
+    if (original == NULL) {
+        lz77_log(LOG_ERROR, "Argument `original' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (hints == NULL) {
+        lz77_log(LOG_ERROR, "Argument `hints' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (!original->is_input || !hints->is_input) {
+        lz77_log(LOG_ERROR, "Hints require an input stream and a compressed input stream");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (original->hints == NULL) {
+        original->hints = alloc_calloc(&original->allocations, 1, sizeof(*original->hints));
+        if (original->hints == NULL) {
+            return -1;
+        }
+    }
+    original->hints->from = hints;
+    original->hints->tail = tail;
+    return 0;
+}
+
+uint16_t hints_lookup(lz77_hints *hints, uint64_t position, uint64_t *source)
+{
+    assert(hints != NULL);
+    assert(source != NULL);
+
+    while (position >= hints->position && !hints->is_over) {
+        if (read_phrase(hints) < 0) {
+            hints->is_over = 1;
+        }
+    }
+
+    uint64_t phrase_end = hints->phrase_start + hints->phrase_length;
+    if (position < hints->phrase_start || position >= phrase_end) {
+        return 0;
+    }
+    *source = hints->phrase_source + (position - hints->phrase_start);
+    return phrase_end - position;
+}
+
+uint16_t hints_match(lz77_ustream *ustream, uint16_t *offset)
+{
+    assert(ustream != NULL);
+    assert(ustream->hints != NULL);
+    assert(offset != NULL);
+
+    uint64_t position = ustream->processed_bytes;
+    uint64_t source;
+    if (hints_lookup(ustream->hints, position, &source) == 0) {
+        return 0;
+    }
+    // The source must be inside the window (which may be smaller than the
+    // one used by the hint stream).
+    if (source >= position || position - source > ustream->window_currsize) {
+        return 0;
+    }
+
+    int k = ustream->window_currsize - (position - source);
+    uint16_t i = 0;
+    while (i < ustream->lookahead_currsize && ustream->lookahead[i] == ustream->window[k + i]) {
+        i++;
+    }
+    *offset = k;
+    return i;
+}
+
+/*
+ * Reads the tokens of the hint stream up to the next phrase. Returns 0 if a
+ * phrase was read, or -1 if no more phrases are available.
+ */
+static int read_phrase(lz77_hints *hints)
+{
+    if (!hints->is_open) {
+        if (cstream_open(hints->from) < 0) {
+            lz77_log(LOG_WARN, "Cannot read the hint stream: hints are ignored");
+            return -1;
+        }
+        hints->window_nbits = ustream_init_length_encoder(&hints->length_encoder,
+                hints->from->window_maxsize, hints->from->lookahead_maxsize);
+        hints->is_open = 1;
+    }
+
+    while (1) {
+        uint16_t offset = 0, length = 0;
+        uint8_t next;
+        int result = cstream_read_token(hints->from, &hints->length_encoder,
+                hints->window_nbits, &offset, &length, &next);
+        if (result < 0) {
+            lz77_log(LOG_WARN, "The hint stream is corrupted: the rest of it is ignored");
+            return -1;
+        }
+        if (result == 0) {
+            uint64_t hole;
+            if (cstream_next_member(hints->from, &hole) <= 0) {
+                return -1;
+            }
+            hints->position += hole;
+            hints->member_start = hints->position;
+            continue;
+        }
+        if (length == 0) {
+            hints->position += 1;
+            continue;
+        }
+
+        // Offsets are relative to the beginning of the window, which only
+        // starts sliding once it is full.
+        uint64_t window_currsize = hints->position - hints->member_start;
+        if (window_currsize > hints->from->window_maxsize) {
+            window_currsize = hints->from->window_maxsize;
+        }
+        hints->phrase_start = hints->position;
+        hints->phrase_source = hints->position - window_currsize + offset;
+        hints->phrase_length = length;
+        hints->position += length;
+        return 0;
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file hints_internal.h
+ *
+ * Internal functions to use match hints during a compression.
+ */
+
+#ifndef _LZ77_HINTS_INTERNAL_H_
+#define _LZ77_HINTS_INTERNAL_H_
+
+#include <stdint.h>
+
+#include <lz77ppm/hints.h>
+
+#include <tinyhuff.h>
+
+/**
+ * The state of the parser of a hint stream.
+ *
+ * Positions are counted in bytes from the beginning of the uncompressed data.
+ */
+typedef struct _lz77_hints {
+    /**
+     * The compressed stream the hints are read from.
+     */
+    lz77_cstream *from;
+    /**
+     * The encoder of the lengths of the phrases of the hint stream.
+     */
+    lz77_tinyhuff length_encoder;
+    /**
+     * Number of bits of an offset in the window of the hint stream.
+     */
+    uint8_t window_nbits;
+    /**
+     * The number of bytes at the end of each phrase of the hint stream which
+     * are added to the tree anyway.
+     */
+    uint16_t tail;
+    /**
+     * A boolean value indicating whether the header of the hint stream has
+     * been read.
+     */
+    uint8_t is_open;
+    /**
+     * A boolean value indicating whether no more hints are available (because
+     * the end of the hint stream was reached or the stream is corrupted).
+     */
+    uint8_t is_over;
+    /**
+     * The position at which the current member of the hint stream starts.
+     */
+    uint64_t member_start;
+    /**
+     * The position following the last token read.
+     */
+    uint64_t position;
+    /**
+     * The position of the last phrase read.
+     */
+    uint64_t phrase_start;
+    /**
+     * The position of the source of the last phrase read.
+     */
+    uint64_t phrase_source;
+    /**
+     * The length of the last phrase read.
+     */
+    uint16_t phrase_length;
+} lz77_hints;
+
+/**
+ * Looks for a hint at the given position, that is for a phrase of the hint
+ * stream containing the byte at @c position.
+ *
+ * The function must be called with non-decreasing positions, since the hint
+ * stream is read sequentially.
+ *
+ * @param source Must point to an integer that will be set to the position of
+ *        the byte which @c position is a copy of, if a hint is found.
+ *
+ * @return The number of bytes, starting from @c position, covered by the
+ *         phrase of the hint, or zero if there is no hint at @c position.
+ */
+uint16_t hints_lookup(lz77_hints *hints, uint64_t position, uint64_t *source);
+
+/**
+ * Checks the hint (if any) at the beginning of the look-ahead buffer of a
+ * compression, extending it as much as possible.
+ *
+ * @param offset Must point to an integer that will be set to the offset of
+ *        the match in the window, if any.
+ *
+ * @return The length of the match suggested by the hint, or zero if there is
+ *         no valid hint.
+ */
+uint16_t hints_match(lz77_ustream *ustream, uint16_t *offset);
+
+#endif
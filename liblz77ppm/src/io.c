@@ -0,0 +1,187 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _GNU_SOURCE  // Required on Linux for F_SETPIPE_SZ and F_GETPIPE_SZ
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <io.h>
+
+uint32_t io_setup(int fd, uint8_t *is_pipe)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISFIFO(st.st_mode)) {
+        *is_pipe = 0;
+        return 0;
+    }
+    *is_pipe = 1;
+
+#if defined(F_SETPIPE_SZ) && defined(F_GETPIPE_SZ)
+    // Enlarging the pipe may fail (e.g., EPERM if the limit has been lowered
+    // by the administrator): in that case, just use its current capacity.
+    int capacity = fcntl(fd, F_SETPIPE_SZ, IO_PIPE_SIZE);
+    if (capacity < 0) {
+        capacity = fcntl(fd, F_GETPIPE_SZ);
+    }
+    if (capacity > 0) {
+        return capacity;
+    }
+#endif
+    return IO_PIPE_SIZE;
+}
+
+ssize_t io_read(int fd, void *buffer, size_t count, uint8_t is_pipe)
+{
+    uint8_t *data = buffer;
+    size_t readcount = 0;
+    while (readcount < count) {
+        ssize_t n = read(fd, data + readcount, count - readcount);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        readcount += n;
+        if (n == 0 || !is_pipe) {
+            break;
+        }
+    }
+    return readcount;
+}
+
+int io_is_socket(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+ssize_t io_recv(int fd, void *buffer, size_t count, size_t min_count)
+{
+    uint8_t *data = buffer;
+    size_t received = 0;
+    while (received < count) {
+        ssize_t n;
+        if (received < min_count) {
+            n = recv(fd, data + received, min_count - received, MSG_WAITALL);
+        } else {
+            n = recv(fd, data + received, count - received, MSG_DONTWAIT);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (received > 0) {
+                break;  // Nothing else queued, or an error left to the next call.
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        received += n;
+    }
+    return received;
+}
+
+int io_write(int fd, const void *buffer, size_t count)
+{
+    const uint8_t *data = buffer;
+    while (count > 0) {
+        ssize_t n = write(fd, data, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        count -= n;
+    }
+    return 0;
+}
+
+int io_find_hole(int fd, uint64_t from, uint64_t min_length, uint64_t *start, uint64_t *end)
+{
+#if defined(SEEK_HOLE) && defined(SEEK_DATA)
+    struct stat st;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    int found = 0;
+    off_t position = from;
+    while (position < st.st_size) {
+        off_t hole = lseek(fd, position, SEEK_HOLE);
+        if (hole < 0 || hole >= st.st_size) {
+            break;
+        }
+        // ENXIO means that the hole extends up to the end of the file.
+        off_t data = lseek(fd, hole, SEEK_DATA);
+        if (data < 0) {
+            if (errno != ENXIO) {
+                break;
+            }
+            data = st.st_size;
+        }
+        if ((uint64_t)(data - hole) >= min_length) {
+            *start = hole;
+            *end = data;
+            found = 1;
+            break;
+        }
+        position = data;
+    }
+
+    lseek(fd, offset, SEEK_SET);
+    return found;
+#else
+    (void)fd;
+    (void)from;
+    (void)min_length;
+    (void)start;
+    (void)end;
+    return 0;
+#endif
+}
+
+int io_skip(int fd, uint64_t length)
+{
+    struct stat st;
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || fstat(fd, &st) != 0) {
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = ESPIPE;
+        return -1;
+    }
+
+    off_t target = offset + length;
+    if (offset < st.st_size) {
+        // The range overlaps the current content of the file.
+#ifdef FALLOC_FL_PUNCH_HOLE
+        off_t overlap = (target < st.st_size ? target : st.st_size) - offset;
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, overlap) < 0) {
+            return -1;
+        }
+#else
+        errno = EOPNOTSUPP;
+        return -1;
+#endif
+    }
+    if (target > st.st_size && ftruncate(fd, target) < 0) {
+        return -1;
+    }
+    return lseek(fd, target, SEEK_SET) < 0 ? -1 : 0;
+}
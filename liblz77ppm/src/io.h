@@ -0,0 +1,132 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file io.h
+ *
+ * Low-level input/output routines shared by compressed and uncompressed
+ * streams backed by a file, a pipe or a socket descriptor.
+ */
+
+#ifndef _LZ77_IO_H_
+#define _LZ77_IO_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * The capacity requested for pipes used by the streams, which is also the size
+ * of the chunks read from or written to them. Linux allows unprivileged
+ * processes to enlarge a pipe up to @c /proc/sys/fs/pipe-max-size, which
+ * defaults to 1 MiB.
+ */
+#define IO_PIPE_SIZE (1 << 20)
+
+/**
+ * The default size of the buffer of a compressed stream reading from a socket,
+ * which is large enough to take everything queued by the system at once.
+ */
+#define IO_SOCKET_SIZE (256 * 1024)
+
+/**
+ * Prepares a descriptor to be used by a stream.
+ *
+ * If the descriptor refers to a pipe, its capacity is enlarged (if supported
+ * by the system) up to #IO_PIPE_SIZE, so that the processes at its two ends
+ * exchange data in large chunks instead of being woken up every few
+ * kilobytes.
+ *
+ * @param fd The descriptor to be prepared.
+ * @param is_pipe Must point to a byte that will be set to a non-zero value if
+ *        @c fd refers to a pipe, or to zero otherwise.
+ *
+ * @return The suggested size (in bytes) of the buffer used to read from or
+ *         write to @c fd, or zero if no particular size is suggested (in this
+ *         case the caller will use its own default).
+ */
+uint32_t io_setup(int fd, uint8_t *is_pipe);
+
+/**
+ * Reads up to @c count bytes from a descriptor.
+ *
+ * When @c is_pipe is non-zero, the function keeps reading until the buffer is
+ * full or the writer closes the pipe, so that the caller always gets large
+ * chunks of data even if the writer produces them in small pieces. Otherwise,
+ * it behaves like a single @c read(2). In both cases, reads interrupted by a
+ * signal are restarted.
+ *
+ * @return The number of bytes read (zero at EOF), or a negative value in case
+ *         of error. See @c errno for further information.
+ */
+ssize_t io_read(int fd, void *buffer, size_t count, uint8_t is_pipe);
+
+/**
+ * Checks whether a descriptor refers to a socket.
+ */
+int io_is_socket(int fd);
+
+/**
+ * Receives up to @c count bytes from a socket, in as few calls as possible.
+ *
+ * The function blocks (with @c MSG_WAITALL, so that the process is woken up
+ * once) until at least @c min_count bytes have been received, and then takes
+ * whatever else is already queued by the system, without blocking, until the
+ * buffer is full. Receives interrupted by a signal are restarted.
+ *
+ * @param min_count The low-water mark, from 1 to @c count.
+ *
+ * @return The number of bytes received (less than @c min_count only if the
+ *         peer has shut the connection down, zero at EOF), or a negative value
+ *         in case of error. See @c errno for further information. An error
+ *         occurring after some bytes have been received is reported by the
+ *         next call.
+ */
+ssize_t io_recv(int fd, void *buffer, size_t count, size_t min_count);
+
+/**
+ * Writes exactly @c count bytes to a descriptor, restarting partial or
+ * interrupted writes.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int io_write(int fd, const void *buffer, size_t count);
+
+/**
+ * Finds the next hole of a sparse file, i.e. a range that is not backed by
+ * disk blocks and reads as zeros.
+ *
+ * The offset of @c fd is left unchanged.
+ *
+ * @param fd A descriptor to a regular file.
+ * @param from The offset from which the hole is searched.
+ * @param min_length The minimum length of the hole: shorter holes are ignored.
+ * @param start Must point to an integer that will be set to the offset of the
+ *        first byte of the hole.
+ * @param end Must point to an integer that will be set to the offset of the
+ *        first byte following the hole.
+ *
+ * @return 1 if a hole has been found, or 0 otherwise (also when @c fd does
+ *         not support @c SEEK_HOLE).
+ */
+int io_find_hole(int fd, uint64_t from, uint64_t min_length, uint64_t *start, uint64_t *end);
+
+/**
+ * Advances the offset of a regular file by @c length bytes, leaving a hole
+ * behind it.
+ *
+ * Any existing content of the file in the skipped range is deallocated, and
+ * the file is extended if the new offset is beyond its end.
+ *
+ * @return 0 in case of success, or a negative value if the hole cannot be
+ *         created (in which case the caller should write zeros instead). See
+ *         @c errno for further information.
+ */
+int io_skip(int fd, uint64_t length);
+
+#endif
@@ -0,0 +1,527 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _DEFAULT_SOURCE  // Required on Linux for htobe64() and be64toh()
+#define _BSD_SOURCE      // The same, before glibc 2.19
+#ifdef __FreeBSD__
+#  include <sys/endian.h>
+#else
+#  include <endian.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/journal.h>
+#include <lz77ppm/logger.h>
+
+#include <archive.h>
+#include <io.h>
+
+/**
+ * Contains an entry of the index of a journal, describing a member of the
+ * log. All fields are stored in big-endian byte order.
+ */
+typedef struct {
+    /** The offset of the member in the log. */
+    uint8_t offset[8];
+    /** The size of the member. */
+    uint8_t size[8];
+    /** The number of the first record of the member. */
+    uint8_t first_record[8];
+    /** The timestamp of the first record of the member. */
+    uint8_t first_timestamp[8];
+    /** The timestamp of the last record of the member. */
+    uint8_t last_timestamp[8];
+    /** The number of records of the member. */
+    uint8_t count[4];
+} journal_entry;
+
+/**
+ * An entry of the index, decoded.
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t first_record;
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    uint32_t count;
+} journal_member;
+
+struct _lz77_journal_writer {
+    archive_writer archive;
+    uint16_t window_size;
+    uint16_t lookahead_size;
+    uint32_t flush_size;
+    uint64_t flush_interval;
+    /** The framed records waiting to be compressed. */
+    uint8_t *buffer;
+    uint32_t used;
+    uint32_t capacity;
+    /** The member being buffered (its offset is the end of the log). */
+    journal_member pending;
+};
+
+struct _lz77_journal_reader {
+    int fd;
+    /** The members of the log, as loaded from the index. */
+    journal_member *members;
+    uint64_t nmembers;
+    /** The index of the member decompressed into @c data. */
+    uint64_t member;
+    /** The decompressed member, or @c NULL. */
+    uint8_t *data;
+    uint64_t data_size;
+    /** The position of the next record in @c data. */
+    uint64_t position;
+};
+
+static void encode_entry(journal_entry *entry, const journal_member *member);
+static void decode_entry(journal_member *member, const journal_entry *entry);
+static int load_member(lz77_journal_reader *reader, uint64_t member);
+
+lz77_journal_writer * lz77_journal_writer_open(int fd,
+                                               int index_fd,
+                                               uint16_t window_size,
+                                               uint16_t lookahead_size)
+{
+    if (fd < 0 || index_fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return NULL;
+    }
+    if (window_size < LZ77_MIN_WINDOW_SIZE || window_size > LZ77_MAX_WINDOW_SIZE
+            || lookahead_size < LZ77_MIN_LOOKAHEAD_SIZE) {
+        lz77_log(LOG_ERROR, "Invalid window or look-ahead buffer size");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Continue after the last member of the index.
+    archive_writer archive;
+    journal_entry entry;
+    journal_member last;
+    if (archive_open(&archive, fd, index_fd, sizeof(entry), &entry) < 0) {
+        return NULL;
+    }
+    decode_entry(&last, &entry);
+    if (archive_recover(&archive, last.offset + last.size) < 0) {
+        return NULL;
+    }
+
+    lz77_journal_writer *object = calloc(1, sizeof(*object));
+    if (object != NULL) {
+        object->archive = archive;
+        object->window_size = window_size;
+        object->lookahead_size = lookahead_size;
+        object->flush_size = LZ77_JOURNAL_DEFAULT_FLUSH_SIZE;
+        object->pending.offset = archive.end;
+        object->pending.first_record = last.first_record + last.count;
+    }
+    return object;
+}
+
+int lz77_journal_set_flush(lz77_journal_writer *writer, uint32_t size, uint64_t interval)
+{
+    if (writer == NULL) {
+        lz77_log(LOG_ERROR, "Argument `writer' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (size == 0) {
+        lz77_log(LOG_ERROR, "The flush size must be positive");
+        errno = EINVAL;
+        return -1;
+    }
+
+    writer->flush_size = size;
+    writer->flush_interval = interval;
+    return 0;
+}
+
+int64_t lz77_journal_append(lz77_journal_writer *writer,
+                            const void *record,
+                            uint32_t size,
+                            uint64_t timestamp)
+{
+    if (writer == NULL || (record == NULL && size > 0)) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    journal_member *pending = &writer->pending;
+    if (pending->count > 0 && writer->flush_interval > 0
+            && timestamp - pending->first_timestamp >= writer->flush_interval) {
+        // The record starts a new interval.
+        if (lz77_journal_flush(writer) < 0) {
+            return -1;
+        }
+    }
+
+    if (size > UINT32_MAX - 4 - writer->used) {
+        // The record does not fit into the buffer: flush the previous ones.
+        if (lz77_journal_flush(writer) < 0) {
+            return -1;
+        }
+        if (size > UINT32_MAX - 4) {
+            lz77_log(LOG_ERROR, "The record is too large (%lu bytes)", (unsigned long)size);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    uint32_t needed = writer->used + 4 + size;
+    if (needed > writer->capacity) {
+        uint32_t capacity = writer->capacity < 1024 ? 1024 : writer->capacity;
+        while (capacity < needed) {
+            capacity = capacity > UINT32_MAX / 2 ? UINT32_MAX : capacity * 2;
+        }
+        uint8_t *temp = realloc(writer->buffer, capacity);
+        if (temp == NULL) {
+            return -1;
+        }
+        writer->buffer = temp;
+        writer->capacity = capacity;
+    }
+
+    uint8_t *frame = writer->buffer + writer->used;
+    frame[0] = size >> 24;
+    frame[1] = size >> 16;
+    frame[2] = size >> 8;
+    frame[3] = size;
+    memcpy(frame + 4, record, size);
+    writer->used = needed;
+
+    if (pending->count == 0) {
+        pending->first_timestamp = timestamp;
+    }
+    pending->last_timestamp = timestamp;
+    pending->count++;
+    int64_t number = pending->first_record + pending->count - 1;
+
+    if (writer->used >= writer->flush_size && lz77_journal_flush(writer) < 0) {
+        return -1;
+    }
+    return number;
+}
+
+int lz77_journal_flush(lz77_journal_writer *writer)
+{
+    if (writer == NULL) {
+        lz77_log(LOG_ERROR, "Argument `writer' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    journal_member *pending = &writer->pending;
+    if (pending->count == 0) {
+        return 0;
+    }
+
+    // Each flush produces an independent member, which is appended to the log.
+    int64_t size = archive_append(&writer->archive, writer->buffer, writer->used,
+                                  writer->window_size, writer->lookahead_size);
+    if (size < 0) {
+        return -1;
+    }
+
+    // The index is written after the member, so that it never refers to
+    // incomplete data.
+    pending->size = size;
+    journal_entry entry;
+    encode_entry(&entry, pending);
+    if (archive_commit(&writer->archive, size, &entry, sizeof(entry)) < 0) {
+        return -1;
+    }
+
+    pending->offset += pending->size;
+    pending->first_record += pending->count;
+    pending->count = 0;
+    writer->used = 0;
+    return 0;
+}
+
+int lz77_journal_writer_close(lz77_journal_writer **pwriter)
+{
+    assert(pwriter != NULL);
+
+    lz77_journal_writer *writer = *pwriter;
+    if (writer == NULL) {
+        return 0;
+    }
+
+    int result = lz77_journal_flush(writer);
+    int error = errno;
+    free(writer->buffer);
+    free(writer);
+    *pwriter = NULL;
+    errno = error;
+    return result;
+}
+
+lz77_journal_reader * lz77_journal_reader_open(int fd, int index_fd)
+{
+    if (fd < 0 || index_fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(index_fd, &st) != 0) {
+        return NULL;
+    }
+    if (st.st_size % sizeof(journal_entry) != 0) {
+        lz77_log(LOG_ERROR, "The index of the journal is corrupted");
+        errno = EINVAL;
+        return NULL;
+    }
+    uint64_t nmembers = st.st_size / sizeof(journal_entry);
+
+    lz77_journal_reader *object = calloc(1, sizeof(*object));
+    if (object == NULL) {
+        return NULL;
+    }
+    object->fd = fd;
+    object->nmembers = nmembers;
+    object->members = malloc((nmembers > 0 ? nmembers : 1) * sizeof(*object->members));
+    journal_entry *entries = malloc((nmembers > 0 ? nmembers : 1) * sizeof(*entries));
+    if (object->members == NULL || entries == NULL
+            || lseek(index_fd, 0, SEEK_SET) != 0
+            || io_read(index_fd, entries, nmembers * sizeof(*entries), 1)
+                    != (ssize_t)(nmembers * sizeof(*entries))) {
+        int error = errno;
+        free(entries);
+        lz77_journal_reader_free(&object);
+        errno = error;
+        return NULL;
+    }
+
+    // Check that the members follow one another.
+    for (uint64_t i = 0; i < nmembers; i++) {
+        decode_entry(&object->members[i], &entries[i]);
+        const journal_member *previous = i > 0 ? &object->members[i - 1] : NULL;
+        uint64_t offset = previous ? previous->offset + previous->size : 0;
+        uint64_t first = previous ? previous->first_record + previous->count : 0;
+        if (object->members[i].offset != offset || object->members[i].first_record != first) {
+            lz77_log(LOG_ERROR, "The index of the journal is corrupted");
+            free(entries);
+            lz77_journal_reader_free(&object);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    free(entries);
+
+    // Position the reader at the first record.
+    object->member = nmembers;
+    if (nmembers > 0 && load_member(object, 0) < 0) {
+        int error = errno;
+        lz77_journal_reader_free(&object);
+        errno = error;
+        return NULL;
+    }
+    return object;
+}
+
+uint64_t lz77_journal_count(const lz77_journal_reader *reader)
+{
+    assert(reader != NULL);
+
+    if (reader->nmembers == 0) {
+        return 0;
+    }
+    const journal_member *last = &reader->members[reader->nmembers - 1];
+    return last->first_record + last->count;
+}
+
+int lz77_journal_seek(lz77_journal_reader *reader, uint64_t record)
+{
+    if (reader == NULL) {
+        lz77_log(LOG_ERROR, "Argument `reader' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t count = lz77_journal_count(reader);
+    if (record > count) {
+        lz77_log(LOG_ERROR, "The journal has no record %llu", (unsigned long long)record);
+        errno = EINVAL;
+        return -1;
+    }
+    if (record == count) {
+        free(reader->data);
+        reader->data = NULL;
+        reader->data_size = reader->position = 0;
+        reader->member = reader->nmembers;
+        return 0;
+    }
+
+    // Find the last member starting at or before the record.
+    uint64_t low = 0, high = reader->nmembers - 1;
+    while (low < high) {
+        uint64_t middle = low + (high - low + 1) / 2;
+        if (reader->members[middle].first_record <= record) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    if (load_member(reader, low) < 0) {
+        return -1;
+    }
+
+    // Skip the preceding records of the member.
+    const uint8_t *ignored;
+    uint32_t size;
+    for (uint64_t i = reader->members[low].first_record; i < record; i++) {
+        if (lz77_journal_next(reader, &ignored, &size) <= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int64_t lz77_journal_seek_time(lz77_journal_reader *reader, uint64_t timestamp)
+{
+    if (reader == NULL) {
+        lz77_log(LOG_ERROR, "Argument `reader' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Find the first member whose last record is not older than the time.
+    uint64_t low = 0, high = reader->nmembers;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (reader->members[middle].last_timestamp < timestamp) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    uint64_t record = low < reader->nmembers
+            ? reader->members[low].first_record
+            : lz77_journal_count(reader);
+    if (lz77_journal_seek(reader, record) < 0) {
+        return -1;
+    }
+    return record;
+}
+
+int lz77_journal_next(lz77_journal_reader *reader, const uint8_t **record, uint32_t *size)
+{
+    if (reader == NULL || record == NULL || size == NULL) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (reader->position == reader->data_size) {
+        if (reader->member + 1 >= reader->nmembers) {
+            reader->member = reader->nmembers;
+            return 0;
+        }
+        if (load_member(reader, reader->member + 1) < 0) {
+            return -1;
+        }
+    }
+
+    const uint8_t *frame = reader->data + reader->position;
+    uint64_t left = reader->data_size - reader->position;
+    uint32_t length = 0;
+    if (left >= 4) {
+        length = (uint32_t)frame[0] << 24 | (uint32_t)frame[1] << 16
+                | (uint32_t)frame[2] << 8 | frame[3];
+    }
+    if (left < 4 || left - 4 < length) {
+        lz77_log(LOG_ERROR, "A record of the journal is truncated");
+        errno = EINVAL;
+        return -1;
+    }
+    *record = frame + 4;
+    *size = length;
+    reader->position += 4 + length;
+    return 1;
+}
+
+void lz77_journal_reader_free(lz77_journal_reader **preader)
+{
+    assert(preader != NULL);
+
+    lz77_journal_reader *reader = *preader;
+    if (reader == NULL) {
+        return;
+    }
+
+    free(reader->members);
+    free(reader->data);
+    free(reader);
+    *preader = NULL;
+}
+
+/*
+ * Reads and decompresses a member of the log, positioning the reader at its
+ * first record.
+ */
+static int load_member(lz77_journal_reader *reader, uint64_t member)
+{
+    const journal_member *m = &reader->members[member];
+    uint8_t *data;
+    int64_t result = archive_load(reader->fd, m->offset, m->size, &data);
+    if (result < 0) {
+        return -1;
+    }
+
+    free(reader->data);
+    reader->data = data;
+    reader->data_size = result;
+    reader->position = 0;
+    reader->member = member;
+    return 0;
+}
+
+static void encode_entry(journal_entry *entry, const journal_member *member)
+{
+    uint64_t value;
+    value = htobe64(member->offset);
+    memcpy(entry->offset, &value, 8);
+    value = htobe64(member->size);
+    memcpy(entry->size, &value, 8);
+    value = htobe64(member->first_record);
+    memcpy(entry->first_record, &value, 8);
+    value = htobe64(member->first_timestamp);
+    memcpy(entry->first_timestamp, &value, 8);
+    value = htobe64(member->last_timestamp);
+    memcpy(entry->last_timestamp, &value, 8);
+    uint32_t count = htonl(member->count);
+    memcpy(entry->count, &count, 4);
+}
+
+static void decode_entry(journal_member *member, const journal_entry *entry)
+{
+    uint64_t value;
+    memcpy(&value, entry->offset, 8);
+    member->offset = be64toh(value);
+    memcpy(&value, entry->size, 8);
+    member->size = be64toh(value);
+    memcpy(&value, entry->first_record, 8);
+    member->first_record = be64toh(value);
+    memcpy(&value, entry->first_timestamp, 8);
+    member->first_timestamp = be64toh(value);
+    memcpy(&value, entry->last_timestamp, 8);
+    member->last_timestamp = be64toh(value);
+    uint32_t count;
+    memcpy(&count, entry->count, 4);
+    member->count = ntohl(count);
+}
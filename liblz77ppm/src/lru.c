@@ -0,0 +1,172 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <lru.h>
+
+static lru_entry ** find_entry(lru_table *table, const uint64_t key[2]);
+static void unlink_entry(lru_table *table, lru_entry *entry);
+static void push_entry(lru_table *table, lru_entry *entry);
+static void evict_oldest(lru_table *table);
+static void grow_table(lru_table *table);
+
+int lru_init(lru_table *table,
+             size_t budget,
+             size_t nbuckets,
+             void (*release)(lru_entry *entry))
+{
+    assert(nbuckets > 0 && (nbuckets & (nbuckets - 1)) == 0);
+
+    table->buckets = calloc(nbuckets, sizeof(*table->buckets));
+    if (table->buckets == NULL) {
+        return -1;
+    }
+    table->budget = budget;
+    table->used = 0;
+    table->nbuckets = nbuckets;
+    table->count = 0;
+    table->newest = NULL;
+    table->oldest = NULL;
+    table->release = release;
+    return 0;
+}
+
+lru_entry * lru_use(lru_table *table, const uint64_t key[2])
+{
+    lru_entry *entry = *find_entry(table, key);
+    if (entry != NULL) {
+        unlink_entry(table, entry);
+        push_entry(table, entry);
+    }
+    return entry;
+}
+
+int lru_contains(lru_table *table, const uint64_t key[2])
+{
+    return *find_entry(table, key) != NULL;
+}
+
+void lru_insert(lru_table *table, lru_entry *entry)
+{
+    assert(entry->cost <= table->budget);
+    assert(!lru_contains(table, entry->key));
+
+    while (table->used + entry->cost > table->budget) {
+        evict_oldest(table);
+    }
+    // The eviction may have freed the entry preceding the slot.
+    lru_entry **slot = find_entry(table, entry->key);
+    entry->next = *slot;
+    *slot = entry;
+    push_entry(table, entry);
+    table->used += entry->cost;
+    table->count++;
+    if (table->count > table->nbuckets) {
+        grow_table(table);
+    }
+}
+
+void lru_destroy(lru_table *table)
+{
+    while (table->oldest != NULL) {
+        evict_oldest(table);
+    }
+    free(table->buckets);
+    table->buckets = NULL;
+}
+
+/*
+ * Returns the pointer to the entry with the given key, or to the NULL pointer
+ * at the end of its bucket if no such entry exists.
+ */
+static lru_entry ** find_entry(lru_table *table, const uint64_t key[2])
+{
+    lru_entry **slot = &table->buckets[key[0] & (table->nbuckets - 1)];
+    while (*slot != NULL && ((*slot)->key[0] != key[0] || (*slot)->key[1] != key[1])) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+/*
+ * Removes an entry from the list of recently used entries.
+ */
+static void unlink_entry(lru_table *table, lru_entry *entry)
+{
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        table->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        table->oldest = entry->newer;
+    }
+}
+
+/*
+ * Puts an entry at the head of the list of recently used entries.
+ */
+static void push_entry(lru_table *table, lru_entry *entry)
+{
+    entry->newer = NULL;
+    entry->older = table->newest;
+    if (table->newest != NULL) {
+        table->newest->newer = entry;
+    } else {
+        table->oldest = entry;
+    }
+    table->newest = entry;
+}
+
+/*
+ * Removes the least recently used entry from the table, and releases it.
+ */
+static void evict_oldest(lru_table *table)
+{
+    lru_entry *entry = table->oldest;
+    assert(entry != NULL);
+
+    unlink_entry(table, entry);
+    lru_entry **slot = find_entry(table, entry->key);
+    assert(*slot == entry);
+    *slot = entry->next;
+
+    table->used -= entry->cost;
+    table->count--;
+    table->release(entry);
+}
+
+/*
+ * Doubles the number of buckets. If memory is not available, the table is
+ * left as it is (and its buckets just get longer).
+ */
+static void grow_table(lru_table *table)
+{
+    size_t nbuckets = table->nbuckets * 2;
+    lru_entry **buckets = calloc(nbuckets, sizeof(*buckets));
+    if (buckets == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < table->nbuckets; i++) {
+        lru_entry *entry = table->buckets[i];
+        while (entry != NULL) {
+            lru_entry *next = entry->next;
+            lru_entry **slot = &buckets[entry->key[0] & (nbuckets - 1)];
+            entry->next = *slot;
+            *slot = entry;
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->nbuckets = nbuckets;
+}
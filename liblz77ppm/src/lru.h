@@ -0,0 +1,105 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file lru.h
+ *
+ * A hash table of entries bounded by a budget of bytes, which evicts the least
+ * recently used ones, shared by the caches of compressed results and of
+ * decompressed values.
+ *
+ * The table is intrusive: an entry is the first member of the structure of its
+ * owner, which allocates it and frees it when the table releases it. The table
+ * is not thread-safe.
+ */
+
+#ifndef _LZ77_LRU_H_
+#define _LZ77_LRU_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * An entry, which is both in a bucket of the hash table and in the list of
+ * entries sorted from the most to the least recently used.
+ */
+typedef struct _lru_entry {
+    /**
+     * The key of the entry. The first word selects the bucket, so it must be
+     * well distributed.
+     */
+    uint64_t key[2];
+    /** The bytes charged to the budget for the entry. */
+    size_t cost;
+    /** The next entry in the same bucket. */
+    struct _lru_entry *next;
+    /** The previous (more recently used) entry. */
+    struct _lru_entry *newer;
+    /** The next (less recently used) entry. */
+    struct _lru_entry *older;
+} lru_entry;
+
+/**
+ * A table of entries.
+ */
+typedef struct {
+    size_t budget;
+    size_t used;
+    /** The buckets of the hash table (a power of two). */
+    lru_entry **buckets;
+    size_t nbuckets;
+    size_t count;
+    lru_entry *newest;
+    lru_entry *oldest;
+    /** Frees an entry removed from the table, with whatever it owns. */
+    void (*release)(lru_entry *entry);
+} lru_table;
+
+/**
+ * Initializes an empty table.
+ *
+ * @param budget The maximum number of bytes charged for all the entries.
+ * @param nbuckets The initial number of buckets (a power of two).
+ * @param release The function freeing an entry removed from the table.
+ *
+ * @return 0 in case of success, or a negative value if memory is not
+ *         available.
+ */
+int lru_init(lru_table *table,
+             size_t budget,
+             size_t nbuckets,
+             void (*release)(lru_entry *entry));
+
+/**
+ * Finds the entry with the given key, making it the most recently used one.
+ *
+ * @return The entry, or @c NULL if the table has no entry with that key.
+ */
+lru_entry * lru_use(lru_table *table, const uint64_t key[2]);
+
+/**
+ * Checks whether the table has an entry with the given key, without changing
+ * the order of the entries.
+ */
+int lru_contains(lru_table *table, const uint64_t key[2]);
+
+/**
+ * Adds an entry, with a key not in the table, as the most recently used one,
+ * evicting the least recently used entries until it fits into the budget.
+ *
+ * @param entry The entry, whose key and cost must be set (the cost not
+ *        exceeding the budget).
+ */
+void lru_insert(lru_table *table, lru_entry *entry);
+
+/**
+ * Releases all the entries and the buckets of a table.
+ */
+void lru_destroy(lru_table *table);
+
+#endif
@@ -21,10 +21,26 @@
 
 #include <lz77ppm/lz77.h>
 
+#include <checkpoint_internal.h>
+#include <seek_internal.h>
+#include <effort_internal.h>
 #include <ustream_internal.h>
 #include <cstream_internal.h>
 #include <tinyhuff.h>
 
+/*
+ * Encodes the terminating token of a member.
+ */
+static int put_terminator(lz77_cstream *compressed,
+                          int winoff_bits,
+                          const lz77_tinyhuff_code *length_codes)
+{
+    uint64_t token = (uint64_t)1 << winoff_bits;
+    token = (token << length_codes[0].nbits) | length_codes[0].code;
+    uint8_t tbits = LZ77_TYPE_BITS + winoff_bits + length_codes[0].nbits;
+    return cstream_put_bits(compressed, token, tbits);
+}
+
 /*
  * Use int64_t: this function would return an uint64_t (to indicate the size in
  * bytes of the compressed stream) or -1 in case of error. Since the size is
@@ -41,7 +57,7 @@ int64_t lz77_compress(lz77_ustream *original, lz77_cstream *compressed)
     }
 
     int winoff_bits = original->window_nbits;
-    lz77_tinyhuff *length_encoder = original->length_encoder;
+    const lz77_tinyhuff_code *length_codes = original->length_codes;
 
     uint64_t input_size = 0;
     if (report_progress) {
@@ -52,34 +68,57 @@ int64_t lz77_compress(lz77_ustream *original, lz77_cstream *compressed)
             }
         }
         else {
-            input_size = original->end;
+            // Exclude the window primed with a dictionary.
+            input_size = original->end - original->window_currsize;
         }
     }
 
+    if (original->target_throughput > 0) {
+        effort_start(original);
+    }
+
     uint16_t offset, length;
     uint8_t next;
-    while (ustream_find_and_advance(original, &offset, &length, &next) > 0)
+    while (1)
     {
+        int count = ustream_find_and_advance(original, &offset, &length, &next);
+        if (count < 0) {
+            return -1;
+        }
+        if (count == 0) {
+            // The end of the input, or the beginning of a hole: in the latter
+            // case, end the member and start a new one after the hole.
+            int64_t hole = ustream_skip_hole(original);
+            if (hole < 0) {
+                return -1;
+            }
+            if (hole == 0) {
+                break;
+            }
+            if (put_terminator(compressed, winoff_bits, length_codes) < 0
+                    || cstream_put_hole(compressed, hole) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
         uint64_t token;
-        uint16_t tbits;
+        uint8_t tbits;
         if (length != 0) {
             // Encode a phrase token.
-            token = 0x00000001;
-            token = (token << winoff_bits) | offset;
-            tbits = tinyhuff_encode(length_encoder, length, &length);
-            token = (token << tbits) | length;
-            tbits = LZ77_TYPE_BITS + winoff_bits + tbits;
+            const lz77_tinyhuff_code *code = &length_codes[length];
+            token = ((uint64_t)1 << winoff_bits) | offset;
+            token = (token << code->nbits) | code->code;
+            tbits = LZ77_TYPE_BITS + winoff_bits + code->nbits;
         }
         else {
             // Encode a symbol token.
-            token = 0x00000000;
-            token = (token << LZ77_NEXT_BITS) | next;
+            token = next;
             tbits = LZ77_SYMBOL_BITS;
         }
 
         // Write the token to the buffer of compressed data.
-        uint16_t startbit = (sizeof(token) * 8) - tbits;
-        if (cstream_write_bits(compressed, &token, startbit, tbits) < 0) {
+        if (cstream_put_bits(compressed, token, tbits) < 0) {
             return -1;
         }
 
@@ -90,21 +129,27 @@ int64_t lz77_compress(lz77_ustream *original, lz77_cstream *compressed)
             }
             report_progress(original, compressed, percent);
         }
-    }
 
-    // Encode the terminating token.
-    uint64_t token = 0x00000001 << winoff_bits;
-    uint16_t tbits = tinyhuff_encode(length_encoder, 0, &length);
-    token = (token << tbits) | length;
-    tbits = LZ77_TYPE_BITS + winoff_bits + tbits;
+        if (original->target_throughput > 0
+                && original->processed_bytes >= original->effort_next) {
+            effort_adjust(original);
+        }
+
+        if (original->checkpoint_interval > 0
+                && original->processed_bytes >= original->checkpoint_next) {
+            if (checkpoint_save(original, compressed) < 0) {
+                return -1;
+            }
+        }
+    }
 
-    uint32_t startbit = (sizeof(token) * 8) - tbits;
-    if (cstream_write_bits(compressed, &token, startbit, tbits) < 0) {
+    if (put_terminator(compressed, winoff_bits, length_codes) < 0) {
         return -1;
     }
 
-    ustream_close(original);
-    cstream_close(compressed);
+    if (ustream_close(original) < 0 || cstream_close(compressed) < 0) {
+        return -1;
+    }
 
     return (lz77_cstream_get_processed_bits(compressed) + 7) / 8;
 }
@@ -126,6 +171,10 @@ int64_t lz77_decompress(lz77_cstream *compressed, lz77_ustream *original)
     int winoff_bits = original->window_nbits;
     lz77_tinyhuff *length_encoder = original->length_encoder;
 
+    if (original->seek_interval > 0 && seek_save(original, compressed) < 0) {
+        return -1;
+    }
+
     uint64_t input_size = 0;
     if (report_progress) {
         if (compressed->fd >= 0) {
@@ -141,44 +190,34 @@ int64_t lz77_decompress(lz77_cstream *compressed, lz77_ustream *original)
 
     while (1)
     {
-        // Get the next bit from the compressed data to determine if there is
-        // a phrase or a symbol token.
-        int state = 0;
-        cstream_read(compressed, &state, 0, LZ77_TYPE_BITS);
-
         uint16_t offset = 0, length = 0;
         uint8_t next = 0;
-
-        if (state) {
-            unsigned tpos;
-            tpos = (sizeof(offset) * 8) - winoff_bits;
-            cstream_read(compressed, &offset, tpos, winoff_bits);
-
-            while (1) {
-                uint16_t peek = 0;
-                int c, p = cstream_peek(compressed, &peek, 0, sizeof(peek) * 8);
-                peek = htons(peek);
-                c = tinyhuff_decode(length_encoder, &peek, p, &length);
-                if (c > 0) {
-                    cstream_consume(compressed, c);
-                    break;
-                }
+        int result = cstream_read_token(compressed, length_encoder, winoff_bits,
+                &offset, &length, &next);
+        if (result < 0) {
+            return -1;
+        }
+        if (result == 0) {
+            // We just read the terminating token: stop, unless another member
+            // follows (whose phrases cannot refer to the data decompressed so
+            // far).
+            uint64_t hole;
+            int more = cstream_next_member(compressed, &hole);
+            if (more < 0) {
+                return -1;
             }
-
-            // Ensure that the offset has the correct byte ordering for the
-            // system (the decoded length is already byte-ordered).
-            offset = ntohs(offset);
-
-            if (length == 0) {
-                // We just read the terminating token.
+            if (more == 0) {
                 break;
             }
-        }
-        else {
-            unsigned tpos = (sizeof(next) * 8) - LZ77_NEXT_BITS;
-            if (cstream_read(compressed, &next, tpos, LZ77_NEXT_BITS) != LZ77_NEXT_BITS) {
+            if (hole > 0 && ustream_put_zeros(original, hole) < 0) {
                 return -1;
             }
+            ustream_restart(original);
+            // Let reads after a hole start after it.
+            if (hole > 0 && original->seek_interval > 0 && seek_save(original, compressed) < 0) {
+                return -1;
+            }
+            continue;
         }
 
         // Write the phrase from the window to the output stream.
@@ -186,6 +225,12 @@ int64_t lz77_decompress(lz77_cstream *compressed, lz77_ustream *original)
             return -1;
         }
 
+        if (original->seek_interval > 0 && original->processed_bytes >= original->seek_next) {
+            if (seek_save(original, compressed) < 0) {
+                return -1;
+            }
+        }
+
         if (report_progress) {
             float percent = 0;
             if (input_size > 0) {
@@ -0,0 +1,714 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // Required for pthread_mutex_t and pthread_cond_t
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+#include <cstream_internal.h>
+#include <ustream_internal.h>
+#include <alloc_internal.h>
+#include <bit.h>
+#include <io.h>
+
+/**
+ * The amount of output after which a new chunk is started. A chunk ends at a
+ * token boundary, so it can be longer by up to a phrase or a run of zeros.
+ */
+#define PARALLEL_CHUNK_SIZE (256 * 1024)
+
+/** The maximum length of a run of zeros in a single token. */
+#define PARALLEL_MAX_ZEROS UINT16_MAX
+
+/**
+ * A token of the compressed stream, as parsed before being materialized.
+ *
+ * If @c length is zero, the token is a symbol, stored in @c distance. If
+ * @c distance is zero, the token is a run of @c length zeros (a piece of a
+ * hole). Otherwise, the token is a phrase copying @c length bytes from
+ * @c distance bytes before its position.
+ */
+typedef struct {
+    uint16_t distance;
+    uint16_t length;
+} parallel_token;
+
+/**
+ * A phrase whose source was not known when its chunk was materialized.
+ */
+typedef struct {
+    /** The index of the token, relative to the first token of the chunk. */
+    uint32_t token;
+    /** The position of the phrase, relative to the beginning of the chunk. */
+    uint32_t position;
+} parallel_deferred;
+
+/**
+ * A chunk of the output, materialized by a single thread.
+ */
+typedef struct {
+    /** The index of the first token of the chunk. */
+    uint64_t token;
+    /** The position of the first byte of the chunk in the output buffer. */
+    uint64_t start;
+    /** The first word of the bitmap of the chunk in the one of the plan. */
+    uint64_t bitmap;
+    /** The phrases deferred until the previous chunks are completed. */
+    parallel_deferred *deferred;
+    uint32_t deferred_count;
+    uint32_t deferred_capacity;
+    /**
+     * The allocations of the deferred phrases. They are made by the thread
+     * materializing the chunk, and added to the counters of the stream (which
+     * are not thread-safe) by the calling thread once the plan is freed.
+     */
+    lz77_alloc_counters allocations;
+    /**
+     * A boolean value indicating whether the chunk has been materialized
+     * (except for its deferred phrases). It is guarded by the mutex of the
+     * job.
+     */
+    uint8_t materialized;
+} parallel_chunk;
+
+/**
+ * The tokens of a whole stream, split into chunks.
+ */
+typedef struct {
+    parallel_token *tokens;
+    uint64_t token_count;
+    uint64_t token_capacity;
+    parallel_chunk *chunks;
+    uint64_t chunk_count;
+    uint64_t chunk_capacity;
+    /**
+     * The end of the output in the output buffer (which begins with the
+     * dictionary, if any).
+     */
+    uint64_t end;
+    /** The size of the window after the last token. */
+    uint16_t window_currsize;
+    /**
+     * The bytes of each chunk written by deferred phrases (checking a few
+     * words is much faster than searching the deferred phrases).
+     */
+    uint64_t *unknown;
+} parallel_plan;
+
+/**
+ * The state shared by the threads materializing the chunks of a plan.
+ *
+ * It is freed by the last thread releasing it: the tasks submitted to the
+ * executor may run after the decompression has been completed, in which case
+ * they find no chunk left and only release the job (the plan and the output
+ * may no longer exist).
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    /** Signaled whenever a chunk has been materialized. */
+    pthread_cond_t materialized;
+    /** The number of threads (or tasks not yet run) using the job. */
+    int references;
+    /** The number of chunks of the plan. */
+    uint64_t count;
+    /** The index of the next chunk to be materialized. */
+    uint64_t next;
+    /** The number of chunks being materialized. */
+    uint64_t running;
+    /** The value of @c errno of the first chunk which failed, or zero. */
+    int error;
+    parallel_plan *plan;
+    uint8_t *output;
+} parallel_job;
+
+static int parse(lz77_cstream *compressed, lz77_ustream *original, parallel_plan *plan);
+static inline int read_token(lz77_cstream *cstream,
+                             lz77_tinyhuff *length_encoder,
+                             uint8_t winoff_bits,
+                             uint16_t *offset,
+                             uint16_t *length,
+                             uint8_t *next);
+static int add_token(parallel_plan *plan,
+                     lz77_alloc_counters *counters,
+                     uint16_t distance,
+                     uint16_t length);
+static int prepare_output(lz77_ustream *original, const parallel_plan *plan, uint8_t **output);
+static int materialize(lz77_executor *executor,
+                       lz77_alloc_counters *counters,
+                       parallel_plan *plan,
+                       uint8_t *output);
+static void run_task(void *argument);
+static void materialize_chunks(parallel_job *job);
+static void take_chunk(parallel_job *job);
+static int materialize_chunk(parallel_plan *plan, uint64_t index, uint8_t *output);
+static void complete_chunk(parallel_plan *plan, uint64_t index, uint8_t *output);
+static void release_job(parallel_job *job);
+static int finish_output(lz77_ustream *original, const parallel_plan *plan, uint8_t *output);
+static void free_plan(parallel_plan *plan, lz77_alloc_counters *counters);
+
+/*
+ * Gets a mask of the bits of a word of a bitmap between two positions (the
+ * end being in the same word, or at its end).
+ */
+static inline uint64_t range_mask(uint32_t start, uint32_t end)
+{
+    uint64_t mask = ~(uint64_t)0 << (start % 64);
+    if (end % 64 != 0 && end / 64 == start / 64) {
+        mask &= ~(~(uint64_t)0 << (end % 64));
+    }
+    return mask;
+}
+
+/*
+ * Checks whether any bit of a bitmap is set between two positions.
+ */
+static inline int any_bit(const uint64_t *bitmap, uint32_t start, uint32_t end)
+{
+    while (start < end) {
+        uint32_t next = (start / 64 + 1) * 64;
+        if (bitmap[start / 64] & range_mask(start, end < next ? end : next)) {
+            return 1;
+        }
+        start = next;
+    }
+    return 0;
+}
+
+/*
+ * Sets the bits of a bitmap between two positions.
+ */
+static inline void set_bits(uint64_t *bitmap, uint32_t start, uint32_t end)
+{
+    while (start < end) {
+        uint32_t next = (start / 64 + 1) * 64;
+        bitmap[start / 64] |= range_mask(start, end < next ? end : next);
+        start = next;
+    }
+}
+
+/*
+ * Copies a phrase within the output, one byte at a time if it overlaps its
+ * own source (see ustream_save()).
+ */
+static inline void copy_phrase(uint8_t *output, uint64_t source, uint64_t dest, uint16_t length)
+{
+    if (source + length <= dest) {
+        memcpy(output + dest, output + source, length);
+    } else {
+        for (int i = 0; i < length; i++) {
+            output[dest + i] = output[source + i];
+        }
+    }
+}
+
+int64_t lz77_decompress_parallel(lz77_executor *executor,
+                                 lz77_cstream *compressed,
+                                 lz77_ustream *original)
+{
+    if (compressed == NULL || original == NULL) {
+        lz77_log(LOG_ERROR, "Streams must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (original->seek_interval > 0) {
+        lz77_log(LOG_ERROR, "A stream writing a seek index cannot be decompressed in parallel");
+        errno = EINVAL;
+        return -1;
+    }
+    if (executor == NULL) {
+        executor = lz77_default_executor;
+    }
+    if (executor != NULL && executor->submit == NULL) {
+        lz77_log(LOG_ERROR, "The executor has no submit function");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (cstream_open(compressed) < 0 || ustream_open(original) < 0) {
+        return -1;
+    }
+
+    parallel_plan plan;
+    memset(&plan, 0, sizeof(plan));
+    int result = parse(compressed, original, &plan);
+    uint8_t *output = NULL;
+    if (result == 0) {
+        result = prepare_output(original, &plan, &output);
+    }
+    if (result == 0) {
+        result = materialize(executor, &original->allocations, &plan, output);
+    }
+    if (result == 0) {
+        result = finish_output(original, &plan, output);
+    }
+
+    int error = errno;
+    if (original->fd >= 0) {
+        free(output);
+    }
+    free_plan(&plan, &original->allocations);
+    if (result < 0) {
+        errno = error;
+        return -1;
+    }
+
+    cstream_close(compressed);
+    ustream_close(original);
+
+    return original->processed_bytes;
+}
+
+/*
+ * Reads all the tokens of a compressed stream (with the members following the
+ * first one), and computes the position of each chunk of the output.
+ */
+static int parse(lz77_cstream *compressed, lz77_ustream *original, parallel_plan *plan)
+{
+    int winoff_bits = original->window_nbits;
+    lz77_tinyhuff *length_encoder = original->length_encoder;
+    uint16_t window_maxsize = original->window_maxsize;
+    lz77_alloc_counters *counters = &original->allocations;
+
+    // The output follows the dictionary, if any, which is in the window.
+    plan->end = original->end;
+    plan->window_currsize = original->window_currsize;
+
+    while (1) {
+        uint16_t offset = 0, length = 0;
+        uint8_t next = 0;
+        int result = read_token(compressed, length_encoder, winoff_bits, &offset, &length, &next);
+        if (result < 0) {
+            return -1;
+        }
+        if (result == 0) {
+            uint64_t hole;
+            int more = cstream_next_member(compressed, &hole);
+            if (more <= 0) {
+                return more;
+            }
+            while (hole > 0) {
+                uint16_t count = hole < PARALLEL_MAX_ZEROS ? hole : PARALLEL_MAX_ZEROS;
+                if (add_token(plan, counters, 0, count) < 0) {
+                    return -1;
+                }
+                hole -= count;
+            }
+            plan->window_currsize = 0;
+            continue;
+        }
+
+        if (length > 0 && offset >= plan->window_currsize) {
+            lz77_log(LOG_ERROR, "A phrase refers to data before the beginning of the window");
+            errno = EINVAL;
+            return -1;
+        }
+        if (length == 0) {
+            result = add_token(plan, counters, next, 0);
+        } else {
+            result = add_token(plan, counters, plan->window_currsize - offset, length);
+        }
+        if (result < 0) {
+            return -1;
+        }
+
+        uint32_t currsize = plan->window_currsize + (length == 0 ? 1 : length);
+        plan->window_currsize = currsize < window_maxsize ? currsize : window_maxsize;
+    }
+}
+
+/*
+ * Reads a token like cstream_read_token(), decoding it from a single load of
+ * 64 bits while they are in the buffer (the parse is the serial part of the
+ * decompression). Any other case, including the terminating token, is left
+ * to cstream_read_token().
+ */
+static inline int read_token(lz77_cstream *cstream,
+                             lz77_tinyhuff *length_encoder,
+                             uint8_t winoff_bits,
+                             uint16_t *offset,
+                             uint16_t *length,
+                             uint8_t *next)
+{
+    if (cstream->pos / 8 + sizeof(uint64_t) <= cstream->end / 8) {
+        // At least 57 bits are loaded, and a token takes at most 1 + 16 + 16.
+        uint64_t bits = bit_load_be64(cstream->cdata + cstream->pos / 8) << (cstream->pos % 8);
+        if ((bits >> 63) == 0) {
+            *length = 0;
+            *next = bits >> (64 - LZ77_SYMBOL_BITS);
+            cstream_consume(cstream, LZ77_SYMBOL_BITS);
+            return 1;
+        }
+        uint16_t peek = (bits << (LZ77_TYPE_BITS + winoff_bits)) >> 48;
+        uint8_t consumed = tinyhuff_decode(length_encoder, &peek, 16, length);
+        if (consumed > 0 && *length > 0) {
+            *offset = (bits << LZ77_TYPE_BITS) >> (64 - winoff_bits);
+            cstream_consume(cstream, LZ77_TYPE_BITS + winoff_bits + consumed);
+            return 1;
+        }
+    }
+    return cstream_read_token(cstream, length_encoder, winoff_bits, offset, length, next);
+}
+
+/*
+ * Appends a token to a plan, starting a new chunk before it if the current
+ * one is full.
+ */
+static int add_token(parallel_plan *plan,
+                     lz77_alloc_counters *counters,
+                     uint16_t distance,
+                     uint16_t length)
+{
+    if (plan->chunk_count == 0
+            || plan->end - plan->chunks[plan->chunk_count - 1].start >= PARALLEL_CHUNK_SIZE) {
+        if (plan->chunk_count == plan->chunk_capacity) {
+            uint64_t capacity = plan->chunk_capacity == 0 ? 16 : plan->chunk_capacity * 2;
+            parallel_chunk *chunks = alloc_realloc(counters, plan->chunks,
+                    capacity * sizeof(*chunks));
+            if (chunks == NULL) {
+                return -1;
+            }
+            plan->chunks = chunks;
+            plan->chunk_capacity = capacity;
+        }
+        parallel_chunk *chunk = &plan->chunks[plan->chunk_count++];
+        memset(chunk, 0, sizeof(*chunk));
+        chunk->token = plan->token_count;
+        chunk->start = plan->end;
+    }
+
+    if (plan->token_count == plan->token_capacity) {
+        uint64_t capacity = plan->token_capacity == 0 ? 4096 : plan->token_capacity * 2;
+        parallel_token *tokens = alloc_realloc(counters, plan->tokens,
+                capacity * sizeof(*tokens));
+        if (tokens == NULL) {
+            return -1;
+        }
+        plan->tokens = tokens;
+        plan->token_capacity = capacity;
+    }
+    parallel_token *token = &plan->tokens[plan->token_count++];
+    token->distance = distance;
+    token->length = length;
+    plan->end += length == 0 ? 1 : length;
+    return 0;
+}
+
+/*
+ * Gets a buffer which can hold the whole output, preceded by the dictionary.
+ * A memory stream is enlarged to hold it; a descriptor stream gets a
+ * temporary buffer, to be freed by the caller.
+ */
+static int prepare_output(lz77_ustream *original, const parallel_plan *plan, uint8_t **output)
+{
+    if (original->fd >= 0) {
+        if ((size_t)plan->end != plan->end) {
+            errno = ENOMEM;
+            return -1;
+        }
+        *output = alloc_malloc(&original->allocations, plan->end > 0 ? plan->end : 1);
+        if (*output == NULL) {
+            return -1;
+        }
+        memcpy(*output, original->data, original->end);
+        return 0;
+    }
+
+    if (plan->end > UINT32_MAX) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (original->size < plan->end) {
+        if (original->can_realloc == 0) {
+            errno = ENOMEM;
+            return -1;
+        }
+        uint8_t *data = alloc_realloc(&original->allocations, original->data, plan->end);
+        if (data == NULL) {
+            return -1;
+        }
+        original->data = data;
+        original->size = plan->end;
+    }
+    *output = original->data;
+    return 0;
+}
+
+/*
+ * Materializes all the chunks of a plan on the threads of the executor and on
+ * the calling thread. Meanwhile, the calling thread completes the chunks in
+ * the order of the stream, as soon as each one has been materialized.
+ */
+static int materialize(lz77_executor *executor,
+                       lz77_alloc_counters *counters,
+                       parallel_plan *plan,
+                       uint8_t *output)
+{
+    // The shared buffers are allocated here, where the counters can be
+    // updated: each chunk gets the words of its bytes.
+    uint64_t words = 0;
+    for (uint64_t c = 0; c < plan->chunk_count; c++) {
+        uint64_t end = c + 1 < plan->chunk_count ? plan->chunks[c + 1].start : plan->end;
+        plan->chunks[c].bitmap = words;
+        words += (end - plan->chunks[c].start + 63) / 64;
+    }
+    if ((size_t)words != words) {
+        errno = ENOMEM;
+        return -1;
+    }
+    plan->unknown = alloc_calloc(counters, words > 0 ? words : 1, sizeof(*plan->unknown));
+    if (plan->unknown == NULL) {
+        return -1;
+    }
+    parallel_job *job = alloc_malloc(counters, sizeof(*job));
+    if (job == NULL) {
+        return -1;
+    }
+    memset(job, 0, sizeof(*job));
+    int error = pthread_mutex_init(&job->mutex, NULL);
+    if (error == 0) {
+        error = pthread_cond_init(&job->materialized, NULL);
+        if (error != 0) {
+            pthread_mutex_destroy(&job->mutex);
+        }
+    }
+    if (error != 0) {
+        free(job);
+        errno = error;
+        return -1;
+    }
+    job->references = 1;
+    job->count = plan->chunk_count;
+    job->plan = plan;
+    job->output = output;
+
+    // The calling thread works as well, so one task less is needed.
+    uint64_t tasks = 0;
+    if (executor != NULL && executor->workers > 0 && plan->chunk_count > 1) {
+        tasks = plan->chunk_count - 1;
+        if (tasks > (uint64_t)executor->workers) {
+            tasks = executor->workers;
+        }
+    }
+    for (uint64_t t = 0; t < tasks; t++) {
+        pthread_mutex_lock(&job->mutex);
+        job->references++;
+        pthread_mutex_unlock(&job->mutex);
+        if (executor->submit(executor, run_task, job) < 0) {
+            // The chunks left are materialized by the calling thread.
+            pthread_mutex_lock(&job->mutex);
+            job->references--;
+            pthread_mutex_unlock(&job->mutex);
+            break;
+        }
+    }
+
+    uint64_t completed = 0;
+    pthread_mutex_lock(&job->mutex);
+    while (completed < job->count && job->error == 0) {
+        if (plan->chunks[completed].materialized) {
+            pthread_mutex_unlock(&job->mutex);
+            complete_chunk(plan, completed, output);
+            completed++;
+            pthread_mutex_lock(&job->mutex);
+        } else if (job->next < job->count) {
+            take_chunk(job);
+        } else {
+            pthread_cond_wait(&job->materialized, &job->mutex);
+        }
+    }
+    // After an error, wait for the chunks being materialized (which use the
+    // plan), and leave the other ones.
+    job->next = job->count;
+    while (job->running > 0) {
+        pthread_cond_wait(&job->materialized, &job->mutex);
+    }
+    error = job->error;
+    pthread_mutex_unlock(&job->mutex);
+    release_job(job);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Runs a task submitted to the executor.
+ */
+static void run_task(void *argument)
+{
+    parallel_job *job = argument;
+    materialize_chunks(job);
+    release_job(job);
+}
+
+/*
+ * Materializes the chunks of a job not yet taken by other threads.
+ */
+static void materialize_chunks(parallel_job *job)
+{
+    pthread_mutex_lock(&job->mutex);
+    // The plan may have been freed already once no chunk is left.
+    while (job->next < job->count && job->error == 0) {
+        take_chunk(job);
+    }
+    pthread_mutex_unlock(&job->mutex);
+}
+
+/*
+ * Materializes the next chunk of a job, whose mutex is held by the caller
+ * (and released meanwhile).
+ */
+static void take_chunk(parallel_job *job)
+{
+    uint64_t index = job->next++;
+    job->running++;
+    pthread_mutex_unlock(&job->mutex);
+
+    int result = materialize_chunk(job->plan, index, job->output);
+
+    pthread_mutex_lock(&job->mutex);
+    if (result < 0 && job->error == 0) {
+        job->error = errno;
+    }
+    job->plan->chunks[index].materialized = 1;
+    job->running--;
+    pthread_cond_broadcast(&job->materialized);
+}
+
+/*
+ * Writes the symbols, the zeros and the phrases whose source is known of a
+ * chunk. A phrase is deferred if it refers to a previous chunk (which may
+ * not have been materialized yet), or to a phrase of this chunk which has
+ * been deferred.
+ */
+static int materialize_chunk(parallel_plan *plan, uint64_t index, uint8_t *output)
+{
+    parallel_chunk *chunk = &plan->chunks[index];
+    uint64_t first = chunk->token;
+    uint64_t last = index + 1 < plan->chunk_count
+            ? plan->chunks[index + 1].token : plan->token_count;
+    // The first chunk can refer to the dictionary, which is already there.
+    uint64_t known = index == 0 ? 0 : chunk->start;
+    uint64_t *unknown = plan->unknown + chunk->bitmap;
+
+    uint64_t pos = chunk->start;
+    for (uint64_t t = first; t < last; t++) {
+        const parallel_token *token = &plan->tokens[t];
+        if (token->length == 0) {
+            output[pos++] = token->distance;
+            continue;
+        }
+        if (token->distance == 0) {
+            memset(output + pos, 0, token->length);
+            pos += token->length;
+            continue;
+        }
+
+        // The bytes of an overlapping phrase past its position are its own.
+        uint64_t source = pos - token->distance;
+        uint64_t source_end = source + token->length < pos ? source + token->length : pos;
+        if (source >= known && (chunk->deferred_count == 0
+                || !any_bit(unknown, source - chunk->start, source_end - chunk->start))) {
+            copy_phrase(output, source, pos, token->length);
+            pos += token->length;
+            continue;
+        }
+
+        if (chunk->deferred_count == chunk->deferred_capacity) {
+            uint32_t capacity = chunk->deferred_capacity == 0 ? 64 : chunk->deferred_capacity * 2;
+            parallel_deferred *deferred = alloc_realloc(&chunk->allocations, chunk->deferred,
+                    capacity * sizeof(*deferred));
+            if (deferred == NULL) {
+                return -1;
+            }
+            chunk->deferred = deferred;
+            chunk->deferred_capacity = capacity;
+        }
+        parallel_deferred *deferred = &chunk->deferred[chunk->deferred_count++];
+        deferred->token = t - first;
+        deferred->position = pos - chunk->start;
+        set_bits(unknown, pos - chunk->start, pos - chunk->start + token->length);
+        pos += token->length;
+    }
+    return 0;
+}
+
+/*
+ * Copies the deferred phrases of a chunk, once all the previous chunks have
+ * been completed (so every byte before a deferred phrase is known by the time
+ * it is copied).
+ */
+static void complete_chunk(parallel_plan *plan, uint64_t index, uint8_t *output)
+{
+    const parallel_chunk *chunk = &plan->chunks[index];
+    const parallel_token *tokens = plan->tokens + chunk->token;
+    for (uint32_t d = 0; d < chunk->deferred_count; d++) {
+        const parallel_token *token = &tokens[chunk->deferred[d].token];
+        uint64_t dest = chunk->start + chunk->deferred[d].position;
+        copy_phrase(output, dest - token->distance, dest, token->length);
+    }
+}
+
+/*
+ * Releases a reference to a job, freeing it if it was the last one.
+ */
+static void release_job(parallel_job *job)
+{
+    pthread_mutex_lock(&job->mutex);
+    int last = --job->references == 0;
+    pthread_mutex_unlock(&job->mutex);
+    if (last) {
+        pthread_cond_destroy(&job->materialized);
+        pthread_mutex_destroy(&job->mutex);
+        free(job);
+    }
+}
+
+/*
+ * Updates an output stream as if the tokens had been written one by one: the
+ * output of a descriptor is written, and the output of a memory stream is
+ * left in its buffer, with the window at its end.
+ */
+static int finish_output(lz77_ustream *original, const parallel_plan *plan, uint8_t *output)
+{
+    uint64_t count = plan->end - original->end;
+    if (original->fd >= 0) {
+        // Only the dictionary is left in the buffer of the stream.
+        if (io_write(original->fd, output + original->end, count) < 0) {
+            return -1;
+        }
+    } else {
+        original->end = plan->end;
+        original->window_currsize = plan->window_currsize;
+        original->window = original->data + original->end - original->window_currsize;
+    }
+    original->processed_bytes += count;
+    return 0;
+}
+
+/*
+ * Frees the arrays of a plan, counting the allocations made for its chunks.
+ */
+static void free_plan(parallel_plan *plan, lz77_alloc_counters *counters)
+{
+    for (uint64_t c = 0; c < plan->chunk_count; c++) {
+        alloc_add(counters, &plan->chunks[c].allocations);
+        free(plan->chunks[c].deferred);
+    }
+    free(plan->chunks);
+    free(plan->tokens);
+    free(plan->unknown);
+    memset(plan, 0, sizeof(*plan));
+}
@@ -0,0 +1,48 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <lz77ppm/lz77.h>
+
+#include <price.h>
+#include <alloc_internal.h>
+
+int prices_init(lz77_prices *prices,
+                const lz77_tinyhuff_code *length_codes,
+                uint16_t max_length,
+                uint8_t winoff_bits,
+                lz77_alloc_counters *counters)
+{
+    assert(prices != NULL);
+    assert(length_codes != NULL);
+
+    prices->length = alloc_malloc(counters, (size_t)max_length + 1);
+    if (prices->length == NULL) {
+        return -1;
+    }
+    prices->symbol = LZ77_SYMBOL_BITS;
+    prices->offset = LZ77_TYPE_BITS + winoff_bits;
+    prices->max_length = max_length;
+
+    // The code of length zero is the terminating token, not a phrase.
+    prices->length[0] = 0;
+    for (unsigned length = 1; length <= max_length; length++) {
+        prices->length[length] = length_codes[length].nbits;
+    }
+    return 0;
+}
+
+void prices_free(lz77_prices *prices)
+{
+    assert(prices != NULL);
+
+    free(prices->length);
+    prices->length = NULL;
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file price.h
+ *
+ * Tables of the cost (in bits) of the fields of a token, so that a parser can
+ * compare the encodings of the same data with a few lookups.
+ */
+
+#ifndef _LZ77_PRICE_H_
+#define _LZ77_PRICE_H_
+
+#include <stdint.h>
+
+#include <lz77ppm/alloc.h>
+
+#include <tinyhuff.h>
+
+/**
+ * The prices of the tokens of a stream.
+ */
+typedef struct _lz77_prices {
+    /**
+     * The price of a symbol token.
+     */
+    uint8_t symbol;
+    /**
+     * The price of the type and of the offset of a phrase token (which does
+     * not depend on the offset, since offsets have a fixed width).
+     */
+    uint8_t offset;
+    /**
+     * The maximum length of a phrase.
+     */
+    uint16_t max_length;
+    /**
+     * The price of the code of each length, indexed by length (with
+     * <tt>max_length + 1</tt> entries), or zero if the length cannot be
+     * encoded in a phrase.
+     */
+    uint8_t *length;
+} lz77_prices;
+
+/**
+ * Fills the tables of prices from the codes of the lengths.
+ *
+ * @param length_codes The codes of the lengths from 0 to @c max_length, as
+ *        built by #tinyhuff_build_table.
+ * @param max_length The maximum length of a phrase.
+ * @param winoff_bits The number of bits of an offset in the window.
+ * @param counters The counters updated by the allocation of the table.
+ *
+ * @return 0 in case of success, or a negative value if memory is not
+ *         available.
+ */
+int prices_init(lz77_prices *prices,
+                const lz77_tinyhuff_code *length_codes,
+                uint16_t max_length,
+                uint8_t winoff_bits,
+                lz77_alloc_counters *counters);
+
+/**
+ * Releases the tables of prices.
+ */
+void prices_free(lz77_prices *prices);
+
+/**
+ * Gets the price of a phrase token of the given length, which must be
+ * encodable.
+ */
+static inline uint32_t prices_phrase(const lz77_prices *prices, uint16_t length)
+{
+    return prices->offset + prices->length[length];
+}
+
+/**
+ * Gets the price of encoding the given number of bytes as symbol tokens.
+ */
+static inline uint32_t prices_symbols(const lz77_prices *prices, uint32_t count)
+{
+    return prices->symbol * count;
+}
+
+/**
+ * Checks whether a match of the given length (at most @c max_length) can be
+ * encoded as a phrase token costing fewer bits than the symbol tokens it
+ * replaces.
+ */
+static inline int prices_phrase_pays(const lz77_prices *prices, uint16_t length)
+{
+    return prices->length[length] != 0
+            && prices_phrase(prices, length) < prices_symbols(prices, length);
+}
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/raw.h>
+#include <lz77ppm/logger.h>
+
+#include <ustream_internal.h>
+#include <bit.h>
+#include <tinyhuff.h>
+
+/** The number of bits of an index of the hash table of the matcher. */
+#define RAW_HASH_BITS 12
+
+/** The maximum length in bits of a length code (as peeked by the decoder). */
+#define RAW_MAX_CODE_BITS 16
+
+/**
+ * A writer of bits to a caller's buffer.
+ */
+typedef struct {
+    uint8_t *data;
+    uint32_t capacity;
+    uint32_t used;
+    /** The bits not yet written, right-aligned. */
+    uint64_t bits;
+    /** The number of bits not yet written (less than 32 between calls). */
+    uint8_t nbits;
+} raw_writer;
+
+static int check_sizes(uint16_t window_size, uint16_t lookahead_size);
+static uint16_t max_match_length(lz77_tinyhuff *encoder, uint16_t lookahead_size);
+static int flush_bits(raw_writer *writer);
+
+/*
+ * Appends up to 32 bits to the output, writing them four bytes at a time.
+ */
+static inline int put_bits(raw_writer *writer, uint32_t value, uint8_t nbits)
+{
+    assert(nbits <= 32);
+
+    writer->bits = (writer->bits << nbits) | value;
+    writer->nbits += nbits;
+    if (writer->nbits >= 32) {
+        if (writer->capacity - writer->used < 4) {
+            errno = ENOMEM;
+            return -1;
+        }
+        uint32_t word = writer->bits >> (writer->nbits - 32);
+        uint8_t *out = writer->data + writer->used;
+        out[0] = word >> 24;
+        out[1] = word >> 16;
+        out[2] = word >> 8;
+        out[3] = word;
+        writer->used += 4;
+        writer->nbits -= 32;
+    }
+    return 0;
+}
+
+/*
+ * Hashes the three bytes at the given address.
+ */
+static inline uint32_t hash3(const uint8_t *p)
+{
+    uint32_t value = p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (value * 2654435761u) >> (32 - RAW_HASH_BITS);
+}
+
+/*
+ * Compresses a block with a greedy matcher, which takes the last position of
+ * the same three bytes (if it is still in the window) as the only candidate.
+ *
+ * Positions are stored modulo 2^16, which is enough to address a window. When
+ * the whole input fits into the window (@c fits is non-zero), the window
+ * never slides, so the offset of a match is its position and no bounds have
+ * to be checked: the function is inlined twice, and this case compiles into
+ * the simpler loop.
+ */
+static inline int compress_block(const uint8_t *data,
+                                 uint32_t size,
+                                 raw_writer *writer,
+                                 lz77_tinyhuff *encoder,
+                                 uint8_t winoff_bits,
+                                 uint16_t window_size,
+                                 uint16_t max_length,
+                                 int fits)
+{
+    uint16_t table[1 << RAW_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    // The positions followed by at least three bytes can be hashed.
+    uint32_t hashed = size > 2 ? size - 2 : 0;
+    uint16_t min_length = encoder->min_value;
+    uint32_t pos = 0;
+    while (pos < size) {
+        uint32_t length = 0, offset = 0;
+        if (pos < hashed) {
+            uint32_t h = hash3(data + pos);
+            uint32_t candidate = pos - (uint16_t)(pos - table[h]);
+            table[h] = pos;
+            uint32_t start = fits || pos <= window_size ? 0 : pos - window_size;
+            if (candidate < pos && candidate >= start) {
+                uint32_t limit = size - pos < max_length ? size - pos : max_length;
+                const uint8_t *a = data + candidate, *b = data + pos;
+                uint64_t wa, wb;
+                while (length + 8 <= limit) {
+                    memcpy(&wa, a + length, 8);
+                    memcpy(&wb, b + length, 8);
+                    if (wa != wb) {
+                        break;
+                    }
+                    length += 8;
+                }
+                while (length < limit && a[length] == b[length]) {
+                    length++;
+                }
+                offset = candidate - start;
+            }
+        }
+
+        if (length >= min_length) {
+            uint16_t code;
+            uint8_t nbits = tinyhuff_encode(encoder, length, &code);
+            if ((uint32_t)(LZ77_TYPE_BITS + winoff_bits + nbits) < LZ77_SYMBOL_BITS * length) {
+                if (put_bits(writer, (1u << winoff_bits) | offset,
+                             LZ77_TYPE_BITS + winoff_bits) < 0
+                        || put_bits(writer, code, nbits) < 0) {
+                    return -1;
+                }
+                // Index the positions covered by the phrase as well.
+                uint32_t end = pos + length;
+                for (pos++; pos < end; pos++) {
+                    if (pos < hashed) {
+                        table[hash3(data + pos)] = pos;
+                    }
+                }
+                continue;
+            }
+        }
+
+        if (put_bits(writer, data[pos], LZ77_SYMBOL_BITS) < 0) {
+            return -1;
+        }
+        pos++;
+    }
+
+    return flush_bits(writer);
+}
+
+int64_t lz77_raw_compress(const uint8_t *data,
+                          uint32_t size,
+                          uint8_t *buffer,
+                          uint32_t capacity,
+                          uint16_t window_size,
+                          uint16_t lookahead_size)
+{
+    if ((data == NULL && size > 0) || buffer == NULL) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (check_sizes(window_size, lookahead_size) < 0) {
+        return -1;
+    }
+
+    lz77_tinyhuff encoder;
+    uint8_t winoff_bits = ustream_init_length_encoder(&encoder, window_size, lookahead_size);
+    uint16_t max_length = max_match_length(&encoder, lookahead_size);
+
+    raw_writer writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.data = buffer;
+    writer.capacity = capacity;
+
+    int result;
+    if (size <= window_size) {
+        result = compress_block(data, size, &writer, &encoder, winoff_bits,
+                window_size, max_length, 1);
+    } else {
+        result = compress_block(data, size, &writer, &encoder, winoff_bits,
+                window_size, max_length, 0);
+    }
+    return result < 0 ? -1 : (int64_t)writer.used;
+}
+
+int64_t lz77_raw_decompress(const uint8_t *block,
+                            uint32_t size,
+                            uint8_t *buffer,
+                            uint32_t original_size,
+                            uint16_t window_size,
+                            uint16_t lookahead_size)
+{
+    if ((block == NULL && size > 0) || (buffer == NULL && original_size > 0)) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (check_sizes(window_size, lookahead_size) < 0) {
+        return -1;
+    }
+
+    lz77_tinyhuff encoder;
+    uint8_t winoff_bits = ustream_init_length_encoder(&encoder, window_size, lookahead_size);
+
+    // Each token is decoded from the 64 bits starting at its first bit, of
+    // which at least 57 are loaded (a token takes at most 1 + 16 + 16 bits).
+    uint64_t total_bits = (uint64_t)size * 8;
+    uint64_t bitpos = 0;
+    uint32_t pos = 0;
+    while (pos < original_size) {
+        uint32_t byte = bitpos / 8;
+        uint64_t bits;
+        if (size - byte >= 8) {
+            bits = bit_load_be64(block + byte);
+        } else {
+            uint8_t tail[8];
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block + byte, size - byte);
+            bits = bit_load_be64(tail);
+        }
+        bits <<= bitpos % 8;
+
+        if ((bits >> 63) == 0) {
+            if (bitpos + LZ77_SYMBOL_BITS > total_bits) {
+                break;
+            }
+            buffer[pos++] = bits >> (64 - LZ77_SYMBOL_BITS);
+            bitpos += LZ77_SYMBOL_BITS;
+            continue;
+        }
+
+        uint32_t offset = (bits << LZ77_TYPE_BITS) >> (64 - winoff_bits);
+        uint16_t peek = (bits << (LZ77_TYPE_BITS + winoff_bits)) >> 48;
+        uint16_t length;
+        uint8_t consumed = tinyhuff_decode(&encoder, &peek, 16, &length);
+        bitpos += LZ77_TYPE_BITS + winoff_bits + consumed;
+        if (consumed == 0 || length == 0 || bitpos > total_bits) {
+            break;
+        }
+
+        uint32_t start = pos <= window_size ? 0 : pos - window_size;
+        if (offset >= pos - start || length > original_size - pos) {
+            break;
+        }
+        const uint8_t *source = buffer + start + offset;
+        uint8_t *dest = buffer + pos;
+        if (source + length <= dest) {
+            memcpy(dest, source, length);
+        } else {
+            // The phrase overlaps its own output.
+            for (int i = 0; i < length; i++) {
+                dest[i] = source[i];
+            }
+        }
+        pos += length;
+    }
+
+    if (pos < original_size) {
+        lz77_log(LOG_ERROR, "The raw block is corrupted");
+        errno = EINVAL;
+        return -1;
+    }
+    return pos;
+}
+
+/*
+ * Checks the window and look-ahead sizes agreed for raw blocks.
+ */
+static int check_sizes(uint16_t window_size, uint16_t lookahead_size)
+{
+    if (window_size < LZ77_MIN_WINDOW_SIZE || window_size > LZ77_MAX_WINDOW_SIZE
+            || lookahead_size < LZ77_MIN_LOOKAHEAD_SIZE || lookahead_size > window_size) {
+        lz77_log(LOG_ERROR, "Invalid window or look-ahead buffer size");
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Gets the maximum length of a phrase whose code can be peeked by the decoder
+ * (the longest lengths of a large look-ahead buffer have longer codes).
+ */
+static uint16_t max_match_length(lz77_tinyhuff *encoder, uint16_t lookahead_size)
+{
+    uint16_t code;
+    if (lookahead_size < encoder->min_value
+            || tinyhuff_encode(encoder, lookahead_size, &code) <= RAW_MAX_CODE_BITS) {
+        return lookahead_size;
+    }
+    return encoder->max_encoded_value - 1;
+}
+
+/*
+ * Writes the bits left in a writer, padding the last byte with zeros.
+ */
+static int flush_bits(raw_writer *writer)
+{
+    uint8_t nbytes = (writer->nbits + 7) / 8;
+    if (writer->capacity - writer->used < nbytes) {
+        errno = ENOMEM;
+        return -1;
+    }
+    uint64_t bits = writer->bits << (nbytes * 8 - writer->nbits);
+    for (int i = nbytes - 1; i >= 0; i--) {
+        writer->data[writer->used + i] = bits;
+        bits >>= 8;
+    }
+    writer->used += nbytes;
+    writer->nbits = 0;
+    return 0;
+}
@@ -0,0 +1,334 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _DEFAULT_SOURCE  // Required on Linux for htobe64(), be64toh() and pread()
+#define _BSD_SOURCE      // The same, before glibc 2.19
+#ifdef __FreeBSD__
+#  include <sys/endian.h>
+#else
+#  include <endian.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+#include <seek_internal.h>
+#include <cstream_internal.h>
+#include <ustream_internal.h>
+#include <alloc_internal.h>
+#include <io.h>
+
+/** The version of the layout of the seek index. */
+#define SEEK_VERSION 0x10
+
+/**
+ * Contains the header of a seek index. All multi-byte fields are stored in
+ * big-endian byte order.
+ */
+typedef struct {
+    /** A "magic" identifier, always set to the sequence 'L', 'Z', 'S', 'I'. */
+    uint8_t magic[4];
+    /** The version of the layout of the index. */
+    uint8_t version;
+    uint8_t reserved[3];
+    /** The size of the window of the compressed file. */
+    uint16_t window_size;
+    /** The size of the look-ahead buffer of the compressed file. */
+    uint16_t lookahead_size;
+} seek_header;
+
+/**
+ * Contains the beginning of an entry of a seek index, which is followed by the
+ * window (always @c window_size bytes, of which only the first
+ * @c window_currsize are meaningful).
+ */
+typedef struct {
+    /** The position of the next token, in bits. */
+    uint8_t bit_position[8];
+    /** The number of bytes decompressed before the next token. */
+    uint8_t output_offset[8];
+    /** The current size of the window. */
+    uint8_t window_currsize[2];
+} seek_entry;
+
+static size_t entry_size(uint16_t window_size);
+static int read_at(int fd, void *buffer, size_t size, uint64_t offset);
+static int read_entry(int index_fd, uint16_t window_size, uint64_t index, uint8_t *entry);
+static uint64_t entry_output_offset(const uint8_t *entry);
+
+int lz77_seek_index_enable(lz77_ustream *original, int index_fd, uint64_t interval)
+{
+    if (original == NULL) {
+        lz77_log(LOG_ERROR, "Argument `original' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (original->is_input) {
+        lz77_log(LOG_ERROR, "A seek index requires the output stream of a decompression");
+        errno = EINVAL;
+        return -1;
+    }
+    if (index_fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return -1;
+    }
+    if (interval == 0) {
+        lz77_log(LOG_ERROR, "The interval of the seek index must be greater than zero");
+        errno = EINVAL;
+        return -1;
+    }
+
+    original->seek_fd = index_fd;
+    original->seek_interval = interval;
+    original->seek_next = original->processed_bytes;
+    return 0;
+}
+
+int seek_save(lz77_ustream *original, lz77_cstream *compressed)
+{
+    assert(original != NULL);
+    assert(compressed != NULL);
+    assert(original->seek_interval > 0);
+
+    uint16_t window_size = original->window_maxsize;
+    size_t size = entry_size(window_size);
+    if (original->seek_entry == NULL) {
+        // The window size is known only once the streams are opened.
+        original->seek_entry = alloc_malloc(&original->allocations, size);
+        if (original->seek_entry == NULL) {
+            return -1;
+        }
+        seek_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "LZSI", 4);
+        header.version = SEEK_VERSION;
+        header.window_size = htons(window_size);
+        header.lookahead_size = htons(original->lookahead_maxsize);
+        if (io_write(original->seek_fd, &header, sizeof(header)) < 0) {
+            return -1;
+        }
+    }
+
+    uint8_t *entry = original->seek_entry;
+    memset(entry, 0, size);
+    seek_entry *fields = (seek_entry *)entry;
+    uint64_t value = htobe64(compressed->processed_bits);
+    memcpy(fields->bit_position, &value, sizeof(value));
+    value = htobe64(original->processed_bytes);
+    memcpy(fields->output_offset, &value, sizeof(value));
+    uint16_t currsize = htons(original->window_currsize);
+    memcpy(fields->window_currsize, &currsize, sizeof(currsize));
+    memcpy(entry + sizeof(*fields), original->window, original->window_currsize);
+    if (io_write(original->seek_fd, entry, size) < 0) {
+        return -1;
+    }
+
+    original->seek_next = original->processed_bytes + original->seek_interval;
+    return 0;
+}
+
+int64_t lz77_seek_read(int fd, int index_fd, uint64_t offset, void *buffer, uint32_t size)
+{
+    if (fd < 0 || index_fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return -1;
+    }
+    if (buffer == NULL) {
+        lz77_log(LOG_ERROR, "Argument `buffer' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    seek_header header;
+    struct stat st;
+    if (read_at(index_fd, &header, sizeof(header), 0) < 0 || fstat(index_fd, &st) < 0) {
+        return -1;
+    }
+    uint16_t window_size = ntohs(header.window_size);
+    uint16_t lookahead_size = ntohs(header.lookahead_size);
+    if (memcmp(header.magic, "LZSI", 4) != 0 || header.version != SEEK_VERSION
+            || window_size < LZ77_MIN_WINDOW_SIZE
+            || lookahead_size < LZ77_MIN_LOOKAHEAD_SIZE || lookahead_size > window_size
+            || st.st_size < (off_t)(sizeof(header) + entry_size(window_size))) {
+        lz77_log(LOG_ERROR, "Invalid seek index");
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t count = (st.st_size - sizeof(header)) / entry_size(window_size);
+
+    uint8_t *entry = malloc(entry_size(window_size));
+    if (entry == NULL) {
+        return -1;
+    }
+
+    // Find the last entry not beyond the offset (the first one is at the
+    // beginning of the data). When several entries have the same offset, the
+    // last one is taken, whose window is the smallest (e.g., after a hole).
+    uint64_t low = 0, high = count;
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        if (read_entry(index_fd, window_size, middle, entry) < 0) {
+            free(entry);
+            return -1;
+        }
+        if (entry_output_offset(entry) <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    if (read_entry(index_fd, window_size, low, entry) < 0) {
+        free(entry);
+        return -1;
+    }
+    seek_entry *fields = (seek_entry *)entry;
+    uint64_t bit_position;
+    memcpy(&bit_position, fields->bit_position, sizeof(bit_position));
+    bit_position = be64toh(bit_position);
+    uint16_t window_currsize;
+    memcpy(&window_currsize, fields->window_currsize, sizeof(window_currsize));
+    window_currsize = ntohs(window_currsize);
+    uint64_t skip = offset - entry_output_offset(entry);
+    if (window_currsize > window_size || entry_output_offset(entry) > offset) {
+        lz77_log(LOG_ERROR, "Invalid seek index");
+        free(entry);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Resume the decompression from the entry, into memory.
+    lz77_cstream *compressed = lz77_cstream_from_descriptor(fd);
+    lz77_ustream *original = NULL;
+    if (compressed == NULL
+            || cstream_open_at(compressed, window_size, lookahead_size, bit_position) < 0
+            || (original = lz77_ustream_to_memory(compressed, NULL, 0, 1)) == NULL
+            || ustream_open(original) < 0
+            || ustream_prime(original, entry + sizeof(*fields), window_currsize) < 0) {
+        int error = errno;
+        if (original != NULL) {
+            free(original->data);
+        }
+        lz77_ustream_free(&original);
+        lz77_cstream_free(&compressed);
+        free(entry);
+        errno = error;
+        return -1;
+    }
+    free(entry);
+
+    int64_t result = 0;
+    uint64_t needed = skip + size;
+    int winoff_bits = original->window_nbits;
+    while (original->processed_bytes < needed) {
+        uint16_t token_offset = 0, length = 0;
+        uint8_t next = 0;
+        int r = cstream_read_token(compressed, original->length_encoder, winoff_bits,
+                &token_offset, &length, &next);
+        if (r < 0) {
+            result = -1;
+            break;
+        }
+        if (r == 0) {
+            uint64_t hole;
+            int more = cstream_next_member(compressed, &hole);
+            if (more <= 0) {
+                result = more;
+                break;
+            }
+            // Only the zeros within the range are needed.
+            uint64_t missing = needed - original->processed_bytes;
+            if (hole > 0 && ustream_put_zeros(original, hole < missing ? hole : missing) < 0) {
+                result = -1;
+                break;
+            }
+            ustream_restart(original);
+            continue;
+        }
+        if (ustream_save(original, token_offset, length, next) < 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    if (result == 0 && original->processed_bytes > skip) {
+        uint64_t available = original->processed_bytes - skip;
+        result = available < size ? available : size;
+        memcpy(buffer, original->data + original->hidden + skip, result);
+    }
+
+    int error = errno;
+    free(original->data);
+    lz77_ustream_free(&original);
+    lz77_cstream_free(&compressed);
+    errno = error;
+    return result;
+}
+
+/**
+ * Gets the size of an entry of a seek index.
+ */
+static size_t entry_size(uint16_t window_size)
+{
+    return sizeof(seek_entry) + window_size;
+}
+
+/**
+ * Reads exactly @c size bytes at the given offset of a file.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred or
+ *         the file is shorter (@c errno is then set to @c EINVAL).
+ */
+static int read_at(int fd, void *buffer, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t count = pread(fd, (uint8_t *)buffer + done, size - done, offset + done);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            return -1;
+        }
+        if (count == 0) {
+            lz77_log(LOG_ERROR, "Truncated seek index");
+            errno = EINVAL;
+            return -1;
+        }
+        done += count;
+    }
+    return 0;
+}
+
+/**
+ * Reads the entry of a seek index with the given index.
+ */
+static int read_entry(int index_fd, uint16_t window_size, uint64_t index, uint8_t *entry)
+{
+    size_t size = entry_size(window_size);
+    return read_at(index_fd, entry, size, sizeof(seek_header) + index * size);
+}
+
+/**
+ * Gets the number of bytes decompressed before the token of an entry.
+ */
+static uint64_t entry_output_offset(const uint8_t *entry)
+{
+    uint64_t value;
+    memcpy(&value, ((const seek_entry *)entry)->output_offset, sizeof(value));
+    return be64toh(value);
+}
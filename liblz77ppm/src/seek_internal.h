@@ -0,0 +1,32 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file seek_internal.h
+ *
+ * Functions used by the decompression algorithm to write a seek index.
+ */
+
+#ifndef _LZ77_SEEK_INTERNAL_H_
+#define _LZ77_SEEK_INTERNAL_H_
+
+#include <lz77ppm/seek.h>
+
+/**
+ * Writes an entry of the seek index describing the current state of a
+ * decompression (and the header of the index, before the first entry).
+ *
+ * It must be called between two tokens, i.e. after the last token read from
+ * @c compressed has been written to @c original.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int seek_save(lz77_ustream *original, lz77_cstream *compressed);
+
+#endif
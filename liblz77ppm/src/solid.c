@@ -0,0 +1,420 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _DEFAULT_SOURCE  // Required on Linux for htobe64() and be64toh()
+#define _BSD_SOURCE      // The same, before glibc 2.19
+#ifdef __FreeBSD__
+#  include <sys/endian.h>
+#else
+#  include <endian.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/solid.h>
+#include <lz77ppm/logger.h>
+
+#include <archive.h>
+#include <io.h>
+
+/**
+ * Contains an entry of the table of a solid archive. All fields are stored in
+ * big-endian byte order.
+ */
+typedef struct {
+    /** The offset of the member containing the entry in the archive. */
+    uint8_t member_offset[8];
+    /** The size of the member. */
+    uint8_t member_size[8];
+    /** The offset of the entry in the decompressed member. */
+    uint8_t offset[4];
+    /** The size of the entry. */
+    uint8_t size[4];
+} solid_record;
+
+/**
+ * An entry of the table, decoded.
+ */
+typedef struct {
+    uint64_t member_offset;
+    uint64_t member_size;
+    uint32_t offset;
+    uint32_t size;
+} solid_entry;
+
+struct _lz77_solid_writer {
+    archive_writer archive;
+    uint16_t window_size;
+    uint16_t lookahead_size;
+    uint32_t group_size;
+    /** The entries of the current group, concatenated. */
+    uint8_t *buffer;
+    uint32_t used;
+    uint32_t capacity;
+    /** The sizes of the entries of the current group. */
+    uint32_t *sizes;
+    uint32_t count;
+    uint32_t sizes_capacity;
+    /** The number of the first entry of the current group. */
+    uint64_t first_entry;
+};
+
+struct _lz77_solid_reader {
+    int fd;
+    /** The entries of the archive, as loaded from the table. */
+    solid_entry *entries;
+    uint64_t nentries;
+    /** The offset of the member decompressed into @c data. */
+    uint64_t member_offset;
+    /** The decompressed member, or @c NULL. */
+    uint8_t *data;
+    uint64_t data_size;
+};
+
+static void encode_record(solid_record *record, const solid_entry *entry);
+static void decode_record(solid_entry *entry, const solid_record *record);
+static int load_member(lz77_solid_reader *reader, const solid_entry *entry);
+
+lz77_solid_writer * lz77_solid_writer_open(int fd,
+                                           int table_fd,
+                                           uint16_t window_size,
+                                           uint16_t lookahead_size)
+{
+    if (fd < 0 || table_fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return NULL;
+    }
+    if (window_size < LZ77_MIN_WINDOW_SIZE || window_size > LZ77_MAX_WINDOW_SIZE
+            || lookahead_size < LZ77_MIN_LOOKAHEAD_SIZE) {
+        lz77_log(LOG_ERROR, "Invalid window or look-ahead buffer size");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Continue after the member of the last entry of the table.
+    archive_writer archive;
+    solid_record record;
+    solid_entry last;
+    if (archive_open(&archive, fd, table_fd, sizeof(record), &record) < 0) {
+        return NULL;
+    }
+    decode_record(&last, &record);
+    if (archive_recover(&archive, last.member_offset + last.member_size) < 0) {
+        return NULL;
+    }
+
+    lz77_solid_writer *object = calloc(1, sizeof(*object));
+    if (object != NULL) {
+        object->archive = archive;
+        object->window_size = window_size;
+        object->lookahead_size = lookahead_size;
+        object->group_size = LZ77_SOLID_DEFAULT_GROUP_SIZE;
+        object->first_entry = archive.index_size / sizeof(solid_record);
+    }
+    return object;
+}
+
+int lz77_solid_set_group_size(lz77_solid_writer *writer, uint32_t size)
+{
+    if (writer == NULL) {
+        lz77_log(LOG_ERROR, "Argument `writer' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (size == 0) {
+        lz77_log(LOG_ERROR, "The group size must be positive");
+        errno = EINVAL;
+        return -1;
+    }
+
+    writer->group_size = size;
+    return 0;
+}
+
+int64_t lz77_solid_add(lz77_solid_writer *writer, const void *data, uint32_t size)
+{
+    if (writer == NULL || (data == NULL && size > 0)) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Entries are never split between groups.
+    if (writer->count > 0 && (size > writer->group_size - writer->used
+                              || writer->used > writer->group_size)) {
+        if (lz77_solid_flush(writer) < 0) {
+            return -1;
+        }
+    }
+    if (size > UINT32_MAX - writer->used) {
+        lz77_log(LOG_ERROR, "The entry is too large (%lu bytes)", (unsigned long)size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t needed = writer->used + size;
+    if (needed > writer->capacity) {
+        uint32_t capacity = writer->capacity < 1024 ? 1024 : writer->capacity;
+        while (capacity < needed) {
+            capacity = capacity > UINT32_MAX / 2 ? UINT32_MAX : capacity * 2;
+        }
+        uint8_t *temp = realloc(writer->buffer, capacity);
+        if (temp == NULL) {
+            return -1;
+        }
+        writer->buffer = temp;
+        writer->capacity = capacity;
+    }
+    if (writer->count == writer->sizes_capacity) {
+        uint32_t capacity = writer->sizes_capacity < 64 ? 64 : writer->sizes_capacity * 2;
+        uint32_t *temp = realloc(writer->sizes, capacity * sizeof(*temp));
+        if (temp == NULL) {
+            return -1;
+        }
+        writer->sizes = temp;
+        writer->sizes_capacity = capacity;
+    }
+
+    if (size > 0) {
+        memcpy(writer->buffer + writer->used, data, size);
+    }
+    writer->used = needed;
+    writer->sizes[writer->count++] = size;
+    return writer->first_entry + writer->count - 1;
+}
+
+int lz77_solid_flush(lz77_solid_writer *writer)
+{
+    if (writer == NULL) {
+        lz77_log(LOG_ERROR, "Argument `writer' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (writer->count == 0) {
+        return 0;
+    }
+
+    // Each group is an independent member, which is appended to the archive.
+    int64_t size = archive_append(&writer->archive, writer->buffer, writer->used,
+                                  writer->window_size, writer->lookahead_size);
+    if (size < 0) {
+        return -1;
+    }
+
+    // The table is written after the member, so that it never refers to
+    // incomplete data.
+    solid_record *records = malloc(writer->count * sizeof(*records));
+    if (records == NULL) {
+        return -1;
+    }
+    solid_entry entry;
+    entry.member_offset = writer->archive.end;
+    entry.member_size = size;
+    entry.offset = 0;
+    for (uint32_t i = 0; i < writer->count; i++) {
+        entry.size = writer->sizes[i];
+        encode_record(&records[i], &entry);
+        entry.offset += entry.size;
+    }
+    int result = archive_commit(&writer->archive, size, records,
+                                writer->count * sizeof(*records));
+    free(records);
+    if (result < 0) {
+        return -1;
+    }
+
+    writer->first_entry += writer->count;
+    writer->count = 0;
+    writer->used = 0;
+    return 0;
+}
+
+int lz77_solid_writer_close(lz77_solid_writer **pwriter)
+{
+    assert(pwriter != NULL);
+
+    lz77_solid_writer *writer = *pwriter;
+    if (writer == NULL) {
+        return 0;
+    }
+
+    int result = lz77_solid_flush(writer);
+    int error = errno;
+    free(writer->buffer);
+    free(writer->sizes);
+    free(writer);
+    *pwriter = NULL;
+    errno = error;
+    return result;
+}
+
+lz77_solid_reader * lz77_solid_reader_open(int fd, int table_fd)
+{
+    if (fd < 0 || table_fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(table_fd, &st) != 0) {
+        return NULL;
+    }
+    if (st.st_size % sizeof(solid_record) != 0) {
+        lz77_log(LOG_ERROR, "The table of the solid archive is corrupted");
+        errno = EINVAL;
+        return NULL;
+    }
+    uint64_t nentries = st.st_size / sizeof(solid_record);
+
+    lz77_solid_reader *object = calloc(1, sizeof(*object));
+    if (object == NULL) {
+        return NULL;
+    }
+    object->fd = fd;
+    object->nentries = nentries;
+    object->entries = malloc((nentries > 0 ? nentries : 1) * sizeof(*object->entries));
+    solid_record *records = malloc((nentries > 0 ? nentries : 1) * sizeof(*records));
+    if (object->entries == NULL || records == NULL
+            || lseek(table_fd, 0, SEEK_SET) != 0
+            || io_read(table_fd, records, nentries * sizeof(*records), 1)
+                    != (ssize_t)(nentries * sizeof(*records))) {
+        int error = errno;
+        free(records);
+        lz77_solid_reader_free(&object);
+        errno = error;
+        return NULL;
+    }
+
+    // Check that the entries follow one another, within a member or at the
+    // beginning of the next one.
+    for (uint64_t i = 0; i < nentries; i++) {
+        solid_entry *e = &object->entries[i];
+        decode_record(e, &records[i]);
+        const solid_entry *previous = i > 0 ? &object->entries[i - 1] : NULL;
+        int valid;
+        if (previous != NULL && e->member_offset == previous->member_offset) {
+            valid = e->member_size == previous->member_size
+                    && e->offset == previous->offset + previous->size;
+        } else {
+            uint64_t offset = previous ? previous->member_offset + previous->member_size : 0;
+            valid = e->member_offset == offset && e->offset == 0;
+        }
+        if (!valid) {
+            lz77_log(LOG_ERROR, "The table of the solid archive is corrupted");
+            free(records);
+            lz77_solid_reader_free(&object);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    free(records);
+
+    object->member_offset = UINT64_MAX;
+    return object;
+}
+
+uint64_t lz77_solid_count(const lz77_solid_reader *reader)
+{
+    assert(reader != NULL);
+
+    return reader->nentries;
+}
+
+int64_t lz77_solid_get(lz77_solid_reader *reader, uint64_t entry, const uint8_t **data)
+{
+    if (reader == NULL || data == NULL) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (entry >= reader->nentries) {
+        lz77_log(LOG_ERROR, "The solid archive has no entry %llu", (unsigned long long)entry);
+        errno = EINVAL;
+        return -1;
+    }
+
+    const solid_entry *e = &reader->entries[entry];
+    if (e->member_offset != reader->member_offset && load_member(reader, e) < 0) {
+        return -1;
+    }
+    if ((uint64_t)e->offset + e->size > reader->data_size) {
+        lz77_log(LOG_ERROR, "An entry of the solid archive is truncated");
+        errno = EINVAL;
+        return -1;
+    }
+    *data = reader->data + e->offset;
+    return e->size;
+}
+
+void lz77_solid_reader_free(lz77_solid_reader **preader)
+{
+    assert(preader != NULL);
+
+    lz77_solid_reader *reader = *preader;
+    if (reader == NULL) {
+        return;
+    }
+
+    free(reader->entries);
+    free(reader->data);
+    free(reader);
+    *preader = NULL;
+}
+
+/*
+ * Reads and decompresses the member containing an entry.
+ */
+static int load_member(lz77_solid_reader *reader, const solid_entry *entry)
+{
+    uint8_t *data;
+    int64_t result = archive_load(reader->fd, entry->member_offset, entry->member_size, &data);
+    if (result < 0) {
+        return -1;
+    }
+
+    free(reader->data);
+    reader->data = data;
+    reader->data_size = result;
+    reader->member_offset = entry->member_offset;
+    return 0;
+}
+
+static void encode_record(solid_record *record, const solid_entry *entry)
+{
+    uint64_t value = htobe64(entry->member_offset);
+    memcpy(record->member_offset, &value, sizeof(value));
+    value = htobe64(entry->member_size);
+    memcpy(record->member_size, &value, sizeof(value));
+    uint32_t value32 = htonl(entry->offset);
+    memcpy(record->offset, &value32, sizeof(value32));
+    value32 = htonl(entry->size);
+    memcpy(record->size, &value32, sizeof(value32));
+}
+
+static void decode_record(solid_entry *entry, const solid_record *record)
+{
+    uint64_t value;
+    memcpy(&value, record->member_offset, sizeof(value));
+    entry->member_offset = be64toh(value);
+    memcpy(&value, record->member_size, sizeof(value));
+    entry->member_size = be64toh(value);
+    uint32_t value32;
+    memcpy(&value32, record->offset, sizeof(value32));
+    entry->offset = ntohl(value32);
+    memcpy(&value32, record->size, sizeof(value32));
+    entry->size = ntohl(value32);
+}
@@ -0,0 +1,495 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // Required for pthread_rwlock_t
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/store.h>
+#include <lz77ppm/logger.h>
+
+#include <lru.h>
+
+/** The size of the chunks of the arena holding the compressed values. */
+#define STORE_CHUNK_SIZE (256 * 1024)
+
+/** The number of independent shards of the cache of decompressed values. */
+#define STORE_SHARDS 16
+
+/**
+ * A chunk of the arena. Values are appended to the first chunk of the list
+ * while they fit.
+ */
+typedef struct _store_chunk {
+    struct _store_chunk *next;
+    size_t used;
+    size_t capacity;
+    uint8_t data[];
+} store_chunk;
+
+/**
+ * The record of a value.
+ */
+typedef struct {
+    /** The compressed value, in the arena. */
+    const uint8_t *data;
+    /** The size of @c data, equal to @c size if the value is not compressed. */
+    uint32_t stored_size;
+    uint32_t size;
+} store_record;
+
+/**
+ * A decompressed value. The key of its entry is made of the number of the
+ * value divided by #STORE_SHARDS (the keys of a shard are spaced by
+ * #STORE_SHARDS, so the quotient selects the buckets) and of the number
+ * itself.
+ */
+typedef struct {
+    /** The entry in the table of the shard (the first member). */
+    lru_entry entry;
+    uint32_t size;
+    uint8_t data[];
+} store_entry;
+
+/**
+ * A shard of the cache, holding the values whose number is congruent to its
+ * index modulo #STORE_SHARDS.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    lru_table table;
+    uint64_t hits;
+    uint64_t misses;
+} store_shard;
+
+struct _lz77_store {
+    uint16_t window_size;
+    uint16_t lookahead_size;
+    const lz77_dictionary *dictionary;
+    /** Protects the records, the arena and the totals. */
+    pthread_rwlock_t lock;
+    store_record *records;
+    uint64_t count;
+    uint64_t capacity;
+    store_chunk *chunks;
+    uint64_t original;
+    uint64_t stored;
+    store_shard shards[STORE_SHARDS];
+};
+
+static int64_t compress_value(lz77_store *store, const uint8_t *data, uint32_t size, uint8_t **output);
+static int decompress_value(lz77_store *store, const store_record *record, uint8_t *buffer);
+static int64_t append_record(lz77_store *store, const uint8_t *data, uint32_t stored_size, uint32_t size);
+static const uint8_t * arena_append(lz77_store *store, const uint8_t *data, uint32_t size);
+static void cache_insert(store_shard *shard, uint64_t key, const uint8_t *data, uint32_t size);
+static void release_entry(lru_entry *entry);
+
+lz77_store * lz77_store_create(uint16_t window_size,
+                               uint16_t lookahead_size,
+                               const lz77_dictionary *dictionary,
+                               size_t budget)
+{
+    if (window_size < LZ77_MIN_WINDOW_SIZE || window_size > LZ77_MAX_WINDOW_SIZE
+            || lookahead_size < LZ77_MIN_LOOKAHEAD_SIZE
+            || (dictionary == NULL && lookahead_size > window_size)) {
+        lz77_log(LOG_ERROR, "Invalid window or look-ahead buffer size");
+        errno = EINVAL;
+        return NULL;
+    }
+
+    lz77_store *object = calloc(1, sizeof(*object));
+    if (object == NULL) {
+        return NULL;
+    }
+    int error = pthread_rwlock_init(&object->lock, NULL);
+    if (error != 0) {
+        free(object);
+        errno = error;
+        return NULL;
+    }
+    object->window_size = window_size;
+    object->lookahead_size = lookahead_size;
+    object->dictionary = dictionary;
+
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        store_shard *shard = &object->shards[i];
+        error = lru_init(&shard->table, budget / STORE_SHARDS, 16, release_entry) < 0
+                ? ENOMEM : pthread_mutex_init(&shard->mutex, NULL);
+        if (error != 0) {
+            free(shard->table.buckets);
+            while (--i >= 0) {
+                pthread_mutex_destroy(&object->shards[i].mutex);
+                lru_destroy(&object->shards[i].table);
+            }
+            pthread_rwlock_destroy(&object->lock);
+            free(object);
+            errno = error;
+            return NULL;
+        }
+    }
+    return object;
+}
+
+int64_t lz77_store_put(lz77_store *store, const void *data, uint32_t size)
+{
+    if (store == NULL || (data == NULL && size > 0)) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The compression does not touch the store, so the readers are blocked
+    // only while the value is appended.
+    uint8_t *compressed = NULL;
+    int64_t stored_size = compress_value(store, data, size, &compressed);
+    if (stored_size < 0) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&store->lock);
+    int64_t key = append_record(store, compressed != NULL ? compressed : data, stored_size, size);
+    pthread_rwlock_unlock(&store->lock);
+    free(compressed);
+    return key;
+}
+
+int64_t lz77_store_size(lz77_store *store, uint64_t key)
+{
+    if (store == NULL) {
+        lz77_log(LOG_ERROR, "Argument `store' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    int64_t result = -1;
+    pthread_rwlock_rdlock(&store->lock);
+    if (key < store->count) {
+        result = store->records[key].size;
+    }
+    pthread_rwlock_unlock(&store->lock);
+    if (result < 0) {
+        lz77_log(LOG_ERROR, "The value does not exist");
+        errno = EINVAL;
+    }
+    return result;
+}
+
+int64_t lz77_store_get(lz77_store *store, uint64_t key, void *buffer, uint32_t capacity)
+{
+    if (store == NULL || (buffer == NULL && capacity > 0)) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+
+    store_shard *shard = &store->shards[key % STORE_SHARDS];
+    if (shard->table.budget > 0) {
+        uint64_t entry_key[2] = { key / STORE_SHARDS, key };
+        pthread_mutex_lock(&shard->mutex);
+        store_entry *entry = (store_entry *)lru_use(&shard->table, entry_key);
+        if (entry != NULL && entry->size <= capacity) {
+            uint32_t size = entry->size;
+            memcpy(buffer, entry->data, size);
+            shard->hits++;
+            pthread_mutex_unlock(&shard->mutex);
+            return size;
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+
+    // The arena never moves, so the record can be used after the lock is
+    // released, and the values are decompressed in parallel.
+    store_record record;
+    pthread_rwlock_rdlock(&store->lock);
+    int exists = key < store->count;
+    if (exists) {
+        record = store->records[key];
+    }
+    pthread_rwlock_unlock(&store->lock);
+    if (!exists) {
+        lz77_log(LOG_ERROR, "The value does not exist");
+        errno = EINVAL;
+        return -1;
+    }
+    if (record.size > capacity) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (decompress_value(store, &record, buffer) < 0) {
+        return -1;
+    }
+
+    cache_insert(shard, key, buffer, record.size);
+    return record.size;
+}
+
+void lz77_store_get_stats(lz77_store *store,
+                          uint64_t *original,
+                          uint64_t *stored,
+                          uint64_t *hits,
+                          uint64_t *misses)
+{
+    assert(store != NULL);
+
+    pthread_rwlock_rdlock(&store->lock);
+    if (original != NULL) {
+        *original = store->original;
+    }
+    if (stored != NULL) {
+        *stored = store->stored;
+    }
+    pthread_rwlock_unlock(&store->lock);
+
+    uint64_t total_hits = 0, total_misses = 0;
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        store_shard *shard = &store->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        total_hits += shard->hits;
+        total_misses += shard->misses;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    if (hits != NULL) {
+        *hits = total_hits;
+    }
+    if (misses != NULL) {
+        *misses = total_misses;
+    }
+}
+
+void lz77_store_free(lz77_store **pstore)
+{
+    assert(pstore != NULL);
+
+    lz77_store *store = *pstore;
+    if (store == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < STORE_SHARDS; i++) {
+        store_shard *shard = &store->shards[i];
+        lru_destroy(&shard->table);
+        pthread_mutex_destroy(&shard->mutex);
+    }
+    while (store->chunks != NULL) {
+        store_chunk *next = store->chunks->next;
+        free(store->chunks);
+        store->chunks = next;
+    }
+    free(store->records);
+    pthread_rwlock_destroy(&store->lock);
+    free(store);
+    *pstore = NULL;
+}
+
+/*
+ * Compresses a value, with the store's dictionary if it has one.
+ *
+ * @return The size of the compressed value, with @c output set to an
+ *         allocated buffer containing it; or the size of the value, with
+ *         @c output set to @c NULL, if the value is not worth compressing;
+ *         or a negative value in case of error.
+ */
+static int64_t compress_value(lz77_store *store, const uint8_t *data, uint32_t size, uint8_t **output)
+{
+    *output = NULL;
+    if (size == 0) {
+        return 0;
+    }
+
+    if (store->dictionary == NULL) {
+        // A block as large as the value is not worth compressing.
+        uint8_t *block = malloc(size);
+        if (block == NULL) {
+            return -1;
+        }
+        int64_t result = lz77_raw_compress(data, size, block, size - 1,
+                store->window_size, store->lookahead_size);
+        if (result < 0) {
+            free(block);
+            return errno == ENOMEM ? (int64_t)size : -1;
+        }
+        *output = block;
+        return result;
+    }
+
+    lz77_ustream *ustream = lz77_ustream_from_memory(data, size,
+            store->window_size, store->lookahead_size);
+    if (ustream == NULL) {
+        return -1;
+    }
+    lz77_cstream *cstream = NULL;
+    if (lz77_dictionary_use(ustream, store->dictionary) < 0
+            || (cstream = lz77_cstream_to_memory(ustream, NULL, 0, 1)) == NULL) {
+        int error = errno;
+        lz77_ustream_free(&ustream);
+        errno = error;
+        return -1;
+    }
+    int64_t result = lz77_compress(ustream, cstream);
+    uint8_t *compressed = lz77_cstream_get_buffer(cstream);
+    int error = errno;
+    lz77_ustream_free(&ustream);
+    lz77_cstream_free(&cstream);
+    if (result < 0) {
+        free(compressed);
+        errno = error;
+        return -1;
+    }
+    if (result >= size) {
+        free(compressed);
+        return size;
+    }
+    *output = compressed;
+    return result;
+}
+
+/*
+ * Decompresses a value into a buffer of its size.
+ */
+static int decompress_value(lz77_store *store, const store_record *record, uint8_t *buffer)
+{
+    if (record->stored_size == record->size) {
+        memcpy(buffer, record->data, record->size);
+        return 0;
+    }
+
+    if (store->dictionary == NULL) {
+        int64_t result = lz77_raw_decompress(record->data, record->stored_size, buffer,
+                record->size, store->window_size, store->lookahead_size);
+        return result < 0 ? -1 : 0;
+    }
+
+    // An output primed with a dictionary needs a buffer of its own, which is
+    // then copied.
+    lz77_cstream *cstream = lz77_cstream_from_memory(record->data, record->stored_size);
+    if (cstream == NULL) {
+        return -1;
+    }
+    lz77_ustream *ustream = lz77_ustream_to_memory(cstream, NULL, 0, 1);
+    int64_t result = -1;
+    if (ustream != NULL && lz77_dictionary_use(ustream, store->dictionary) == 0) {
+        result = lz77_decompress(cstream, ustream);
+    }
+    int error = errno;
+    uint8_t *decompressed = ustream != NULL ? lz77_ustream_get_buffer(ustream) : NULL;
+    if (result >= 0 && result != record->size) {
+        lz77_log(LOG_ERROR, "The stored value is corrupted");
+        error = EINVAL;
+        result = -1;
+    }
+    if (result >= 0) {
+        memcpy(buffer, decompressed, record->size);
+    }
+    lz77_ustream_free(&ustream);
+    lz77_cstream_free(&cstream);
+    free(decompressed);
+    errno = error;
+    return result < 0 ? -1 : 0;
+}
+
+/*
+ * Adds the record of a value, copying its stored data to the arena. It must be
+ * called with the lock held for writing.
+ *
+ * @return The number of the value, or a negative value if memory is not
+ *         available.
+ */
+static int64_t append_record(lz77_store *store, const uint8_t *data, uint32_t stored_size, uint32_t size)
+{
+    if (store->count == store->capacity) {
+        uint64_t capacity = store->capacity > 0 ? store->capacity * 2 : 64;
+        store_record *records = realloc(store->records, capacity * sizeof(*records));
+        if (records == NULL) {
+            return -1;
+        }
+        store->records = records;
+        store->capacity = capacity;
+    }
+    const uint8_t *stored = arena_append(store, data, stored_size);
+    if (stored == NULL) {
+        return -1;
+    }
+    store_record *record = &store->records[store->count];
+    record->data = stored;
+    record->stored_size = stored_size;
+    record->size = size;
+    store->original += size;
+    store->stored += stored_size + sizeof(*record);
+    return store->count++;
+}
+
+/*
+ * Copies a value to the arena, and returns its address (or NULL if memory is
+ * not available). Values larger than a quarter of a chunk get a chunk of
+ * their own, which is put after the first one so as not to waste its free
+ * space.
+ */
+static const uint8_t * arena_append(lz77_store *store, const uint8_t *data, uint32_t size)
+{
+    store_chunk *chunk = store->chunks;
+    if (chunk == NULL || chunk->capacity - chunk->used < size) {
+        int own = size > STORE_CHUNK_SIZE / 4;
+        size_t capacity = own ? size : STORE_CHUNK_SIZE;
+        chunk = malloc(sizeof(*chunk) + capacity);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        if (own && store->chunks != NULL) {
+            chunk->next = store->chunks->next;
+            store->chunks->next = chunk;
+        } else {
+            chunk->next = store->chunks;
+            store->chunks = chunk;
+        }
+    }
+    uint8_t *dest = chunk->data + chunk->used;
+    memcpy(dest, data, size);
+    chunk->used += size;
+    return dest;
+}
+
+/*
+ * Counts a miss, and puts a copy of a decompressed value in the cache unless
+ * it does not fit into the budget or another thread has already put it.
+ */
+static void cache_insert(store_shard *shard, uint64_t key, const uint8_t *data, uint32_t size)
+{
+    size_t cost = sizeof(store_entry) + size;
+    store_entry *entry = cost <= shard->table.budget ? malloc(cost) : NULL;
+    if (entry != NULL) {
+        entry->entry.key[0] = key / STORE_SHARDS;
+        entry->entry.key[1] = key;
+        entry->entry.cost = cost;
+        entry->size = size;
+        memcpy(entry->data, data, size);
+    }
+
+    pthread_mutex_lock(&shard->mutex);
+    shard->misses++;
+    if (entry != NULL && !lru_contains(&shard->table, entry->entry.key)) {
+        lru_insert(&shard->table, &entry->entry);
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    free(entry);
+}
+
+/*
+ * Frees an entry evicted from the table of a shard.
+ */
+static void release_entry(lru_entry *entry)
+{
+    free(entry);
+}
@@ -156,6 +156,23 @@ uint8_t tinyhuff_encode(lz77_tinyhuff *enc, uint16_t value, uint16_t *code)
     return nbits;
 }
 
+void tinyhuff_build_table(lz77_tinyhuff *enc, lz77_tinyhuff_code *table)
+{
+    assert(enc != NULL);
+    assert(table != NULL);
+
+    for (unsigned value = 0; value <= enc->max_value; value++) {
+        if (tinyhuff_can_encode(enc, value)) {
+            uint16_t code;
+            table[value].nbits = tinyhuff_encode(enc, value, &code);
+            table[value].code = code;
+        } else {
+            table[value].nbits = 0;
+            table[value].code = 0;
+        }
+    }
+}
+
 uint8_t tinyhuff_can_encode(lz77_tinyhuff *enc, uint16_t value)
 {
     assert(enc != NULL);
@@ -204,7 +221,10 @@ uint8_t tinyhuff_decode(lz77_tinyhuff *enc,
         *value += diff;
         to_consume += enc->diff_nbits;
     }
-    assert(*value <= enc->max_value);
+    if (*value > enc->max_value) {
+        // Corrupted data (only produced by a different encoder).
+        return 0;
+    }
     assert(to_consume <= peeked_length);
 
     return to_consume;
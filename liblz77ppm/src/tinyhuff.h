@@ -42,6 +42,22 @@ typedef struct _lz77_tinyhuff {
     uint8_t diff_nbits;
 } lz77_tinyhuff;
 
+/**
+ * An entry of a table of precomputed codes.
+ *
+ * @see #tinyhuff_build_table
+ */
+typedef struct _lz77_tinyhuff_code {
+    /**
+     * The Huffman code, right-aligned.
+     */
+    uint32_t code;
+    /**
+     * The length in bits of the code, or zero if the value cannot be encoded.
+     */
+    uint8_t nbits;
+} lz77_tinyhuff_code;
+
 /**
  * The minimum length of a code produced by #lz77_tinyhuff_encode.
  * This is used to choose whether to encode a symbol token or a phrase token
@@ -68,6 +84,17 @@ void tinyhuff_init(lz77_tinyhuff *encoder, uint16_t min_value, uint16_t max_valu
  */
 uint8_t tinyhuff_encode(lz77_tinyhuff *enc, uint16_t value, uint16_t *code);
 
+/**
+ * Fills a table with the codes of all the values accepted by an encoder, so
+ * that the compression loop can encode a length with a single lookup.
+ *
+ * @param table An array of <tt>enc->max_value + 1</tt> entries. The entry at
+ *        index @c i is set to the code of the value @c i (as returned by
+ *        #tinyhuff_encode), or to a code of zero bits if @c i cannot be
+ *        encoded.
+ */
+void tinyhuff_build_table(lz77_tinyhuff *enc, lz77_tinyhuff_code *table);
+
 /**
  * Gets a value indicating whether the given number can be encoded.
  *
@@ -12,6 +12,9 @@
 #include <tree.h>
 #include <ustream_internal.h>
 
+static void rotate_tree_array(lz77_tree v[], int size, int shift);
+static void shift_tree_indices(lz77_tree v[], int size, int shift);
+
 void lz77_tree_init(lz77_ustream *ustream)
 {
     lz77_tree *root = &ustream->tree[ustream->window_maxsize];
@@ -26,15 +29,38 @@ uint16_t lz77_find_and_add(lz77_ustream *ustream, int curr, uint16_t *offset)
     assert(0 <= curr && curr < ustream->window_maxsize);
     assert(offset != NULL);
 
-    // Start searching from the right child of the root.
-    int test = ustream->tree[ustream->window_maxsize].larger;
+    lz77_tree *tree = ustream->tree;
+    int root = ustream->window_maxsize;
+
+    // The node being added takes the place of the one which is leaving the
+    // window.
+    lz77_tree_delete_node(tree, curr);
 
     // The position inside the tree array which corresponds to the beginning
     // of the window.
     int begin = (ustream->window - ustream->cdata) % ustream->window_maxsize;
 
+    // The new node becomes the root of the tree: the nodes on the search path
+    // are split into those smaller than it (attached to the right end of its
+    // smaller subtree) and those larger than it (attached to the left end of
+    // its larger subtree). Recently added nodes are thus found near the root.
+    uint16_t *smaller = &tree[curr].smaller;
+    uint16_t *larger = &tree[curr].larger;
+    int smaller_parent = curr;
+    int larger_parent = curr;
+
     uint16_t longest = 0;
-    while (1) {
+    int replaced = 0;
+    int test = tree[root].larger;
+    int depth = 0;
+    while (test != UNUSED) {
+        if (++depth > ustream->search_depth && ustream->search_depth != 0) {
+            // The path is too long (the tree is not balanced): drop the rest
+            // of it, which is made of the oldest nodes. Dropped nodes are
+            // recognized by lz77_tree_delete_node().
+            break;
+        }
+
         int k = test - begin;
         if (k < 0) {
             k += ustream->window_maxsize;
@@ -52,52 +78,48 @@ uint16_t lz77_find_and_add(lz77_ustream *ustream, int curr, uint16_t *offset)
         if (i > longest) {
             *offset = k;
             longest = i;
-            if (longest == ustream->lookahead_currsize) {
-                // We found a match for the whole look-ahead buffer. Since
-                // duplicated nodes in the tree are not permitted, we just
-                // replace the old node (test) with the new one (curr).
-                if (test != curr) {
-                    lz77_tree_delete_node(ustream->tree, curr);
-                    lz77_tree_replace_node(ustream->tree, test, curr);
-                }
-                break;
+        }
+        if (i == ustream->lookahead_currsize) {
+            // We found a match for the whole look-ahead buffer. Since
+            // duplicated nodes in the tree are not permitted, the old node
+            // (test) is replaced with the new one (curr).
+            *smaller = tree[test].smaller;
+            if (*smaller != UNUSED) {
+                tree[*smaller].parent = smaller_parent;
+            }
+            *larger = tree[test].larger;
+            if (*larger != UNUSED) {
+                tree[*larger].parent = larger_parent;
             }
+            tree[test].parent = UNUSED;
+            replaced = 1;
+            break;
         }
-        assert(delta != 0);
 
-        uint16_t *child;
+        int next;
         if (delta > 0) {
-            child = &ustream->tree[test].larger;
+            next = tree[test].larger;
+            *smaller = test;
+            tree[test].parent = smaller_parent;
+            smaller = &tree[test].larger;
+            smaller_parent = test;
         }
         else {
-            child = &ustream->tree[test].smaller;
-        }
-        if (*child == UNUSED) {
-            // We reached the end of our path in the tree. Add the new node
-            // (curr) as a child of the test node.
-            if (test == curr) {
-                // lz77_tree_replace_node(ustream->tree, test, curr);
-                break;
-            }
-            else {
-                if (ustream->tree[curr].parent != UNUSED) {
-                    lz77_tree_delete_node(ustream->tree, curr);
-                }
-                if (*child == UNUSED) {
-                    // Function lz77_tree_delete_node() may have changed the
-                    // node we had selected (*child). If this is the case, just
-                    // continue navigating the tree, otherwise set the node and
-                    // break.
-                    *child = curr;
-                    ustream->tree[curr].parent = test;
-                    ustream->tree[curr].larger = UNUSED;
-                    ustream->tree[curr].smaller = UNUSED;
-                    break;
-                }
-            }
+            next = tree[test].smaller;
+            *larger = test;
+            tree[test].parent = larger_parent;
+            larger = &tree[test].smaller;
+            larger_parent = test;
         }
-        test = *child;
+        test = next;
+    }
+    if (!replaced) {
+        *smaller = UNUSED;
+        *larger = UNUSED;
     }
+
+    tree[root].larger = curr;
+    tree[curr].parent = root;
     return longest;
 }
 
@@ -163,7 +185,15 @@ void lz77_tree_delete_node(lz77_tree *tree, int index)
 {
     assert(index != UNUSED);
 
-    if (tree[index].parent == UNUSED) {
+    int parent = tree[index].parent;
+    if (parent == UNUSED) {
+        return;
+    }
+    if (tree[parent].smaller != index && tree[parent].larger != index) {
+        // The node was dropped from the tree, together with its subtree, by
+        // a search which went too deep. The nodes of that subtree are still
+        // linked together, so they can be deleted as usual.
+        tree[index].parent = UNUSED;
         return;
     }
     if (tree[index].smaller != UNUSED && tree[index].larger != UNUSED) {
@@ -178,3 +208,59 @@ void lz77_tree_delete_node(lz77_tree *tree, int index)
         lz77_tree_contract_node(tree, index, tree[index].larger);
     }
 }
+
+void lz77_tree_rotate(lz77_tree *tree, int size, int shift)
+{
+    rotate_tree_array(tree, size, shift);
+    shift_tree_indices(tree, size, shift);
+}
+
+/**
+ * Left-rotates the tree array by the given number of positions.
+ */
+static void rotate_tree_array(lz77_tree v[], int size, int shift)
+{
+    if (size <= 1 || (shift % size) == 0) {
+        return;
+    }
+    for (int offset = 0; offset < shift; offset++) {
+        lz77_tree a = v[offset];
+        int i = offset;
+        while (i + shift < size) {
+            v[i] = v[i + shift];
+            i += shift;
+        }
+        v[i] = a;
+    }
+    rotate_tree_array(v + size - shift, shift, shift - size % shift);
+}
+
+/**
+ * Updates all indices of the tree nodes by a given shift.
+ */
+static void shift_tree_indices(lz77_tree v[], int size, int shift)
+{
+    for (int i = 0; i <= size; i++) {
+        if (v[i].parent != UNUSED && v[i].parent != size) {
+            if (v[i].parent - shift < 0) {
+                v[i].parent = size + v[i].parent - shift;
+            } else {
+                v[i].parent = v[i].parent - shift;
+            }
+        }
+        if (v[i].smaller != UNUSED) {
+            if (v[i].smaller - shift < 0) {
+                v[i].smaller = size + v[i].smaller - shift;
+            } else {
+                v[i].smaller = v[i].smaller - shift;
+            }
+        }
+        if (v[i].larger != UNUSED) {
+            if (v[i].larger - shift < 0) {
+                v[i].larger = size + v[i].larger - shift;
+            } else {
+                v[i].larger = v[i].larger - shift;
+            }
+        }
+    }
+}
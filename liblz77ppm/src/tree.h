@@ -80,4 +80,19 @@ void lz77_tree_replace_node(lz77_tree *tree, int old, int new);
  */
 void lz77_tree_delete_node(lz77_tree *tree, int index);
 
+/**
+ * Left-rotates the array of nodes, updating all the indices accordingly.
+ *
+ * @param size The size of the window (i.e., the index of the root node, which
+ *        is not moved).
+ * @param shift The number of positions of the rotation. After the rotation,
+ *        the node previously at index @c shift is at index 0.
+ *
+ * Since the node associated to a word of the window is selected using the
+ * position of the word modulo @c size, this function must be called whenever
+ * the window is moved to a position which is not congruent to the previous
+ * one (e.g., when it is moved to the beginning of the data buffer).
+ */
+void lz77_tree_rotate(lz77_tree *tree, int size, int shift);
+
 #endif
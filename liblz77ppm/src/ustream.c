@@ -15,12 +15,16 @@
 #include <lz77ppm/lz77.h>
 #include <lz77ppm/logger.h>
 
+#include <alloc_internal.h>
 #include <ustream_internal.h>
 #include <cstream_internal.h>
+#include <hints_internal.h>
+#include <dictionary_internal.h>
+#include <io.h>
 
 static uint8_t number_of_bits(uint16_t value);
-static void rotate_tree_array(lz77_tree v[], int size, int shift);
-static void shift_tree_indices(lz77_tree v[], int size, int shift);
+static ssize_t read_input(lz77_ustream *ustream, uint8_t *dest, uint32_t max_count);
+static void find_hole(lz77_ustream *ustream);
 
 uint8_t * lz77_ustream_get_buffer(lz77_ustream *ustream)
 {
@@ -37,6 +41,17 @@ uint8_t * lz77_ustream_get_buffer(lz77_ustream *ustream)
     }
 }
 
+uint64_t lz77_ustream_get_processed_bytes(lz77_ustream *ustream)
+{
+    if (ustream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `ustream' must not be NULL");
+        errno = EINVAL;
+        return 0;
+    }
+
+    return ustream->processed_bytes;
+}
+
 lz77_ustream * lz77_ustream_from_memory(const uint8_t *data,
                                         uint32_t size,
                                         uint16_t window_size,
@@ -54,6 +69,13 @@ lz77_ustream * lz77_ustream_from_memory(const uint8_t *data,
         errno = EINVAL;
         return NULL;
     }
+    if (window_size > LZ77_MAX_WINDOW_SIZE) {
+        lz77_log(LOG_ERROR,
+                "The window size cannot be greater than %d (given %d)",
+                LZ77_MAX_WINDOW_SIZE, window_size);
+        errno = EINVAL;
+        return NULL;
+    }
     if (lookahead_size < LZ77_MIN_LOOKAHEAD_SIZE) {
         lz77_log(LOG_ERROR,
                 "The look-ahead buffer size cannot be less then %d (given %d)",
@@ -64,7 +86,9 @@ lz77_ustream * lz77_ustream_from_memory(const uint8_t *data,
 
     lz77_ustream *object = calloc(1, sizeof(*object));
     if (object != NULL) {
-        object->tree = malloc((window_size + 1) * sizeof(*object->tree));
+        alloc_record(&object->allocations, sizeof(*object));
+        object->tree = alloc_malloc(&object->allocations,
+                (window_size + 1) * sizeof(*object->tree));
         if (object->tree == NULL) {
             free(object);
             return NULL;
@@ -77,9 +101,11 @@ lz77_ustream * lz77_ustream_from_memory(const uint8_t *data,
         object->window = data;
         object->window_maxsize = window_size;
         object->window_nbits = number_of_bits(window_size - 1);
+        object->search_depth = LZ77_DEFAULT_SEARCH_DEPTH;
         object->lookahead = data;
         object->lookahead_maxsize = lookahead_size;
-        object->length_encoder = calloc(1, sizeof(*object->length_encoder));
+        object->length_encoder = alloc_calloc(&object->allocations, 1,
+                sizeof(*object->length_encoder));
         if (object->length_encoder == NULL) {
             free(object->tree);
             free(object);
@@ -103,6 +129,13 @@ lz77_ustream * lz77_ustream_from_descriptor(int fd, uint16_t window_size, uint16
         errno = EINVAL;
         return NULL;
     }
+    if (window_size > LZ77_MAX_WINDOW_SIZE) {
+        lz77_log(LOG_ERROR,
+                "The window size cannot be greater than %d (given %d)",
+                LZ77_MAX_WINDOW_SIZE, window_size);
+        errno = EINVAL;
+        return NULL;
+    }
     if (lookahead_size < LZ77_MIN_LOOKAHEAD_SIZE) {
         lz77_log(LOG_ERROR,
                 "The look-ahead buffer size cannot be less then %d (given %d)",
@@ -113,6 +146,7 @@ lz77_ustream * lz77_ustream_from_descriptor(int fd, uint16_t window_size, uint16
 
     lz77_ustream *object = calloc(1, sizeof(*object));
     if (object != NULL) {
+        alloc_record(&object->allocations, sizeof(*object));
         // data_size must be at least (window_size + lookahead_size).
         // If it is set exactly to (window_size + lookahead_size), data is read
         // from the descriptor few bytes at a time (even one byte at a time),
@@ -120,12 +154,19 @@ lz77_ustream * lz77_ustream_from_descriptor(int fd, uint16_t window_size, uint16
         // space in the buffer. Increase this size to achieve a better
         // performance.
         int data_size = (window_size + lookahead_size) * 10;
-        uint8_t * data = malloc(data_size);
+        // When reading from a pipe, use (at least) a buffer as large as the
+        // pipe itself, so that it can be drained with a few system calls.
+        int pipe_size = io_setup(fd, &object->is_pipe);
+        if (data_size < pipe_size) {
+            data_size = pipe_size;
+        }
+        uint8_t * data = alloc_malloc(&object->allocations, data_size);
         if (data == NULL) {
             free(object);
             return NULL;
         }
-        object->tree = malloc((window_size + 1) * sizeof(*object->tree));
+        object->tree = alloc_malloc(&object->allocations,
+                (window_size + 1) * sizeof(*object->tree));
         if (object->tree == NULL) {
             free(data);
             free(object);
@@ -139,9 +180,11 @@ lz77_ustream * lz77_ustream_from_descriptor(int fd, uint16_t window_size, uint16
         object->window = data;
         object->window_maxsize = window_size;
         object->window_nbits = number_of_bits(window_size - 1);
+        object->search_depth = LZ77_DEFAULT_SEARCH_DEPTH;
         object->lookahead = data;
         object->lookahead_maxsize = lookahead_size;
-        object->length_encoder = calloc(1, sizeof(*object->length_encoder));
+        object->length_encoder = alloc_calloc(&object->allocations, 1,
+                sizeof(*object->length_encoder));
         if (object->length_encoder == NULL) {
             free(object->tree);
             free(data);
@@ -165,13 +208,15 @@ lz77_ustream * lz77_ustream_to_memory(lz77_cstream *from,
 
     lz77_ustream *object = calloc(1, sizeof(*object));
     if (object != NULL) {
+        alloc_record(&object->allocations, sizeof(*object));
         object->fd = -1;
         object->data = data;
         object->size = data == NULL ? 0 : size;
         object->can_realloc = can_realloc;
         object->window = data;
         object->from = from;
-        object->length_encoder = calloc(1, sizeof(*object->length_encoder));
+        object->length_encoder = alloc_calloc(&object->allocations, 1,
+                sizeof(*object->length_encoder));
     }
     return object;
 }
@@ -191,19 +236,121 @@ lz77_ustream * lz77_ustream_to_descriptor(lz77_cstream *from, int fd)
 
     lz77_ustream *object = calloc(1, sizeof(*object));
     if (object != NULL) {
+        alloc_record(&object->allocations, sizeof(*object));
         object->fd = fd;
         object->can_realloc = 1;
         object->from = from;
-        object->length_encoder = calloc(1, sizeof(*object->length_encoder));
+        // The pipe size is just recorded here: the buffer is allocated when the
+        // stream is opened (see ustream_open()).
+        object->pipe_size = io_setup(fd, &object->is_pipe);
+        object->length_encoder = alloc_calloc(&object->allocations, 1,
+                sizeof(*object->length_encoder));
     }
     return object;
 }
 
+int lz77_ustream_reset(lz77_ustream *ustream, const uint8_t *data, uint32_t size)
+{
+    if (ustream == NULL || data == NULL) {
+        lz77_log(LOG_ERROR, "Arguments must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    // The buffer of a stream primed with a dictionary is owned by the stream.
+    if (!ustream->is_input || ustream->fd >= 0 || ustream->can_realloc) {
+        lz77_log(LOG_ERROR, "Only an input stream backed by a memory buffer can be reset");
+        errno = EINVAL;
+        return -1;
+    }
+    if (ustream->hints != NULL || ustream->checkpoint_interval > 0) {
+        lz77_log(LOG_ERROR, "A stream using hints or checkpoints cannot be reset");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (ustream->length_codes != NULL && ustream->target_throughput > 0) {
+        // Undo the adjustments made to meet the target throughput.
+        ustream->search_depth = ustream->effort_depth;
+        ustream->acceleration = ustream->effort_acceleration;
+    }
+    ustream->cdata = data;
+    ustream->size = size;
+    ustream->end = size;
+    ustream->window = data;
+    ustream->window_currsize = 0;
+    ustream->lookahead = data;
+    ustream->lookahead_currsize = 0;
+    ustream->misses = 0;
+    ustream->skip = 0;
+    ustream->processed_bytes = 0;
+    return 0;
+}
+
+int lz77_ustream_reset_descriptor(lz77_ustream *ustream, int fd)
+{
+    if (ustream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `ustream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (fd < 0) {
+        lz77_log(LOG_ERROR, "The file descriptor is not valid");
+        errno = EINVAL;
+        return -1;
+    }
+    if (ustream->fd < 0) {
+        lz77_log(LOG_ERROR, "Only a stream backed by a descriptor can be reset to another one");
+        errno = EINVAL;
+        return -1;
+    }
+    if (ustream->hints != NULL || ustream->checkpoint_interval > 0
+            || ustream->seek_interval > 0 || ustream->dictionary != NULL) {
+        lz77_log(LOG_ERROR,
+                "A stream using hints, checkpoints, a seek index or a dictionary cannot be reset");
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The buffers are kept: the one of an input stream was sized for the
+    // first descriptor, while the one of an output stream is enlarged (if
+    // needed) when the stream is opened.
+    ustream->fd = fd;
+    if (ustream->is_input) {
+        io_setup(fd, &ustream->is_pipe);
+        if (ustream->length_codes != NULL && ustream->target_throughput > 0) {
+            // Undo the adjustments made to meet the target throughput.
+            ustream->search_depth = ustream->effort_depth;
+            ustream->acceleration = ustream->effort_acceleration;
+        }
+        ustream->cdata = ustream->data;
+        ustream->lookahead = ustream->data;
+        ustream->misses = 0;
+        ustream->skip = 0;
+        ustream->file_offset = 0;
+        ustream->hole_start = 0;
+        ustream->hole_end = 0;
+    } else {
+        ustream->pipe_size = io_setup(fd, &ustream->is_pipe);
+        ustream->window_nbits = 0;
+        ustream->hidden = 0;
+    }
+    ustream->end = 0;
+    ustream->window = ustream->data;
+    ustream->window_currsize = 0;
+    ustream->lookahead_currsize = 0;
+    ustream->processed_bytes = 0;
+    return 0;
+}
+
 int ustream_open(lz77_ustream *ustream)
 {
     assert(ustream != NULL);
-    // Check if the stream is already opened
-    assert(ustream->window_currsize == 0 && ustream->lookahead_currsize == 0);
+    // Check if the stream is already opened. Notice that the window of an
+    // input stream may have been primed (e.g., when resuming from a
+    // checkpoint or with a dictionary): in that case it is already at the
+    // beginning of the buffer.
+    assert(ustream->lookahead_currsize == 0);
+    assert(ustream->window_currsize == 0 || ustream->is_input);
     assert(ustream->is_input || ustream->window_nbits == 0);
     if (!ustream->is_input) {
         // If the compressed stream's sizes are not valid, maybe it is not open.
@@ -214,19 +361,35 @@ int ustream_open(lz77_ustream *ustream)
     if (ustream->is_input) {
         // Fill the look-ahead buffer.
         if (ustream->fd >= 0) {
-            int readcount = read(ustream->fd, ustream->data, ustream->size);
+            if (ustream->sparse) {
+                off_t offset = lseek(ustream->fd, 0, SEEK_CUR);
+                if (offset < 0) {
+                    // Not a file: there are no holes to look for.
+                    ustream->sparse = 0;
+                } else {
+                    ustream->file_offset = offset;
+                    find_hole(ustream);
+                }
+            }
+            uint8_t *dest = ustream->data + ustream->window_currsize;
+            int max_count = ustream->size - ustream->window_currsize;
+            int readcount = read_input(ustream, dest, max_count);
             if (readcount < 0) {
                 return -1;
             }
-            ustream->end = readcount;
-            ustream->lookahead_currsize = ustream->end;
-        } else {
-            ustream->lookahead_currsize = ustream->size;
+            ustream->lookahead = dest;
+            ustream->end = ustream->window_currsize + readcount;
+        }
+        // Clamp before assigning, since the available data may not fit into
+        // lookahead_currsize (e.g., 65536 bytes in memory).
+        uint32_t available = ustream->end - ustream->window_currsize;
+        if (available > ustream->lookahead_maxsize) {
+            available = ustream->lookahead_maxsize;
         }
-        if (ustream->lookahead_currsize > ustream->lookahead_maxsize) {
-            ustream->lookahead_currsize = ustream->lookahead_maxsize;
+        ustream->lookahead_currsize = available;
+        if (ustream->window_currsize == 0) {
+            lz77_tree_init(ustream);
         }
-        lz77_tree_init(ustream);
     }
     else {
         assert(ustream->from != NULL);
@@ -236,18 +399,45 @@ int ustream_open(lz77_ustream *ustream)
         if (ustream->fd >= 0) {
             int data_size = ustream->window_maxsize * 10;
             // When changing the previous 10, update test_ustream_fill_buffer().
-            uint8_t * data = malloc(data_size);
-            if (data == NULL) {
-                return -1;
+            if (data_size < (int)ustream->pipe_size) {
+                data_size = ustream->pipe_size;
             }
-            ustream->data = data;
-            ustream->size = data_size;
-            ustream->window = data;
+            // The buffer of a stream which has been reset is reused, if it
+            // is large enough.
+            if (ustream->data == NULL || ustream->size < (uint32_t)data_size) {
+                free(ustream->data);
+                ustream->data = NULL;
+                uint8_t * data = alloc_malloc(&ustream->allocations, data_size);
+                if (data == NULL) {
+                    return -1;
+                }
+                ustream->data = data;
+                ustream->size = data_size;
+            }
+            ustream->window = ustream->data;
+        }
+        if (ustream->dictionary != NULL && dictionary_prime_output(ustream) < 0) {
+            return -1;
         }
     }
-    int min_match_length = LZ77_TYPE_BITS + ustream->window_nbits + LZ77_TINYHUFF_MIN_CODE_BITS;
-    min_match_length = (min_match_length / LZ77_SYMBOL_BITS) + 1;
-    tinyhuff_init(ustream->length_encoder, min_match_length, ustream->lookahead_maxsize);
+    ustream_init_length_encoder(ustream->length_encoder,
+            ustream->window_maxsize, ustream->lookahead_maxsize);
+
+    if (ustream->is_input && ustream->length_codes == NULL) {
+        // The table is kept when the stream is reset.
+        int count = ustream->lookahead_maxsize + 1;
+        ustream->length_codes = alloc_malloc(&ustream->allocations,
+                count * sizeof(*ustream->length_codes));
+        if (ustream->length_codes == NULL) {
+            return -1;
+        }
+        tinyhuff_build_table(ustream->length_encoder, ustream->length_codes);
+    }
+    if (ustream->is_input && ustream->prices.length == NULL
+            && prices_init(&ustream->prices, ustream->length_codes, ustream->lookahead_maxsize,
+                           ustream->window_nbits, &ustream->allocations) < 0) {
+        return -1;
+    }
 
     return 0;
 }
@@ -259,21 +449,92 @@ int ustream_close(lz77_ustream *ustream)
     if (ustream->fd >= 0) {
         // Flush the data buffer when in output mode.
         if (ustream->is_input == 0) {
-            uint8_t * data = ustream->data;
-            uint32_t count = ustream->end;
-            int64_t writecount = 0;
-            while (writecount != count) {
-                writecount = write(ustream->fd, data, count);
-                if (writecount < 0) {
-                    return -1;
-                }
-                data += writecount;
-                count -= writecount;
+            if (io_write(ustream->fd, ustream->data + ustream->hidden,
+                         ustream->end - ustream->hidden) < 0) {
+                return -1;
             }
             ustream->end = 0;
+            ustream->hidden = 0;
         }
     }
+    else if (ustream->hidden > 0) {
+        // Move the output over the dictionary which preceded it.
+        memmove(ustream->data, ustream->data + ustream->hidden,
+                ustream->end - ustream->hidden);
+        ustream->end -= ustream->hidden;
+        ustream->window = ustream->data;
+        ustream->window_currsize = 0;
+        ustream->hidden = 0;
+    }
+
+    return 0;
+}
+
+int lz77_ustream_set_search_depth(lz77_ustream *ustream, uint16_t depth)
+{
+    if (ustream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `ustream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (!ustream->is_input) {
+        lz77_log(LOG_ERROR, "The search depth can only be set on an input stream");
+        errno = EINVAL;
+        return -1;
+    }
+
+    ustream->search_depth = depth;
+    return 0;
+}
+
+int lz77_ustream_set_acceleration(lz77_ustream *ustream, uint16_t acceleration)
+{
+    if (ustream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `ustream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (!ustream->is_input) {
+        lz77_log(LOG_ERROR, "The acceleration can only be set on an input stream");
+        errno = EINVAL;
+        return -1;
+    }
+
+    ustream->acceleration = acceleration;
+    return 0;
+}
+
+int lz77_ustream_set_target_throughput(lz77_ustream *ustream, uint64_t bytes_per_second)
+{
+    if (ustream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `ustream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (!ustream->is_input) {
+        lz77_log(LOG_ERROR, "The target throughput can only be set on an input stream");
+        errno = EINVAL;
+        return -1;
+    }
+
+    ustream->target_throughput = bytes_per_second;
+    return 0;
+}
+
+int lz77_ustream_set_sparse(lz77_ustream *ustream, uint8_t sparse)
+{
+    if (ustream == NULL) {
+        lz77_log(LOG_ERROR, "Argument `ustream' must not be NULL");
+        errno = EINVAL;
+        return -1;
+    }
+    if (ustream->fd < 0) {
+        lz77_log(LOG_ERROR, "Only a stream backed by a descriptor can be sparse");
+        errno = EINVAL;
+        return -1;
+    }
 
+    ustream->sparse = sparse;
     return 0;
 }
 
@@ -286,8 +547,9 @@ void lz77_ustream_free(lz77_ustream **pustream)
         return;
     }
 
-    if (ustream->fd >= 0) {
-        // Release the memory of the internal buffer.
+    if (ustream->fd >= 0 || (ustream->is_input && ustream->can_realloc)) {
+        // Release the memory of the internal buffer (also allocated for an
+        // input in memory primed with a dictionary).
         assert(ustream->can_realloc != 0);
         free(ustream->data);
         ustream->cdata = ustream->data = NULL;
@@ -296,6 +558,15 @@ void lz77_ustream_free(lz77_ustream **pustream)
     ustream->tree = NULL;
     free(ustream->length_encoder);
     ustream->length_encoder = NULL;
+    free(ustream->length_codes);
+    ustream->length_codes = NULL;
+    prices_free(&ustream->prices);
+    free(ustream->checkpoint_slot);
+    ustream->checkpoint_slot = NULL;
+    free(ustream->seek_entry);
+    ustream->seek_entry = NULL;
+    free(ustream->hints);
+    ustream->hints = NULL;
     free(ustream);
 
     *pustream = NULL;
@@ -316,6 +587,9 @@ int ustream_find_and_advance(lz77_ustream * ustream,
         return 0;
     }
 
+    // Whether a search is done (or a hint is used) at this position.
+    int searched = 1;
+
     if (ustream->window_currsize == 0) {
         // Initialize the tree by adding the first symbol as the right child of the root.
         ustream->tree[ustream->window_maxsize].larger = 0;
@@ -332,13 +606,52 @@ int ustream_find_and_advance(lz77_ustream * ustream,
     else {
         // The new node will be put in the array of nodes at position curr.
         int curr = (ustream->lookahead - ustream->cdata) % ustream->window_maxsize;
-        *length = lz77_find_and_add(ustream, curr, offset);
+        uint16_t hinted = 0, hinted_offset = 0;
+        if (ustream->hints != NULL) {
+            hinted = hints_match(ustream, &hinted_offset);
+        }
+        if (hinted == ustream->lookahead_currsize) {
+            // No longer match exists: skip the search, just removing the node
+            // which is leaving the window from the tree.
+            lz77_tree_delete_node(ustream->tree, curr);
+            *length = hinted;
+            *offset = hinted_offset;
+        }
+        else if (ustream->skip > 0 && hinted == 0) {
+            // Recent searches failed: emit a literal without searching.
+            ustream->skip--;
+            lz77_tree_delete_node(ustream->tree, curr);
+            *length = 0;
+            searched = 0;
+        }
+        else {
+            *length = lz77_find_and_add(ustream, curr, offset);
+            if (hinted > *length) {
+                *length = hinted;
+                *offset = hinted_offset;
+            }
+        }
     }
 
-    int can_encode = tinyhuff_can_encode(ustream->length_encoder, *length);
+    // A match is taken only if its phrase is cheaper than its symbols.
+    int pays = prices_phrase_pays(&ustream->prices, *length);
+
+    if (ustream->acceleration != 0 && searched) {
+        if (!pays) {
+            if (ustream->misses < UINT16_MAX) {
+                ustream->misses++;
+            }
+            uint32_t skip = (uint32_t)ustream->misses * ustream->acceleration / 16;
+            ustream->skip = skip < LZ77_MAX_ACCELERATION_SKIP ? skip : LZ77_MAX_ACCELERATION_SKIP;
+        }
+        else {
+            ustream->misses = 0;
+            ustream->skip = 0;
+        }
+    }
 
     int count;
-    if (*length == 0 || can_encode == 0) {
+    if (!pays) {
         count = 1;
         *length = 0;
         *offset = 0;
@@ -403,24 +716,24 @@ int ustream_find_and_advance(lz77_ustream * ustream,
                 uint8_t *dest = new_lookah + lookah_size;
                 int max_count = ustream->size - data_size;
                 assert(max_count == ustream->data + ustream->size - dest);
-                int readcount = read(ustream->fd, dest, max_count);
+                int readcount = read_input(ustream, dest, max_count);
                 if (readcount < 0) {
                     return -1;
                 }
 
                 // Rotate the tree array.
                 int x = (ustream->window - ustream->data) % ustream->window_maxsize;
-                rotate_tree_array(ustream->tree, ustream->window_maxsize, x);
-                shift_tree_indices(ustream->tree, ustream->window_maxsize, x);
+                lz77_tree_rotate(ustream->tree, ustream->window_maxsize, x);
 
                 // Update status variables.
                 ustream->window = ustream->data;
                 ustream->lookahead = new_lookah;
                 ustream->end = data_size + readcount;
-                ustream->lookahead_currsize = lookah_size + readcount;
-                if (ustream->lookahead_currsize > ustream->lookahead_maxsize) {
-                    ustream->lookahead_currsize = ustream->lookahead_maxsize;
+                int available = lookah_size + readcount;
+                if (available > ustream->lookahead_maxsize) {
+                    available = ustream->lookahead_maxsize;
                 }
+                ustream->lookahead_currsize = available;
             } else {
                 // Reduce the current size of the look-ahead buffer.
                 ustream->lookahead_currsize -= 1;
@@ -429,9 +742,20 @@ int ustream_find_and_advance(lz77_ustream * ustream,
         }
 
         if (i < count - 1) {
-            int curr = (ustream->lookahead - ustream->cdata) % ustream->window_maxsize;
-            uint16_t ignored;
-            lz77_find_and_add(ustream, curr, &ignored);
+            // A position inside a phrase of the hint stream (except for its
+            // last few bytes) is not added to the tree: its content is already
+            // in the window at the source of that phrase.
+            uint16_t covered = 0;
+            if (ustream->hints != NULL) {
+                uint64_t source;
+                uint64_t position = ustream->processed_bytes + i + 1;
+                covered = hints_lookup(ustream->hints, position, &source);
+            }
+            if (covered == 0 || covered <= ustream->hints->tail) {
+                int curr = (ustream->lookahead - ustream->cdata) % ustream->window_maxsize;
+                uint16_t ignored;
+                lz77_find_and_add(ustream, curr, &ignored);
+            }
         }
     }
 
@@ -443,27 +767,31 @@ int ustream_find_and_advance(lz77_ustream * ustream,
 int ustream_save(lz77_ustream * ustream, uint16_t offset, uint16_t length, uint8_t next)
 {
     assert(ustream != NULL);
-    assert(length == 0 || offset <= ustream->window_currsize);
     assert(ustream->window + ustream->window_currsize == ustream->data + ustream->end);
 
+    if (length > 0 && offset >= ustream->window_currsize) {
+        // This happens, for instance, when data compressed with a dictionary
+        // is decompressed without it.
+        lz77_log(LOG_ERROR, "A phrase refers to data before the beginning of the window");
+        errno = EINVAL;
+        return -1;
+    }
+
     int count = length == 0 ? 1 : length;
     if (ustream->size < ustream->end + count) {
         if (ustream->fd >= 0) {
-            assert(ustream->window_maxsize == ustream->window_currsize);
-            uint8_t *data = ustream->data;
-            uint32_t count = ustream->window - ustream->data;
-            int64_t writecount = 0;
-            while (writecount != count) {
-                writecount = write(ustream->fd, data, count);
-                if (writecount < 0) {
-                    return -1;
-                }
-                data += writecount;
-                count -= writecount;
+            // The window is not full only at the beginning of a member. The
+            // bytes of a dictionary, if any, are not part of the output.
+            uint32_t flushed = ustream->window - ustream->data;
+            if (flushed > ustream->hidden
+                    && io_write(ustream->fd, ustream->data + ustream->hidden,
+                                flushed - ustream->hidden) < 0) {
+                return -1;
             }
-            memmove(ustream->data, ustream->window, ustream->window_maxsize);
+            ustream->hidden = flushed > ustream->hidden ? 0 : ustream->hidden - flushed;
+            memmove(ustream->data, ustream->window, ustream->window_currsize);
             ustream->window = ustream->data;
-            ustream->end = ustream->window_maxsize;
+            ustream->end = ustream->window_currsize;
         } else {
             if (ustream->can_realloc == 0) {
                 errno = ENOMEM;
@@ -477,7 +805,7 @@ int ustream_save(lz77_ustream * ustream, uint16_t offset, uint16_t length, uint8
                 new_size = ustream->size * 1.1;
             }
             ustream->size = new_size;
-            uint8_t *temp = realloc(ustream->data, ustream->size);
+            uint8_t *temp = alloc_realloc(&ustream->allocations, ustream->data, ustream->size);
             if (temp == NULL) {
                 free(ustream->data);
                 ustream->data = NULL;
@@ -535,61 +863,182 @@ int ustream_save(lz77_ustream * ustream, uint16_t offset, uint16_t length, uint8
     return 0;
 }
 
-static uint8_t number_of_bits(uint16_t value)
+uint8_t ustream_init_length_encoder(lz77_tinyhuff *encoder,
+                                    uint16_t window_maxsize,
+                                    uint16_t lookahead_maxsize)
 {
-    uint8_t r = 1;
-    while (value >>= 1) {
-        r++;
+    uint8_t window_nbits = number_of_bits(window_maxsize - 1);
+    int min_match_length = LZ77_TYPE_BITS + window_nbits + LZ77_TINYHUFF_MIN_CODE_BITS;
+    min_match_length = (min_match_length / LZ77_SYMBOL_BITS) + 1;
+    tinyhuff_init(encoder, min_match_length, lookahead_maxsize);
+    return window_nbits;
+}
+
+void ustream_restart(lz77_ustream *ustream)
+{
+    assert(ustream != NULL);
+    assert(!ustream->is_input);
+
+    ustream->window = ustream->data + ustream->end;
+    ustream->window_currsize = 0;
+}
+
+int ustream_prime(lz77_ustream *ustream, const uint8_t *window, uint16_t size)
+{
+    assert(ustream != NULL);
+    assert(!ustream->is_input);
+    assert(ustream->end == 0);
+
+    if (ustream->fd < 0) {
+        // Make room for the window before the output.
+        assert(ustream->can_realloc != 0);
+        if (ustream->size > UINT32_MAX - size) {
+            errno = ENOMEM;
+            return -1;
+        }
+        uint32_t total = ustream->size + size;
+        uint8_t *data = alloc_realloc(&ustream->allocations, ustream->data,
+                total > 0 ? total : 1);
+        if (data == NULL) {
+            return -1;
+        }
+        ustream->data = data;
+        ustream->size = total;
     }
-    return r;
+    // The buffer of a descriptor is much larger than the window.
+    assert(ustream->size >= size);
+    memcpy(ustream->data, window, size);
+    ustream->window = ustream->data;
+    ustream->window_currsize = size;
+    ustream->end = size;
+    ustream->hidden = size;
+    return 0;
 }
 
-/**
- * Left-rotates the tree array by the given number of positions.
- */
-static void rotate_tree_array(lz77_tree v[], int size, int shift)
+int64_t ustream_skip_hole(lz77_ustream *ustream)
 {
-    if (size <= 1 || (shift % size) == 0) {
-        return;
+    assert(ustream != NULL);
+    assert(ustream->is_input);
+    assert(ustream->lookahead_currsize == 0);
+
+    if (!ustream->sparse || ustream->file_offset != ustream->hole_start) {
+        return 0;
     }
-    for (int offset = 0; offset < shift; offset++) {
-        lz77_tree a = v[offset];
-        int i = offset;
-        while (i + shift < size) {
-            v[i] = v[i + shift];
-            i += shift;
-        }
-        v[i] = a;
+
+    uint64_t length = ustream->hole_end - ustream->hole_start;
+    if (lseek(ustream->fd, ustream->hole_end, SEEK_SET) < 0) {
+        return -1;
     }
-    rotate_tree_array(v + size - shift, shift, shift - size % shift);
+    ustream->file_offset = ustream->hole_end;
+    ustream->processed_bytes += length;
+    find_hole(ustream);
+
+    // Start again with an empty window, as at the beginning of the input.
+    int readcount = read_input(ustream, ustream->data, ustream->size);
+    if (readcount < 0) {
+        return -1;
+    }
+    ustream->window = ustream->lookahead = ustream->data;
+    ustream->window_currsize = 0;
+    ustream->end = readcount;
+    ustream->lookahead_currsize = readcount < ustream->lookahead_maxsize
+            ? readcount : ustream->lookahead_maxsize;
+    ustream->misses = 0;
+    ustream->skip = 0;
+    lz77_tree_init(ustream);
+
+    return length;
 }
 
-/**
- * Updates all indices of the tree nodes by a given shift.
- */
-static void shift_tree_indices(lz77_tree v[], int size, int shift)
+int ustream_put_zeros(lz77_ustream *ustream, uint64_t length)
 {
-    for (int i = 0; i <= size; i++) {
-        if (v[i].parent != UNUSED && v[i].parent != size) {
-            if (v[i].parent - shift < 0) {
-                v[i].parent = size + v[i].parent - shift;
-            } else {
-                v[i].parent = v[i].parent - shift;
-            }
+    static const uint8_t zeros[4096];
+
+    assert(ustream != NULL);
+    assert(!ustream->is_input);
+
+    if (ustream->fd >= 0) {
+        // Flush the buffer, so that the zeros follow the data in the file.
+        if (io_write(ustream->fd, ustream->data + ustream->hidden,
+                     ustream->end - ustream->hidden) < 0) {
+            return -1;
         }
-        if (v[i].smaller != UNUSED) {
-            if (v[i].smaller - shift < 0) {
-                v[i].smaller = size + v[i].smaller - shift;
-            } else {
-                v[i].smaller = v[i].smaller - shift;
+        ustream->end = 0;
+        ustream->hidden = 0;
+        if (!ustream->sparse || io_skip(ustream->fd, length) < 0) {
+            for (uint64_t left = length; left > 0; ) {
+                size_t count = left < sizeof(zeros) ? left : sizeof(zeros);
+                if (io_write(ustream->fd, zeros, count) < 0) {
+                    return -1;
+                }
+                left -= count;
             }
         }
-        if (v[i].larger != UNUSED) {
-            if (v[i].larger - shift < 0) {
-                v[i].larger = size + v[i].larger - shift;
-            } else {
-                v[i].larger = v[i].larger - shift;
+    }
+    else {
+        if (length > UINT32_MAX - ustream->end) {
+            errno = ENOMEM;
+            return -1;
+        }
+        if (ustream->size < ustream->end + length) {
+            if (ustream->can_realloc == 0) {
+                errno = ENOMEM;
+                return -1;
+            }
+            uint8_t *temp = alloc_realloc(&ustream->allocations, ustream->data,
+                    ustream->end + length);
+            if (temp == NULL) {
+                free(ustream->data);
+                ustream->data = NULL;
+                return -1;
             }
+            ustream->data = temp;
+            ustream->size = ustream->end + length;
+        }
+        memset(ustream->data + ustream->end, 0, length);
+        ustream->end += length;
+    }
+
+    // The window must be restarted before more data is written.
+    ustream->window = ustream->data + ustream->end;
+    ustream->window_currsize = 0;
+    ustream->processed_bytes += length;
+    return 0;
+}
+
+/*
+ * Reads the input into the data buffer, without going past the next hole.
+ */
+static ssize_t read_input(lz77_ustream *ustream, uint8_t *dest, uint32_t max_count)
+{
+    if (ustream->sparse) {
+        if (max_count > ustream->hole_start - ustream->file_offset) {
+            max_count = ustream->hole_start - ustream->file_offset;
         }
     }
+    ssize_t readcount = io_read(ustream->fd, dest, max_count, ustream->is_pipe);
+    if (readcount > 0) {
+        ustream->file_offset += readcount;
+    }
+    return readcount;
+}
+
+/*
+ * Looks for the next hole of the input, starting from the current offset.
+ */
+static void find_hole(lz77_ustream *ustream)
+{
+    if (!io_find_hole(ustream->fd, ustream->file_offset, USTREAM_MIN_HOLE_SIZE,
+                      &ustream->hole_start, &ustream->hole_end)) {
+        ustream->hole_start = ustream->hole_end = UINT64_MAX;
+    }
+}
+
+static uint8_t number_of_bits(uint16_t value)
+{
+    uint8_t r = 1;
+    while (value >>= 1) {
+        r++;
+    }
+    return r;
 }
@@ -15,11 +15,15 @@
 #ifndef _LZ77_USTREAM_INTERNAL_H_
 #define _LZ77_USTREAM_INTERNAL_H_
 
+#include <lz77ppm/alloc.h>
 #include <lz77ppm/ustream.h>
 
+#include <price.h>
 #include <tinyhuff.h>
 #include <tree.h>
 
+struct _lz77_hints;
+
 /**
  * Represents a stream containing uncompressed data.
  *
@@ -80,6 +84,17 @@ struct _lz77_ustream {
      * (and thus used for input by the compression algorithm).
      */
     uint8_t is_input;
+    /**
+     * A boolean value indicating whether @c fd refers to a pipe. Pipes are
+     * read until the internal buffer is full, instead of accepting the
+     * (possibly very small) chunks returned by a single @c read.
+     */
+    uint8_t is_pipe;
+    /**
+     * The capacity of the pipe referred to by @c fd (zero if @c fd is not a
+     * pipe). It is used to size the output buffer when the stream is opened.
+     */
+    uint32_t pipe_size;
     /**
      * A pointer to the sliding window inside the array pointed to by the
      * @c data or @c cdata field.
@@ -125,10 +140,74 @@ struct _lz77_ustream {
      * (at position @c window_size) is the root of the tree.
      */
     lz77_tree *tree;
+    /**
+     * The maximum number of nodes of @c tree visited by a search, or zero if
+     * searches are not limited.
+     *
+     * @see #lz77_ustream_set_search_depth
+     */
+    uint16_t search_depth;
+    /**
+     * The acceleration of the compression, or zero if every position is
+     * searched.
+     *
+     * @see #lz77_ustream_set_acceleration
+     */
+    uint16_t acceleration;
+    /**
+     * The number of consecutive searches which found no match.
+     */
+    uint16_t misses;
+    /**
+     * The number of positions still to be skipped (i.e., encoded as literals
+     * without being searched or added to @c tree) after the last miss.
+     */
+    uint16_t skip;
+    /**
+     * The input throughput (in bytes per second of CPU time) which the
+     * compression tries to achieve, or zero if the effort is not adapted.
+     *
+     * @see #lz77_ustream_set_target_throughput
+     */
+    uint64_t target_throughput;
+    /**
+     * The current effort level, from 0 (the fastest) to
+     * <tt>EFFORT_LEVELS - 1</tt> (which uses @c effort_depth and
+     * @c effort_acceleration).
+     */
+    uint8_t effort_level;
+    /**
+     * The search depth set on the stream, restored at the highest effort.
+     */
+    uint16_t effort_depth;
+    /**
+     * The acceleration set on the stream, restored at the highest effort.
+     */
+    uint16_t effort_acceleration;
+    /**
+     * The input offset (i.e., the value of @c processed_bytes) after which the
+     * throughput will be measured again.
+     */
+    uint64_t effort_next;
+    /**
+     * The CPU time (in nanoseconds) of the last measurement.
+     */
+    uint64_t effort_clock;
     /**
      * The compressor used to encode the length of a match.
      */
     lz77_tinyhuff *length_encoder;
+    /**
+     * The codes of all the lengths accepted by @c length_encoder, indexed by
+     * length. It is allocated when an input stream is opened, with a size of
+     * @c lookahead_maxsize+1 entries.
+     */
+    lz77_tinyhuff_code *length_codes;
+    /**
+     * The prices of the tokens, used to reject the matches which would cost
+     * more than their symbols. Its tables are allocated with @c length_codes.
+     */
+    lz77_prices prices;
     /**
      * The total number of bytes processed, i.e. the number of bytes consumed
      * from the stream, if opened for reading, or the number of bytes written to
@@ -141,8 +220,109 @@ struct _lz77_ustream {
      * data from a @c lz77_cstream).
      */
     lz77_cstream *from;
+    /**
+     * The number of input bytes between two checkpoints, or zero if
+     * checkpoints are disabled.
+     *
+     * @see #lz77_checkpoint_enable
+     */
+    uint64_t checkpoint_interval;
+    /**
+     * The descriptor of the checkpoint file. It is valid only if
+     * @c checkpoint_interval is not zero.
+     */
+    int checkpoint_fd;
+    /**
+     * The input offset (i.e., the value of @c processed_bytes) after which the
+     * next checkpoint will be taken.
+     */
+    uint64_t checkpoint_next;
+    /**
+     * The sequence number of the last checkpoint written or loaded.
+     */
+    uint64_t checkpoint_sequence;
+    /**
+     * A buffer used to serialize a checkpoint, allocated when checkpoints are
+     * enabled.
+     */
+    uint8_t *checkpoint_slot;
+    /**
+     * The number of output bytes between two entries of the seek index, or
+     * zero if no index is written.
+     *
+     * @see #lz77_seek_index_enable
+     */
+    uint64_t seek_interval;
+    /**
+     * The descriptor of the seek index. It is valid only if @c seek_interval
+     * is not zero.
+     */
+    int seek_fd;
+    /**
+     * The output offset (i.e., the value of @c processed_bytes) after which
+     * the next entry of the seek index is written.
+     */
+    uint64_t seek_next;
+    /**
+     * A buffer used to serialize an entry of the seek index, allocated when
+     * the first one is written.
+     */
+    uint8_t *seek_entry;
+    /**
+     * The match hints used by the compression, or @c NULL if no hints are
+     * available.
+     *
+     * @see #lz77_hints_enable
+     */
+    struct _lz77_hints *hints;
+    /**
+     * The dictionary priming the window of an output stream when it is
+     * opened, or @c NULL.
+     *
+     * @see #lz77_dictionary_use
+     */
+    const struct _lz77_dictionary *dictionary;
+    /**
+     * The number of bytes at the beginning of @c data which belong to the
+     * dictionary, rather than to the output, of an output stream.
+     */
+    uint32_t hidden;
+    /**
+     * A boolean value indicating whether the holes of a sparse file are
+     * detected (input) or recreated (output).
+     *
+     * @see #lz77_ustream_set_sparse
+     */
+    uint8_t sparse;
+    /**
+     * The offset in the file of the next byte to be read from @c fd, when
+     * holes are detected.
+     */
+    uint64_t file_offset;
+    /**
+     * The offset in the file of the first byte of the next hole of the input.
+     * No data beyond it is read until the hole is skipped.
+     */
+    uint64_t hole_start;
+    /**
+     * The offset in the file of the first byte following the next hole of the
+     * input, or @c hole_start if no hole follows.
+     */
+    uint64_t hole_end;
+    /**
+     * The allocations made on behalf of the stream.
+     *
+     * @see #lz77_ustream_get_alloc_counters
+     */
+    lz77_alloc_counters allocations;
 };
 
+/**
+ * The minimum length of a hole of a sparse input file: shorter holes are
+ * compressed as ordinary data, which costs less than starting a new member.
+ */
+#define USTREAM_MIN_HOLE_SIZE (64 * 1024)
+
 /**
  * Opens an @c lz77_ustream, initializing its internal data structures.
  *
@@ -215,4 +395,60 @@ int ustream_find_and_advance(lz77_ustream *ustream,
  */
 int ustream_save(lz77_ustream *ustream, uint16_t offset, uint16_t length, uint8_t next);
 
+/**
+ * Initializes the encoder of the lengths of the phrases for the given window
+ * and look-ahead sizes (the shortest phrase worth encoding depends on the
+ * number of bits of an offset).
+ *
+ * @return The number of bits of an offset in the window.
+ */
+uint8_t ustream_init_length_encoder(lz77_tinyhuff *encoder,
+                                    uint16_t window_maxsize,
+                                    uint16_t lookahead_maxsize);
+
+/**
+ * Empties the sliding window of an output @c lz77_ustream, so that the tokens
+ * of a new member of a compressed stream (which cannot refer to the data of
+ * the previous members) can be written to it.
+ */
+void ustream_restart(lz77_ustream *ustream);
+
+/**
+ * Copies the given bytes to the beginning of the buffer of an output stream,
+ * as the initial window (e.g., a dictionary, or the window of a decompression
+ * resumed in the middle of a compressed stream).
+ *
+ * It must be called when the stream is opened, after the window size has
+ * been taken from the compressed stream and the buffer has been allocated.
+ * The copied bytes are recorded in the @c hidden field of the stream, so that
+ * they are not written to the output.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int ustream_prime(lz77_ustream *ustream, const uint8_t *window, uint16_t size);
+
+/**
+ * Skips the hole which an input @c lz77_ustream has reached, if any, and
+ * fills the look-ahead buffer with the data following it. The window is
+ * emptied, since the data after the hole is compressed in a new member.
+ *
+ * Call this function when #ustream_find_and_advance reports the end of the
+ * data.
+ *
+ * @return The length of the hole, zero if the end of the input has been
+ *         reached, or a negative value in case of error. See @c errno for
+ *         further information.
+ */
+int64_t ustream_skip_hole(lz77_ustream *ustream);
+
+/**
+ * Writes @c length zeros to an output @c lz77_ustream. If the stream is
+ * sparse and backed by a regular file, a hole is created instead.
+ *
+ * @return 0 in case of success, or a negative value if an error occurred. See
+ *         @c errno for further information.
+ */
+int ustream_put_zeros(lz77_ustream *ustream, uint64_t length);
+
 #endif
@@ -0,0 +1,416 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file incremental.c
+ *
+ * Block-wise compression, which reuses the compressed blocks of a previous
+ * version of the same file.
+ *
+ * @author Antonio Macrì
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lz77ppm/lz77.h>
+
+#include "incremental.h"
+
+/*
+ * The index starts with a header, followed by an entry for each block. All
+ * integers are stored in big-endian order.
+ *
+ *   header: magic "LZIX" (4), version (1), reserved (3), window size (2),
+ *           look-ahead size (2), block size (4), number of blocks (8)
+ *   entry:  hash of the data (8), hash of the member (8), offset of the
+ *           member (8), size of the member (4), size of the data (4)
+ */
+#define INDEX_HEADER_SIZE 24
+#define INDEX_ENTRY_SIZE  32
+
+#define FNV1A64_INIT  0xcbf29ce484222325ULL
+#define FNV1A64_PRIME 0x100000001b3ULL
+
+typedef struct {
+    uint64_t hash;
+    uint64_t member_hash;
+    uint64_t offset;
+    uint32_t member_size;
+    uint32_t size;
+} index_entry;
+
+typedef struct {
+    uint16_t window_size;
+    uint16_t lookahead_size;
+    uint32_t block_size;
+    uint64_t count;
+    index_entry *entries;
+} block_index;
+
+static uint64_t hash_data(const uint8_t *data, size_t size)
+{
+    // FNV-1a: two versions of a block with the same size and hash are taken
+    // to be equal, with a probability of error of about 2^-64.
+    uint64_t hash = FNV1A64_INIT;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * FNV1A64_PRIME;
+    }
+    return hash;
+}
+
+static void put_be(uint8_t *p, uint64_t value, int nbytes)
+{
+    for (int i = nbytes - 1; i >= 0; i--) {
+        p[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+static uint64_t get_be(const uint8_t *p, int nbytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < nbytes; i++) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static ssize_t read_fully(int fd, uint8_t *buffer, size_t count)
+{
+    size_t readcount = 0;
+    while (readcount < count) {
+        ssize_t n = read(fd, buffer + readcount, count - readcount);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        readcount += n;
+    }
+    return readcount;
+}
+
+static int write_fully(int fd, const uint8_t *buffer, size_t count)
+{
+    while (count > 0) {
+        ssize_t n = write(fd, buffer, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += n;
+        count -= n;
+    }
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const index_entry *x = a, *y = b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    if (x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    return 0;
+}
+
+static int load_index(const char *filename, block_index *index)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    uint8_t header[INDEX_HEADER_SIZE];
+    if (read_fully(fd, header, sizeof(header)) != sizeof(header)
+            || memcmp(header, "LZIX", 4) != 0 || header[4] != LZ77PPM_VERSION) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    index->window_size = get_be(header + 8, 2);
+    index->lookahead_size = get_be(header + 10, 2);
+    index->block_size = get_be(header + 12, 4);
+    index->count = get_be(header + 16, 8);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0
+            || (uint64_t)st.st_size != INDEX_HEADER_SIZE + index->count * INDEX_ENTRY_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    index->entries = malloc(index->count * sizeof(*index->entries));
+    if (index->entries == NULL && index->count > 0) {
+        close(fd);
+        return -1;
+    }
+    for (uint64_t i = 0; i < index->count; i++) {
+        uint8_t entry[INDEX_ENTRY_SIZE];
+        if (read_fully(fd, entry, sizeof(entry)) != sizeof(entry)) {
+            free(index->entries);
+            close(fd);
+            errno = EINVAL;
+            return -1;
+        }
+        index->entries[i].hash = get_be(entry, 8);
+        index->entries[i].member_hash = get_be(entry + 8, 8);
+        index->entries[i].offset = get_be(entry + 16, 8);
+        index->entries[i].member_size = get_be(entry + 24, 4);
+        index->entries[i].size = get_be(entry + 28, 4);
+    }
+    close(fd);
+
+    // Sort the entries, so that a block can be looked up by hash and size
+    // wherever it was located in the previous version.
+    qsort(index->entries, index->count, sizeof(*index->entries), compare_entries);
+    return 0;
+}
+
+static int save_index(const char *filename, const block_index *index)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    uint8_t header[INDEX_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, "LZIX", 4);
+    header[4] = LZ77PPM_VERSION;
+    put_be(header + 8, index->window_size, 2);
+    put_be(header + 10, index->lookahead_size, 2);
+    put_be(header + 12, index->block_size, 4);
+    put_be(header + 16, index->count, 8);
+    int result = write_fully(fd, header, sizeof(header));
+
+    for (uint64_t i = 0; i < index->count && result == 0; i++) {
+        uint8_t entry[INDEX_ENTRY_SIZE];
+        put_be(entry, index->entries[i].hash, 8);
+        put_be(entry + 8, index->entries[i].member_hash, 8);
+        put_be(entry + 16, index->entries[i].offset, 8);
+        put_be(entry + 24, index->entries[i].member_size, 4);
+        put_be(entry + 28, index->entries[i].size, 4);
+        result = write_fully(fd, entry, sizeof(entry));
+    }
+
+    if (close(fd) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+/*
+ * Copies the member of an unchanged block from the previous output into the
+ * given buffer. Returns 0 if the member is not available (e.g., the previous
+ * output has been modified after its index was written).
+ */
+static int fetch_member(int fd_previous, const index_entry *entry, uint8_t *member)
+{
+    if (lseek(fd_previous, entry->offset, SEEK_SET) < 0) {
+        return 0;
+    }
+    ssize_t n = read_fully(fd_previous, member, entry->member_size);
+    if (n != (ssize_t)entry->member_size) {
+        return n < 0 ? -1 : 0;
+    }
+    return hash_data(member, entry->member_size) == entry->member_hash;
+}
+
+static int64_t compress_block(const uint8_t *block, uint32_t size,
+                              uint8_t *member, uint32_t member_maxsize,
+                              uint16_t window_size, uint16_t lookahead_size)
+{
+    lz77_ustream *original_stream = lz77_ustream_from_memory(
+            block, size, window_size, lookahead_size);
+    lz77_cstream *compressed_stream = NULL;
+    int64_t member_size = -1;
+    if (original_stream == NULL) {
+        goto cleanup;
+    }
+
+    compressed_stream = lz77_cstream_to_memory(original_stream, member, member_maxsize, 0);
+    if (compressed_stream == NULL) {
+        goto cleanup;
+    }
+
+    // The progress of a single block is meaningless: the caller reports the
+    // progress of the whole file instead.
+    void (*saved_report_progress)(lz77_ustream *, lz77_cstream *, float) = report_progress;
+    report_progress = NULL;
+    member_size = lz77_compress(original_stream, compressed_stream);
+    report_progress = saved_report_progress;
+
+cleanup:
+    lz77_ustream_free(&original_stream);
+    lz77_cstream_free(&compressed_stream);
+    return member_size;
+}
+
+int64_t incremental_compress(int fd_input,
+                             int fd_output,
+                             const char *index_filename,
+                             const char *previous_filename,
+                             uint32_t block_size,
+                             uint16_t window_size,
+                             uint16_t lookahead_size,
+                             incremental_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    block_index previous = { 0 };
+    int fd_previous = -1;
+    if (previous_filename != NULL) {
+        char *previous_index = malloc(strlen(previous_filename)
+                + sizeof(INCREMENTAL_INDEX_SUFFIX));
+        if (previous_index == NULL) {
+            return -1;
+        }
+        sprintf(previous_index, "%s%s", previous_filename, INCREMENTAL_INDEX_SUFFIX);
+        if (load_index(previous_index, &previous) < 0) {
+            fprintf(stderr, "Cannot read the index %s: compressing every block\n",
+                    previous_index);
+        } else if (previous.window_size != window_size
+                || previous.lookahead_size != lookahead_size) {
+            // Members with different parameters cannot be mixed in a file.
+            fprintf(stderr, "The previous version was compressed with different "
+                    "window or look-ahead sizes: compressing every block\n");
+        } else {
+            fd_previous = open(previous_filename, O_RDONLY);
+            if (fd_previous < 0) {
+                perror("Cannot open the previous version: compressing every block");
+            }
+        }
+        free(previous_index);
+    }
+
+    uint64_t input_size = 0;
+    if (report_progress) {
+        struct stat st;
+        if (fstat(fd_input, &st) == 0 && S_ISREG(st.st_mode)) {
+            input_size = st.st_size;
+        }
+    }
+
+    // A member is never larger than the block encoded as a sequence of symbol
+    // tokens (9 bits each), plus its header and terminating token.
+    uint32_t member_maxsize = block_size + block_size / 8 + 64;
+    uint8_t *block = malloc(block_size);
+    uint8_t *member = malloc(member_maxsize);
+
+    block_index current = { 0 };
+    current.window_size = window_size;
+    current.lookahead_size = lookahead_size;
+    current.block_size = block_size;
+    uint64_t capacity = 0;
+
+    int64_t output_size = -1;
+    if (block == NULL || member == NULL) {
+        goto cleanup;
+    }
+
+    uint64_t offset = 0;
+    while (1) {
+        ssize_t size = read_fully(fd_input, block, block_size);
+        if (size < 0) {
+            perror("Cannot read input file");
+            goto cleanup;
+        }
+        // Even an empty input produces a member.
+        if (size == 0 && current.count > 0) {
+            break;
+        }
+
+        if (current.count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            index_entry *temp = realloc(current.entries, capacity * sizeof(*temp));
+            if (temp == NULL) {
+                goto cleanup;
+            }
+            current.entries = temp;
+        }
+        index_entry *entry = &current.entries[current.count++];
+        entry->hash = hash_data(block, size);
+        entry->size = size;
+        entry->offset = offset;
+
+        int reused = 0;
+        if (fd_previous >= 0) {
+            const index_entry *found = bsearch(entry, previous.entries, previous.count,
+                    sizeof(*previous.entries), compare_entries);
+            if (found != NULL && found->member_size <= member_maxsize) {
+                reused = fetch_member(fd_previous, found, member);
+                if (reused < 0) {
+                    perror("Cannot read the previous version");
+                    goto cleanup;
+                }
+                if (reused) {
+                    entry->member_size = found->member_size;
+                    entry->member_hash = found->member_hash;
+                    stats->reused_blocks++;
+                }
+            }
+        }
+        if (!reused) {
+            int64_t member_size = compress_block(block, size, member, member_maxsize,
+                    window_size, lookahead_size);
+            if (member_size < 0) {
+                goto cleanup;
+            }
+            entry->member_size = member_size;
+            entry->member_hash = hash_data(member, member_size);
+        }
+
+        if (write_fully(fd_output, member, entry->member_size) < 0) {
+            perror("Cannot write output file");
+            goto cleanup;
+        }
+        offset += entry->member_size;
+        stats->input_size += size;
+
+        if (report_progress) {
+            float percent = 0;
+            if (input_size > 0) {
+                percent = 100.0 * stats->input_size / input_size;
+            }
+            report_progress(NULL, NULL, percent);
+        }
+    }
+    stats->blocks = current.count;
+
+    if (save_index(index_filename, &current) < 0) {
+        perror("Cannot write the index");
+        goto cleanup;
+    }
+    output_size = offset;
+
+cleanup:
+    free(block);
+    free(member);
+    free(current.entries);
+    free(previous.entries);
+    if (fd_previous >= 0) {
+        close(fd_previous);
+    }
+    return output_size;
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file incremental.h
+ *
+ * Block-wise compression, which reuses the compressed blocks of a previous
+ * version of the same file.
+ *
+ * The input is split into blocks of a fixed size, each one compressed
+ * independently into a member of the output (see #lz77_decompress). An index
+ * is written next to the output, recording for each block a hash of its data
+ * and the position of its member. When a new version of the input is
+ * compressed, the blocks whose hash and size match those of a block of the
+ * previous version are not compressed again: the member of the old block is
+ * copied verbatim from the previous output.
+ *
+ * @author Antonio Macrì
+ */
+
+#ifndef _LZ77PPM_INCREMENTAL_H_
+#define _LZ77PPM_INCREMENTAL_H_
+
+#include <stdint.h>
+
+/**
+ * The suffix appended to the name of a compressed file to get the name of its
+ * index.
+ */
+#define INCREMENTAL_INDEX_SUFFIX ".idx"
+
+/**
+ * Counters describing an incremental compression.
+ */
+typedef struct {
+    /** The number of bytes read from the input. */
+    uint64_t input_size;
+    /** The number of blocks of the input. */
+    uint64_t blocks;
+    /** The number of blocks copied from the previous output. */
+    uint64_t reused_blocks;
+} incremental_stats;
+
+/**
+ * Compresses a file block by block.
+ *
+ * @param fd_input The descriptor of the input, read sequentially.
+ * @param fd_output The descriptor of the output file.
+ * @param index_filename The name of the index file to be written.
+ * @param previous_filename The name of the output of a previous compression
+ *        (whose index is found by appending #INCREMENTAL_INDEX_SUFFIX), or
+ *        @c NULL to compress every block.
+ * @param block_size The size of the blocks.
+ * @param window_size The size of the window.
+ * @param lookahead_size The size of the look-ahead buffer.
+ * @param stats Must point to a structure that will be filled with the
+ *        counters of the operation.
+ *
+ * @return The size of the output, or @c -1 in case of failure.
+ */
+int64_t incremental_compress(int fd_input,
+                             int fd_output,
+                             const char *index_filename,
+                             const char *previous_filename,
+                             uint32_t block_size,
+                             uint16_t window_size,
+                             uint16_t lookahead_size,
+                             incremental_stats *stats);
+
+#endif
@@ -21,17 +21,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include <lz77ppm/lz77.h>
 
+#include "incremental.h"
+#include "scaling.h"
+#include "server.h"
+#include "sweep.h"
+
 #define PROGRAM_VERSION "1.0"
 
 #define DEFAULT_WINDOW_SIZE    4096
 #define DEFAULT_LOOKAHEAD_SIZE 32
 
+#define CHECKPOINT_INTERVAL (64 << 20)
+
+#define MAX_BLOCK_SIZE (1 << 30)
+
+#define RECOMPRESS_HINT_TAIL 2
+
 #define XSTR(a) STR(a)
 #define STR(a) #a
 
@@ -40,8 +53,25 @@ static struct option long_options[] = {
     { "decompress", no_argument, 0, 'd' },
     { "window-size", required_argument, 0, 'w' },
     { "lookahead-size", required_argument, 0, 'l' },
+    { "acceleration", required_argument, 0, 'a' },
+    { "target-speed", required_argument, 0, 'T' },
     { "output", required_argument, 0, 'o' },
     { "force", no_argument, 0, 'f' },
+    { "checkpoint", required_argument, 0, 'k' },
+    { "resume", no_argument, 0, 'r' },
+    { "block-size", required_argument, 0, 'b' },
+    { "previous", required_argument, 0, 'p' },
+    { "recompress", no_argument, 0, 'R' },
+    { "dictionary", required_argument, 0, 'x' },
+    { "make-dictionary", no_argument, 0, 'X' },
+    { "seek-index", required_argument, 0, 'I' },
+    { "range", required_argument, 0, 'g' },
+    { "no-sparse", no_argument, 0, 'Z' },
+    { "sweep", no_argument, 0, 'S' },
+    { "scaling", required_argument, 0, 'P' },
+    { "daemon", required_argument, 0, 'D' },
+    { "client", required_argument, 0, 'C' },
+    { "bulk", no_argument, 0, 'B' },
     { "summary", no_argument, 0, 's' },
     { "stats", no_argument, 0, 't' },
     { "help", no_argument, 0, 'h' },
@@ -57,8 +87,39 @@ static struct {
     { "Decompress a file", NULL },
     { "Specify the size of the window", XSTR(DEFAULT_WINDOW_SIZE) },
     { "Specify the size of the look-ahead buffer", XSTR(DEFAULT_LOOKAHEAD_SIZE) },
+    { "Skip the search of matches after failed searches, trading compression "
+      "ratio for speed on poorly compressible data (0 to search everywhere)", "0" },
+    { "Adapt the effort of the compression to reach the given speed in MB/s of "
+      "CPU time, searching less when it is too slow (0 to never adapt)", "0" },
     { "Specify the filename of the output file", NULL },
     { "Force overwrite of the output file if it already exists", NULL },
+    { "Periodically save the state of the compression to the given file "
+      "(every 64 MiB of input)", NULL },
+    { "Resume an interrupted compression from the file given with -k", NULL },
+    { "Compress independent blocks of the given size, writing their index to "
+      "OUTPUT" INCREMENTAL_INDEX_SUFFIX, NULL },
+    { "Copy the unchanged blocks from a file previously compressed with -b", NULL },
+    { "Compress again a compressed file, using its phrases as hints to speed up "
+      "the search", NULL },
+    { "Prime the window with a dictionary file prepared with -X (the same one "
+      "is needed to decompress)", NULL },
+    { "Prepare a dictionary file for the given window and look-ahead sizes from "
+      "the input (its last bytes, up to the window size)", NULL },
+    { "With -d, write a seek index of the input to the given file (an entry "
+      "every 1 MiB of output); with -g, read the input through it", NULL },
+    { "Decompress only the range START:LENGTH (or from START to the end) of "
+      "the original data, using the seek index given with -I", NULL },
+    { "Treat the holes of sparse files as data: compress them as zeros, and "
+      "write zeros instead of seeking over them when decompressing", NULL },
+    { "Compress and decompress the input with many window and look-ahead sizes, "
+      "search depths and accelerations (only the ones given, if -w, -l or -a are "
+      "used), marking the best ones", NULL },
+    { "Compress and decompress the input in memory on 1, 2, 4... up to the given "
+      "number of threads at once, reporting how the total speed scales (0 for "
+      "the number of CPUs)", NULL },
+    { "Run as a daemon, accepting jobs on the given UNIX socket", NULL },
+    { "Let the daemon listening on the given UNIX socket run the operation", NULL },
+    { "With -C, let the operation wait for the latency-sensitive ones", NULL },
     { "Show a summary of the operation that will be performed", NULL },
     { "Show statistics after the operation is completed", NULL },
     { "Show this help", NULL },
@@ -103,6 +164,28 @@ static void usage(const char *program)
     printf("  %s -c input.txt -w 1024 -l 64 -o output.lz\n", program);
     printf("    Compress the file input.txt to output.lz using the given "
             "window and look-ahead buffer sizes\n");
+    printf("  %s -c input.img -k input.ckp -o output.lz\n", program);
+    printf("    Compress the file input.img to output.lz saving checkpoints to input.ckp; "
+            "if interrupted, add -r to resume\n");
+    printf("  %s -c -b 1048576 -p monday.lz tuesday.img -o tuesday.lz\n", program);
+    printf("    Compress the file tuesday.img to tuesday.lz, copying the 1 MiB blocks "
+            "that did not change since monday.lz\n");
+    printf("  %s -R -w 32768 -l 255 fast.lz -o small.lz\n", program);
+    printf("    Compress again the file fast.lz to small.lz using larger "
+            "window and look-ahead buffer sizes\n");
+    printf("  %s -D /tmp/lz77ppm.sock &\n", program);
+    printf("    Start a daemon running the operations requested with -C /tmp/lz77ppm.sock\n");
+    printf("  %s -d -I archive.lzi archive.lz > /dev/null\n", program);
+    printf("    Write a seek index of archive.lz to archive.lzi\n");
+    printf("  %s -g 1048576:4096 -I archive.lzi archive.lz\n", program);
+    printf("    Decompress 4 KiB from offset 1 MiB of archive.lz\n");
+    printf("  %s -S -l 64 sample.txt\n", program);
+    printf("    Measure size and speed of the compression of sample.txt with a "
+            "look-ahead buffer of 64 bytes and all the window sizes, search depths "
+            "and accelerations\n");
+    printf("  %s -P 0 sample.txt\n", program);
+    printf("    Measure how the speed scales with the number of threads, up to "
+            "the number of CPUs\n");
 
     printf("\n");
     show_version(program);
@@ -146,8 +229,19 @@ int64_t do_compress(const char *input_filename,
                     const char *output_filename,
                     int window_size,
                     int lookahead_size,
-                    int overwrite_output)
+                    uint16_t acceleration,
+                    uint64_t target_throughput,
+                    const lz77_dictionary *dictionary,
+                    int overwrite_output,
+                    const char *checkpoint_filename,
+                    int resume,
+                    int sparse)
 {
+    if (checkpoint_filename != NULL && (input_filename == NULL || output_filename == NULL)) {
+        fprintf(stderr, "Checkpoints require both an input and an output file!\n");
+        exit(-2);
+    }
+
     int fd_input;
     if (input_filename == NULL) {
         fd_input = STDIN_FILENO;
@@ -163,6 +257,9 @@ int64_t do_compress(const char *input_filename,
     int fd_output;
     if (output_filename == NULL) {
         fd_output = STDOUT_FILENO;
+    } else if (resume) {
+        // Keep what has been written up to the checkpoint.
+        fd_output = open(output_filename, O_WRONLY);
     } else {
         int oflag = O_WRONLY | O_CREAT | (overwrite_output ? O_TRUNC : O_EXCL);
         fd_output = open(output_filename, oflag, 0644);
@@ -174,33 +271,245 @@ int64_t do_compress(const char *input_filename,
         exit(-2);
     }
 
+    int fd_checkpoint = -1;
+    if (checkpoint_filename != NULL) {
+        int oflag = O_RDWR | O_CREAT | (resume ? 0 : O_TRUNC);
+        fd_checkpoint = open(checkpoint_filename, oflag, 0644);
+        if (fd_checkpoint < 0) {
+            perror("Cannot open checkpoint file");
+            close(fd_input);
+            close(fd_output);
+            exit(-2);
+        }
+    }
+
+    int64_t result_size = -1;
+
     lz77_ustream * original_stream = lz77_ustream_from_descriptor(
             fd_input, window_size, lookahead_size);
+    lz77_cstream * compressed_stream = NULL;
     if (original_stream == NULL) {
-        close(fd_input);
-        close(fd_output);
-        return -1;
+        goto cleanup;
     }
 
-    lz77_cstream * compressed_stream = lz77_cstream_to_descriptor(original_stream, fd_output);
+    compressed_stream = lz77_cstream_to_descriptor(original_stream, fd_output);
     if (compressed_stream == NULL) {
-        lz77_ustream_free(&original_stream);
+        goto cleanup;
+    }
+
+    if (acceleration > 0 && lz77_ustream_set_acceleration(original_stream, acceleration) < 0) {
+        goto cleanup;
+    }
+    if (target_throughput > 0
+            && lz77_ustream_set_target_throughput(original_stream, target_throughput) < 0) {
+        goto cleanup;
+    }
+    // Holes are detected only in regular files, so this is harmless on pipes.
+    if (sparse && lz77_ustream_set_sparse(original_stream, 1) < 0) {
+        goto cleanup;
+    }
+    if (dictionary != NULL && lz77_dictionary_use(original_stream, dictionary) < 0) {
+        goto cleanup;
+    }
+    if (resume && lz77_checkpoint_resume(original_stream, compressed_stream, fd_checkpoint) < 0) {
+        goto cleanup;
+    }
+    if (fd_checkpoint >= 0
+            && lz77_checkpoint_enable(original_stream, fd_checkpoint, CHECKPOINT_INTERVAL) < 0) {
+        goto cleanup;
+    }
+
+    result_size = lz77_compress(original_stream, compressed_stream);
+
+    if (result_size >= 0 && fd_checkpoint >= 0) {
+        // The compression is complete: the checkpoints are no longer needed.
+        unlink(checkpoint_filename);
+    }
+
+cleanup:
+    lz77_ustream_free(&original_stream);
+    lz77_cstream_free(&compressed_stream);
+    close(fd_input);
+    close(fd_output);
+    if (fd_checkpoint >= 0) {
+        close(fd_checkpoint);
+    }
+
+    return result_size;
+}
+
+int64_t do_compress_blocks(const char *input_filename,
+                           const char *output_filename,
+                           int window_size,
+                           int lookahead_size,
+                           int overwrite_output,
+                           uint32_t block_size,
+                           const char *previous_filename,
+                           incremental_stats *stats)
+{
+    if (output_filename == NULL) {
+        fprintf(stderr, "Compressing blocks requires an output file!\n");
+        exit(-2);
+    }
+
+    struct stat previous_st, output_st;
+    if (previous_filename != NULL && stat(previous_filename, &previous_st) == 0
+            && stat(output_filename, &output_st) == 0
+            && previous_st.st_dev == output_st.st_dev
+            && previous_st.st_ino == output_st.st_ino) {
+        fprintf(stderr, "The previous version cannot be overwritten by the output file!\n");
+        exit(-2);
+    }
+
+    int fd_input;
+    if (input_filename == NULL) {
+        fd_input = STDIN_FILENO;
+    } else {
+        fd_input = open(input_filename, O_RDONLY, S_IRUSR);
+    }
+
+    if (fd_input < 0) {
+        perror("Cannot open input file");
+        exit(-2);
+    }
+
+    int oflag = O_WRONLY | O_CREAT | (overwrite_output ? O_TRUNC : O_EXCL);
+    int fd_output = open(output_filename, oflag, 0644);
+    if (fd_output < 0) {
+        perror("Cannot open output file");
         close(fd_input);
+        exit(-2);
+    }
+
+    char *index_filename = malloc(strlen(output_filename) + sizeof(INCREMENTAL_INDEX_SUFFIX));
+    int64_t result_size = -1;
+    if (index_filename != NULL) {
+        sprintf(index_filename, "%s%s", output_filename, INCREMENTAL_INDEX_SUFFIX);
+        result_size = incremental_compress(fd_input, fd_output, index_filename,
+                previous_filename, block_size, window_size, lookahead_size, stats);
+    }
+
+    free(index_filename);
+    close(fd_input);
+    if (close(fd_output) != 0) {
+        result_size = -1;
+    }
+
+    return result_size;
+}
+
+int64_t do_recompress(const char *input_filename,
+                      const char *output_filename,
+                      int window_size,
+                      int lookahead_size,
+                      int overwrite_output)
+{
+    if (input_filename == NULL) {
+        fprintf(stderr, "Recompression requires an input file!\n");
+        exit(-2);
+    }
+
+    // The input file is read twice: by a child process, which decompresses it
+    // to a pipe, and by the compression, which takes its tokens as hints.
+    int fd_input = open(input_filename, O_RDONLY, S_IRUSR);
+    int fd_hints = open(input_filename, O_RDONLY, S_IRUSR);
+    if (fd_input < 0 || fd_hints < 0) {
+        perror("Cannot open input file");
+        exit(-2);
+    }
+
+    int fd_output;
+    if (output_filename == NULL) {
+        fd_output = STDOUT_FILENO;
+    } else {
+        int oflag = O_WRONLY | O_CREAT | (overwrite_output ? O_TRUNC : O_EXCL);
+        fd_output = open(output_filename, oflag, 0644);
+    }
+
+    if (fd_output < 0) {
+        perror("Cannot open output file");
+        close(fd_input);
+        close(fd_hints);
+        exit(-2);
+    }
+
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        perror("Cannot create a pipe");
+        exit(-2);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Cannot create a process");
+        exit(-2);
+    }
+    if (pid == 0) {
+        close(pipefd[0]);
+        close(fd_hints);
         close(fd_output);
-        return -1;
+        report_progress = NULL;
+
+        int64_t result_size = -1;
+        lz77_cstream * compressed_stream = lz77_cstream_from_descriptor(fd_input);
+        lz77_ustream * decompressed_stream = NULL;
+        if (compressed_stream != NULL) {
+            decompressed_stream = lz77_ustream_to_descriptor(compressed_stream, pipefd[1]);
+        }
+        if (decompressed_stream != NULL) {
+            result_size = lz77_decompress(compressed_stream, decompressed_stream);
+        }
+        _exit(result_size < 0 ? 1 : 0);
+    }
+    close(pipefd[1]);
+    close(fd_input);
+
+    int64_t result_size = -1;
+
+    lz77_ustream * original_stream = lz77_ustream_from_descriptor(
+            pipefd[0], window_size, lookahead_size);
+    lz77_cstream * compressed_stream = NULL;
+    lz77_cstream * hints_stream = NULL;
+    if (original_stream == NULL) {
+        goto cleanup;
     }
 
-    int64_t result_size = lz77_compress(original_stream, compressed_stream);
+    compressed_stream = lz77_cstream_to_descriptor(original_stream, fd_output);
+    hints_stream = lz77_cstream_from_descriptor(fd_hints);
+    if (compressed_stream == NULL || hints_stream == NULL) {
+        goto cleanup;
+    }
+
+    if (lz77_hints_enable(original_stream, hints_stream, RECOMPRESS_HINT_TAIL) < 0) {
+        goto cleanup;
+    }
 
+    result_size = lz77_compress(original_stream, compressed_stream);
+
+cleanup:
     lz77_ustream_free(&original_stream);
     lz77_cstream_free(&compressed_stream);
-    close(fd_input);
+    lz77_cstream_free(&hints_stream);
+    close(pipefd[0]);
+    close(fd_hints);
     close(fd_output);
 
+    // A compression of a truncated decompression would be truncated as well.
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Cannot decompress input file!\n");
+        result_size = -1;
+    }
+
     return result_size;
 }
 
-int64_t do_decompress(const char *input_filename, const char *output_filename, int overwrite_output)
+int64_t do_decompress(const char *input_filename,
+                      const char *output_filename,
+                      const lz77_dictionary *dictionary,
+                      const char *index_filename,
+                      int overwrite_output,
+                      int sparse)
 {
     int fd_input;
     if (input_filename == NULL) {
@@ -243,16 +552,495 @@ int64_t do_decompress(const char *input_filename, const char *output_filename, i
         return -1;
     }
 
-    int64_t result_size = lz77_decompress(compressed_stream, decompressed_stream);
+    int fd_index = -1;
+    if (index_filename != NULL) {
+        int oflag = O_WRONLY | O_CREAT | (overwrite_output ? O_TRUNC : O_EXCL);
+        fd_index = open(index_filename, oflag, 0644);
+        if (fd_index < 0) {
+            perror("Cannot open index file");
+            lz77_cstream_free(&compressed_stream);
+            lz77_ustream_free(&decompressed_stream);
+            close(fd_input);
+            close(fd_output);
+            exit(-2);
+        }
+    }
+
+    int64_t result_size = -1;
+    if ((!sparse || lz77_ustream_set_sparse(decompressed_stream, 1) == 0)
+            && (dictionary == NULL || lz77_dictionary_use(decompressed_stream, dictionary) == 0)
+            && (fd_index < 0 || lz77_seek_index_enable(decompressed_stream, fd_index,
+                                                       LZ77_SEEK_DEFAULT_INTERVAL) == 0)) {
+        result_size = lz77_decompress(compressed_stream, decompressed_stream);
+    }
 
     lz77_cstream_free(&compressed_stream);
     lz77_ustream_free(&decompressed_stream);
     close(fd_input);
     close(fd_output);
+    if (fd_index >= 0) {
+        close(fd_index);
+    }
+
+    return result_size;
+}
+
+int64_t do_read_range(const char *input_filename,
+                      const char *output_filename,
+                      const char *index_filename,
+                      int overwrite_output,
+                      uint64_t offset,
+                      uint64_t length)
+{
+    int fd_input = open(input_filename, O_RDONLY, S_IRUSR);
+    if (fd_input < 0) {
+        perror("Cannot open input file");
+        exit(-2);
+    }
+    int fd_index = open(index_filename, O_RDONLY, S_IRUSR);
+    if (fd_index < 0) {
+        perror("Cannot open index file");
+        close(fd_input);
+        exit(-2);
+    }
+
+    int fd_output;
+    if (output_filename == NULL) {
+        fd_output = STDOUT_FILENO;
+    } else {
+        int oflag = O_WRONLY | O_CREAT | (overwrite_output ? O_TRUNC : O_EXCL);
+        fd_output = open(output_filename, oflag, 0644);
+    }
+    if (fd_output < 0) {
+        perror("Cannot open output file");
+        close(fd_input);
+        close(fd_index);
+        exit(-2);
+    }
+
+    // Each read decompresses from the nearest entry of the index: large
+    // chunks make the overhead negligible.
+    const uint32_t chunk_size = 16 * LZ77_SEEK_DEFAULT_INTERVAL;
+    uint8_t *buffer = malloc(chunk_size);
+    int64_t result_size = buffer == NULL ? -1 : 0;
+    while (buffer != NULL && (uint64_t)result_size < length) {
+        uint64_t left = length - result_size;
+        uint32_t size = left < chunk_size ? left : chunk_size;
+        int64_t count = lz77_seek_read(fd_input, fd_index, offset + result_size, buffer, size);
+        if (count < 0) {
+            result_size = -1;
+            break;
+        }
+        int64_t written = 0;
+        while (written < count) {
+            ssize_t n = write(fd_output, buffer + written, count - written);
+            if (n < 0) {
+                break;
+            }
+            written += n;
+        }
+        if (written < count) {
+            perror("Cannot write output file");
+            result_size = -1;
+            break;
+        }
+        result_size += count;
+        if (count < size) {
+            break;
+        }
+    }
+
+    free(buffer);
+    close(fd_input);
+    close(fd_index);
+    close(fd_output);
+    return result_size;
+}
+
+int64_t do_client(const char *socket_path,
+                  const char *input_filename,
+                  const char *output_filename,
+                  int overwrite_output,
+                  int decompress,
+                  int bulk,
+                  uint16_t window_size,
+                  uint16_t lookahead_size)
+{
+    int fd_input;
+    if (input_filename == NULL) {
+        fd_input = STDIN_FILENO;
+    } else {
+        fd_input = open(input_filename, O_RDONLY, S_IRUSR);
+    }
+
+    if (fd_input < 0) {
+        perror("Cannot open input file");
+        exit(-2);
+    }
+
+    int fd_output;
+    if (output_filename == NULL) {
+        fd_output = STDOUT_FILENO;
+    } else {
+        int oflag = O_WRONLY | O_CREAT | (overwrite_output ? O_TRUNC : O_EXCL);
+        fd_output = open(output_filename, oflag, 0644);
+    }
+
+    if (fd_output < 0) {
+        perror("Cannot open output file");
+        close(fd_input);
+        exit(-2);
+    }
+
+    int64_t result_size = server_submit(socket_path,
+            decompress ? SERVER_DECOMPRESS : SERVER_COMPRESS,
+            bulk ? SERVER_BULK : SERVER_INTERACTIVE,
+            window_size, lookahead_size, fd_input, fd_output);
+    if (result_size < 0) {
+        perror("The daemon could not run the operation");
+    }
+
+    close(fd_input);
+    close(fd_output);
+
+    return result_size;
+}
+
+static void sweep_report_progress(int completed, int count)
+{
+    fprintf(stderr, "\rProgress %d of %d settings...", completed, count);
+    if (completed == count) {
+        fprintf(stderr, "\n");
+    }
+}
+
+/*
+ * Reads the whole input into memory, returning NULL in case of error.
+ */
+static uint8_t *read_input(const char *input_filename, size_t *psize)
+{
+    int fd_input;
+    if (input_filename == NULL) {
+        fd_input = STDIN_FILENO;
+    } else {
+        fd_input = open(input_filename, O_RDONLY, S_IRUSR);
+    }
+
+    if (fd_input < 0) {
+        perror("Cannot open input file");
+        exit(-2);
+    }
+
+    uint8_t *data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    while (1) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : (1 << 20);
+            if (capacity > UINT32_MAX) {
+                capacity = UINT32_MAX;
+            }
+            if (size == capacity) {
+                fprintf(stderr, "Input file too large!\n");
+                free(data);
+                close(fd_input);
+                return NULL;
+            }
+            uint8_t *larger = realloc(data, capacity);
+            if (larger == NULL) {
+                perror("Cannot read input file");
+                free(data);
+                close(fd_input);
+                return NULL;
+            }
+            data = larger;
+        }
+        ssize_t n = read(fd_input, data + size, capacity - size);
+        if (n < 0) {
+            perror("Cannot read input file");
+            free(data);
+            close(fd_input);
+            return NULL;
+        }
+        if (n == 0) {
+            break;
+        }
+        size += n;
+    }
+    close(fd_input);
+
+    *psize = size;
+    return data;
+}
+
+/*
+ * Prints a single value of a hardware event, or a dash if it is missing.
+ */
+static void print_event(double value)
+{
+    if (value < 0) {
+        printf(" %8s", "-");
+    } else {
+        printf(" %8.*lf", value < 10 ? 4 : 2, value);
+    }
+}
+
+/*
+ * Prints the hardware events per byte of each setting of a sweep, if any
+ * were counted.
+ */
+static void print_sweep_events(const sweep_result *results, int count)
+{
+    int available = 0;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < COUNTERS; j++) {
+            if (results[i].compressed_size >= 0 && results[i].compression_events[j] >= 0) {
+                available = 1;
+            }
+        }
+    }
+    if (!available) {
+        printf("\nHardware counters are not available: only speeds are reported.\n");
+        return;
+    }
+
+    printf("\nHardware events per byte (compression, then decompression):\n");
+    printf("%8s %10s %6s %6s %8s", "Window", "Look-ahead", "Depth", "Accel.", "MB/s");
+    for (int j = 0; j < COUNTERS; j++) {
+        printf(" %8s", counters_name(j));
+    }
+    printf(" %8s", "MB/s");
+    for (int j = 0; j < COUNTERS; j++) {
+        printf(" %8s", counters_name(j));
+    }
+    printf("\n");
+    for (int i = 0; i < count; i++) {
+        const sweep_result *r = &results[i];
+        if (r->compressed_size < 0) {
+            continue;
+        }
+        printf("%8d %10d %6d %6d %8.2lf", r->window_size, r->lookahead_size,
+                r->search_depth, r->acceleration, r->compression_speed / 1e6);
+        for (int j = 0; j < COUNTERS; j++) {
+            print_event(r->compression_events[j]);
+        }
+        printf(" %8.2lf", r->decompression_speed / 1e6);
+        for (int j = 0; j < COUNTERS; j++) {
+            print_event(r->decompression_events[j]);
+        }
+        printf("\n");
+    }
+}
 
+/*
+ * Prints the hardware events per byte of each number of threads of a scaling
+ * run, if any were counted.
+ */
+static void print_scaling_events(const scaling_result *results, int count)
+{
+    int available = 0;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < COUNTERS; j++) {
+            if (results[i].compression_events[j] >= 0) {
+                available = 1;
+            }
+        }
+    }
+    if (!available) {
+        printf("\nHardware counters are not available: only speeds are reported.\n");
+        return;
+    }
+
+    printf("\nHardware events per byte (compression, then decompression):\n");
+    printf("%8s %8s", "Threads", "MB/s");
+    for (int j = 0; j < COUNTERS; j++) {
+        printf(" %8s", counters_name(j));
+    }
+    printf(" %8s", "MB/s");
+    for (int j = 0; j < COUNTERS; j++) {
+        printf(" %8s", counters_name(j));
+    }
+    printf("\n");
+    for (int i = 0; i < count; i++) {
+        const scaling_result *r = &results[i];
+        printf("%8d %8.2lf", r->threads, r->compression_speed / 1e6);
+        for (int j = 0; j < COUNTERS; j++) {
+            print_event(r->compression_events[j]);
+        }
+        printf(" %8.2lf", r->decompression_speed / 1e6);
+        for (int j = 0; j < COUNTERS; j++) {
+            print_event(r->decompression_events[j]);
+        }
+        printf("\n");
+    }
+}
+
+int do_sweep(const char *input_filename, uint16_t window_size, uint16_t lookahead_size,
+             uint16_t acceleration, int show_progress)
+{
+    // The whole input is kept in memory, where each setting reads it from.
+    size_t size;
+    uint8_t *data = read_input(input_filename, &size);
+    if (data == NULL) {
+        return -1;
+    }
+
+    int count = sweep_grid(window_size, lookahead_size, acceleration, NULL);
+    sweep_result *results = malloc(count * sizeof(*results));
+    if (count == 0 || results == NULL) {
+        fprintf(stderr, "No valid window and look-ahead sizes!\n");
+        free(results);
+        free(data);
+        return -1;
+    }
+    sweep_grid(window_size, lookahead_size, acceleration, results);
+
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int result = sweep_run(data, size, results, count, threads > 0 ? threads : 1,
+            show_progress ? sweep_report_progress : NULL);
+
+    printf("%8s %10s %6s %6s %12s %7s %12s %12s\n", "Window", "Look-ahead", "Depth",
+            "Accel.", "Size", "Ratio", "Comp. MB/s", "Decomp. MB/s");
+    for (int i = 0; i < count; i++) {
+        sweep_result *r = &results[i];
+        if (r->compressed_size < 0) {
+            printf("%8d %10d %6d %6d %12s\n", r->window_size, r->lookahead_size,
+                    r->search_depth, r->acceleration, "failed");
+            continue;
+        }
+        printf("%8d %10d %6d %6d %12lld %7.3lf %12.2lf %12.2lf%s\n",
+                r->window_size, r->lookahead_size, r->search_depth, r->acceleration,
+                (long long)r->compressed_size,
+                r->compressed_size > 0 ? size / (double)r->compressed_size : 0.0,
+                r->compression_speed / 1e6, r->decompression_speed / 1e6,
+                r->is_pareto ? "  *" : "");
+    }
+    printf("\n* Pareto-optimal: no other setting is at least as good in size "
+            "and speeds, and better in one of them.\n");
+    printf("A depth of 0 searches the whole window.\n");
+    print_sweep_events(results, count);
+
+    free(results);
+    free(data);
+    return result < 0 ? -1 : (int64_t)count;
+}
+
+int do_scaling(const char *input_filename, uint16_t window_size, uint16_t lookahead_size,
+               int max_threads)
+{
+    size_t size;
+    uint8_t *data = read_input(input_filename, &size);
+    if (data == NULL) {
+        return -1;
+    }
+
+    printf("%8s %12s %10s %12s %10s\n",
+            "Threads", "Comp. MB/s", "Efficiency", "Decomp. MB/s", "Efficiency");
+    // The numbers of threads are powers of two, and then the maximum.
+    scaling_result results[sizeof(int) * 8 + 1];
+    scaling_result single;
+    int result = 0;
+    int runs = 0;
+    int threads = 1;
+    while (result == 0) {
+        scaling_result r;
+        result = scaling_run(data, size, window_size, lookahead_size, threads, &r);
+        if (result < 0) {
+            fprintf(stderr, "Cannot run %d threads!\n", threads);
+            break;
+        }
+        if (threads == 1) {
+            single = r;
+        }
+        results[runs] = r;
+        // The efficiency is the fraction of the speed of a single thread
+        // retained by each of them.
+        printf("%8d %12.2lf %9.1lf%% %12.2lf %9.1lf%%\n", threads,
+                r.compression_speed / 1e6,
+                100 * r.compression_speed / (threads * single.compression_speed),
+                r.decompression_speed / 1e6,
+                100 * r.decompression_speed / (threads * single.decompression_speed));
+        fflush(stdout);
+        runs++;
+        if (threads == max_threads) {
+            break;
+        }
+        threads = threads * 2 < max_threads ? threads * 2 : max_threads;
+    }
+    print_scaling_events(results, runs);
+
+    free(data);
+    return result < 0 ? -1 : runs;
+}
+
+int64_t do_make_dictionary(const char *input_filename,
+                           const char *output_filename,
+                           uint16_t window_size,
+                           uint16_t lookahead_size,
+                           int overwrite_output)
+{
+    size_t size;
+    uint8_t *data = read_input(input_filename, &size);
+    if (data == NULL) {
+        return -1;
+    }
+
+    int fd_output;
+    if (output_filename == NULL) {
+        fd_output = STDOUT_FILENO;
+    } else {
+        int oflag = O_WRONLY | O_CREAT | (overwrite_output ? O_TRUNC : O_EXCL);
+        fd_output = open(output_filename, oflag, 0644);
+    }
+
+    if (fd_output < 0) {
+        perror("Cannot open output file");
+        free(data);
+        exit(-2);
+    }
+
+    int64_t result_size = -1;
+    lz77_dictionary *dictionary = lz77_dictionary_create(data, size, window_size, lookahead_size);
+    if (dictionary != NULL && lz77_dictionary_save(dictionary, fd_output) == 0) {
+        struct stat st;
+        result_size = fstat(fd_output, &st) == 0 ? st.st_size : 0;
+    }
+
+    lz77_dictionary_free(&dictionary);
+    free(data);
+    close(fd_output);
     return result_size;
 }
 
+/*
+ * Maps a dictionary file into memory (the mapping is kept until the program
+ * exits), exiting in case of error.
+ */
+static lz77_dictionary *load_dictionary(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("Cannot open dictionary file");
+        exit(-2);
+    }
+    void *image = st.st_size > 0
+            ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+            : MAP_FAILED;
+    close(fd);
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "Cannot map dictionary file!\n");
+        exit(-2);
+    }
+
+    lz77_dictionary *dictionary = lz77_dictionary_from_memory(image, st.st_size);
+    if (dictionary == NULL) {
+        fprintf(stderr, "Invalid dictionary file!\n");
+        exit(-2);
+    }
+    return dictionary;
+}
+
 static struct timeval start;
 
 static void cli_report_progress(lz77_ustream *ustream, lz77_cstream *cstream, float percent)
@@ -283,12 +1071,34 @@ int main(int argc, char* argv[])
     const char *output_filename = NULL;
     uint16_t window_size = DEFAULT_WINDOW_SIZE;
     uint16_t lookahead_size = DEFAULT_LOOKAHEAD_SIZE;
+    uint16_t acceleration = 0;
+    uint64_t target_throughput = 0;
     int force_overwrite = 0;
+    const char *checkpoint_filename = NULL;
+    int resume = 0;
+    uint32_t block_size = 0;
+    const char *previous_filename = NULL;
+    incremental_stats block_stats = { 0, 0, 0 };
+    int recompress = 0;
+    const char *dictionary_filename = NULL;
+    const char *index_filename = NULL;
+    int read_range = 0;
+    int sparse = 1;
+    uint64_t range_offset = 0;
+    uint64_t range_length = UINT64_MAX;
+    int make_dictionary = 0;
+    int sweep = 0;
+    int scaling_threads = -1;
+    const char *daemon_socket = NULL;
+    const char *client_socket = NULL;
+    int bulk = 0;
+    uint16_t sweep_window_size = 0;
+    uint16_t sweep_lookahead_size = 0;
     int show_summary = 0;
     int show_statistics = 0;
 
     int c;
-    while ((c = getopt_long(argc, argv, "cdw:l:o:fsthV", long_options, 0)) >= 0)
+    while ((c = getopt_long(argc, argv, "cdw:l:a:T:o:fk:rb:p:Rx:XI:g:ZSP:D:C:BsthV", long_options, 0)) >= 0)
     {
         switch (c) {
             case 'c':
@@ -299,11 +1109,11 @@ int main(int argc, char* argv[])
                 break;
             case 'w': {
                 unsigned long int w = strtoul(optarg, NULL, 10);
-                if (w >= (1 << sizeof(window_size) * 8)) {
+                if (w > LZ77_MAX_WINDOW_SIZE) {
                     fprintf(stderr, "Window size too large (%lu)!\n", w);
                     return -1;
                 }
-                window_size = w;
+                window_size = sweep_window_size = w;
                 break;
             }
             case 'l': {
@@ -312,7 +1122,25 @@ int main(int argc, char* argv[])
                     fprintf(stderr, "Look-ahead size too large (%lu)!\n", l);
                     return -1;
                 }
-                lookahead_size = l;
+                lookahead_size = sweep_lookahead_size = l;
+                break;
+            }
+            case 'a': {
+                unsigned long int a = strtoul(optarg, NULL, 10);
+                if (a > UINT16_MAX) {
+                    fprintf(stderr, "Acceleration too large (%lu)!\n", a);
+                    return -1;
+                }
+                acceleration = a;
+                break;
+            }
+            case 'T': {
+                double t = strtod(optarg, NULL);
+                if (!(t >= 0 && t < 1e12)) {
+                    fprintf(stderr, "Invalid target speed (%s)!\n", optarg);
+                    return -1;
+                }
+                target_throughput = t * 1e6;
                 break;
             }
             case 'o':
@@ -321,6 +1149,73 @@ int main(int argc, char* argv[])
             case 'f':
                 force_overwrite = 1;
                 break;
+            case 'k':
+                checkpoint_filename = optarg;
+                break;
+            case 'r':
+                resume = 1;
+                break;
+            case 'b': {
+                unsigned long int b = strtoul(optarg, NULL, 10);
+                if (b == 0 || b > MAX_BLOCK_SIZE) {
+                    fprintf(stderr, "Invalid block size (%lu)!\n", b);
+                    return -1;
+                }
+                block_size = b;
+                break;
+            }
+            case 'p':
+                previous_filename = optarg;
+                break;
+            case 'R':
+                recompress = 1;
+                break;
+            case 'x':
+                dictionary_filename = optarg;
+                break;
+            case 'X':
+                make_dictionary = 1;
+                break;
+            case 'I':
+                index_filename = optarg;
+                break;
+            case 'g': {
+                char *end;
+                range_offset = strtoull(optarg, &end, 10);
+                if (*end == ':') {
+                    range_length = strtoull(end + 1, &end, 10);
+                }
+                if (end == optarg || *end != '\0') {
+                    fprintf(stderr, "Invalid range (%s)!\n", optarg);
+                    return -1;
+                }
+                read_range = 1;
+                break;
+            }
+            case 'Z':
+                sparse = 0;
+                break;
+            case 'S':
+                sweep = 1;
+                break;
+            case 'P': {
+                long int p = strtol(optarg, NULL, 10);
+                if (p < 0 || p > 4096) {
+                    fprintf(stderr, "Invalid number of threads (%s)!\n", optarg);
+                    return -1;
+                }
+                scaling_threads = p;
+                break;
+            }
+            case 'D':
+                daemon_socket = optarg;
+                break;
+            case 'C':
+                client_socket = optarg;
+                break;
+            case 'B':
+                bulk = 1;
+                break;
             case 's':
                 show_summary = 1;
                 report_progress = cli_report_progress;
@@ -347,23 +1242,187 @@ int main(int argc, char* argv[])
     if (optind == argc - 1) {
         input_filename = argv[optind];
     }
+    if (resume && (checkpoint_filename == NULL || decompress)) {
+        fprintf(stderr, "Option -r requires a compression with option -k!\n");
+        return -1;
+    }
+    if (previous_filename != NULL && block_size == 0) {
+        fprintf(stderr, "Option -p requires option -b!\n");
+        return -1;
+    }
+    if (block_size > 0 && (decompress || checkpoint_filename != NULL)) {
+        fprintf(stderr, "Option -b cannot be used with decompression or checkpoints!\n");
+        return -1;
+    }
+
+    if (recompress && (decompress || checkpoint_filename != NULL || block_size > 0)) {
+        fprintf(stderr, "Option -R cannot be used with decompression, checkpoints or blocks!\n");
+        return -1;
+    }
+
+    if (sweep && (decompress || recompress || checkpoint_filename != NULL
+                  || block_size > 0 || output_filename != NULL)) {
+        fprintf(stderr, "Option -S cannot be used with decompression, recompression, "
+                "checkpoints, blocks or an output file!\n");
+        return -1;
+    }
+
+    if (scaling_threads >= 0 && (decompress || recompress || sweep || checkpoint_filename != NULL
+                                 || block_size > 0 || output_filename != NULL
+                                 || client_socket != NULL || daemon_socket != NULL
+                                 || make_dictionary || dictionary_filename != NULL
+                                 || acceleration > 0 || target_throughput > 0)) {
+        fprintf(stderr, "Option -P cannot be used with other operations or an output file!\n");
+        return -1;
+    }
+
+    if (client_socket != NULL && (recompress || sweep || checkpoint_filename != NULL
+                                  || block_size > 0)) {
+        fprintf(stderr, "Option -C cannot be used with recompression, sweeps, "
+                "checkpoints or blocks!\n");
+        return -1;
+    }
+    if (acceleration > 0 && (decompress || recompress || block_size > 0
+                             || client_socket != NULL || daemon_socket != NULL)) {
+        fprintf(stderr, "Option -a cannot be used with decompression, recompression, "
+                "blocks or a daemon!\n");
+        return -1;
+    }
+    if (target_throughput > 0 && (decompress || recompress || sweep || block_size > 0
+                                  || client_socket != NULL || daemon_socket != NULL
+                                  || make_dictionary)) {
+        fprintf(stderr, "Option -T cannot be used with decompression, recompression, "
+                "sweeps, blocks, dictionaries or a daemon!\n");
+        return -1;
+    }
+    if (dictionary_filename != NULL && (recompress || sweep || block_size > 0
+                                        || client_socket != NULL || daemon_socket != NULL
+                                        || make_dictionary)) {
+        fprintf(stderr, "Option -x cannot be used with recompression, sweeps, blocks, "
+                "a daemon or option -X!\n");
+        return -1;
+    }
+    if (make_dictionary && (decompress || recompress || sweep || checkpoint_filename != NULL
+                            || block_size > 0 || client_socket != NULL
+                            || daemon_socket != NULL || acceleration > 0)) {
+        fprintf(stderr, "Option -X cannot be used with other operations!\n");
+        return -1;
+    }
+    if (read_range && (index_filename == NULL || input_filename == NULL)) {
+        fprintf(stderr, "Option -g requires option -I and an input file!\n");
+        return -1;
+    }
+    if (read_range && (recompress || sweep || scaling_threads >= 0 || make_dictionary
+                       || checkpoint_filename != NULL || block_size > 0
+                       || acceleration > 0 || target_throughput > 0)) {
+        fprintf(stderr, "Option -g cannot be used with other operations!\n");
+        return -1;
+    }
+    if (index_filename != NULL && !decompress && !read_range) {
+        fprintf(stderr, "Option -I requires option -d or -g!\n");
+        return -1;
+    }
+    if (index_filename != NULL && (client_socket != NULL || daemon_socket != NULL
+                                   || (read_range && dictionary_filename != NULL))) {
+        fprintf(stderr, "Option -I cannot be used with a daemon, and option -g "
+                "does not need a dictionary!\n");
+        return -1;
+    }
+
+    if (!sparse && (recompress || sweep || scaling_threads >= 0 || make_dictionary
+                    || read_range || block_size > 0
+                    || client_socket != NULL || daemon_socket != NULL)) {
+        fprintf(stderr, "Option -Z can only be used with a plain compression or "
+                "decompression!\n");
+        return -1;
+    }
+
+    if (bulk && client_socket == NULL) {
+        fprintf(stderr, "Option -B requires option -C!\n");
+        return -1;
+    }
+
+    if (daemon_socket != NULL) {
+        if (client_socket != NULL || recompress || sweep || checkpoint_filename != NULL
+                || block_size > 0 || input_filename != NULL || output_filename != NULL) {
+            fprintf(stderr, "Option -D cannot be used with other operations or files!\n");
+            return -1;
+        }
+        // Reports of the progress of each job would be mixed up.
+        report_progress = NULL;
+        long threads = sysconf(_SC_NPROCESSORS_ONLN);
+        return server_run(daemon_socket, threads > 0 ? threads : 1);
+    }
+
+    lz77_dictionary *dictionary = NULL;
+    if (dictionary_filename != NULL) {
+        dictionary = load_dictionary(dictionary_filename);
+    }
 
     int64_t output_size;
-    if (!decompress) {
+    if (make_dictionary) {
+        output_size = do_make_dictionary(input_filename, output_filename,
+                window_size, lookahead_size, force_overwrite);
+    }
+    else if (sweep) {
+        // Reports of the progress of each compression would be mixed up.
+        report_progress = NULL;
+        output_size = do_sweep(input_filename, sweep_window_size, sweep_lookahead_size,
+                acceleration, show_summary || show_statistics);
+    }
+    else if (read_range) {
+        output_size = do_read_range(input_filename, output_filename, index_filename,
+                force_overwrite, range_offset, range_length);
+    }
+    else if (scaling_threads >= 0) {
+        // Reports of the progress of each compression would be mixed up.
+        report_progress = NULL;
+        long threads = scaling_threads > 0 ? scaling_threads : sysconf(_SC_NPROCESSORS_ONLN);
+        output_size = do_scaling(input_filename, window_size, lookahead_size,
+                threads > 0 ? threads : 1);
+    }
+    else if (!decompress) {
         if (show_summary) {
-            fprintf(stderr, "Compression:\n");
+            fprintf(stderr, "%s:\n", recompress ? "Recompression" : "Compression");
             fprintf(stderr, "  Input file:      %s\n",
                     input_filename ? input_filename : "(standard input)");
             fprintf(stderr, "  Output file:     %s\n",
                     output_filename ? output_filename : "(standard output)");
             fprintf(stderr, "  Window size:     %d bytes\n", window_size);
             fprintf(stderr, "  Look-ahead size: %d bytes\n", lookahead_size);
+            if (acceleration > 0) {
+                fprintf(stderr, "  Acceleration:    %d\n", acceleration);
+            }
+            if (target_throughput > 0) {
+                fprintf(stderr, "  Target speed:    %.1lf MB/s\n", target_throughput / 1e6);
+            }
+            if (!sparse) {
+                fprintf(stderr, "  Sparse files:    holes compressed as zeros\n");
+            }
+            if (block_size > 0) {
+                fprintf(stderr, "  Block size:      %lu bytes\n", (unsigned long)block_size);
+                fprintf(stderr, "  Previous file:   %s\n",
+                        previous_filename ? previous_filename : "(none)");
+            }
         }
 
         struct timeval end;
         gettimeofday(&start, NULL);
-        output_size = do_compress(input_filename, output_filename,
-                window_size, lookahead_size, force_overwrite);
+        if (client_socket != NULL) {
+            output_size = do_client(client_socket, input_filename, output_filename,
+                    force_overwrite, 0, bulk, window_size, lookahead_size);
+        } else if (recompress) {
+            output_size = do_recompress(input_filename, output_filename,
+                    window_size, lookahead_size, force_overwrite);
+        } else if (block_size > 0) {
+            output_size = do_compress_blocks(input_filename, output_filename,
+                    window_size, lookahead_size, force_overwrite,
+                    block_size, previous_filename, &block_stats);
+        } else {
+            output_size = do_compress(input_filename, output_filename,
+                    window_size, lookahead_size, acceleration, target_throughput, dictionary,
+                    force_overwrite, checkpoint_filename, resume, sparse);
+        }
         gettimeofday(&end, NULL);
 
         if (show_summary) {
@@ -382,6 +1441,11 @@ int main(int argc, char* argv[])
                     compression_ratio, 100 / compression_ratio);
             fprintf(stderr, "  Elapsed time:      %s\n", print_time(elapsed_time));
             fprintf(stderr, "  Data rate:         %s/s\n", print_size(input_size / elapsed_time));
+            if (block_size > 0) {
+                fprintf(stderr, "  Reused blocks:     %llu of %llu\n",
+                        (unsigned long long)block_stats.reused_blocks,
+                        (unsigned long long)block_stats.blocks);
+            }
         }
     }
     else {
@@ -395,7 +1459,13 @@ int main(int argc, char* argv[])
 
         struct timeval end;
         gettimeofday(&start, NULL);
-        output_size = do_decompress(input_filename, output_filename, force_overwrite);
+        if (client_socket != NULL) {
+            output_size = do_client(client_socket, input_filename, output_filename,
+                    force_overwrite, 1, 0, window_size, lookahead_size);
+        } else {
+            output_size = do_decompress(input_filename, output_filename, dictionary,
+                    index_filename, force_overwrite, sparse);
+        }
         gettimeofday(&end, NULL);
 
         if (show_summary) {
@@ -417,5 +1487,6 @@ int main(int argc, char* argv[])
         }
     }
 
+    lz77_dictionary_free(&dictionary);
     return output_size > 0 ? 0 : output_size;
 }
@@ -0,0 +1,280 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file scaling.c
+ *
+ * Measurement of how the throughput of the library scales with the number of
+ * threads.
+ *
+ * @author Antonio Macrì
+ */
+
+#define _POSIX_C_SOURCE 200809L  // Required for clock_gettime() and pthread_barrier_t
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lz77ppm/lz77.h>
+
+#include "scaling.h"
+
+/**
+ * The time for which each phase runs.
+ */
+#define SCALING_SECONDS 0.5
+
+/**
+ * The state shared by the threads of a run.
+ */
+typedef struct {
+    const uint8_t *data;
+    uint32_t size;
+    uint16_t window_size;
+    uint16_t lookahead_size;
+    pthread_mutex_t mutex;
+    pthread_cond_t started;
+    /**
+     * Zero until all the threads are started, then 1 to let them run, or -1
+     * if some could not be started.
+     */
+    int go;
+    /** Lets the threads start the decompression together. */
+    pthread_barrier_t barrier;
+} scaling_state;
+
+/**
+ * The state of a single thread.
+ */
+typedef struct {
+    scaling_state *state;
+    pthread_t id;
+    double compression_speed;
+    double decompression_speed;
+    /** The bytes processed, and the hardware events counted meanwhile. */
+    double compression_bytes;
+    double decompression_bytes;
+    uint64_t compression_events[COUNTERS];
+    uint64_t decompression_events[COUNTERS];
+    int failed;
+} scaling_thread;
+
+static void *run_thread(void *arg);
+static int64_t compress(const scaling_state *state, const uint8_t *data, uint8_t **compressed);
+static int64_t decompress(const uint8_t *compressed, uint32_t compressed_size,
+                          uint8_t *decompressed, uint32_t size);
+static double wall_seconds(void);
+static void add_events(uint64_t total[COUNTERS], const uint64_t values[COUNTERS]);
+
+int scaling_run(const uint8_t *data,
+                uint32_t size,
+                uint16_t window_size,
+                uint16_t lookahead_size,
+                int threads,
+                scaling_result *result)
+{
+    scaling_state state;
+    state.data = data;
+    state.size = size;
+    state.window_size = window_size;
+    state.lookahead_size = lookahead_size;
+    state.go = 0;
+    if (threads < 1 || pthread_barrier_init(&state.barrier, NULL, threads) != 0) {
+        return -1;
+    }
+    pthread_mutex_init(&state.mutex, NULL);
+    pthread_cond_init(&state.started, NULL);
+
+    scaling_thread *ts = calloc(threads, sizeof(*ts));
+    int started = 0;
+    while (ts != NULL && started < threads) {
+        ts[started].state = &state;
+        if (pthread_create(&ts[started].id, NULL, run_thread, &ts[started]) != 0) {
+            break;
+        }
+        started++;
+    }
+    pthread_mutex_lock(&state.mutex);
+    // Otherwise, the threads started would wait forever for the missing ones.
+    state.go = (ts != NULL && started == threads) ? 1 : -1;
+    pthread_cond_broadcast(&state.started);
+    pthread_mutex_unlock(&state.mutex);
+
+    int failed = state.go < 0;
+    result->threads = threads;
+    result->compression_speed = 0;
+    result->decompression_speed = 0;
+    double compression_bytes = 0, decompression_bytes = 0;
+    uint64_t compression_events[COUNTERS] = { 0 }, decompression_events[COUNTERS] = { 0 };
+    for (int i = 0; i < started; i++) {
+        pthread_join(ts[i].id, NULL);
+        failed |= ts[i].failed;
+        result->compression_speed += ts[i].compression_speed;
+        result->decompression_speed += ts[i].decompression_speed;
+        compression_bytes += ts[i].compression_bytes;
+        decompression_bytes += ts[i].decompression_bytes;
+        add_events(compression_events, ts[i].compression_events);
+        add_events(decompression_events, ts[i].decompression_events);
+    }
+    counters_per_byte(compression_events, compression_bytes, result->compression_events);
+    counters_per_byte(decompression_events, decompression_bytes, result->decompression_events);
+    free(ts);
+    pthread_cond_destroy(&state.started);
+    pthread_mutex_destroy(&state.mutex);
+    pthread_barrier_destroy(&state.barrier);
+    return failed ? -1 : 0;
+}
+
+static void *run_thread(void *arg)
+{
+    scaling_thread *t = arg;
+    scaling_state *state = t->state;
+    uint32_t size = state->size;
+
+    // A private copy of the input, allocated (and so, on NUMA hosts, placed)
+    // by the thread using it.
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    uint8_t *decompressed = malloc(size > 0 ? size : 1);
+    if (data != NULL) {
+        memcpy(data, state->data, size);
+    }
+    t->failed = data == NULL || decompressed == NULL;
+
+    pthread_mutex_lock(&state->mutex);
+    while (state->go == 0) {
+        pthread_cond_wait(&state->started, &state->mutex);
+    }
+    int go = state->go;
+    pthread_mutex_unlock(&state->mutex);
+    if (go < 0) {
+        free(decompressed);
+        free(data);
+        return NULL;
+    }
+
+    // Counters only count the thread which opens them.
+    counters c;
+    counters_open(&c);
+
+    uint8_t *compressed = NULL;
+    int64_t compressed_size = -1;
+    int runs = 0;
+    double elapsed = 0;
+    counters_start(&c);
+    double start = wall_seconds();
+    while (!t->failed && elapsed < SCALING_SECONDS) {
+        free(compressed);
+        compressed_size = compress(state, data, &compressed);
+        t->failed = compressed_size < 0;
+        runs++;
+        elapsed = wall_seconds() - start;
+    }
+    counters_stop(&c, t->compression_events);
+    if (!t->failed) {
+        t->compression_speed = (double)size * runs / elapsed;
+        t->compression_bytes = (double)size * runs;
+    }
+
+    int64_t decompressed_size = -1;
+    runs = 0;
+    elapsed = 0;
+    pthread_barrier_wait(&state->barrier);
+    counters_start(&c);
+    start = wall_seconds();
+    while (!t->failed && elapsed < SCALING_SECONDS) {
+        decompressed_size = decompress(compressed, compressed_size, decompressed, size);
+        t->failed = decompressed_size < 0;
+        runs++;
+        elapsed = wall_seconds() - start;
+    }
+    counters_stop(&c, t->decompression_events);
+    counters_close(&c);
+    if (!t->failed) {
+        t->decompression_speed = (double)size * runs / elapsed;
+        t->decompression_bytes = (double)size * runs;
+        t->failed = decompressed_size != size || memcmp(data, decompressed, size) != 0;
+    }
+
+    free(compressed);
+    free(decompressed);
+    free(data);
+    return NULL;
+}
+
+/*
+ * Compresses the data into a new buffer, returning its size or -1 in case of
+ * error.
+ */
+static int64_t compress(const scaling_state *state, const uint8_t *data, uint8_t **compressed)
+{
+    *compressed = NULL;
+    lz77_ustream *ustream = lz77_ustream_from_memory(data, state->size,
+            state->window_size, state->lookahead_size);
+    if (ustream == NULL) {
+        return -1;
+    }
+    lz77_cstream *cstream = lz77_cstream_to_memory(ustream, NULL, 0, 1);
+    if (cstream == NULL) {
+        lz77_ustream_free(&ustream);
+        return -1;
+    }
+    int64_t result = lz77_compress(ustream, cstream);
+    *compressed = lz77_cstream_get_buffer(cstream);
+    lz77_ustream_free(&ustream);
+    lz77_cstream_free(&cstream);
+    return result;
+}
+
+/*
+ * Decompresses the data into the given buffer, returning its size or -1 in
+ * case of error.
+ */
+static int64_t decompress(const uint8_t *compressed, uint32_t compressed_size,
+                          uint8_t *decompressed, uint32_t size)
+{
+    lz77_cstream *cstream = lz77_cstream_from_memory(compressed, compressed_size);
+    if (cstream == NULL) {
+        return -1;
+    }
+    lz77_ustream *ustream = lz77_ustream_to_memory(cstream, decompressed, size, 0);
+    if (ustream == NULL) {
+        lz77_cstream_free(&cstream);
+        return -1;
+    }
+    int64_t result = lz77_decompress(cstream, ustream);
+    lz77_cstream_free(&cstream);
+    lz77_ustream_free(&ustream);
+    return result;
+}
+
+/*
+ * Returns the time elapsed since an arbitrary point, in seconds.
+ */
+static double wall_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Adds the values of the counters of a thread to the totals. An event missing
+ * in any thread is missing in the totals.
+ */
+static void add_events(uint64_t total[COUNTERS], const uint64_t values[COUNTERS])
+{
+    for (int i = 0; i < COUNTERS; i++) {
+        if (total[i] == COUNTER_MISSING || values[i] == COUNTER_MISSING) {
+            total[i] = COUNTER_MISSING;
+        } else {
+            total[i] += values[i];
+        }
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file scaling.h
+ *
+ * Measurement of how the throughput of the library scales with the number of
+ * threads compressing and decompressing at the same time.
+ *
+ * Each thread has its own copy of the data and its own streams, so nothing is
+ * shared among them but the library itself (its allocations and its globals)
+ * and the hardware (caches and memory bandwidth). With perfect scaling, the
+ * aggregate throughput of @e n threads would be @e n times the one of a
+ * single thread: the ratio between the two is the @em efficiency.
+ *
+ * Unlike sweeps, speeds are measured on the wall-clock time, since the time
+ * spent waiting for a lock or for memory is exactly what is being measured.
+ * The hardware counters of each thread, if available, are read around the
+ * same operations, so that, e.g., cache misses growing with the number of
+ * threads show where the scaling is lost.
+ *
+ * @author Antonio Macrì
+ */
+
+#ifndef _LZ77PPM_SCALING_H_
+#define _LZ77PPM_SCALING_H_
+
+#include <stdint.h>
+
+#include <bench/counters.h>
+
+/**
+ * The results of a number of threads.
+ */
+typedef struct {
+    /** The number of threads. */
+    int threads;
+    /** The aggregate compression speed of all the threads, in bytes per second. */
+    double compression_speed;
+    /** The aggregate decompression speed of all the threads, in bytes per second. */
+    double decompression_speed;
+    /**
+     * The hardware events per byte of the compressions of all the threads, or
+     * negative values for the events which could not be counted.
+     */
+    double compression_events[COUNTERS];
+    /** The hardware events per byte of the decompressions of all the threads. */
+    double decompression_events[COUNTERS];
+} scaling_result;
+
+/**
+ * Runs the given number of threads, each compressing the given data over and
+ * over for a fixed time, then each decompressing its result over and over.
+ * The threads start each phase together.
+ *
+ * @param data The data to be compressed.
+ * @param size The size of @c data.
+ * @param window_size The size of the window.
+ * @param lookahead_size The size of the look-ahead buffer.
+ * @param threads The number of threads.
+ * @param result Filled with the results.
+ *
+ * @return 0 in case of success, or -1 if an operation failed, the decompressed
+ *         data differ from the original, or the threads cannot be started.
+ */
+int scaling_run(const uint8_t *data,
+                uint32_t size,
+                uint16_t window_size,
+                uint16_t lookahead_size,
+                int threads,
+                scaling_result *result);
+
+#endif
@@ -0,0 +1,708 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file server.c
+ *
+ * A daemon running compression and decompression jobs received over a UNIX
+ * socket, and a client submitting them.
+ *
+ * The main thread polls the listening socket and the connections, reading
+ * one request at a time and queueing its job; a pool of threads runs the
+ * jobs and sends the responses. Each thread keeps its streams from one job to
+ * the next, re-arming them with the descriptors of the new job, so that their
+ * buffers and tables are not set up again.
+ *
+ * @author Antonio Macrì
+ */
+
+#define _GNU_SOURCE  // Required on Linux for accept4() and MSG_CMSG_CLOEXEC
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <lz77ppm/lz77.h>
+#include <lz77ppm/logger.h>
+
+#include "server.h"
+
+#define SERVER_MAGIC "LZJQ"
+
+/**
+ * The maximum length of a path in a request.
+ */
+#define SERVER_MAX_PATH 4096
+
+/**
+ * While both interactive and bulk jobs are waiting, one job in this many is a
+ * bulk one.
+ */
+#define SERVER_BULK_SHARE 4
+
+#define SERVER_BACKLOG 64
+
+/**
+ * A connection of a client. It is closed when it has been closed by the
+ * client and all of its jobs have been completed.
+ */
+typedef struct {
+    int fd;
+    /** The number of pending jobs, plus one while the connection is polled. */
+    int references;
+} connection;
+
+/**
+ * A job received from a client.
+ */
+typedef struct _job {
+    struct _job *next;
+    connection *from;
+    uint32_t id;
+    uint8_t operation;
+    uint16_t window_size;
+    uint16_t lookahead_size;
+    /** The descriptors of the input and output, or -1 if not opened yet. */
+    int fd_input;
+    int fd_output;
+    /** The paths of the input and output, or @c NULL if descriptors were passed. */
+    char *input_path;
+    char *output_path;
+} job;
+
+/**
+ * The jobs waiting for a thread, one list for each priority.
+ */
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t available;
+    job *head[2];
+    job *tail[2];
+    /** The number of interactive jobs taken in a row while bulk jobs waited. */
+    int interactive_streak;
+    int stopping;
+} queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, { NULL, NULL }, { NULL, NULL }, 0, 0 };
+
+/**
+ * The streams kept by a thread between jobs. A pair is created by the first
+ * job needing it, and created again after a job has failed (or, for
+ * compressions, when the sizes of the window or of the look-ahead buffer
+ * change).
+ */
+typedef struct {
+    /** The streams of compressions, or @c NULL. */
+    lz77_ustream *original;
+    lz77_cstream *compressed;
+    /** The sizes with which @c original was created. */
+    uint16_t window_size;
+    uint16_t lookahead_size;
+    /** The streams of decompressions, or @c NULL. */
+    lz77_cstream *input;
+    lz77_ustream *decompressed;
+} context;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static int listen_on(const char *socket_path);
+static int receive_request(connection *conn);
+static void *worker(void *arg);
+static job *take_job(void);
+static int64_t run_job(job *j, context *ctx);
+static int arm_compression(context *ctx, const job *j);
+static int arm_decompression(context *ctx, const job *j);
+static void free_compression(context *ctx);
+static void free_decompression(context *ctx);
+static void respond(connection *conn, uint32_t id, int error, uint64_t size);
+static void free_job(job *j);
+static void release(connection *conn);
+
+static void put_u16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+static void put_u32(uint8_t *p, uint32_t v) { put_u16(p, v >> 16); put_u16(p + 2, v); }
+static void put_u64(uint8_t *p, uint64_t v) { put_u32(p, v >> 32); put_u32(p + 4, v); }
+static uint16_t get_u16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static uint32_t get_u32(const uint8_t *p) { return ((uint32_t)get_u16(p) << 16) | get_u16(p + 2); }
+static uint64_t get_u64(const uint8_t *p) { return ((uint64_t)get_u32(p) << 32) | get_u32(p + 4); }
+
+static void on_signal(int signum)
+{
+    (void)(signum);
+    stop_requested = 1;
+}
+
+int server_run(const char *socket_path, int threads)
+{
+    int fd_listen = listen_on(socket_path);
+    if (fd_listen < 0) {
+        return -1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    // No SA_RESTART: poll() must be interrupted.
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    // An output passed by a client may be a pipe whose reader has gone away.
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+
+    pthread_t *ids = malloc(threads * sizeof(*ids));
+    int started = 0;
+    while (ids != NULL && started < threads
+            && pthread_create(&ids[started], NULL, worker, NULL) == 0) {
+        started++;
+    }
+
+    // The first descriptor is the listening socket, the others are the
+    // connections (conns[i] corresponds to fds[i]).
+    int count = 1;
+    int capacity = 16;
+    struct pollfd *fds = malloc(capacity * sizeof(*fds));
+    connection **conns = malloc(capacity * sizeof(*conns));
+    int result = 0;
+    if (started == 0 || fds == NULL || conns == NULL) {
+        lz77_log(LOG_ERROR, "Cannot start the daemon");
+        result = -1;
+        stop_requested = 1;
+    } else {
+        fds[0].fd = fd_listen;
+        fds[0].events = POLLIN;
+    }
+
+    while (!stop_requested) {
+        if (poll(fds, count, -1) < 0) {
+            if (errno != EINTR) {
+                lz77_log(LOG_ERROR, "Cannot poll the connections: %s", strerror(errno));
+                result = -1;
+                break;
+            }
+            continue;
+        }
+
+        // Requests are handled before new connections, which are appended.
+        for (int i = count - 1; i > 0; i--) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            if ((fds[i].revents & POLLIN) && receive_request(conns[i]) == 0) {
+                continue;
+            }
+            // Closed by the client (or broken): stop polling it.
+            release(conns[i]);
+            fds[i] = fds[count - 1];
+            conns[i] = conns[count - 1];
+            count--;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(fd_listen, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            if (count == capacity) {
+                struct pollfd *larger_fds = realloc(fds, 2 * capacity * sizeof(*fds));
+                if (larger_fds != NULL) {
+                    fds = larger_fds;
+                }
+                connection **larger_conns = realloc(conns, 2 * capacity * sizeof(*conns));
+                if (larger_conns != NULL) {
+                    conns = larger_conns;
+                }
+                if (larger_fds == NULL || larger_conns == NULL) {
+                    close(fd);
+                    continue;
+                }
+                capacity *= 2;
+            }
+            connection *conn = malloc(sizeof(*conn));
+            if (conn == NULL) {
+                close(fd);
+                continue;
+            }
+            conn->fd = fd;
+            conn->references = 1;
+            fds[count].fd = fd;
+            fds[count].events = POLLIN;
+            conns[count] = conn;
+            count++;
+        }
+    }
+
+    // Let the running jobs complete, then cancel the waiting ones.
+    pthread_mutex_lock(&queue.mutex);
+    queue.stopping = 1;
+    pthread_cond_broadcast(&queue.available);
+    pthread_mutex_unlock(&queue.mutex);
+    for (int i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    for (int p = 0; p < 2; p++) {
+        while (queue.head[p] != NULL) {
+            job *j = queue.head[p];
+            queue.head[p] = j->next;
+            respond(j->from, j->id, ECANCELED, 0);
+            free_job(j);
+        }
+    }
+    for (int i = 1; i < count; i++) {
+        release(conns[i]);
+    }
+
+    free(ids);
+    free(fds);
+    free(conns);
+    close(fd_listen);
+    unlink(socket_path);
+    return result;
+}
+
+int64_t server_submit(const char *socket_path,
+                      int operation,
+                      int priority,
+                      uint16_t window_size,
+                      uint16_t lookahead_size,
+                      int fd_input,
+                      int fd_output)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    uint32_t id = getpid();
+    uint8_t request[SERVER_REQUEST_SIZE];
+    memcpy(request, SERVER_MAGIC, 4);
+    put_u32(request + 4, id);
+    request[8] = operation;
+    request[9] = priority;
+    put_u16(request + 10, window_size);
+    put_u16(request + 12, lookahead_size);
+    put_u16(request + 14, 0);
+    put_u16(request + 16, 0);
+
+    int passed[2] = { fd_input, fd_output };
+    union {
+        char buffer[CMSG_SPACE(sizeof(passed))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { request, sizeof(request) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(passed));
+    memcpy(CMSG_DATA(cmsg), passed, sizeof(passed));
+
+    uint8_t response[SERVER_RESPONSE_SIZE];
+    ssize_t n = -1;
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(request)) {
+        n = recv(fd, response, sizeof(response), 0);
+    }
+    int error = errno;
+    close(fd);
+
+    if (n != (ssize_t)sizeof(response)
+            || memcmp(response, SERVER_MAGIC, 4) != 0
+            || get_u32(response + 4) != id) {
+        errno = n < 0 ? error : EPROTO;
+        return -1;
+    }
+    if (get_u32(response + 8) != 0) {
+        errno = get_u32(response + 8);
+        return -1;
+    }
+    return get_u64(response + 12);
+}
+
+/*
+ * Creates the listening socket. A socket left behind by a daemon which is no
+ * longer running is replaced.
+ */
+static int listen_on(const char *socket_path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        lz77_log(LOG_ERROR, "The path of the socket is too long: %s", socket_path);
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        lz77_log(LOG_ERROR, "Cannot create the socket: %s", strerror(errno));
+        return -1;
+    }
+
+    mode_t mask = umask(077);
+    int bound = bind(fd, (struct sockaddr *)&address, sizeof(address));
+    if (bound < 0 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe >= 0 && connect(probe, (struct sockaddr *)&address, sizeof(address)) < 0
+                && errno == ECONNREFUSED) {
+            unlink(socket_path);
+            bound = bind(fd, (struct sockaddr *)&address, sizeof(address));
+        } else {
+            errno = EADDRINUSE;
+        }
+        if (probe >= 0) {
+            close(probe);
+        }
+    }
+    umask(mask);
+
+    if (bound < 0 || listen(fd, SERVER_BACKLOG) < 0) {
+        lz77_log(LOG_ERROR, "Cannot listen on %s: %s", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Reads a request from a connection, queueing its job. Returns -1 if the
+ * connection was closed by the client or is broken, or 0 otherwise (invalid
+ * requests are answered with an error).
+ */
+static int receive_request(connection *conn)
+{
+    uint8_t buffer[SERVER_REQUEST_SIZE + 2 * SERVER_MAX_PATH];
+    union {
+        char buffer[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { buffer, sizeof(buffer) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t n = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        return -1;
+    }
+
+    int passed[2];
+    int passed_count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (passed_count < 2) {
+                passed[passed_count++] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    uint32_t id = n >= 8 ? get_u32(buffer + 4) : 0;
+    int valid = n >= SERVER_REQUEST_SIZE
+            && !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+            && memcmp(buffer, SERVER_MAGIC, 4) == 0
+            && (buffer[8] == SERVER_COMPRESS || buffer[8] == SERVER_DECOMPRESS)
+            && (buffer[9] == SERVER_INTERACTIVE || buffer[9] == SERVER_BULK);
+    uint16_t input_length = valid ? get_u16(buffer + 14) : 0;
+    uint16_t output_length = valid ? get_u16(buffer + 16) : 0;
+    valid = valid
+            && SERVER_REQUEST_SIZE + input_length + output_length == n
+            && (input_length == 0) + (output_length == 0) == passed_count;
+
+    job *j = valid ? calloc(1, sizeof(*j)) : NULL;
+    if (j == NULL) {
+        for (int i = 0; i < passed_count; i++) {
+            close(passed[i]);
+        }
+        respond(conn, id, valid ? ENOMEM : EINVAL, 0);
+        return 0;
+    }
+
+    j->from = conn;
+    j->id = id;
+    j->operation = buffer[8];
+    j->window_size = get_u16(buffer + 10);
+    j->lookahead_size = get_u16(buffer + 12);
+    j->fd_input = j->fd_output = -1;
+    int next_passed = 0;
+    const uint8_t *path = buffer + SERVER_REQUEST_SIZE;
+    if (input_length == 0) {
+        j->fd_input = passed[next_passed++];
+    } else {
+        j->input_path = strndup((const char *)path, input_length);
+    }
+    if (output_length == 0) {
+        j->fd_output = passed[next_passed++];
+    } else {
+        j->output_path = strndup((const char *)path + input_length, output_length);
+    }
+    if ((input_length > 0 && j->input_path == NULL)
+            || (output_length > 0 && j->output_path == NULL)) {
+        respond(conn, id, ENOMEM, 0);
+        pthread_mutex_lock(&queue.mutex);
+        conn->references++;
+        pthread_mutex_unlock(&queue.mutex);
+        free_job(j);
+        return 0;
+    }
+
+    int priority = buffer[9];
+    pthread_mutex_lock(&queue.mutex);
+    conn->references++;
+    if (queue.tail[priority] != NULL) {
+        queue.tail[priority]->next = j;
+    } else {
+        queue.head[priority] = j;
+    }
+    queue.tail[priority] = j;
+    pthread_cond_signal(&queue.available);
+    pthread_mutex_unlock(&queue.mutex);
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    (void)(arg);
+
+    context ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    while (1) {
+        pthread_mutex_lock(&queue.mutex);
+        while (!queue.stopping && queue.head[SERVER_INTERACTIVE] == NULL
+                && queue.head[SERVER_BULK] == NULL) {
+            pthread_cond_wait(&queue.available, &queue.mutex);
+        }
+        if (queue.stopping) {
+            pthread_mutex_unlock(&queue.mutex);
+            break;
+        }
+        job *j = take_job();
+        pthread_mutex_unlock(&queue.mutex);
+
+        errno = 0;
+        int64_t size = run_job(j, &ctx);
+        int error = size < 0 ? (errno != 0 ? errno : EIO) : 0;
+        respond(j->from, j->id, error, size < 0 ? 0 : size);
+        free_job(j);
+    }
+    free_compression(&ctx);
+    free_decompression(&ctx);
+    return NULL;
+}
+
+/*
+ * Removes the next job from the queue, which must not be empty. The mutex of
+ * the queue must be held.
+ */
+static job *take_job(void)
+{
+    int priority;
+    if (queue.head[SERVER_BULK] == NULL) {
+        priority = SERVER_INTERACTIVE;
+    } else if (queue.head[SERVER_INTERACTIVE] == NULL) {
+        priority = SERVER_BULK;
+        queue.interactive_streak = 0;
+    } else if (queue.interactive_streak >= SERVER_BULK_SHARE - 1) {
+        priority = SERVER_BULK;
+        queue.interactive_streak = 0;
+    } else {
+        priority = SERVER_INTERACTIVE;
+        queue.interactive_streak++;
+    }
+
+    job *j = queue.head[priority];
+    queue.head[priority] = j->next;
+    if (queue.head[priority] == NULL) {
+        queue.tail[priority] = NULL;
+    }
+    return j;
+}
+
+/*
+ * Runs a job with the streams of a thread, returning the number of bytes
+ * written to its output, or -1 in case of error.
+ */
+static int64_t run_job(job *j, context *ctx)
+{
+    if (j->input_path != NULL) {
+        j->fd_input = open(j->input_path, O_RDONLY | O_CLOEXEC);
+    }
+    if (j->output_path != NULL) {
+        j->fd_output = open(j->output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (j->fd_input < 0 || j->fd_output < 0) {
+        return -1;
+    }
+
+    int64_t result = -1;
+    int error;
+    if (j->operation == SERVER_COMPRESS) {
+        if (arm_compression(ctx, j) == 0) {
+            result = lz77_compress(ctx->original, ctx->compressed);
+        }
+        error = errno;
+        if (result < 0) {
+            // Do not reuse streams left in the middle of a compression.
+            free_compression(ctx);
+        }
+    } else {
+        if (arm_decompression(ctx, j) == 0) {
+            result = lz77_decompress(ctx->input, ctx->decompressed);
+        }
+        error = errno;
+        if (result < 0) {
+            free_decompression(ctx);
+        }
+    }
+    errno = error;
+    return result;
+}
+
+/*
+ * Prepares the streams of a thread for a compression job, reusing those of
+ * the previous one if possible.
+ */
+static int arm_compression(context *ctx, const job *j)
+{
+    if (ctx->original != NULL && (ctx->window_size != j->window_size
+                                  || ctx->lookahead_size != j->lookahead_size)) {
+        free_compression(ctx);
+    }
+    if (ctx->original != NULL) {
+        if (lz77_ustream_reset_descriptor(ctx->original, j->fd_input) < 0
+                || lz77_cstream_reset_descriptor(ctx->compressed, j->fd_output) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    ctx->original = lz77_ustream_from_descriptor(j->fd_input, j->window_size, j->lookahead_size);
+    if (ctx->original != NULL) {
+        ctx->compressed = lz77_cstream_to_descriptor(ctx->original, j->fd_output);
+    }
+    if (ctx->compressed == NULL) {
+        int error = errno;
+        free_compression(ctx);
+        errno = error;
+        return -1;
+    }
+    ctx->window_size = j->window_size;
+    ctx->lookahead_size = j->lookahead_size;
+    return 0;
+}
+
+/*
+ * Prepares the streams of a thread for a decompression job, reusing those of
+ * the previous one if possible.
+ */
+static int arm_decompression(context *ctx, const job *j)
+{
+    if (ctx->input != NULL) {
+        if (lz77_cstream_reset_descriptor(ctx->input, j->fd_input) < 0
+                || lz77_ustream_reset_descriptor(ctx->decompressed, j->fd_output) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    ctx->input = lz77_cstream_from_descriptor(j->fd_input);
+    if (ctx->input != NULL) {
+        ctx->decompressed = lz77_ustream_to_descriptor(ctx->input, j->fd_output);
+    }
+    if (ctx->decompressed == NULL) {
+        int error = errno;
+        free_decompression(ctx);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+static void free_compression(context *ctx)
+{
+    lz77_ustream_free(&ctx->original);
+    lz77_cstream_free(&ctx->compressed);
+}
+
+static void free_decompression(context *ctx)
+{
+    lz77_cstream_free(&ctx->input);
+    lz77_ustream_free(&ctx->decompressed);
+}
+
+static void respond(connection *conn, uint32_t id, int error, uint64_t size)
+{
+    uint8_t response[SERVER_RESPONSE_SIZE];
+    memcpy(response, SERVER_MAGIC, 4);
+    put_u32(response + 4, id);
+    put_u32(response + 8, error);
+    put_u64(response + 12, size);
+    // A message is sent atomically, even if other threads are responding on
+    // the same connection. The client may have gone away: just ignore it.
+    send(conn->fd, response, sizeof(response), MSG_NOSIGNAL);
+}
+
+static void free_job(job *j)
+{
+    if (j->fd_input >= 0) {
+        close(j->fd_input);
+    }
+    if (j->fd_output >= 0) {
+        close(j->fd_output);
+    }
+    free(j->input_path);
+    free(j->output_path);
+    release(j->from);
+    free(j);
+}
+
+static void release(connection *conn)
+{
+    pthread_mutex_lock(&queue.mutex);
+    int references = --conn->references;
+    pthread_mutex_unlock(&queue.mutex);
+    if (references == 0) {
+        close(conn->fd);
+        free(conn);
+    }
+}
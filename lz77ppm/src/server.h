@@ -0,0 +1,106 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file server.h
+ *
+ * A daemon running compression and decompression jobs received over a UNIX
+ * socket, and a client submitting them.
+ *
+ * The socket is of type @c SOCK_SEQPACKET: each request and each response is
+ * a single message. A request is made of a header of #SERVER_REQUEST_SIZE
+ * bytes (all integers are big-endian):
+ *
+ * | Offset | Size | Field                                               |
+ * |-------:|-----:|-----------------------------------------------------|
+ * |      0 |    4 | Magic string "LZJQ"                                 |
+ * |      4 |    4 | Identifier of the job, copied into the response     |
+ * |      8 |    1 | Operation (#SERVER_COMPRESS or #SERVER_DECOMPRESS)  |
+ * |      9 |    1 | Priority (#SERVER_INTERACTIVE or #SERVER_BULK)      |
+ * |     10 |    2 | Window size (ignored by decompressions)             |
+ * |     12 |    2 | Look-ahead size (ignored by decompressions)         |
+ * |     14 |    2 | Length of the input path (0 to pass a descriptor)   |
+ * |     16 |    2 | Length of the output path (0 to pass a descriptor)  |
+ *
+ * followed by the input and output paths (not terminated). Descriptors are
+ * passed in the same message with @c SCM_RIGHTS: the input first, if its path
+ * is empty, then the output, if its path is empty. Paths are opened by the
+ * daemon, relative to its working directory; an output file is created or
+ * truncated.
+ *
+ * A response is made of #SERVER_RESPONSE_SIZE bytes:
+ *
+ * | Offset | Size | Field                                               |
+ * |-------:|-----:|-----------------------------------------------------|
+ * |      0 |    4 | Magic string "LZJQ"                                 |
+ * |      4 |    4 | Identifier of the job                               |
+ * |      8 |    4 | Zero in case of success, or an @c errno value       |
+ * |     12 |    8 | Number of bytes written to the output               |
+ *
+ * A client can send several requests on the same connection without waiting
+ * for their responses, which may arrive in a different order.
+ *
+ * @author Antonio Macrì
+ */
+
+#ifndef _LZ77PPM_SERVER_H_
+#define _LZ77PPM_SERVER_H_
+
+#include <stdint.h>
+
+#define SERVER_REQUEST_SIZE  18
+#define SERVER_RESPONSE_SIZE 20
+
+/** The operation of a job compressing its input. */
+#define SERVER_COMPRESS   1
+/** The operation of a job decompressing its input. */
+#define SERVER_DECOMPRESS 2
+
+/** The priority of a job which someone is waiting for. */
+#define SERVER_INTERACTIVE 0
+/** The priority of a job which can be delayed by interactive ones. */
+#define SERVER_BULK        1
+
+/**
+ * Runs the daemon, until it receives @c SIGINT or @c SIGTERM.
+ *
+ * Jobs are run by a pool of threads, which always take an interactive job
+ * first, except that one bulk job in a few is taken while both kinds are
+ * waiting (so that bulk jobs are never blocked forever).
+ *
+ * @param socket_path The path of the socket, which is created (readable and
+ *        writable by the owner only) and removed when the daemon stops.
+ * @param threads The number of threads running the jobs.
+ *
+ * @return 0 if the daemon was stopped by a signal, or -1 in case of error.
+ */
+int server_run(const char *socket_path, int threads);
+
+/**
+ * Submits a job to a daemon and waits for its completion.
+ *
+ * @param socket_path The path of the socket of the daemon.
+ * @param operation Either #SERVER_COMPRESS or #SERVER_DECOMPRESS.
+ * @param priority Either #SERVER_INTERACTIVE or #SERVER_BULK.
+ * @param window_size The size of the window of a compression.
+ * @param lookahead_size The size of the look-ahead buffer of a compression.
+ * @param fd_input The descriptor of the input, passed to the daemon.
+ * @param fd_output The descriptor of the output, passed to the daemon.
+ *
+ * @return The number of bytes written to the output, or -1 in case of error
+ *         (@c errno is set to the error reported by the daemon, if any).
+ */
+int64_t server_submit(const char *socket_path,
+                      int operation,
+                      int priority,
+                      uint16_t window_size,
+                      uint16_t lookahead_size,
+                      int fd_input,
+                      int fd_output);
+
+#endif
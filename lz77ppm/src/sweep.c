@@ -0,0 +1,319 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file sweep.c
+ *
+ * Compression and decompression of the same data with many combinations of
+ * parameters, to find the best ones for a kind of data.
+ *
+ * @author Antonio Macrì
+ */
+
+#define _POSIX_C_SOURCE 200809L  // Required for clock_gettime()
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lz77ppm/lz77.h>
+
+#include "sweep.h"
+
+/**
+ * The minimum time for which an operation is repeated.
+ */
+#define SWEEP_MIN_SECONDS 0.2
+
+#define SWEEP_MIN_WINDOW_SIZE    256
+#define SWEEP_MIN_LOOKAHEAD_SIZE 8
+#define SWEEP_MAX_LOOKAHEAD_SIZE 256
+
+/**
+ * The search depths of the grid, from the shallowest (zero for no limit).
+ */
+static const uint16_t sweep_search_depths[] = { 16, LZ77_DEFAULT_SEARCH_DEPTH, 0 };
+
+/**
+ * The accelerations of the grid, from none.
+ */
+static const uint16_t sweep_accelerations[] = { 0, 8, 32 };
+
+#define SWEEP_SEARCH_DEPTHS (sizeof(sweep_search_depths) / sizeof(sweep_search_depths[0]))
+#define SWEEP_ACCELERATIONS (sizeof(sweep_accelerations) / sizeof(sweep_accelerations[0]))
+
+/**
+ * The state shared by the threads of a sweep.
+ */
+typedef struct {
+    const uint8_t *data;
+    uint32_t size;
+    sweep_result *results;
+    int count;
+    void (*progress)(int completed, int count);
+    pthread_mutex_t mutex;
+    /** The index of the next setting to be run. */
+    int next;
+    /** The number of settings completed. */
+    int completed;
+} sweep_state;
+
+static void *sweep_thread(void *arg);
+static int run_setting(const uint8_t *data, uint32_t size, counters *c, sweep_result *result);
+static double thread_seconds(void);
+static void mark_pareto(sweep_result *results, int count);
+
+int sweep_grid(uint16_t window_size,
+               uint16_t lookahead_size,
+               uint16_t acceleration,
+               sweep_result *results)
+{
+    int count = 0;
+    size_t accelerations = acceleration ? 1 : SWEEP_ACCELERATIONS;
+    uint32_t w = window_size ? window_size : SWEEP_MIN_WINDOW_SIZE;
+    while (w <= LZ77_MAX_WINDOW_SIZE) {
+        uint32_t l = lookahead_size ? lookahead_size : SWEEP_MIN_LOOKAHEAD_SIZE;
+        while (l <= SWEEP_MAX_LOOKAHEAD_SIZE || l == lookahead_size) {
+            for (size_t d = 0; d < SWEEP_SEARCH_DEPTHS && l <= w; d++) {
+                for (size_t a = 0; a < accelerations; a++) {
+                    if (results != NULL) {
+                        memset(&results[count], 0, sizeof(results[count]));
+                        results[count].window_size = w;
+                        results[count].lookahead_size = l;
+                        results[count].search_depth = sweep_search_depths[d];
+                        results[count].acceleration =
+                                acceleration ? acceleration : sweep_accelerations[a];
+                    }
+                    count++;
+                }
+            }
+            if (lookahead_size) {
+                break;
+            }
+            l *= 2;
+        }
+        if (window_size) {
+            break;
+        }
+        // The largest window is not a power of two.
+        w = (w == LZ77_MAX_WINDOW_SIZE / 2 + 1) ? LZ77_MAX_WINDOW_SIZE : w * 2;
+    }
+    return count;
+}
+
+int sweep_run(const uint8_t *data,
+              uint32_t size,
+              sweep_result *results,
+              int count,
+              int threads,
+              void (*progress)(int completed, int count))
+{
+    sweep_state state;
+    state.data = data;
+    state.size = size;
+    state.results = results;
+    state.count = count;
+    state.progress = progress;
+    state.next = 0;
+    state.completed = 0;
+    pthread_mutex_init(&state.mutex, NULL);
+
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    pthread_t *ids = malloc(threads * sizeof(*ids));
+    if (ids == NULL) {
+        pthread_mutex_destroy(&state.mutex);
+        return -1;
+    }
+
+    int started = 0;
+    while (started < threads
+            && pthread_create(&ids[started], NULL, sweep_thread, &state) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        // Run in this thread anyway.
+        sweep_thread(&state);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    free(ids);
+    pthread_mutex_destroy(&state.mutex);
+
+    mark_pareto(results, count);
+
+    for (int i = 0; i < count; i++) {
+        if (results[i].compressed_size < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *sweep_thread(void *arg)
+{
+    sweep_state *state = arg;
+
+    // Counters only count the thread which opens them.
+    counters c;
+    counters_open(&c);
+
+    while (1) {
+        pthread_mutex_lock(&state->mutex);
+        int i = state->next++;
+        pthread_mutex_unlock(&state->mutex);
+        if (i >= state->count) {
+            break;
+        }
+
+        if (run_setting(state->data, state->size, &c, &state->results[i]) < 0) {
+            state->results[i].compressed_size = -1;
+        }
+
+        pthread_mutex_lock(&state->mutex);
+        state->completed++;
+        if (state->progress != NULL) {
+            state->progress(state->completed, state->count);
+        }
+        pthread_mutex_unlock(&state->mutex);
+    }
+    counters_close(&c);
+    return NULL;
+}
+
+/*
+ * Compresses and decompresses the data with a single setting, checking that
+ * the data is unchanged. Returns 0 in case of success, or -1 in case of error.
+ */
+static int run_setting(const uint8_t *data, uint32_t size, counters *c, sweep_result *result)
+{
+    uint8_t *compressed = NULL;
+    int64_t compressed_size = -1;
+    int runs = 0;
+    uint64_t values[COUNTERS] = { 0 };
+    counters_start(c);
+    double start = thread_seconds();
+    double elapsed;
+    do {
+        free(compressed);
+        compressed = NULL;
+
+        lz77_ustream *original_stream = lz77_ustream_from_memory(data, size,
+                result->window_size, result->lookahead_size);
+        if (original_stream == NULL) {
+            return -1;
+        }
+        if (lz77_ustream_set_search_depth(original_stream, result->search_depth) < 0
+                || lz77_ustream_set_acceleration(original_stream, result->acceleration) < 0) {
+            lz77_ustream_free(&original_stream);
+            return -1;
+        }
+        lz77_cstream *compressed_stream = lz77_cstream_to_memory(original_stream, NULL, 0, 1);
+        if (compressed_stream == NULL) {
+            lz77_ustream_free(&original_stream);
+            return -1;
+        }
+        compressed_size = lz77_compress(original_stream, compressed_stream);
+        compressed = lz77_cstream_get_buffer(compressed_stream);
+        lz77_ustream_free(&original_stream);
+        lz77_cstream_free(&compressed_stream);
+        if (compressed_size < 0) {
+            free(compressed);
+            return -1;
+        }
+        runs++;
+        elapsed = thread_seconds() - start;
+    } while (elapsed < SWEEP_MIN_SECONDS);
+    counters_stop(c, values);
+    result->compressed_size = compressed_size;
+    result->compression_speed = (double)size * runs / elapsed;
+    counters_per_byte(values, (double)size * runs, result->compression_events);
+
+    uint8_t *decompressed = malloc(size > 0 ? size : 1);
+    if (decompressed == NULL) {
+        free(compressed);
+        return -1;
+    }
+    int64_t decompressed_size = -1;
+    runs = 0;
+    memset(values, 0, sizeof(values));
+    counters_start(c);
+    start = thread_seconds();
+    do {
+        lz77_cstream *compressed_stream = lz77_cstream_from_memory(compressed, compressed_size);
+        if (compressed_stream == NULL) {
+            break;
+        }
+        lz77_ustream *decompressed_stream = lz77_ustream_to_memory(compressed_stream,
+                decompressed, size, 0);
+        if (decompressed_stream == NULL) {
+            lz77_cstream_free(&compressed_stream);
+            break;
+        }
+        decompressed_size = lz77_decompress(compressed_stream, decompressed_stream);
+        lz77_cstream_free(&compressed_stream);
+        lz77_ustream_free(&decompressed_stream);
+        if (decompressed_size < 0) {
+            break;
+        }
+        runs++;
+        elapsed = thread_seconds() - start;
+    } while (elapsed < SWEEP_MIN_SECONDS);
+    counters_stop(c, values);
+    result->decompression_speed = (double)size * runs / elapsed;
+    counters_per_byte(values, (double)size * runs, result->decompression_events);
+
+    int valid = decompressed_size == size && memcmp(data, decompressed, size) == 0;
+    free(compressed);
+    free(decompressed);
+    return valid ? 0 : -1;
+}
+
+/*
+ * Returns the CPU time used by the calling thread, in seconds.
+ */
+static double thread_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Returns a non-zero value if the result a dominates the result b, that is if
+ * it is not worse in any respect, and better in at least one.
+ */
+static int dominates(const sweep_result *a, const sweep_result *b)
+{
+    if (a->compressed_size > b->compressed_size
+            || a->compression_speed < b->compression_speed
+            || a->decompression_speed < b->decompression_speed) {
+        return 0;
+    }
+    return a->compressed_size < b->compressed_size
+            || a->compression_speed > b->compression_speed
+            || a->decompression_speed > b->decompression_speed;
+}
+
+static void mark_pareto(sweep_result *results, int count)
+{
+    for (int i = 0; i < count; i++) {
+        results[i].is_pareto = results[i].compressed_size >= 0;
+        for (int j = 0; j < count && results[i].is_pareto; j++) {
+            if (results[j].compressed_size >= 0 && dominates(&results[j], &results[i])) {
+                results[i].is_pareto = 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of lz77ppm, a simple implementation of the LZ77
+ * compression algorithm.
+ *
+ * This is free and unencumbered software released into the public domain.
+ * For more information, see the included UNLICENSE file.
+ */
+
+/**
+ * @file sweep.h
+ *
+ * Compression and decompression of the same data with many combinations of
+ * parameters, to find the best ones for a kind of data.
+ *
+ * Each setting is compressed and decompressed by a pool of threads, so that
+ * the whole grid takes about as long as its slowest settings. The results are
+ * compared by compressed size, compression speed and decompression speed: a
+ * setting is @em Pareto-optimal if no other setting is at least as good in all
+ * of them and better in at least one.
+ *
+ * @author Antonio Macrì
+ */
+
+#ifndef _LZ77PPM_SWEEP_H_
+#define _LZ77PPM_SWEEP_H_
+
+#include <stdint.h>
+
+#include <bench/counters.h>
+
+/**
+ * The parameters and the results of one setting of a sweep.
+ */
+typedef struct {
+    /** The size of the window. */
+    uint16_t window_size;
+    /** The size of the look-ahead buffer. */
+    uint16_t lookahead_size;
+    /** The search depth of the compression (zero for no limit). */
+    uint16_t search_depth;
+    /** The acceleration of the compression (zero for none). */
+    uint16_t acceleration;
+    /** The size of the compressed data, or -1 if the setting failed. */
+    int64_t compressed_size;
+    /** The compression speed, in bytes per second. */
+    double compression_speed;
+    /** The decompression speed, in bytes per second. */
+    double decompression_speed;
+    /**
+     * The hardware events per byte of the compression, or negative values for
+     * the events which could not be counted.
+     */
+    double compression_events[COUNTERS];
+    /** The hardware events per byte of the decompression. */
+    double decompression_events[COUNTERS];
+    /** A boolean value indicating whether the setting is Pareto-optimal. */
+    int is_pareto;
+} sweep_result;
+
+/**
+ * Fills a grid of settings, made of powers of two for both the window (from 256
+ * bytes to the maximum) and the look-ahead buffer (from 8 to 256 bytes), with
+ * the look-ahead buffer never larger than the window, each one with a shallow,
+ * the default and an unlimited search depth, and with no acceleration, a mild
+ * and a strong one.
+ *
+ * @param window_size If not zero, the only window size of the grid.
+ * @param lookahead_size If not zero, the only look-ahead size of the grid.
+ * @param acceleration If not zero, the only acceleration of the grid.
+ * @param results An array which is filled with the parameters of the
+ *        settings, or @c NULL to count them only.
+ *
+ * @return The number of settings of the grid.
+ */
+int sweep_grid(uint16_t window_size,
+               uint16_t lookahead_size,
+               uint16_t acceleration,
+               sweep_result *results);
+
+/**
+ * Compresses and decompresses the given data with each setting, and marks the
+ * Pareto-optimal ones.
+ *
+ * Speeds are measured on the CPU time of the thread running each setting, so
+ * that settings running at the same time do not slow each other down (as far
+ * as they do not compete for the caches or the memory bandwidth). Each
+ * operation is repeated on small inputs, to get a measurable time. The
+ * hardware counters of each thread, if available, are read around the same
+ * operations.
+ *
+ * @param data The data to be compressed.
+ * @param size The size of @c data.
+ * @param results The settings, as filled by #sweep_grid.
+ * @param count The number of settings.
+ * @param threads The number of threads to be used.
+ * @param progress If not @c NULL, a function called (by any thread, one at a
+ *        time) after each setting is completed.
+ *
+ * @return 0 in case of success, or -1 if some setting failed (its compressed
+ *         size is -1) or the threads cannot be started.
+ */
+int sweep_run(const uint8_t *data,
+              uint32_t size,
+              sweep_result *results,
+              int count,
+              int threads,
+              void (*progress)(int completed, int count));
+
+#endif